@@ -0,0 +1,20 @@
+# Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+# All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+#
+# Adriaan de Groot <groot@kde.org>
+
+# Finds the Lightning Memory-Mapped Database (LMDB) library, setting
+#   LMDB_FOUND, LMDB_INCLUDE_DIRS and LMDB_LIBRARIES
+
+find_path(LMDB_INCLUDE_DIR lmdb.h)
+find_library(LMDB_LIBRARY lmdb)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LMDB DEFAULT_MSG LMDB_LIBRARY LMDB_INCLUDE_DIR)
+
+if(LMDB_FOUND)
+  set(LMDB_INCLUDE_DIRS ${LMDB_INCLUDE_DIR})
+  set(LMDB_LIBRARIES ${LMDB_LIBRARY})
+endif()
+
+mark_as_advanced(LMDB_INCLUDE_DIR LMDB_LIBRARY)
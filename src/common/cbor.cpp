@@ -0,0 +1,475 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "cbor.h"
+
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+
+static const unsigned int max_depth = 256;
+
+// Major types
+enum : unsigned int { Unsigned = 0, Negative, Bytes, Text, Array, Map, Tag, Simple };
+
+// Argument of a head with additional information 31
+static const uint64_t indefinite = ~uint64_t(0);
+
+namespace
+{
+
+class Parser
+{
+private:
+	const unsigned char* p;
+	const unsigned char* end;
+	const unsigned char* begin;
+	std::string& error;
+
+	bool fail(const char* message)
+	{
+		if (error.empty())
+		{
+			error = "CBOR ";
+			error.append(message);
+			error.append(" at offset ");
+			error.append(std::to_string(p - begin));
+			error.push_back('.');
+		}
+		return false;
+	}
+
+	/** Read a head into @p major and @p n (indefinite if there is no length). */
+	bool head(unsigned int& major, unsigned int& info, uint64_t& n)
+	{
+		if (p >= end)
+		{
+			return fail("data item expected");
+		}
+		major = *p >> 5;
+		info = *p & 0x1f;
+		p++;
+		if (info < 24)
+		{
+			n = info;
+			return true;
+		}
+		if (info == 31)
+		{
+			n = indefinite;
+			return (major == Bytes) || (major == Text) || (major == Array) || (major == Map) || (major == Simple) ? true : fail("bad indefinite length");
+		}
+		if (info > 27)
+		{
+			return fail("bad additional information");
+		}
+		size_t size = size_t(1) << (info - 24);
+		if (size_t(end - p) < size)
+		{
+			return fail("truncated");
+		}
+		n = 0;
+		for (size_t i = 0; i < size; i++)
+		{
+			n = (n << 8) | *p++;
+		}
+		return true;
+	}
+
+	/** The next byte is a break (and is skipped). */
+	bool at_break()
+	{
+		if ((p < end) && (*p == 0xff))
+		{
+			p++;
+			return true;
+		}
+		return false;
+	}
+
+	bool string(unsigned int major, uint64_t n, std::string& s)
+	{
+		if (n != indefinite)
+		{
+			if (uint64_t(end - p) < n)
+			{
+				return fail("truncated");
+			}
+			s.append(reinterpret_cast<const char*>(p), n);
+			p += n;
+			return true;
+		}
+		// Chunks, each a definite string of the same type
+		while (!at_break())
+		{
+			unsigned int chunk_major, info;
+			if (!head(chunk_major, info, n))
+			{
+				return false;
+			}
+			if ((chunk_major != major) || (n == indefinite))
+			{
+				return fail("bad string chunk");
+			}
+			if (!string(major, n, s))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static double half(uint64_t h)
+	{
+		int exponent = (h >> 10) & 0x1f;
+		double mantissa = h & 0x3ff;
+		double d;
+		if (exponent == 0)
+		{
+			d = ldexp(mantissa, -24);
+		}
+		else if (exponent != 31)
+		{
+			d = ldexp(mantissa + 1024, exponent - 25);
+		}
+		else
+		{
+			d = mantissa == 0 ? INFINITY : NAN;
+		}
+		return (h & 0x8000) ? -d : d;
+	}
+
+public:
+	Parser(const char* b, const char* e, std::string& err) :
+		p(reinterpret_cast<const unsigned char*>(b)),
+		end(reinterpret_cast<const unsigned char*>(e)),
+		begin(reinterpret_cast<const unsigned char*>(b)),
+		error(err)
+	{
+	}
+
+	bool at_end() const { return p == end; }
+
+	bool value(picojson::value& v, unsigned int depth)
+	{
+		if (depth > max_depth)
+		{
+			return fail("nested too deeply");
+		}
+
+		unsigned int major, info;
+		uint64_t n;
+		if (!head(major, info, n))
+		{
+			return false;
+		}
+
+		switch (major)
+		{
+		case Unsigned:
+			v = picojson::value(double(n));
+			return true;
+		case Negative:
+			v = picojson::value(-1.0 - double(n));
+			return true;
+		case Bytes:
+		case Text:
+			{
+				std::string s;
+				if (!string(major, n, s))
+				{
+					return false;
+				}
+				v = picojson::value(s);
+				return true;
+			}
+		case Array:
+			{
+				v = picojson::value(picojson::array());
+				picojson::array& a = v.get<picojson::array>();
+				for (uint64_t i = 0; (n == indefinite) ? !at_break() : (i < n); i++)
+				{
+					if (p >= end)
+					{
+						return fail("truncated");
+					}
+					a.emplace_back();
+					if (!value(a.back(), depth + 1))
+					{
+						return false;
+					}
+				}
+				return true;
+			}
+		case Map:
+			{
+				v = picojson::value(picojson::object());
+				picojson::object& o = v.get<picojson::object>();
+				for (uint64_t i = 0; (n == indefinite) ? !at_break() : (i < n); i++)
+				{
+					picojson::value key;
+					if (p >= end)
+					{
+						return fail("truncated");
+					}
+					if (!value(key, depth + 1))
+					{
+						return false;
+					}
+					if (!key.is<std::string>())
+					{
+						return fail("map key is not a string");
+					}
+					// As in JSON, of duplicate keys the last one counts
+					if (!value(o[key.get<std::string>()], depth + 1))
+					{
+						return false;
+					}
+				}
+				return true;
+			}
+		case Tag:
+			return value(v, depth + 1);
+		case Simple:
+		default:
+			switch (info)
+			{
+			case 20:
+			case 21:
+				v = picojson::value(info == 21);
+				return true;
+			case 22:
+			case 23:
+				v = picojson::value();
+				return true;
+			case 25:
+			case 26:
+			case 27:
+				{
+					double d;
+					if (info == 25)
+					{
+						d = half(n);
+					}
+					else if (info == 26)
+					{
+						uint32_t bits = n;
+						float f;
+						memcpy(&f, &bits, sizeof(f));
+						d = f;
+					}
+					else
+					{
+						memcpy(&d, &n, sizeof(d));
+					}
+					// Not in JSON, and picojson throws on them
+					if (!isfinite(d))
+					{
+						return fail("non-finite number");
+					}
+					v = picojson::value(d);
+					return true;
+				}
+			default:
+				return fail("unsupported simple value");
+			}
+		}
+	}
+} ;
+
+bool is_utf8(const std::string& s)
+{
+	const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+	const unsigned char* end = p + s.size();
+	while (p < end)
+	{
+		if (*p < 0x80)
+		{
+			p++;
+			continue;
+		}
+		size_t n;
+		uint32_t code;
+		if ((*p & 0xe0) == 0xc0)
+		{
+			n = 1;
+			code = *p & 0x1f;
+		}
+		else if ((*p & 0xf0) == 0xe0)
+		{
+			n = 2;
+			code = *p & 0x0f;
+		}
+		else if ((*p & 0xf8) == 0xf0)
+		{
+			n = 3;
+			code = *p & 0x07;
+		}
+		else
+		{
+			return false;
+		}
+		if (size_t(end - p) <= n)
+		{
+			return false;
+		}
+		for (size_t i = 1; i <= n; i++)
+		{
+			if ((p[i] & 0xc0) != 0x80)
+			{
+				return false;
+			}
+			code = (code << 6) | (p[i] & 0x3f);
+		}
+		// No overlong forms, surrogates or code points past U+10FFFF
+		static const uint32_t least[] = { 0, 0x80, 0x800, 0x10000 };
+		if ((code < least[n]) || ((code >= 0xd800) && (code < 0xe000)) || (code > 0x10ffff))
+		{
+			return false;
+		}
+		p += n + 1;
+	}
+	return true;
+}
+
+}  // namespace
+
+bool SteamWorks::CBOR::parse(const char* begin, const char* end, picojson::value& value, std::string& error)
+{
+	error.clear();
+	Parser parser(begin, end, error);
+	if (!parser.value(value, 0))
+	{
+		return false;
+	}
+	if (!parser.at_end())
+	{
+		error = "CBOR data after the data item.";
+		return false;
+	}
+	return true;
+}
+
+void SteamWorks::CBOR::put_head(std::string& out, unsigned int major, uint64_t n)
+{
+	unsigned char type = major << 5;
+	if (n < 24)
+	{
+		out.push_back(char(type | n));
+		return;
+	}
+	int size = (n <= 0xff) ? 1 : (n <= 0xffff) ? 2 : (n <= 0xffffffffu) ? 4 : 8;
+	out.push_back(char(type | ((size == 1) ? 24 : (size == 2) ? 25 : (size == 4) ? 26 : 27)));
+	for (int i = size - 1; i >= 0; i--)
+	{
+		out.push_back(char((n >> (8 * i)) & 0xff));
+	}
+}
+
+void SteamWorks::CBOR::put_begin_map(std::string& out)
+{
+	out.push_back(char((Map << 5) | 31));
+}
+
+void SteamWorks::CBOR::put_begin_array(std::string& out)
+{
+	out.push_back(char((Array << 5) | 31));
+}
+
+void SteamWorks::CBOR::put_break(std::string& out)
+{
+	out.push_back(char(0xff));
+}
+
+void SteamWorks::CBOR::put_string(std::string& out, const std::string& s)
+{
+	put_head(out, is_utf8(s) ? Text : Bytes, s.size());
+	out.append(s);
+}
+
+void SteamWorks::CBOR::put_number(std::string& out, double d)
+{
+	// 2^64 is exact in a double; integers below it in magnitude fit the head
+	static const double limit = 18446744073709551616.0;
+	if ((d == floor(d)) && (d > -limit) && (d < limit) && !((d == 0) && signbit(d)))
+	{
+		if (d >= 0)
+		{
+			put_head(out, Unsigned, uint64_t(d));
+		}
+		else
+		{
+			put_head(out, Negative, uint64_t(-1.0 - d));
+		}
+		return;
+	}
+	uint64_t bits;
+	memcpy(&bits, &d, sizeof(bits));
+	out.push_back(char((Simple << 5) | 27));
+	for (int i = 7; i >= 0; i--)
+	{
+		out.push_back(char((bits >> (8 * i)) & 0xff));
+	}
+}
+
+void SteamWorks::CBOR::put_bool(std::string& out, bool b)
+{
+	out.push_back(char((Simple << 5) | (b ? 21 : 20)));
+}
+
+void SteamWorks::CBOR::put_null(std::string& out)
+{
+	out.push_back(char((Simple << 5) | 22));
+}
+
+void SteamWorks::CBOR::put_value(std::string& out, const picojson::value& v)
+{
+	if (v.is<picojson::null>())
+	{
+		put_null(out);
+	}
+	else if (v.is<bool>())
+	{
+		put_bool(out, v.get<bool>());
+	}
+	else if (v.is<double>())
+	{
+		put_number(out, v.get<double>());
+	}
+	else if (v.is<std::string>())
+	{
+		put_string(out, v.get<std::string>());
+	}
+	else if (v.is<picojson::array>())
+	{
+		const picojson::array& a = v.get<picojson::array>();
+		put_head(out, Array, a.size());
+		for (const auto& e : a)
+		{
+			put_value(out, e);
+		}
+	}
+	else
+	{
+		const picojson::object& o = v.get<picojson::object>();
+		put_head(out, Map, o.size());
+		for (const auto& kv : o)
+		{
+			put_string(out, kv.first);
+			put_value(out, kv.second);
+		}
+	}
+}
+
+bool SteamWorks::CBOR::is_cbor(const char* content_type)
+{
+	static const char cbor[] = "application/cbor";
+	static const size_t length = sizeof(cbor) - 1;
+	return content_type &&
+		(strncasecmp(content_type, cbor, length) == 0) &&
+		((content_type[length] == 0) || (content_type[length] == ';') || (content_type[length] == ' '));
+}
@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * CBOR (RFC 7049) for requests and responses, as a compact alternative
+ * to JSON text. CBOR is read into (and written from) the same picojson
+ * values as JSON, so verbs do not know the difference:
+ *
+ *  - integers and floats become numbers (doubles); numbers that are
+ *    integral are written as CBOR integers;
+ *  - text strings and byte strings both become strings; strings that
+ *    are not valid UTF-8 (e.g. binary LDAP attribute values) are
+ *    written as byte strings, so they pass unchanged;
+ *  - tags are ignored, undefined is read as null;
+ *  - infinities and NaN are refused, as JSON has no such numbers.
+ *
+ * Map keys must be strings.
+ */
+#ifndef STEAMWORKS_COMMON_CBOR_H
+#define STEAMWORKS_COMMON_CBOR_H
+
+#include "picojson.h"
+
+#include <string>
+
+#include <stdint.h>
+
+namespace SteamWorks
+{
+namespace CBOR
+{
+
+/**
+ * Parse one CBOR data item from @p begin to @p end into @p value.
+ * Returns false (and sets @p error) if it is not well-formed, is
+ * followed by more data, or nests too deeply.
+ */
+bool parse(const char* begin, const char* end, picojson::value& value, std::string& error);
+
+/// Head of a data item of @p major type with argument @p n
+void put_head(std::string& out, unsigned int major, uint64_t n);
+/// Start and end of an object or array of indefinite length
+void put_begin_map(std::string& out);
+void put_begin_array(std::string& out);
+void put_break(std::string& out);
+
+void put_string(std::string& out, const std::string& s);
+void put_number(std::string& out, double d);
+void put_bool(std::string& out, bool b);
+void put_null(std::string& out);
+void put_value(std::string& out, const picojson::value& v);
+
+/// True if @p content_type (e.g. a request's CONTENT_TYPE) is CBOR
+bool is_cbor(const char* content_type);
+
+}  // namespace CBOR
+}  // namespace Steamworks
+
+#endif
@@ -5,221 +5,818 @@ All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
 Adriaan de Groot <groot@kde.org>
 */
 
+#include <errno.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
-
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "fastcgi.h"
 #include "fcgiapp.h"
 #include "picojson.h"
 
+#include "cbor.h"
 #include "fcgi.h"
+#include "jsondom.h"
 #include "jsonresponse.h"
+#include "jsonwriter.h"
 #include "logger.h"
+#include "metrics.h"
 #include "verb.h"
 
 
-static const int MAX_STDIN = 65535;
-static int request_count = 0;
+static size_t max_request = 1 << 20;
+static std::atomic<int> request_count(0);
+
+using SteamWorks::FCGI::Metrics;
+using Encoding = SteamWorks::JSON::Writer::Encoding;
 
 namespace fcgi
 {
 static SteamWorks::Logging::Logger *logger = 0;
 
 /**
- * Reads the remainer of an input stream (this seems to be needed if wrapping
- * FCGI streams into C++ streams on some versions of libg++). Currently no-op.
+ * One request and its response, as handle_request() sees them. They
+ * come from libfcgi, or from the multiplexing mainloop.
  */
-void drain_input(FCGX_Stream* in)
+class Exchange
 {
-}
+public:
+	int status;  // As set for the response; 200 unless set
+	size_t bytes_out;  // Written so far
+	Encoding encoding;  // Of the response
+
+	Exchange() :
+		status(200),
+		bytes_out(0),
+		encoding(Encoding::JSON)
+	{
+	}
+	virtual ~Exchange() {}
+
+	/// Value of the CGI parameter @p name, or nullptr
+	virtual const char* param(const char* name) = 0;
+	/// Read up to @p length bytes of the request data into @p buffer
+	virtual int read(char* buffer, int length) = 0;
+
+	bool write(const char* data, size_t length)
+	{
+		bytes_out += length;
+		return put(data, length);
+	}
+
+	void set_status(int s)
+	{
+		status = s;
+		put_status(s);
+	}
+
+protected:
+	virtual bool put(const char* data, size_t length) = 0;
+	virtual void put_status(int status) = 0;
+} ;
 
-class FCGInputStream
+class FCGXExchange : public Exchange
 {
 private:
-	FCGX_Stream* input;
-	bool eof, valid;
-	char current;
+	FCGX_Stream* m_in;
+	FCGX_Stream* m_out;
+	FCGX_ParamArray m_env;
 
 public:
-	FCGInputStream(FCGX_Stream* s) :
-		input(s),
-		eof(false),
-		valid(false)
+	FCGXExchange(FCGX_Stream* in, FCGX_Stream* out, FCGX_ParamArray env) :
+		m_in(in),
+		m_out(out),
+		m_env(env)
+	{
+	}
+
+	const char* param(const char* name) override { return FCGX_GetParam(name, m_env); }
+	int read(char* buffer, int length) override { return FCGX_GetStr(buffer, length, m_in); }
+
+protected:
+	bool put(const char* data, size_t length) override { return FCGX_PutStr(data, int(length), m_out) >= 0; }
+	void put_status(int status) override { FCGX_SetExitStatus(status, m_out); }
+} ;
+
+/**
+ * The response is written as it is produced, so its length is not
+ * known up front; it ends with the FCGI stream.
+ */
+const char _response_header[] = "Content-type: text/json\r\n\r\n";
+const char _cbor_response_header[] = "Content-type: application/cbor\r\n\r\n";
+
+bool write_header(Exchange& out)
+{
+	return out.encoding == Encoding::CBOR ?
+		out.write(_cbor_response_header, sizeof(_cbor_response_header) - 1) :
+		out.write(_response_header, sizeof(_response_header) - 1);
+}
+
+SteamWorks::JSON::Writer::sink_t output_sink(Exchange& out)
+{
+	return [&out](const char* data, size_t len) { return out.write(data, len); };
+}
+
+void simple_output(Exchange& out, int status, const picojson::value& map)
+{
+	out.set_status(status);
+	write_header(out);
+	SteamWorks::JSON::Writer writer(output_sink(out), 16384, out.encoding);
+	writer.value(map);
+}
+
+void simple_output(Exchange& out, int status, const char* message=nullptr, const int err=0)
+{
+	if (logger && (status != 200))
+	{
+		logger->debugStream() << "HTTP status " << status << ": " << message;
+	}
+
+	picojson::value::object map;
+	SteamWorks::JSON::simple_output(map, status, message, err);
+	simple_output(out, status, picojson::value(map));
+}
+
+static int find_verb(const SteamWorks::JSON::Node& v, std::string &out)
+{
+	if (!v.is_object())
+	{
+		return -1;
+	}
+	const SteamWorks::JSON::Node& verb = v.get("verb");
+	if (!verb.is_string())
+	{
+		return -2;
+	}
+	out = verb.string().str();
+	return 0;
+}
+
+static int find_verb(const picojson::value& v, std::string &out)
+{
+	if (!v.is<picojson::object>())
+	{
+		return -1;
+	}
+	const picojson::value& verb = v.get("verb");
+	if (!verb.is<std::string>())
+	{
+		return -2;
+	}
+	out = verb.get<std::string>();
+	return 0;
+}
+
+/**
+ * Metrics of the request being handled, recorded when it goes out of
+ * scope, whichever way handle_request() returns.
+ */
+struct Measurement
+{
+	using clock = std::chrono::steady_clock;
+
+	Exchange& exchange;
+	unsigned int slot;
+	bool error;
+	size_t bytes_in;
+	clock::time_point mark;
+
+	Measurement(Exchange& x) :
+		exchange(x),
+		slot(Metrics::OtherSlot),
+		error(false),
+		bytes_in(0),
+		mark(clock::now())
 	{
 	}
 
-	FCGInputStream() :
-		input(0),
-		eof(true),
-		valid(false)
+	~Measurement()
 	{
+		Metrics::record(slot, error || (exchange.status != 200), bytes_in, exchange.bytes_out);
 	}
 
-	char operator *()
+	/// Record the time since the end of the previous phase as @p phase
+	void phase(Metrics::Phase phase)
 	{
-		if (valid)
+		clock::time_point now = clock::now();
+		Metrics::record_phase(slot, phase, std::chrono::duration_cast<std::chrono::nanoseconds>(now - mark).count());
+		mark = now;
+	}
+} ;
+
+/// The metrics verb, which every dispatcher has
+void metrics(const picojson::value& values, picojson::object& response, VerbDispatcher* dispatcher)
+{
+	Metrics::Snapshot snap;
+	Metrics::snapshot(snap);
+
+	picojson::array bounds;
+	for (unsigned int b = 0; b + 1 < SteamWorks::Sharded::num_buckets; b++)
+	{
+		bounds.emplace_back(double(SteamWorks::Sharded::bucket_bound(b)));
+	}
+	response.emplace("latency_bounds_us", picojson::value(bounds));
+	response.emplace("requests", picojson::value(double(request_count.load())));
+
+	picojson::array verbs;
+	for (unsigned int slot = 0; slot < Metrics::num_slots; slot++)
+	{
+		const char* name = Metrics::slot_name(slot, dispatcher);
+		if (!name)
 		{
-			return current;
+			continue;
 		}
-		else
+		picojson::object verb;
+		verb.emplace("verb", picojson::value(name));
+		verb.emplace("requests", picojson::value(double(snap.requests[slot])));
+		verb.emplace("errors", picojson::value(double(snap.errors[slot])));
+		verb.emplace("bytes_in", picojson::value(double(snap.bytes_in[slot])));
+		verb.emplace("bytes_out", picojson::value(double(snap.bytes_out[slot])));
+		for (unsigned int p = 0; p < Metrics::num_phases; p++)
 		{
-			current = FCGX_GetChar(input);
-			if (current < 0)
+			picojson::object phase;
+			picojson::array latency;
+			for (unsigned int b = 0; b < SteamWorks::Sharded::num_buckets; b++)
 			{
-				eof = true;
+				latency.emplace_back(double(snap.latency[slot][p].buckets[b]));
 			}
-			valid = true;
+			phase.emplace("seconds", picojson::value(snap.latency[slot][p].nanoseconds / 1e9));
+			phase.emplace("latency", picojson::value(latency));
+			verb.emplace(Metrics::phase_name(p), picojson::value(phase));
 		}
-		return current;
+		verbs.emplace_back(verb);
 	}
+	response.emplace("verbs", picojson::value(verbs));
 
-	bool operator==(const FCGInputStream& rhs) const
+	if (values.get("format").is<std::string>() && (values.get("format").get<std::string>() == "prometheus"))
 	{
-		if (eof && rhs.eof)
+		std::ostringstream text;
+		Metrics::write_prometheus(text, snap, dispatcher);
+		response.emplace("prometheus", picojson::value(text.str()));
+	}
+}
+
+int handle_request(Exchange& exchange, VerbDispatcher* dispatcher)
+{
+	Measurement measurement(exchange);
+
+	// Requests in CBOR get a response in CBOR; so do JSON requests
+	// that accept it.
+	const bool cbor = SteamWorks::CBOR::is_cbor(exchange.param("CONTENT_TYPE"));
+	const char* accept = exchange.param("HTTP_ACCEPT");
+	if (cbor || (accept && strstr(accept, "application/cbor")))
+	{
+		exchange.encoding = Encoding::CBOR;
+	}
+
+	const char* s_content_length = exchange.param("CONTENT_LENGTH");
+	if (!s_content_length)
+	{
+		simple_output(exchange, 500, "No request data.");
+		return 0;  // Handled correctly, even though we sent an error to the client
+	}
+
+	long content_length = atol(s_content_length);
+	if (content_length < 1)
+	{
+		simple_output(exchange, 500, "Request data too short.");
+		return 0;
+	}
+	if (size_t(content_length) > max_request)
+	{
+		simple_output(exchange, 413, "Request data too long.");
+		return 0;
+	}
+
+	// Read the whole body at once, into a buffer that is kept for
+	// the next request in this thread.
+	static thread_local std::vector<char> buffer;
+	if (buffer.size() < size_t(content_length))
+	{
+		buffer.resize(content_length);
+	}
+	int length = exchange.read(buffer.data(), int(content_length));
+	measurement.bytes_in = length > 0 ? length : 0;
+	if (length < content_length)
+	{
+		simple_output(exchange, 400, "Request data shorter than its Content-Length.");
+		return 0;
+	}
+
+	// JSON is parsed in place; the document keeps its memory for the
+	// next request. CBOR is read into picojson values.
+	static thread_local SteamWorks::JSON::Document request;
+	picojson::value cbor_request;
+	picojson::value::object response_values;
+	std::string verb;
+	int r = 0;
+	if (cbor)
+	{
+		std::string error;
+		if (!SteamWorks::CBOR::parse(buffer.data(), buffer.data() + length, cbor_request, error))
+		{
+			measurement.phase(Metrics::Parse);
+			simple_output(exchange, 500, error.c_str());
+			return 0;
+		}
+		r = find_verb(cbor_request, verb);
+	}
+	else
+	{
+		if (!request.parse(buffer.data(), buffer.data() + length))
 		{
-			return true;
+			measurement.phase(Metrics::Parse);
+			simple_output(exchange, 500, request.error().c_str());
+			return 0;
+		}
+		r = find_verb(request.root(), verb);
+	}
+	if (r < 0)
+	{
+		measurement.phase(Metrics::Parse);
+		simple_output(exchange, 500, "No verb.");
+		return 0;
+	}
+	if (logger)
+	{
+		logger->debug("Got verb '%s'.", verb.c_str());
+	}
+	measurement.slot = Metrics::slot(verb, dispatcher);
+	measurement.phase(Metrics::Parse);
+
+	if (verb == "metrics")
+	{
+		metrics(cbor ? cbor_request : request.root().to_picojson(), response_values, dispatcher);
+		measurement.phase(Metrics::Dispatch);
+		simple_output(exchange, 200, picojson::value(response_values));
+		measurement.phase(Metrics::Serialize);
+		return 0;
+	}
+	if (dispatcher && ((verb == "batch") || dispatcher->is_streamed(verb)))
+	{
+		// The response is written while the verb runs, so it all
+		// counts as dispatch.
+		write_header(exchange);
+		SteamWorks::JSON::Writer writer(output_sink(exchange), 16384, exchange.encoding);
+		if (verb == "batch")
+		{
+			r = dispatcher->exec_batch(cbor ? std::move(cbor_request) : request.root().to_picojson(), writer);
 		}
 		else
 		{
-			return (eof == rhs.eof) && (input == rhs.input);
+			r = cbor ?
+				dispatcher->exec_streamed(verb, cbor_request, writer) :
+				dispatcher->exec_streamed_document(verb, request.root(), writer);
 		}
+		writer.flush();
+		measurement.phase(Metrics::Dispatch);
+		measurement.error = (r < 0) || writer.failed();
+		return r < 0 ? r : 0;
+	}
+	if (dispatcher)
+	{
+		r = cbor ?
+			dispatcher->exec(verb, cbor_request, response_values) :
+			dispatcher->exec_document(verb, request.root(), response_values);
+	}
+	measurement.phase(Metrics::Dispatch);
+	if (r < 0)
+	{
+		simple_output(exchange, 500, "Bad request", -r);
+		return r;
 	}
 
-	// Dummy prefix-++
-	FCGInputStream& operator++()
+	// Verbs report most errors in the response, with a status
+	auto status = response_values.find("status");
+	measurement.error = (status != response_values.end()) && status->second.is<double>() && (status->second.get<double>() >= 400);
+	simple_output(exchange, 200, picojson::value(response_values));
+	measurement.phase(Metrics::Serialize);
+	return 0;
+}
+
+/**
+ * Shared by the worker threads of a threaded mainloop. Workers keep it
+ * alive, since the ones waiting for a connection are left behind when
+ * the loop stops.
+ */
+struct Workers
+{
+	VerbDispatcher* dispatcher;
+	bool serialize;
+	std::mutex exec_mutex;  // Held around exec() and poll() if serialize
+	std::mutex accept_mutex;  // Not all platforms allow accept() from several threads
+
+	std::atomic<bool> stopping;
+	std::mutex mutex;
+	std::condition_variable idle;
+	unsigned int active;  // Requests being handled, protected by mutex
+
+	Workers(VerbDispatcher* d, bool s) :
+		dispatcher(d),
+		serialize(s),
+		stopping(false),
+		active(0)
+	{
+	}
+
+	std::unique_lock<std::mutex> exec_lock()
 	{
-		valid = false;
-		return *this;
+		return serialize ? std::unique_lock<std::mutex>(exec_mutex) : std::unique_lock<std::mutex>();
 	}
 } ;
 
-const char _empty_response[] = "Content-type: text/json\r\nContent-length: 2\r\n\r\n{}";
+void worker(std::shared_ptr<Workers> w)
+{
+	FCGX_Request request;
+	FCGX_InitRequest(&request, 0, 0);
+
+	while (!w->stopping)
+	{
+		int r;
+		{
+			std::lock_guard<std::mutex> lock(w->accept_mutex);
+			r = w->stopping ? -1 : FCGX_Accept_r(&request);
+		}
+		if (r < 0)
+		{
+			break;
+		}
 
-void simple_output(FCGX_Stream* out, int status, const picojson::value& map)
+		{
+			std::lock_guard<std::mutex> lock(w->mutex);
+			w->active++;
+		}
+		FCGXExchange exchange(request.in, request.out, request.envp);
+		if (w->stopping)
+		{
+			simple_output(exchange, 503, "Stopping.");
+			r = 0;
+		}
+		else
+		{
+			auto lock = w->exec_lock();
+			r = handle_request(exchange, w->dispatcher);
+		}
+		request_count++;
+		FCGX_Finish_r(&request);
+		if (r)
+		{
+			w->stopping = true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(w->mutex);
+			w->active--;
+		}
+		w->idle.notify_all();
+	}
+	FCGX_Free(&request, 0);
+}
+
+
+/**
+ * The multiplexing mainloop speaks FastCGI itself, instead of through
+ * libfcgi, which handles one request at a time on a connection and
+ * closes it afterwards unless asked not to. Here connections stay open
+ * as long as the web server wants (FCGI_KEEP_CONN), and the records of
+ * several requests may be interleaved on one connection; each request
+ * is handled once all of its input is in.
+ */
+namespace mux
+{
+
+struct Request
 {
-	std::string text = map.serialize(true);
-	if (text.empty())
+	bool keep_conn;
+	std::string params;  // Name-value pairs, as received
+	std::vector<std::pair<std::string, std::string>> env;
+	std::vector<char> body;
+} ;
+
+struct Connection
+{
+	int fd;
+	std::vector<char> input;  // Received, not yet handled
+	std::map<uint16_t, Request> requests;
+	bool closing;
+
+	Connection(int f) :
+		fd(f),
+		closing(false)
 	{
-		FCGX_PutS(_empty_response, out);
-		return;
 	}
-	const char* const textp = text.c_str();
-	if (!textp)
+} ;
+
+bool write_all(int fd, const char* data, size_t length)
+{
+	while (length)
 	{
-		FCGX_PutS(_empty_response, out);
-		return;
+		ssize_t n = ::send(fd, data, length, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		data += n;
+		length -= n;
 	}
-	size_t len = strlen(textp);
-	if (len < 1)
+	return true;
+}
+
+/// Send a record of @p type for request @p id, split up if it is too long
+bool write_record(int fd, unsigned char type, uint16_t id, const char* data, size_t length)
+{
+	do
 	{
-		FCGX_PutS(_empty_response, out);
-		return;
+		size_t part = length > FCGI_MAX_LENGTH ? FCGI_MAX_LENGTH : length;
+		FCGI_Header header = {
+			FCGI_VERSION_1, type,
+			(unsigned char)(id >> 8), (unsigned char)(id & 0xff),
+			(unsigned char)(part >> 8), (unsigned char)(part & 0xff),
+			0, 0 };
+		if (!write_all(fd, reinterpret_cast<const char*>(&header), sizeof(header)) || !write_all(fd, data, part))
+		{
+			return false;
+		}
+		data += part;
+		length -= part;
 	}
+	while (length);
+	return true;
+}
 
-	FCGX_SetExitStatus(status, out);
-	FCGX_FPrintF(out, "Content-type: text/json\r\nContent-length: %u\r\n\r\n", len);
-	FCGX_PutS(textp, out);
+bool end_request(int fd, uint16_t id, int status, unsigned char protocol_status)
+{
+	FCGI_EndRequestBody body = {
+		(unsigned char)((status >> 24) & 0xff), (unsigned char)((status >> 16) & 0xff),
+		(unsigned char)((status >> 8) & 0xff), (unsigned char)(status & 0xff),
+		protocol_status, { 0, 0, 0 } };
+	return write_record(fd, FCGI_END_REQUEST, id, reinterpret_cast<const char*>(&body), sizeof(body));
 }
 
-void simple_output(FCGX_Stream* out, int status, const char* message=nullptr, const int err=0)
+/**
+ * Split FastCGI name-value pairs in @p data into @p pairs; returns
+ * false if they are malformed.
+ */
+bool parse_pairs(const std::string& data, std::vector<std::pair<std::string, std::string>>& pairs)
 {
-	if (logger && (status != 200))
+	size_t p = 0;
+	while (p < data.size())
 	{
-		logger->debugStream() << "HTTP status " << status << ": " << message;
+		size_t lengths[2];
+		for (int i = 0; i < 2; i++)
+		{
+			if (p >= data.size())
+			{
+				return false;
+			}
+			unsigned char c = data[p];
+			if (c & 0x80)
+			{
+				if (p + 4 > data.size())
+				{
+					return false;
+				}
+				lengths[i] = ((c & 0x7f) << 24) | ((unsigned char)data[p+1] << 16) | ((unsigned char)data[p+2] << 8) | (unsigned char)data[p+3];
+				p += 4;
+			}
+			else
+			{
+				lengths[i] = c;
+				p += 1;
+			}
+		}
+		if ((lengths[0] > data.size() - p) || (lengths[1] > data.size() - p - lengths[0]))
+		{
+			return false;
+		}
+		pairs.emplace_back(data.substr(p, lengths[0]), data.substr(p + lengths[0], lengths[1]));
+		p += lengths[0] + lengths[1];
 	}
+	return true;
+}
 
-	picojson::value::object map;
-	SteamWorks::JSON::simple_output(map, status, message, err);
-	simple_output(out, status, picojson::value(map));
+void put_pair(std::string& data, const char* name, const char* value)
+{
+	// Both are short, so their lengths take one byte each
+	data.push_back(char(strlen(name)));
+	data.push_back(char(strlen(value)));
+	data.append(name);
+	data.append(value);
 }
 
-static int find_verb(const picojson::value& v, std::string &out)
+class MuxExchange : public Exchange
 {
-	if (!v.is<picojson::object>())
+private:
+	int m_fd;
+	uint16_t m_id;
+	const Request& m_request;
+	size_t m_read;
+	bool m_failed;
+
+public:
+	MuxExchange(int fd, uint16_t id, const Request& request) :
+		m_fd(fd),
+		m_id(id),
+		m_request(request),
+		m_read(0),
+		m_failed(false)
 	{
-		return -1;
 	}
-	const picojson::value::object& obj = v.get<picojson::object>();
-	for (picojson::value::object::const_iterator i = obj.begin();i != obj.end(); ++i)
+
+	const char* param(const char* name) override
 	{
-		if (i->first == "verb")
+		for (const auto& p : m_request.env)
 		{
-			out = i->second.to_str();
-			return 0;
+			if (p.first == name)
+			{
+				return p.second.c_str();
+			}
 		}
+		return nullptr;
 	}
-	return -2;
-}
 
-int handle_request(FCGX_Stream* in, FCGX_Stream* out, FCGX_Stream* err, FCGX_ParamArray env, VerbDispatcher* dispatcher)
-{
-	const char* s_content_length = FCGX_GetParam("CONTENT_LENGTH", env);
-	if (!s_content_length)
+	int read(char* buffer, int length) override
 	{
-		simple_output(out, 500, "No request data.");
-		drain_input(in);
-		return 0;  // Handled correctly, even though we sent an error to the client
+		size_t n = std::min(size_t(length), m_request.body.size() - m_read);
+		memcpy(buffer, m_request.body.data() + m_read, n);
+		m_read += n;
+		return int(n);
 	}
 
-	int content_length = atoi(s_content_length);
-	if (content_length < 1)
+protected:
+	bool put(const char* data, size_t length) override
 	{
-		simple_output(out, 500, "Request data too short.");
-		drain_input(in);
-		return 0;
+		m_failed = m_failed || !write_record(m_fd, FCGI_STDOUT, m_id, data, length);
+		return !m_failed;
 	}
-	if (content_length > MAX_STDIN)
+
+	void put_status(int) override
 	{
-		content_length = MAX_STDIN;
+		// Sent with FCGI_END_REQUEST
 	}
+} ;
 
-	if (content_length > 0)
+/**
+ * Handle the record of @p type for request @p id, with @p content.
+ * Returns < 0 if the connection should be closed, > 0 if the
+ * dispatcher asked to stop, and 0 otherwise.
+ */
+int handle_record(Connection& c, unsigned char type, uint16_t id, const std::string& content, VerbDispatcher* dispatcher)
+{
+	if (id == FCGI_NULL_REQUEST_ID)
 	{
-		picojson::value request_values;
-		picojson::value::object response_values;
-		std::string error_string;
-		std::string verb;
-		int r;
-		picojson::parse(request_values, FCGInputStream(in), FCGInputStream(), &error_string);
-		if (!error_string.empty())
+		if (type != FCGI_GET_VALUES)
 		{
-			simple_output(out, 500, error_string.c_str());
+			FCGI_UnknownTypeBody body = { type, { 0, 0, 0, 0, 0, 0, 0 } };
+			return write_record(c.fd, FCGI_UNKNOWN_TYPE, 0, reinterpret_cast<const char*>(&body), sizeof(body)) ? 0 : -1;
 		}
-		else
+
+		std::vector<std::pair<std::string, std::string>> names;
+		std::string values;
+		parse_pairs(content, names);
+		for (const auto& n : names)
 		{
-			if ((r = find_verb(request_values, verb)) < 0)
+			if (n.first == FCGI_MPXS_CONNS)
 			{
-				simple_output(out, 500, "No verb.");
+				put_pair(values, FCGI_MPXS_CONNS, "1");
 			}
-			else
+		}
+		return write_record(c.fd, FCGI_GET_VALUES_RESULT, 0, values.data(), values.size()) ? 0 : -1;
+	}
+
+	if (type == FCGI_BEGIN_REQUEST)
+	{
+		if (content.size() < sizeof(FCGI_BeginRequestBody))
+		{
+			return -1;
+		}
+		const FCGI_BeginRequestBody* body = reinterpret_cast<const FCGI_BeginRequestBody*>(content.data());
+		if (((body->roleB1 << 8) | body->roleB0) != FCGI_RESPONDER)
+		{
+			return end_request(c.fd, id, 0, FCGI_UNKNOWN_ROLE) ? 0 : -1;
+		}
+		Request& r = c.requests[id];
+		r = Request();
+		r.keep_conn = body->flags & FCGI_KEEP_CONN;
+		return 0;
+	}
+
+	auto i = c.requests.find(id);
+	if (i == c.requests.end())
+	{
+		return 0;  // Not (or no longer) active, ignored as the spec says
+	}
+	Request& r = i->second;
+
+	switch (type)
+	{
+	case FCGI_ABORT_REQUEST:
+		c.closing = c.closing || !r.keep_conn;
+		c.requests.erase(i);
+		return end_request(c.fd, id, 0, FCGI_REQUEST_COMPLETE) ? 0 : -1;
+	case FCGI_PARAMS:
+		if (!content.empty())
+		{
+			r.params.append(content);
+		}
+		else if (!parse_pairs(r.params, r.env))
+		{
+			return -1;
+		}
+		return 0;
+	case FCGI_STDIN:
+		if (!content.empty())
+		{
+			// handle_request() refuses requests this long, by their Content-Length
+			if (r.body.size() <= max_request)
 			{
-				if (logger)
-				{
-					logger->debug("Got verb '%s'.", verb.c_str());
-				}
-				if (dispatcher)
-				{
-					r = dispatcher->exec(verb, request_values, response_values);
-				}
-				if (r < 0)
-				{
-					simple_output(out, 500, "Bad request", -r);
-					drain_input(in);
-					return r;
-				}
-				else
-				{
-					picojson::value v(response_values);
-					simple_output(out, 200, v);
-				}
+				r.body.insert(r.body.end(), content.begin(), content.end());
 			}
+			return 0;
 		}
+		break;  // All the input is in
+	default:
+		return 0;  // FCGI_DATA is for filters only
 	}
-	drain_input(in);
-	return 0;
+
+	MuxExchange exchange(c.fd, id, r);
+	int result = handle_request(exchange, dispatcher);
+	request_count++;
+	bool written = write_record(c.fd, FCGI_STDOUT, id, nullptr, 0) && end_request(c.fd, id, exchange.status, FCGI_REQUEST_COMPLETE);
+	c.closing = c.closing || !r.keep_conn;
+	c.requests.erase(i);
+	if (result)
+	{
+		return 1;
+	}
+	return written ? 0 : -1;
+}
+
+/**
+ * Read what is available on connection @p c, and handle the records
+ * that are complete. Returns as handle_record() does.
+ */
+int service(Connection& c, VerbDispatcher* dispatcher)
+{
+	char buffer[16384];
+	ssize_t n = ::read(c.fd, buffer, sizeof(buffer));
+	if (n < 0)
+	{
+		return errno == EINTR ? 0 : -1;
+	}
+	if (n == 0)
+	{
+		return -1;  // Closed by the web server
+	}
+	c.input.insert(c.input.end(), buffer, buffer + n);
+
+	size_t p = 0;
+	int r = 0;
+	while ((r == 0) && !c.closing && (c.input.size() - p >= FCGI_HEADER_LEN))
+	{
+		const FCGI_Header* header = reinterpret_cast<const FCGI_Header*>(c.input.data() + p);
+		size_t length = (header->contentLengthB1 << 8) | header->contentLengthB0;
+		if (c.input.size() - p < FCGI_HEADER_LEN + length + header->paddingLength)
+		{
+			break;  // Wait for the rest of the record
+		}
+		if (header->version != FCGI_VERSION_1)
+		{
+			return -1;
+		}
+		const char* content = c.input.data() + p + FCGI_HEADER_LEN;
+		r = handle_record(c, header->type, (header->requestIdB1 << 8) | header->requestIdB0, std::string(content, length), dispatcher);
+		p += FCGI_HEADER_LEN + length + header->paddingLength;
+	}
+	c.input.erase(c.input.begin(), c.input.begin() + p);
+	return (r == 0) && c.closing ? -1 : r;
 }
 
+}  // namespace mux
+
 }  // namespace
 
+void SteamWorks::FCGI::set_max_request(size_t bytes)
+{
+	max_request = bytes;
+}
+
 int SteamWorks::FCGI::init_logging(const std::string& logname)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger(logname);
@@ -249,7 +846,8 @@ int SteamWorks::FCGI::mainloop(VerbDispatcher *dispatcher)
 		r = FCGX_Accept(&in, &out, &err, &envp);
 		if (r < 0) return r;
 
-		r = fcgi::handle_request(in, out, err, envp, dispatcher);
+		fcgi::FCGXExchange exchange(in, out, envp);
+		r = fcgi::handle_request(exchange, dispatcher);
 		if (r) return r;
 
 		request_count++;
@@ -288,3 +886,137 @@ int SteamWorks::FCGI::mainloop(VerbDispatcher *dispatcher)
 
 	return 0;
 }
+
+int SteamWorks::FCGI::mainloop(VerbDispatcher* dispatcher, unsigned int workers, bool serialize)
+{
+	if (workers < 2)
+	{
+		return mainloop(dispatcher);
+	}
+
+	int r = FCGX_Init();
+	if (r)
+	{
+		return r;
+	}
+
+	auto w = std::make_shared<fcgi::Workers>(dispatcher, serialize);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 0; i < workers; i++)
+	{
+		threads.emplace_back(fcgi::worker, w);
+	}
+	if (fcgi::logger)
+	{
+		fcgi::logger->debugStream() << "Started " << workers << " FCGI workers.";
+	}
+
+	while (!w->stopping)
+	{
+		if (dispatcher)
+		{
+			auto lock = w->exec_lock();
+			dispatcher->poll();  // This has a (short) timeout
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	// Let requests that are being handled finish; the workers that are
+	// waiting in accept() stay there until the process exits.
+	FCGX_ShutdownPending();
+	{
+		std::unique_lock<std::mutex> lock(w->mutex);
+		w->idle.wait(lock, [&w]{ return w->active == 0; });
+	}
+	for (auto& t : threads)
+	{
+		t.detach();
+	}
+	return 0;
+}
+
+int SteamWorks::FCGI::mainloop_multiplexed(VerbDispatcher* dispatcher)
+{
+	static const std::chrono::seconds max_poll_interval(1);
+
+	std::map<int, fcgi::mux::Connection> connections;
+	std::vector<struct pollfd> fds;
+	auto last_poll = std::chrono::steady_clock::now();
+	int r = 0;
+
+	while (r == 0)
+	{
+		fds.clear();
+		fds.push_back({ FCGI_LISTENSOCK_FILENO, POLLIN, 0 });
+		for (const auto& c : connections)
+		{
+			fds.push_back({ c.first, POLLIN, 0 });
+		}
+
+		// Short timeout, so that the dispatcher is polled regularly
+		int ready = ::poll(fds.data(), fds.size(), 10);
+		if (ready < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			r = -1;
+			break;
+		}
+
+		if (fds[0].revents & (POLLERR | POLLNVAL))
+		{
+			if (fcgi::logger)
+			{
+				fcgi::logger->debugStream() << "No FCGI socket, exiting.";
+			}
+			r = -1;
+			break;
+		}
+		if (fds[0].revents & POLLIN)
+		{
+			int fd = ::accept(FCGI_LISTENSOCK_FILENO, nullptr, nullptr);
+			if (fd >= 0)
+			{
+				connections.emplace(fd, fcgi::mux::Connection(fd));
+			}
+		}
+
+		for (size_t i = 1; (i < fds.size()) && (r == 0); i++)
+		{
+			if (!fds[i].revents)
+			{
+				continue;
+			}
+			auto c = connections.find(fds[i].fd);
+			int s = fcgi::mux::service(c->second, dispatcher);
+			if (s < 0)
+			{
+				::close(c->first);
+				connections.erase(c);
+			}
+			else
+			{
+				r = s;  // The dispatcher asked to stop
+			}
+		}
+
+		// Polling the dispatcher can take a while (e.g. a SyncRepl
+		// poll per follower), so it waits until the connections are
+		// quiet; with a steady stream of requests, it still gets
+		// polled every max_poll_interval.
+		auto now = std::chrono::steady_clock::now();
+		if (dispatcher && (r == 0) && ((ready == 0) || (now - last_poll >= max_poll_interval)))
+		{
+			dispatcher->poll();
+			last_poll = std::chrono::steady_clock::now();
+		}
+	}
+
+	for (const auto& c : connections)
+	{
+		::close(c.first);
+	}
+	return r < 0 ? r : 0;
+}
@@ -9,7 +9,9 @@ Adriaan de Groot <groot@kde.org>
  * FCGI support code. An FCGI program waits for incoming connections
  * (corresponding to a new FCGI request) and processes them. The API
  * is just one function, mainloop(), which uses a passed-in dispatcher
- * object to respond to the requests.
+ * object to respond to the requests; it handles one request at a
+ * time, or several at once in worker threads. mainloop_multiplexed()
+ * keeps connections open for more requests.
  *
  * Use init_logging() to cause FCGI processing to log to a given
  * category; this is optional.
@@ -26,9 +28,31 @@ namespace FCGI
 
 /// Set up logging, use the given @p categoryname for logging FCGI actions.
 int init_logging(const std::string& categoryname);
+/// Refuse requests with more than @p bytes of data (the default is 1MiB).
+void set_max_request(size_t bytes);
 /// Run the main FCGI processing loop, using @p dispatcher for actual processing.
 /// If @p dispatcher is null, then only dummy processing occurs.
 int mainloop(VerbDispatcher* dispatcher=0);
+/**
+ * As mainloop(), with @p workers threads that each accept and
+ * handle FCGI requests, so that a slow request does not hold up
+ * the others. The calling thread polls the dispatcher. With one
+ * worker, this is the same as mainloop(dispatcher).
+ *
+ * The dispatcher's exec() and poll() are called from different
+ * threads at once, unless @p serialize is set; then they are run
+ * one at a time (under a single mutex), for dispatchers that are
+ * not thread-safe.
+ */
+int mainloop(VerbDispatcher* dispatcher, unsigned int workers, bool serialize=false);
+/**
+ * As mainloop(dispatcher), but keeping connections from the web
+ * server open for as long as it asks (FCGI_KEEP_CONN), and taking
+ * the records of several requests interleaved on one connection.
+ * Requests are handled one at a time, in the calling thread, once
+ * all of their data has come in.
+ */
+int mainloop_multiplexed(VerbDispatcher* dispatcher=0);
 
 }  // namespace FCGI
 }  // namespace Steamworks
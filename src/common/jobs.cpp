@@ -0,0 +1,201 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "jobs.h"
+
+#include "jsonresponse.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Results that are not fetched are dropped, oldest first, beyond this many
+static const size_t max_finished = 256;
+
+class SteamWorks::JobQueue::Private
+{
+public:
+	typedef enum { queued=0, running, done, failed } State;
+
+	struct Entry
+	{
+		std::string verb;
+		Job job;
+		State state;
+		Object result;
+	} ;
+
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::map<unsigned long, Entry> jobs;
+	std::deque<unsigned long> queue;
+	std::deque<unsigned long> finished;  // In order of finishing
+	unsigned long last_id;
+
+	unsigned int workers;
+	std::vector<std::thread> threads;
+	bool stopping;
+
+	Private(unsigned int w) :
+		last_id(0),
+		workers(w < 1 ? 1 : w),
+		stopping(false)
+	{
+	}
+
+	static const char* state_name(State s)
+	{
+		static const char* const names[] = { "queued", "running", "done", "failed" };
+		return names[s];
+	}
+
+	static void worker(Private* d);
+} ;
+
+void SteamWorks::JobQueue::Private::worker(Private* d)
+{
+	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.jobs");
+	std::unique_lock<std::mutex> lock(d->mutex);
+
+	while (true)
+	{
+		d->wakeup.wait(lock, [&d]{ return d->stopping || !d->queue.empty(); });
+		if (d->stopping)
+		{
+			break;
+		}
+
+		unsigned long id = d->queue.front();
+		d->queue.pop_front();
+		Entry& entry = d->jobs[id];
+		entry.state = running;
+		Job job = std::move(entry.job);
+		log.debugStream() << "Job " << id << " (" << entry.verb << ") started.";
+
+		// Entries are only erased once finished, so entry stays valid
+		Object result;
+		lock.unlock();
+		int r = job(result);
+		lock.lock();
+
+		entry.state = (r < 0) ? failed : done;
+		entry.result.swap(result);
+		log.debugStream() << "Job " << id << " (" << entry.verb << ") " << state_name(entry.state) << '.';
+
+		d->finished.push_back(id);
+		while (d->finished.size() > max_finished)
+		{
+			d->jobs.erase(d->finished.front());
+			d->finished.pop_front();
+		}
+	}
+}
+
+SteamWorks::JobQueue::JobQueue(unsigned int workers) :
+	d(new Private(workers))
+{
+}
+
+SteamWorks::JobQueue::~JobQueue()
+{
+	stop();
+}
+
+void SteamWorks::JobQueue::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(d->mutex);
+		d->stopping = true;
+	}
+	d->wakeup.notify_all();
+
+	// No threads are started once stopping is set
+	for (auto& t : d->threads)
+	{
+		t.join();
+	}
+	d->threads.clear();
+}
+
+unsigned long SteamWorks::JobQueue::submit(const std::string& verb, Job&& job, Object& response)
+{
+	std::lock_guard<std::mutex> lock(d->mutex);
+	if (d->threads.empty() && !d->stopping)
+	{
+		for (unsigned int i = 0; i < d->workers; i++)
+		{
+			d->threads.emplace_back(Private::worker, d.get());
+		}
+	}
+
+	unsigned long id = ++d->last_id;
+	Private::Entry& entry = d->jobs[id];
+	entry.verb = verb;
+	entry.job = std::move(job);
+	entry.state = Private::queued;
+	d->queue.push_back(id);
+	d->wakeup.notify_one();
+
+	response.emplace("job", picojson::value(double(id)));
+	return id;
+}
+
+int SteamWorks::JobQueue::do_job(const Values& values, Object& response)
+{
+	std::lock_guard<std::mutex> lock(d->mutex);
+
+	if (!values.is<picojson::object>() || !values.get("id").is<double>())
+	{
+		picojson::array jobs;
+		for (const auto& j : d->jobs)
+		{
+			picojson::object job;
+			job.emplace("id", picojson::value(double(j.first)));
+			job.emplace("verb", picojson::value(j.second.verb));
+			job.emplace("status", picojson::value(Private::state_name(j.second.state)));
+			jobs.emplace_back(job);
+		}
+		response.emplace("jobs", picojson::value(jobs));
+		return 0;
+	}
+
+	unsigned long id = values.get("id").get<double>();
+	auto i = d->jobs.find(id);
+	if (i == d->jobs.end())
+	{
+		SteamWorks::JSON::simple_output(response, 404, "No such job.");
+		return 0;
+	}
+
+	Private::Entry& entry = i->second;
+	response.emplace("id", picojson::value(double(id)));
+	response.emplace("verb", picojson::value(entry.verb));
+	response.emplace("status", picojson::value(Private::state_name(entry.state)));
+	if ((entry.state == Private::done) || (entry.state == Private::failed))
+	{
+		response.emplace("result", picojson::value(Object()));
+		response["result"].get<picojson::object>().swap(entry.result);
+		d->finished.erase(std::find(d->finished.begin(), d->finished.end(), id));
+		d->jobs.erase(i);
+	}
+	return 0;
+}
+
+bool SteamWorks::JobQueue::wants_job(const Values& values)
+{
+	return values.is<picojson::object>() && values.get("job").evaluate_as_boolean();
+}
+
+bool SteamWorks::JobQueue::wants_job(const JSON::Node& values)
+{
+	return values.get("job").evaluate_as_boolean();
+}
@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Jobs are verbs that take too long to run in the mainloop (e.g. the
+ * initial refresh of a SyncRepl): the verb is queued, and its response
+ * is only { "job": id }. Worker threads run the queued jobs in order;
+ * the "job" verb (do_job) returns the status of a job, and once it is
+ * done, its result.
+ */
+#ifndef STEAMWORKS_COMMON_JOBS_H
+#define STEAMWORKS_COMMON_JOBS_H
+
+#include "jsondom.h"
+#include "picojson.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace SteamWorks
+{
+
+class JobQueue
+{
+private:
+	class Private;
+	std::unique_ptr<Private> d;
+
+public:
+	using Values = picojson::value;
+	using Object = picojson::value::object;
+	/// Runs the verb, filling in the response; returns < 0 on error, as exec() does
+	using Job = std::function<int(Object&)>;
+
+	/**
+	 * Queue with @p workers threads, started when the first job
+	 * is submitted. The destructor calls stop().
+	 */
+	JobQueue(unsigned int workers=1);
+	~JobQueue();
+
+	/**
+	 * Drops the queued jobs, and waits for the running ones to
+	 * finish. Jobs often use their owner (e.g. a dispatcher), so
+	 * the owner calls this before it is torn down. Jobs that are
+	 * submitted afterwards never run.
+	 */
+	void stop();
+
+	/**
+	 * Queue @p job, which runs @p verb, and set "job" (its id)
+	 * in @p response.
+	 */
+	unsigned long submit(const std::string& verb, Job&& job, Object& response);
+
+	/**
+	 * The job verb: with @p values["id"], returns the status of
+	 * that job ("queued", "running", "done" or "failed"), with
+	 * its "result" once it has finished; the result can be
+	 * fetched only once. Without an id, lists the status of
+	 * all the jobs that have not been fetched.
+	 */
+	int do_job(const Values& values, Object& response);
+
+	/** True if the request @p values asks to run its verb as a job. */
+	static bool wants_job(const Values& values);
+	static bool wants_job(const JSON::Node& values);
+} ;
+
+}  // namespace
+
+#endif
@@ -0,0 +1,626 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "jsondom.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static const size_t chunk_size = 65536;
+static const unsigned int max_depth = 256;
+
+const SteamWorks::JSON::Node SteamWorks::JSON::Node::s_null;
+
+/**
+ * First byte from @p p on that ends the plain part of a string:
+ * a quote, a backslash or a control character; @p end if there
+ * is none. Takes 16 bytes at a time where SSE2 is available.
+ */
+static const char* scan_string(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	while (end - p >= 16)
+	{
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		__m128i hits = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+			_mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control));  // <= 0x1f
+		int mask = _mm_movemask_epi8(hits);
+		if (mask)
+		{
+			return p + __builtin_ctz(mask);
+		}
+		p += 16;
+	}
+#endif
+	while ((p < end) && (*p != '"') && (*p != '\\') && ((unsigned char)*p >= 0x20))
+	{
+		p++;
+	}
+	return p;
+}
+
+static int hex_digit(char c)
+{
+	if ((c >= '0') && (c <= '9')) return c - '0';
+	if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+	if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+	return -1;
+}
+
+/** Read 4 hex digits at @p p into @p code; false if they are not. */
+static bool hex4(const char* p, const char* end, unsigned int& code)
+{
+	if (end - p < 4)
+	{
+		return false;
+	}
+	code = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		int d = hex_digit(p[i]);
+		if (d < 0)
+		{
+			return false;
+		}
+		code = (code << 4) | d;
+	}
+	return true;
+}
+
+static char* put_utf8(char* out, unsigned int code)
+{
+	if (code < 0x80)
+	{
+		*out++ = code;
+	}
+	else if (code < 0x800)
+	{
+		*out++ = 0xc0 | (code >> 6);
+		*out++ = 0x80 | (code & 0x3f);
+	}
+	else if (code < 0x10000)
+	{
+		*out++ = 0xe0 | (code >> 12);
+		*out++ = 0x80 | ((code >> 6) & 0x3f);
+		*out++ = 0x80 | (code & 0x3f);
+	}
+	else
+	{
+		*out++ = 0xf0 | (code >> 18);
+		*out++ = 0x80 | ((code >> 12) & 0x3f);
+		*out++ = 0x80 | ((code >> 6) & 0x3f);
+		*out++ = 0x80 | (code & 0x3f);
+	}
+	return out;
+}
+
+const SteamWorks::JSON::Node& SteamWorks::JSON::Node::get(const char* key) const
+{
+	if (m_type != Object)
+	{
+		return s_null;
+	}
+	StringView k{ key, strlen(key) };
+	const Member* m = std::lower_bound(u.members, u.members + m_size, k,
+		[](const Member& member, const StringView& k) { return member.key < k; });
+	if ((m != u.members + m_size) && !(k < m->key))
+	{
+		return m->value;
+	}
+	return s_null;
+}
+
+const SteamWorks::JSON::Member* SteamWorks::JSON::Node::end() const
+{
+	return m_type == Object ? u.members + m_size : nullptr;
+}
+
+std::string SteamWorks::JSON::Node::to_str() const
+{
+	switch (m_type)
+	{
+	case String:
+		return std::string(u.string, m_size);
+	case Array:
+		return "array";
+	case Object:
+		return "object";
+	default:
+		return to_picojson().to_str();  // Numbers are formatted as picojson does
+	}
+}
+
+bool SteamWorks::JSON::Node::evaluate_as_boolean() const
+{
+	switch (m_type)
+	{
+	case Null:
+	case False:
+		return false;
+	case Number:
+		return u.number != 0;
+	case String:
+		return m_size != 0;
+	default:
+		return true;
+	}
+}
+
+picojson::value SteamWorks::JSON::Node::to_picojson() const
+{
+	switch (m_type)
+	{
+	case False:
+	case True:
+		return picojson::value(m_type == True);
+	case Number:
+		return picojson::value(u.number);
+	case String:
+		return picojson::value(std::string(u.string, m_size));
+	case Array:
+		{
+			picojson::array a;
+			a.reserve(m_size);
+			for (uint32_t i = 0; i < m_size; i++)
+			{
+				a.push_back(u.elements[i].to_picojson());
+			}
+			return picojson::value(a);
+		}
+	case Object:
+		{
+			// Members are sorted already, so each insert goes at the end
+			picojson::object o;
+			for (uint32_t i = 0; i < m_size; i++)
+			{
+				o.emplace_hint(o.end(), u.members[i].key.str(), u.members[i].value.to_picojson());
+			}
+			return picojson::value(o);
+		}
+	case Null:
+	default:
+		return picojson::value();
+	}
+}
+
+SteamWorks::JSON::Document::Document() :
+	m_chunk(0),
+	m_used(0),
+	m_begin(nullptr),
+	m_end(nullptr)
+{
+}
+
+SteamWorks::JSON::Document::~Document()
+{
+}
+
+/**
+ * Memory for @p size bytes (aligned for a double) in the arena. Chunks
+ * are kept for the next parse(), and used again in the same order.
+ */
+void* SteamWorks::JSON::Document::allocate(size_t size)
+{
+	size = (size + 7) & ~size_t(7);
+	while (m_chunk < m_chunks.size())
+	{
+		if (m_used + size <= m_chunk_sizes[m_chunk])
+		{
+			void* p = m_chunks[m_chunk].get() + m_used;
+			m_used += size;
+			return p;
+		}
+		m_chunk++;
+		m_used = 0;
+	}
+	m_chunk_sizes.push_back(std::max(size, chunk_size));
+	m_chunks.emplace_back(new char[m_chunk_sizes.back()]);
+	m_chunk = m_chunks.size() - 1;
+	m_used = size;
+	return m_chunks.back().get();
+}
+
+bool SteamWorks::JSON::Document::fail(const char* p, const char* message)
+{
+	if (m_error.empty())
+	{
+		char buf[128];
+		snprintf(buf, sizeof(buf), "JSON %s at offset %lu.", message, (unsigned long)(p - m_begin));
+		m_error = buf;
+	}
+	return false;
+}
+
+bool SteamWorks::JSON::Document::parse(const char* begin, const char* end)
+{
+	m_chunk = 0;
+	m_used = 0;
+	m_elements.clear();
+	m_members.clear();
+	m_error.clear();
+	m_root = Node();
+	m_begin = begin;
+	m_end = end;
+
+	const char* p = parse_value(skip(begin), m_root, 0);
+	if (p && (skip(p) != end))
+	{
+		fail(skip(p), "text after the value");
+		p = nullptr;
+	}
+	if (!p)
+	{
+		m_root = Node();
+		return false;
+	}
+	return true;
+}
+
+const char* SteamWorks::JSON::Document::skip(const char* p) const
+{
+	while ((p < m_end) && ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t')))
+	{
+		p++;
+	}
+	return p;
+}
+
+const char* SteamWorks::JSON::Document::parse_value(const char* p, Node& node, unsigned int depth)
+{
+	if (p >= m_end)
+	{
+		fail(p, "value expected");
+		return nullptr;
+	}
+	if (depth > max_depth)
+	{
+		fail(p, "nested too deeply");
+		return nullptr;
+	}
+
+	switch (*p)
+	{
+	case '{':
+		return parse_object(p, node, depth + 1);
+	case '[':
+		return parse_array(p, node, depth + 1);
+	case '"':
+		{
+			StringView s = StringView();
+			p = parse_string(p, s);
+			node.m_type = Node::String;
+			node.m_size = s.size;
+			node.u.string = s.data;
+			return p;
+		}
+	case 't':
+	case 'f':
+	case 'n':
+		{
+			static const char* const words[] = { "true", "false", "null" };
+			static const Node::Type types[] = { Node::True, Node::False, Node::Null };
+			int w = (*p == 't') ? 0 : (*p == 'f') ? 1 : 2;
+			size_t len = strlen(words[w]);
+			if ((size_t(m_end - p) < len) || (memcmp(p, words[w], len) != 0))
+			{
+				fail(p, "syntax error");
+				return nullptr;
+			}
+			node.m_type = types[w];
+			return p + len;
+		}
+	default:
+		return parse_number(p, node);
+	}
+}
+
+const char* SteamWorks::JSON::Document::parse_string(const char* p, StringView& s)
+{
+	const char* start = ++p;  // Past the quote
+
+	// The common case: no escapes, so the string is in the buffer as-is
+	p = scan_string(p, m_end);
+	if ((p < m_end) && (*p == '"'))
+	{
+		s.data = start;
+		s.size = p - start;
+		return p + 1;
+	}
+
+	// Find the end, to size the unescaped copy (which is not longer)
+	const char* q = p;
+	while ((q < m_end) && (*q == '\\'))
+	{
+		q = scan_string(q + 2, m_end);
+	}
+	if ((q >= m_end) || (*q != '"'))
+	{
+		fail(q, (q < m_end) ? "control character in string" : "unterminated string");
+		return nullptr;
+	}
+
+	char* out = static_cast<char*>(allocate(q - start));
+	char* o = out;
+	memcpy(o, start, p - start);
+	o += p - start;
+	while (p < q)
+	{
+		if (*p != '\\')
+		{
+			const char* plain = scan_string(p, q);
+			memcpy(o, p, plain - p);
+			o += plain - p;
+			p = plain;
+			continue;
+		}
+		p++;
+		switch (*p++)
+		{
+		case '"': *o++ = '"'; break;
+		case '\\': *o++ = '\\'; break;
+		case '/': *o++ = '/'; break;
+		case 'b': *o++ = '\b'; break;
+		case 'f': *o++ = '\f'; break;
+		case 'n': *o++ = '\n'; break;
+		case 'r': *o++ = '\r'; break;
+		case 't': *o++ = '\t'; break;
+		case 'u':
+			{
+				unsigned int code;
+				if (!hex4(p, q, code))
+				{
+					fail(p, "bad \\u escape");
+					return nullptr;
+				}
+				p += 4;
+				if ((code >= 0xd800) && (code < 0xdc00))
+				{
+					unsigned int low;
+					if ((q - p < 6) || (p[0] != '\\') || (p[1] != 'u') || !hex4(p + 2, q, low) || (low < 0xdc00) || (low >= 0xe000))
+					{
+						fail(p, "unpaired surrogate");
+						return nullptr;
+					}
+					p += 6;
+					code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				}
+				else if ((code >= 0xdc00) && (code < 0xe000))
+				{
+					fail(p, "unpaired surrogate");
+					return nullptr;
+				}
+				o = put_utf8(o, code);
+				break;
+			}
+		default:
+			fail(p - 1, "bad escape");
+			return nullptr;
+		}
+	}
+	s.data = out;
+	s.size = o - out;
+	return q + 1;
+}
+
+const char* SteamWorks::JSON::Document::parse_number(const char* p, Node& node)
+{
+	const char* start = p;
+	bool integral = true;
+
+	if ((p < m_end) && (*p == '-'))
+	{
+		p++;
+	}
+	if ((p < m_end) && (*p == '0'))
+	{
+		p++;
+	}
+	else if ((p < m_end) && (*p >= '1') && (*p <= '9'))
+	{
+		while ((p < m_end) && (*p >= '0') && (*p <= '9'))
+		{
+			p++;
+		}
+	}
+	else
+	{
+		fail(start, "syntax error");
+		return nullptr;
+	}
+	if ((p < m_end) && (*p == '.'))
+	{
+		integral = false;
+		const char* digits = ++p;
+		while ((p < m_end) && (*p >= '0') && (*p <= '9'))
+		{
+			p++;
+		}
+		if (p == digits)
+		{
+			fail(p, "digit expected");
+			return nullptr;
+		}
+	}
+	if ((p < m_end) && ((*p == 'e') || (*p == 'E')))
+	{
+		integral = false;
+		p++;
+		if ((p < m_end) && ((*p == '+') || (*p == '-')))
+		{
+			p++;
+		}
+		const char* digits = p;
+		while ((p < m_end) && (*p >= '0') && (*p <= '9'))
+		{
+			p++;
+		}
+		if (p == digits)
+		{
+			fail(p, "digit expected");
+			return nullptr;
+		}
+	}
+
+	node.m_type = Node::Number;
+	const char* digits = start + (*start == '-' ? 1 : 0);
+	if (integral && (p - digits <= 15))
+	{
+		// Exact in a double, no need for strtod
+		int64_t n = 0;
+		for (const char* d = digits; d < p; d++)
+		{
+			n = n * 10 + (*d - '0');
+		}
+		node.u.number = (*start == '-') ? -double(n) : double(n);
+	}
+	else
+	{
+		// strtod() needs a NUL-terminated copy
+		std::string text(start, p);
+		node.u.number = strtod(text.c_str(), nullptr);
+		// Too large for a double; picojson would throw on it
+		if (!std::isfinite(node.u.number))
+		{
+			fail(start, "number out of range");
+			return nullptr;
+		}
+	}
+	return p;
+}
+
+const char* SteamWorks::JSON::Document::parse_array(const char* p, Node& node, unsigned int depth)
+{
+	const size_t first = m_elements.size();
+	p = skip(p + 1);
+	if ((p < m_end) && (*p == ']'))
+	{
+		p++;
+	}
+	else
+	{
+		while (true)
+		{
+			Node element;
+			p = parse_value(p, element, depth);
+			if (!p)
+			{
+				return nullptr;
+			}
+			m_elements.push_back(element);
+			p = skip(p);
+			if ((p < m_end) && (*p == ','))
+			{
+				p = skip(p + 1);
+				continue;
+			}
+			if ((p < m_end) && (*p == ']'))
+			{
+				p++;
+				break;
+			}
+			fail(p, "',' or ']' expected");
+			return nullptr;
+		}
+	}
+
+	size_t count = m_elements.size() - first;
+	Node* elements = static_cast<Node*>(allocate(count * sizeof(Node)));
+	std::uninitialized_copy(m_elements.begin() + first, m_elements.end(), elements);
+	m_elements.resize(first);
+
+	node.m_type = Node::Array;
+	node.m_size = count;
+	node.u.elements = elements;
+	return p;
+}
+
+const char* SteamWorks::JSON::Document::parse_object(const char* p, Node& node, unsigned int depth)
+{
+	const size_t first = m_members.size();
+	p = skip(p + 1);
+	if ((p < m_end) && (*p == '}'))
+	{
+		p++;
+	}
+	else
+	{
+		while (true)
+		{
+			Member member;
+			if ((p >= m_end) || (*p != '"'))
+			{
+				fail(p, "key expected");
+				return nullptr;
+			}
+			p = parse_string(p, member.key);
+			if (!p)
+			{
+				return nullptr;
+			}
+			p = skip(p);
+			if ((p >= m_end) || (*p != ':'))
+			{
+				fail(p, "':' expected");
+				return nullptr;
+			}
+			p = parse_value(skip(p + 1), member.value, depth);
+			if (!p)
+			{
+				return nullptr;
+			}
+			m_members.push_back(member);
+			p = skip(p);
+			if ((p < m_end) && (*p == ','))
+			{
+				p = skip(p + 1);
+				continue;
+			}
+			if ((p < m_end) && (*p == '}'))
+			{
+				p++;
+				break;
+			}
+			fail(p, "',' or '}' expected");
+			return nullptr;
+		}
+	}
+
+	// Sort by key; of duplicate keys, the last one counts (as in picojson)
+	auto begin = m_members.begin() + first;
+	std::stable_sort(begin, m_members.end(), [](const Member& a, const Member& b) { return a.key < b.key; });
+	auto out = begin;
+	for (auto i = begin; i != m_members.end(); ++i)
+	{
+		if ((i + 1 != m_members.end()) && !((i->key < (i + 1)->key)))
+		{
+			continue;
+		}
+		*out++ = *i;
+	}
+	m_members.erase(out, m_members.end());
+
+	size_t count = m_members.size() - first;
+	Member* members = static_cast<Member*>(allocate(count * sizeof(Member)));
+	std::uninitialized_copy(m_members.begin() + first, m_members.end(), members);
+	m_members.resize(first);
+
+	node.m_type = Node::Object;
+	node.m_size = count;
+	node.u.members = members;
+	return p;
+}
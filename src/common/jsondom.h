@@ -0,0 +1,164 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Read-only JSON document model for parsing requests. A Document
+ * parses a buffer in one go into Nodes that live in an arena owned by
+ * the document, so there is no allocation per node; strings without
+ * escapes point into the buffer itself, and objects are a sorted
+ * array of members, looked up by binary search.
+ *
+ * The buffer must outlive the document (or the next parse()). Parsing
+ * again reuses the arena, so a document kept per thread stops
+ * allocating once it has seen the largest request.
+ *
+ * to_picojson() converts a node to picojson, for code that has not
+ * moved to Nodes yet.
+ */
+#ifndef STEAMWORKS_COMMON_JSONDOM_H
+#define STEAMWORKS_COMMON_JSONDOM_H
+
+#include "picojson.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace SteamWorks
+{
+namespace JSON
+{
+
+/// Bytes that belong to a document (or its buffer); not NUL-terminated.
+struct StringView
+{
+	const char* data;
+	size_t size;
+
+	std::string str() const { return std::string(data, size); }
+	bool operator==(const char* s) const { return (strlen(s) == size) && (memcmp(s, data, size) == 0); }
+	bool operator<(const StringView& other) const
+	{
+		int c = memcmp(data, other.data, size < other.size ? size : other.size);
+		return c ? (c < 0) : (size < other.size);
+	}
+} ;
+
+struct Member;
+
+class Node
+{
+friend class Document;
+public:
+	enum Type : uint8_t { Null = 0, False, True, Number, String, Array, Object };
+
+private:
+	Type m_type;
+	uint32_t m_size;  // Length of a string, number of elements or members
+	union
+	{
+		double number;
+		const char* string;
+		const Node* elements;
+		const Member* members;
+	} u;
+
+	static const Node s_null;
+
+public:
+	Node() : m_type(Null), m_size(0) { u.string = nullptr; }
+
+	Type type() const { return m_type; }
+	bool is_null() const { return m_type == Null; }
+	bool is_bool() const { return (m_type == False) || (m_type == True); }
+	bool is_number() const { return m_type == Number; }
+	bool is_string() const { return m_type == String; }
+	bool is_array() const { return m_type == Array; }
+	bool is_object() const { return m_type == Object; }
+
+	bool boolean() const { return m_type == True; }
+	double number() const { return m_type == Number ? u.number : 0.0; }
+	StringView string() const { return StringView{ m_type == String ? u.string : "", m_type == String ? m_size : 0 }; }
+
+	/// Number of elements of an array or members of an object, else 0.
+	size_t size() const { return ((m_type == Array) || (m_type == Object)) ? m_size : 0; }
+	/// Element @p i of an array; a null node if there is none.
+	const Node& operator[](size_t i) const { return ((m_type == Array) && (i < m_size)) ? u.elements[i] : s_null; }
+	/// Member @p key of an object; a null node if there is none.
+	const Node& get(const char* key) const;
+	const Node& get(const std::string& key) const { return get(key.c_str()); }
+	/// Members of an object, sorted by key.
+	const Member* begin() const { return m_type == Object ? u.members : nullptr; }
+	const Member* end() const;
+
+	/// Text of this node as picojson's to_str() has it: strings as they are, and "array" or "object".
+	std::string to_str() const;
+	/// Truth of this node as picojson's evaluate_as_boolean() has it.
+	bool evaluate_as_boolean() const;
+
+	/// Copy of this node (and everything in it) as picojson.
+	picojson::value to_picojson() const;
+} ;
+
+struct Member
+{
+	StringView key;
+	Node value;
+} ;
+
+class Document
+{
+private:
+	// Chunks of memory that nodes and unescaped strings are placed in
+	std::vector<std::unique_ptr<char[]>> m_chunks;
+	std::vector<size_t> m_chunk_sizes;
+	size_t m_chunk;  // Current chunk
+	size_t m_used;  // Bytes used in the current chunk
+
+	// Elements and members of the arrays and objects being parsed
+	std::vector<Node> m_elements;
+	std::vector<Member> m_members;
+
+	Node m_root;
+	std::string m_error;
+
+	const char* m_begin;
+	const char* m_end;
+
+	void* allocate(size_t size);
+	bool fail(const char* p, const char* message);
+
+	const char* skip(const char* p) const;
+	const char* parse_value(const char* p, Node& node, unsigned int depth);
+	const char* parse_string(const char* p, StringView& s);
+	const char* parse_number(const char* p, Node& node);
+	const char* parse_array(const char* p, Node& node, unsigned int depth);
+	const char* parse_object(const char* p, Node& node, unsigned int depth);
+
+public:
+	Document();
+	~Document();
+
+	/**
+	 * Parse the JSON text from @p begin to @p end, replacing what the
+	 * document held before. Returns false (and sets error()) if it is
+	 * not valid JSON, nests too deeply or has a number too large for
+	 * a double.
+	 */
+	bool parse(const char* begin, const char* end);
+
+	const Node& root() const { return m_root; }
+	const std::string& error() const { return m_error; }
+} ;
+
+}  // namespace JSON
+}  // namespace Steamworks
+
+#endif
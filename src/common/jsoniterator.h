@@ -13,139 +13,183 @@ Adriaan de Groot <groot@kde.org>
  * Taking each attribute $a$ as a set of attribute-values
  * $A_a$, produces the cartesian product $A_{a1} \cross A_{a2} .. $
  * as a list.
+ *
+ * Attribute names are looked up case-insensitively. Rather than
+ * comparing every wanted name with every attribute of every
+ * object, the wanted names are interned once in an AttributeIndex,
+ * which gives each (case-folded) name a slot number. An object is
+ * then resolved into its values per slot in a single pass, and
+ * the MultiIterator picks its dimensions from there by slot.
  */
 #ifndef STEAMWORKS_COMMON_JSONITERATOR_H
 #define STEAMWORKS_COMMON_JSONITERATOR_H
 
 #include <picojson.h>
-#include "logger.h"
 
-class MultiIterator
+#include <ctype.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class AttributeIndex
 {
 public:
-	using inner_value_t = std::string;
-	using value_t = std::vector<inner_value_t>;
+	using slot_t = unsigned int;
+	using values_t = std::vector<const picojson::value*>;
 
 private:
-	using inner_list_t = std::forward_list<inner_value_t>;
-	using inner_iterator = inner_list_t::const_iterator;
-	using outer_list_t = std::vector<inner_list_t>;
-	using outer_iterator = outer_list_t::const_iterator;
+	std::unordered_map<std::string, slot_t> m_slots;
+	std::string m_folded;  // Scratch space for folding names in resolve()
 
-	std::vector<bool> m_listy;  // Is the thing in each position list-ish, or a constanct value?
-	value_t m_constants;
-	std::vector<picojson::array::const_iterator> m_begins, m_ends, m_iter;
-	size_t m_size;
-	bool m_firstly;  // Just in case all dimensions are constants, do at least once.
+	static void fold(const std::string& name, std::string& folded)
+	{
+		folded.assign(name);
+		for (auto& c : folded)
+		{
+			c = tolower((unsigned char)c);
+		}
+	}
 
 public:
-	MultiIterator(const picojson::object& object, const std::vector<std::string>& names) :
-		m_listy(names.size()),
-		m_constants(names.size()),
-		m_begins(names.size()),
-		m_ends(names.size()),
-		m_iter(names.size()),
-		m_size(names.size()),
-		m_firstly(true)
+	/**
+	 * Return the slot for attribute @p name, adding it to the
+	 * index if it is new. Names that differ only in case share
+	 * a slot.
+	 */
+	slot_t intern(const std::string& name)
 	{
-		// auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		std::string folded;
+		fold(name, folded);
+		auto r = m_slots.emplace(folded, m_slots.size());
+		return r.first->second;
+	}
 
-		unsigned int nameindex = 0;
-		for (const auto& f : names)
-		{
-			std::string object_name;  // Attribute name (case-insensitive) in object
-			// log.debugStream() << "MultiIterator using dimension " << nameindex << ' ' << f;
+	/** Number of slots (distinct names) in the index. */
+	size_t size() const { return m_slots.size(); }
 
-			// Look up (case-insensitive) the name actually used in the object
-			for (const auto& attrname : object)
+	/**
+	 * Look up the values in @p object for all the slots, storing
+	 * them in @p values indexed by slot; slots for attributes that
+	 * do not occur in the object get a nullptr. The pointers are
+	 * valid as long as @p object is.
+	 */
+	void resolve(const picojson::object& object, values_t& values)
+	{
+		values.assign(m_slots.size(), nullptr);
+		for (const auto& attr : object)
+		{
+			fold(attr.first, m_folded);
+			auto it = m_slots.find(m_folded);
+			if (it != m_slots.end())
 			{
-				if (strcasecmp(f.c_str(), attrname.first.c_str()) == 0)
-				{
-					object_name = attrname.first;
-				}
+				values[it->second] = &attr.second;
 			}
+		}
+	}
+} ;
 
-			// log.debugStream() << "  .. attr " << object_name;
-			if (object_name.empty())
-			{
-				// Not mapped
-				m_listy[nameindex] = false;
-				m_constants[nameindex] = std::string();
-				continue;
-			}
+/**
+ * Iterates over the tuples of values for a list of slots (from
+ * an AttributeIndex) in an object that was resolved with that
+ * index. Each tuple is delivered as an array of @p Blob views
+ * (with members data and size) into the strings in the object,
+ * so nothing is copied; the views are valid as long as the
+ * object is.
+ *
+ * A slot that does not occur in the object yields an empty
+ * value, an array yields each of its elements in turn and an
+ * empty array yields no tuples at all.
+ */
+template<typename Blob> class MultiIterator
+{
+private:
+	using value_iterator = picojson::array::const_iterator;
 
-			const picojson::value& v = object.at(object_name);
-			// log.debugStream() << "  .. val " << v.to_str();
+	struct Dimension
+	{
+		const std::string* constant;  // nullptr for list-ish values
+		value_iterator begin, end, iter;
+	} ;
 
-			if (v.is<picojson::array>())
+	std::vector<Dimension> m_dimensions;
+	bool m_done;
+
+	static const std::string* string_of(const picojson::value& v)
+	{
+		static const std::string empty;
+		return v.is<std::string>() ? &v.get<std::string>() : &empty;
+	}
+
+public:
+	MultiIterator(const AttributeIndex::values_t& values, const std::vector<AttributeIndex::slot_t>& slots) :
+		m_dimensions(slots.size()),
+		m_done(false)
+	{
+		static const picojson::value null_value;
+
+		unsigned int index = 0;
+		for (auto slot : slots)
+		{
+			const picojson::value* v = values.at(slot);
+			Dimension& d = m_dimensions[index++];
+			if (v && v->is<picojson::array>())
 			{
-				const picojson::array& vv = v.get<picojson::array>();
-				m_listy[nameindex] = true;
-				// Skip m_constantsp[nameindex]
-				m_begins[nameindex] = vv.begin();
-				m_iter[nameindex] = vv.begin();
-				m_ends[nameindex] = vv.end();
+				const picojson::array& vv = v->get<picojson::array>();
+				d.constant = nullptr;
+				d.begin = d.iter = vv.begin();
+				d.end = vv.end();
+				if (d.begin == d.end)
+				{
+					m_done = true;
+				}
 			}
 			else
 			{
-				m_listy[nameindex] = false;
-				m_constants[nameindex] = v.get<std::string>();
+				d.constant = string_of(v ? *v : null_value);
 			}
-			nameindex++;
 		}
 	}
 
-	bool is_done() const
+	bool is_done() const { return m_done; }
+
+	/**
+	 * Store the next tuple in @p blobs, which must have room for
+	 * one Blob per slot, and advance. Returns false, leaving
+	 * @p blobs alone, when all the tuples have been delivered.
+	 */
+	bool next(Blob* blobs)
 	{
-		if (m_firstly)
+		if (m_done)
 		{
 			return false;
 		}
 
-		for (unsigned int i = 0; i<m_size; i++)
+		unsigned int i = 0;
+		for (const auto& d : m_dimensions)
 		{
-			if (m_listy[i] && (m_iter[i] != m_ends[i]))
-			{
-				return false;
-			}
+			const std::string* s = d.constant ? d.constant : string_of(*d.iter);
+			blobs[i].data = (void *)s->data();
+			blobs[i].size = s->length();
+			i++;
 		}
-		return true;
-	}
 
-	value_t next()
-	{
-		if (is_done())
+		// Advance like an odometer; done when every dimension wraps.
+		m_done = true;
+		for (auto& d : m_dimensions)
 		{
-			return value_t();
-		}
-
-		m_firstly = false;
-
-		value_t v;
-		for (unsigned int i = 0; i<m_size; i++)
-		{
-			if (m_listy[i])
+			if (d.constant)
 			{
-				if (m_iter[i] == m_ends[i])
-				{
-					m_iter[i] = m_begins[i];
-				}
-				v.push_back((*m_iter[i]).get<std::string>());
-			}
-			else
-			{
-				v.push_back(m_constants[i]);
+				continue;
 			}
-		}
-
-		for (unsigned int i = 0; i<m_size; i++)
-		{
-			if (m_listy[i] && (++m_iter[i] != m_ends[i]))
+			if (++d.iter != d.end)
 			{
+				m_done = false;
 				break;
 			}
+			d.iter = d.begin;
 		}
-		return v;
+		return true;
 	}
 } ;
 
@@ -9,7 +9,7 @@ Adriaan de Groot <groot@kde.org>
 
 #include <string>
 
-void SteamWorks::JSON::simple_output(SteamWorks::JSON::Object response, int status, const char* message, const int err)
+void SteamWorks::JSON::simple_output(SteamWorks::JSON::Object& response, int status, const char* message, const int err)
 {
 	if (status)
 	{
@@ -21,7 +21,7 @@ void SteamWorks::JSON::simple_output(SteamWorks::JSON::Object response, int stat
 		picojson::value msg_v{std::string(message)};
 		response.emplace(std::string("message"), msg_v);
 	}
-	if (errno)
+	if (err)
 	{
 		picojson::value errno_v{static_cast<double>(err)};
 		response.emplace(std::string("errno"), errno_v);
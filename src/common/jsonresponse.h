@@ -25,7 +25,7 @@ using Object = picojson::value::object;
 	*
 	* @see simple_output in fcgi.cpp
 	*/
-void simple_output(Object response, int status, const char* message=nullptr, const int err=0);
+void simple_output(Object& response, int status, const char* message=nullptr, const int err=0);
 
 }  // namespace JSON
 }  // namespace Steamworks
@@ -0,0 +1,230 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "jsonwriter.h"
+
+#include "cbor.h"
+
+#include <iterator>
+
+SteamWorks::JSON::Writer::Writer(const sink_t& sink, size_t chunk, Encoding encoding) :
+	m_sink(sink),
+	m_encoding(encoding),
+	m_chunk(chunk),
+	m_after_key(false),
+	m_failed(false)
+{
+	m_buffer.reserve(chunk);
+}
+
+SteamWorks::JSON::Writer::~Writer()
+{
+	flush();
+}
+
+void SteamWorks::JSON::Writer::separate()
+{
+	if (m_after_key)
+	{
+		m_after_key = false;
+		return;
+	}
+	if (m_encoding == Encoding::CBOR)
+	{
+		return;
+	}
+	if (!m_first.empty())
+	{
+		if (!m_first.back())
+		{
+			m_buffer.push_back(',');
+		}
+		m_first.back() = false;
+	}
+}
+
+void SteamWorks::JSON::Writer::opened(char c)
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		if (c == '{')
+		{
+			CBOR::put_begin_map(m_buffer);
+		}
+		else
+		{
+			CBOR::put_begin_array(m_buffer);
+		}
+	}
+	else
+	{
+		m_buffer.push_back(c);
+	}
+	m_first.push_back(true);
+}
+
+void SteamWorks::JSON::Writer::closed(char c)
+{
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_break(m_buffer);
+	}
+	else
+	{
+		m_buffer.push_back(c);
+	}
+	if (!m_first.empty())
+	{
+		m_first.pop_back();
+	}
+	wrote();
+}
+
+void SteamWorks::JSON::Writer::wrote()
+{
+	if (m_buffer.size() >= m_chunk)
+	{
+		flush();
+	}
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::begin_object()
+{
+	opened('{');
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::end_object()
+{
+	closed('}');
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::begin_array()
+{
+	opened('[');
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::end_array()
+{
+	closed(']');
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::key(const std::string& k)
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_string(m_buffer, k);
+	}
+	else
+	{
+		picojson::serialize_str(k, std::back_inserter(m_buffer));
+		m_buffer.push_back(':');
+	}
+	m_after_key = true;
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::value(const std::string& s)
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_string(m_buffer, s);
+	}
+	else
+	{
+		picojson::serialize_str(s, std::back_inserter(m_buffer));
+	}
+	wrote();
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::value(const char* s)
+{
+	return value(std::string(s ? s : ""));
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::value(double d)
+{
+	if (m_encoding == Encoding::CBOR)
+	{
+		separate();
+		CBOR::put_number(m_buffer, d);
+		wrote();
+		return *this;
+	}
+	return value(picojson::value(d));
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::value(bool b)
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_bool(m_buffer, b);
+	}
+	else
+	{
+		m_buffer.append(b ? "true" : "false");
+	}
+	wrote();
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::null()
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_null(m_buffer);
+	}
+	else
+	{
+		m_buffer.append("null");
+	}
+	wrote();
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::value(const picojson::value& v)
+{
+	separate();
+	if (m_encoding == Encoding::CBOR)
+	{
+		CBOR::put_value(m_buffer, v);
+	}
+	else
+	{
+		v.serialize(std::back_inserter(m_buffer));
+	}
+	wrote();
+	return *this;
+}
+
+SteamWorks::JSON::Writer& SteamWorks::JSON::Writer::members(const picojson::value::object& o)
+{
+	for (const auto& kv : o)
+	{
+		key(kv.first).value(kv.second);
+	}
+	return *this;
+}
+
+bool SteamWorks::JSON::Writer::flush()
+{
+	if (!m_failed && !m_buffer.empty())
+	{
+		m_failed = !m_sink(m_buffer.data(), m_buffer.size());
+	}
+	m_buffer.clear();
+	return !m_failed;
+}
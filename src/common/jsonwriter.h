@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Streaming JSON output. Rather than building a picojson value for a
+ * whole response and serializing that into one string, a Writer
+ * serializes as it goes into a buffer, and hands the buffer to a sink
+ * (e.g. an FCGI output stream) in chunks. Output is compact, not
+ * pretty-printed.
+ *
+ *     JSON::Writer out(sink);
+ *     out.begin_object();
+ *     out.key("count").value(2.0);
+ *     out.key("items").begin_array().value("a").value("b").end_array();
+ *     out.end_object();
+ *
+ * Commas and colons are put in by the writer; it does not check that
+ * the calls make sense (e.g. that a key is given for every member).
+ *
+ * With Encoding::CBOR the same calls write CBOR instead (see cbor.h);
+ * objects and arrays are then of indefinite length.
+ */
+#ifndef STEAMWORKS_COMMON_JSONWRITER_H
+#define STEAMWORKS_COMMON_JSONWRITER_H
+
+#include "picojson.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace SteamWorks
+{
+namespace JSON
+{
+
+class Writer
+{
+public:
+	/// Takes @p len bytes of output at @p data; returns false on failure.
+	using sink_t = std::function<bool(const char* data, size_t len)>;
+	enum class Encoding { JSON, CBOR };
+
+private:
+	sink_t m_sink;
+	Encoding m_encoding;
+	std::string m_buffer;
+	size_t m_chunk;
+	std::vector<bool> m_first;  // Per open object or array: nothing in it yet
+	bool m_after_key;
+	bool m_failed;
+
+	void separate();
+	void opened(char c);
+	void closed(char c);
+	void wrote();
+
+public:
+	/**
+	 * Writer to @p sink, which gets output whenever at least
+	 * @p chunk bytes have been buffered (and on flush()).
+	 */
+	Writer(const sink_t& sink, size_t chunk=16384, Encoding encoding=Encoding::JSON);
+	/// Flushes what is left.
+	~Writer();
+
+	Writer& begin_object();
+	Writer& end_object();
+	Writer& begin_array();
+	Writer& end_array();
+
+	/// Key of the next member of an object; follow with a value.
+	Writer& key(const std::string& k);
+
+	Writer& value(const std::string& s);
+	Writer& value(const char* s);
+	Writer& value(double d);
+	Writer& value(bool b);
+	Writer& null();
+	/// Any picojson value, e.g. an object that was built already.
+	Writer& value(const picojson::value& v);
+	/// Writes all the members of @p o into the open object.
+	Writer& members(const picojson::value::object& o);
+
+	/// Pass the buffered output to the sink; returns false if the sink failed.
+	bool flush();
+	/// True if the sink failed; further output is dropped.
+	bool failed() const { return m_failed; }
+	Encoding encoding() const { return m_encoding; }
+} ;
+
+}  // namespace JSON
+}  // namespace Steamworks
+
+#endif
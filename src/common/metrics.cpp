@@ -0,0 +1,140 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "metrics.h"
+
+#include "verb.h"
+
+using SteamWorks::FCGI::Metrics;
+namespace Sharded = SteamWorks::Sharded;
+
+namespace
+{
+
+struct Shard
+{
+	Sharded::Counter requests[Metrics::num_slots];
+	Sharded::Counter errors[Metrics::num_slots];
+	Sharded::Counter bytes_in[Metrics::num_slots];
+	Sharded::Counter bytes_out[Metrics::num_slots];
+	Sharded::Histogram latency[Metrics::num_slots][Metrics::num_phases];
+} ;
+
+// Static, so zero-initialized
+Sharded::Counters<Shard> shards;
+
+}  // namespace
+
+const char* Metrics::phase_name(unsigned int phase)
+{
+	static const char* const names[num_phases] = { "parse", "dispatch", "serialize" };
+	return phase < num_phases ? names[phase] : "unknown";
+}
+
+unsigned int Metrics::slot(const std::string& verb, const VerbDispatcher* dispatcher)
+{
+	if (verb == "batch")
+	{
+		return BatchSlot;
+	}
+	if (verb == "metrics")
+	{
+		return MetricsSlot;
+	}
+	int i = dispatcher ? dispatcher->verb_index(verb) : -1;
+	return ((i >= 0) && (FirstVerbSlot + i < num_slots)) ? FirstVerbSlot + i : OtherSlot;
+}
+
+const char* Metrics::slot_name(unsigned int slot, const VerbDispatcher* dispatcher)
+{
+	static const char* const names[FirstVerbSlot] = { "other", "batch", "metrics" };
+	if (slot < FirstVerbSlot)
+	{
+		return names[slot];
+	}
+	return dispatcher ? dispatcher->verb_name(slot - FirstVerbSlot) : nullptr;
+}
+
+void Metrics::record(unsigned int slot, bool error, uint64_t bytes_in, uint64_t bytes_out)
+{
+	Shard& s = shards.local();
+	s.requests[slot].add(1);
+	if (error)
+	{
+		s.errors[slot].add(1);
+	}
+	s.bytes_in[slot].add(bytes_in);
+	s.bytes_out[slot].add(bytes_out);
+}
+
+void Metrics::record_phase(unsigned int slot, Phase phase, uint64_t nanoseconds)
+{
+	shards.local().latency[slot][phase].record(nanoseconds);
+}
+
+void Metrics::snapshot(Snapshot& snap)
+{
+	snap = Snapshot();
+	for (unsigned int i = 0; i < Sharded::num_shards; i++)
+	{
+		const Shard& s = shards[i];
+		for (unsigned int slot = 0; slot < num_slots; slot++)
+		{
+			snap.requests[slot] += s.requests[slot].load();
+			snap.errors[slot] += s.errors[slot].load();
+			snap.bytes_in[slot] += s.bytes_in[slot].load();
+			snap.bytes_out[slot] += s.bytes_out[slot].load();
+			for (unsigned int p = 0; p < num_phases; p++)
+			{
+				snap.latency[slot][p].add(s.latency[slot][p]);
+			}
+		}
+	}
+}
+
+void Metrics::write_prometheus(std::ostream& out, const Snapshot& snap, const VerbDispatcher* dispatcher)
+{
+	static const char* const counters[][2] =
+	{
+		{ "steamworks_requests_total", "FCGI requests." },
+		{ "steamworks_request_errors_total", "FCGI requests that failed." },
+		{ "steamworks_request_bytes_total", "Bytes of request data." },
+		{ "steamworks_response_bytes_total", "Bytes of response data." },
+	} ;
+
+	// Verb names are plain identifiers, no need to escape them
+	for (unsigned int c = 0; c < 4; c++)
+	{
+		out << "# HELP " << counters[c][0] << ' ' << counters[c][1] << '\n';
+		out << "# TYPE " << counters[c][0] << " counter\n";
+		const uint64_t* values = (c == 0) ? snap.requests : (c == 1) ? snap.errors : (c == 2) ? snap.bytes_in : snap.bytes_out;
+		for (unsigned int slot = 0; slot < num_slots; slot++)
+		{
+			const char* verb = slot_name(slot, dispatcher);
+			if (verb)
+			{
+				out << counters[c][0] << "{verb=\"" << verb << "\"} " << values[slot] << '\n';
+			}
+		}
+	}
+
+	out << "# HELP steamworks_request_seconds Time spent in each phase of handling FCGI requests.\n";
+	out << "# TYPE steamworks_request_seconds histogram\n";
+	for (unsigned int slot = 0; slot < num_slots; slot++)
+	{
+		const char* verb = slot_name(slot, dispatcher);
+		if (!verb)
+		{
+			continue;
+		}
+		for (unsigned int p = 0; p < num_phases; p++)
+		{
+			std::string labels = std::string("verb=\"") + verb + "\",phase=\"" + phase_name(p) + '"';
+			Sharded::write_prometheus(out, "steamworks_request_seconds", labels, snap.latency[slot][p]);
+		}
+	}
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Counters and latency histograms of the FCGI requests, per verb: how
+ * many there were, how many failed, how many bytes came in and went out,
+ * and how long reading and parsing the request, running the verb and
+ * writing the response took.
+ *
+ * Verbs are counted in slots: a few for the verbs that every component
+ * has (and requests without a known verb), then one per verb in the
+ * order of the dispatcher's VerbTable (see VerbDispatcher::verb_index()).
+ * The counters are sharded, see sharded.h.
+ */
+#ifndef STEAMWORKS_COMMON_METRICS_H
+#define STEAMWORKS_COMMON_METRICS_H
+
+#include "sharded.h"
+
+#include <ostream>
+#include <string>
+#include <stdint.h>
+
+class VerbDispatcher;
+
+namespace SteamWorks
+{
+
+namespace FCGI
+{
+
+class Metrics
+{
+public:
+	enum Phase { Parse = 0, Dispatch, Serialize };
+	enum : unsigned int
+	{
+		num_phases = 3,
+		num_slots = 32
+	} ;
+	/// Slots of requests with no known verb, and of the built-in verbs
+	enum Slot : unsigned int { OtherSlot = 0, BatchSlot, MetricsSlot, FirstVerbSlot } ;
+
+	struct Snapshot
+	{
+		uint64_t requests[num_slots];
+		uint64_t errors[num_slots];
+		uint64_t bytes_in[num_slots];
+		uint64_t bytes_out[num_slots];
+		Sharded::Histogram::Snapshot latency[num_slots][num_phases];
+	} ;
+
+	static const char* phase_name(unsigned int phase);
+
+	/**
+	 * Slot for @p verb: one of the built-in ones, or the slot of the
+	 * verb's index in @p dispatcher; OtherSlot if the verb is unknown or
+	 * there are no slots left.
+	 */
+	static unsigned int slot(const std::string& verb, const VerbDispatcher* dispatcher);
+	/** Name of the verb counted in @p slot, or nullptr if there is none. */
+	static const char* slot_name(unsigned int slot, const VerbDispatcher* dispatcher);
+
+	static void record(unsigned int slot, bool error, uint64_t bytes_in, uint64_t bytes_out);
+	static void record_phase(unsigned int slot, Phase phase, uint64_t nanoseconds);
+
+	static void snapshot(Snapshot& snap);
+
+	/** Writes @p snap in the Prometheus text format. */
+	static void write_prometheus(std::ostream& out, const Snapshot& snap, const VerbDispatcher* dispatcher);
+} ;
+
+}  // namespace FCGI
+}  // namespace SteamWorks
+
+#endif
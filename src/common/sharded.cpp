@@ -0,0 +1,78 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "sharded.h"
+
+#include <stdio.h>
+
+unsigned int SteamWorks::Sharded::shard()
+{
+	static std::atomic<unsigned int> next_shard(0);
+	static thread_local unsigned int shard = next_shard++ % num_shards;
+	return shard;
+}
+
+uint64_t SteamWorks::Sharded::bucket_bound(unsigned int i)
+{
+	return (i + 1 < num_buckets) ? (uint64_t(1) << (2 * i)) : 0;
+}
+
+void SteamWorks::Sharded::Histogram::record(uint64_t ns)
+{
+	nanoseconds.fetch_add(ns, std::memory_order_relaxed);
+
+	unsigned int bucket = 0;
+	uint64_t microseconds = ns / 1000;
+	while ((bucket + 1 < num_buckets) && (microseconds > bucket_bound(bucket)))
+	{
+		bucket++;
+	}
+	buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void SteamWorks::Sharded::Histogram::Snapshot::add(const Histogram& h)
+{
+	nanoseconds += h.nanoseconds.load(std::memory_order_relaxed);
+	for (unsigned int b = 0; b < num_buckets; b++)
+	{
+		buckets[b] += h.buckets[b].load(std::memory_order_relaxed);
+	}
+}
+
+uint64_t SteamWorks::Sharded::Histogram::Snapshot::count() const
+{
+	uint64_t n = 0;
+	for (unsigned int b = 0; b < num_buckets; b++)
+	{
+		n += buckets[b];
+	}
+	return n;
+}
+
+void SteamWorks::Sharded::write_prometheus(std::ostream& out, const char* name, const std::string& labels, const Histogram::Snapshot& h)
+{
+	uint64_t cumulative = 0;
+	for (unsigned int b = 0; b < num_buckets; b++)
+	{
+		cumulative += h.buckets[b];
+		out << name << "_bucket{" << labels;
+		if (bucket_bound(b))
+		{
+			char le[32];
+			snprintf(le, sizeof(le), "%g", bucket_bound(b) / 1e6);
+			out << ",le=\"" << le << "\"} " << cumulative << '\n';
+		}
+		else
+		{
+			out << ",le=\"+Inf\"} " << cumulative << '\n';
+		}
+	}
+	char sum[32];
+	snprintf(sum, sizeof(sum), "%.9f", h.nanoseconds / 1e9);
+	out << name << "_sum{" << labels << "} " << sum << '\n';
+	out << name << "_count{" << labels << "} " << cumulative << '\n';
+}
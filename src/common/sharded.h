@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Sharded counters and latency histograms, for statistics that are
+ * updated from many threads at once (e.g. the FCGI request metrics and
+ * the Pulley backend statistics).
+ *
+ * Counters are relaxed atomics, kept in a few shards; each thread adds
+ * to its own shard, so there are no locks and little contention, and
+ * a snapshot sums the shards. The counters in a shard are a struct of
+ * Counter and Histogram members:
+ *
+ *     struct Shard { Sharded::Counter calls[4]; Sharded::Histogram latency[4]; } ;
+ *     Sharded::Counters<Shard> counters;  // Static, or value-initialized
+ *
+ *     counters.local().calls[op].add(1);
+ */
+#ifndef STEAMWORKS_COMMON_SHARDED_H
+#define STEAMWORKS_COMMON_SHARDED_H
+
+#include <atomic>
+#include <ostream>
+#include <string>
+#include <stdint.h>
+
+namespace SteamWorks
+{
+
+namespace Sharded
+{
+
+enum : unsigned int
+{
+	num_shards = 8,
+	num_buckets = 12  // Latency up to 4^i microseconds, the last unbounded
+} ;
+
+/** Shard of the calling thread; threads are spread over the shards in turn. */
+unsigned int shard();
+
+/** Upper bound of latency bucket @p i in microseconds, 0 for the last. */
+uint64_t bucket_bound(unsigned int i);
+
+struct Counter
+{
+	std::atomic<uint64_t> value;
+
+	void add(uint64_t n) { value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t load() const { return value.load(std::memory_order_relaxed); }
+} ;
+
+struct Histogram
+{
+	struct Snapshot
+	{
+		uint64_t nanoseconds;
+		uint64_t buckets[num_buckets];  // Not cumulative
+
+		void add(const Histogram& h);
+		/** Number of samples, i.e. the sum of the buckets. */
+		uint64_t count() const;
+	} ;
+
+	std::atomic<uint64_t> nanoseconds;
+	std::atomic<uint64_t> buckets[num_buckets];
+
+	void record(uint64_t nanoseconds);
+} ;
+
+/**
+ * The shards of counters @p Shard. Like the atomics in them, they are
+ * zero only if static or value-initialized.
+ */
+template<typename Shard> class Counters
+{
+private:
+	Shard m_shards[num_shards];
+
+public:
+	Shard& local() { return m_shards[shard()]; }
+	const Shard& operator[](unsigned int i) const { return m_shards[i]; }
+} ;
+
+/**
+ * Writes the series of histogram @p name with @p labels (such as
+ * `verb="search"`, already escaped) in the Prometheus text format.
+ * The HELP and TYPE lines are left to the caller.
+ */
+void write_prometheus(std::ostream& out, const char* name, const std::string& labels, const Histogram::Snapshot& h);
+
+}  // namespace Sharded
+}  // namespace SteamWorks
+
+#endif
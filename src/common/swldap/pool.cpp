@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "pool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+class SteamWorks::LDAP::ConnectionPool::Private
+{
+friend class SteamWorks::LDAP::ConnectionPool;
+
+private:
+	std::string m_uri;
+	std::string m_user, m_pass;
+	unsigned int m_size;
+
+	std::mutex m_mutex;
+	std::condition_variable m_released;
+	// Protected by m_mutex
+	std::vector<ConnectionUPtr> m_idle;
+	unsigned int m_count;  // Idle and leased connections
+
+public:
+	Private(const std::string& uri, const std::string& user, const std::string& pass, unsigned int size) :
+		m_uri(uri),
+		m_user(user),
+		m_pass(pass),
+		m_size(size ? size : 1),
+		m_count(0)
+	{
+	}
+
+	ConnectionUPtr take()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_released.wait(lock, [this]{ return !m_idle.empty() || (m_count < m_size); });
+		if (!m_idle.empty())
+		{
+			ConnectionUPtr connection(std::move(m_idle.back()));
+			m_idle.pop_back();
+			return connection;
+		}
+		unsigned int count = ++m_count;
+		lock.unlock();
+
+		SteamWorks::Logging::getLogger("steamworks.ldap").debugStream() << "LDAP pool connection " << count << " of " << m_size;
+		return open();
+	}
+
+	ConnectionUPtr open() const
+	{
+		if (!(m_user.empty() || m_pass.empty()))
+		{
+			return ConnectionUPtr(new Connection(m_uri, m_user, m_pass));
+		}
+		return ConnectionUPtr(new Connection(m_uri));
+	}
+
+	void give(ConnectionUPtr&& connection)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (connection->is_valid())
+			{
+				m_idle.push_back(std::move(connection));
+			}
+			else
+			{
+				m_count--;
+			}
+		}
+		m_released.notify_one();
+		// A failed connection is dropped here, outside the lock
+	}
+
+	void add(ConnectionUPtr&& connection)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_idle.push_back(std::move(connection));
+		m_count++;
+	}
+} ;
+
+SteamWorks::LDAP::ConnectionPool::Lease::Lease(const std::shared_ptr<Private>& pool, ConnectionUPtr&& connection) :
+	m_pool(pool),
+	m_connection(std::move(connection))
+{
+}
+
+SteamWorks::LDAP::ConnectionPool::Lease::~Lease()
+{
+	if (m_pool && m_connection)
+	{
+		m_pool->give(std::move(m_connection));
+	}
+}
+
+SteamWorks::LDAP::ConnectionPool::ConnectionPool(const std::string& uri, const std::string& user, const std::string& password, unsigned int size) :
+	d(std::make_shared<Private>(uri, user, password, size))
+{
+}
+
+SteamWorks::LDAP::ConnectionPool::~ConnectionPool()
+{
+}
+
+void SteamWorks::LDAP::ConnectionPool::add(ConnectionUPtr&& connection)
+{
+	if (connection)
+	{
+		d->add(std::move(connection));
+	}
+}
+
+SteamWorks::LDAP::ConnectionPool::Lease SteamWorks::LDAP::ConnectionPool::acquire()
+{
+	return Lease(d, d->take());
+}
+
+SteamWorks::LDAP::ConnectionUPtr SteamWorks::LDAP::ConnectionPool::connect() const
+{
+	return d->open();
+}
+
+unsigned int SteamWorks::LDAP::ConnectionPool::size() const { return d->m_size; }
+std::string SteamWorks::LDAP::ConnectionPool::get_uri() const { return d->m_uri; }
@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * LDAP operations in a C++ jacket.
+ *
+ * A pool of connections to one LDAP server, for handling requests in
+ * several threads at once: each thread leases a connection for as long
+ * as it needs one (e.g. for one search). Connections are made when they
+ * are first needed, up to the size of the pool; after that, acquire()
+ * waits for a lease to end.
+ */
+
+#ifndef SWLDAP_POOL_H
+#define SWLDAP_POOL_H
+
+#include <memory>
+#include <string>
+
+#include "connection.h"
+
+namespace SteamWorks
+{
+
+namespace LDAP
+{
+
+class ConnectionPool
+{
+private:
+	class Private;
+	std::shared_ptr<Private> d;
+
+public:
+	/**
+	 * Connection to the server, for the lifetime of the lease. A
+	 * lease may outlive the pool. Check is_valid() before use:
+	 * the connection may have failed.
+	 */
+	class Lease
+	{
+	friend class ConnectionPool;
+	private:
+		std::shared_ptr<Private> m_pool;
+		ConnectionUPtr m_connection;
+
+		Lease(const std::shared_ptr<Private>& pool, ConnectionUPtr&& connection);
+
+	public:
+		Lease(Lease&&) = default;
+		~Lease();
+
+		bool is_valid() const { return m_connection && m_connection->is_valid(); }
+		Connection& operator*() const { return *m_connection; }
+		Connection* operator->() const { return m_connection.get(); }
+	} ;
+
+	/**
+	 * Pool of at most @p size connections to @p uri, with simple
+	 * authentication if @p user and @p password are both given.
+	 */
+	ConnectionPool(const std::string& uri, const std::string& user, const std::string& password, unsigned int size);
+	~ConnectionPool();
+
+	/**
+	 * Adds an open @p connection to the server, e.g. the one that
+	 * was made to check that the server can be reached. It counts
+	 * towards the size of the pool.
+	 */
+	void add(ConnectionUPtr&& connection);
+
+	/**
+	 * Leases an idle connection, or a new one if there are fewer
+	 * than size() already; otherwise waits for a lease to end.
+	 * Failed connections are not returned to the pool.
+	 */
+	Lease acquire();
+
+	/**
+	 * Opens a connection to the server that is not part of the
+	 * pool, e.g. for a background job that should not keep
+	 * requests waiting for a lease. Check is_valid() before use.
+	 */
+	ConnectionUPtr connect() const;
+
+	unsigned int size() const;
+	std::string get_uri() const;
+} ;
+
+using ConnectionPoolSPtr = std::shared_ptr<SteamWorks::LDAP::ConnectionPool>;
+
+}  // namespace LDAP
+}  // namespace
+
+#endif
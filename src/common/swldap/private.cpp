@@ -43,7 +43,7 @@ void copy_entry(::LDAP* ldaphandle, ::LDAPMessage* entry, Result map)
 			v_array.reserve(values_len);
 			for (decltype(values_len) i=0; i<values_len; i++)
 			{
-				picojson::value v_attr(values[i]->bv_val);
+				picojson::value v_attr(std::string(values[i]->bv_val, values[i]->bv_len));
 				v_array.emplace_back(v_attr);
 			}
 			picojson::value v_attr(v_array);
@@ -52,7 +52,7 @@ void copy_entry(::LDAP* ldaphandle, ::LDAPMessage* entry, Result map)
 		else
 		{
 			// FIXME: decode ber-values
-			picojson::value v_attr(values[0]->bv_val);
+			picojson::value v_attr(std::string(values[0]->bv_val, values[0]->bv_len));
 			map->emplace(attr, v_attr);
 		}
 		ldap_value_free_len(values);
@@ -100,5 +100,65 @@ void copy_search_result(::LDAP* ldaphandle, ::LDAPMessage* res, Result results,
 	log.infoStream() << " .. search OK.";
 }
 
+void write_entry(::LDAP* ldaphandle, ::LDAPMessage* entry, JSON::Writer& out)
+{
+	BerElement* berp(nullptr);
+	char *attr = ldap_first_attribute(ldaphandle, entry, &berp);
+
+	while (attr != nullptr)
+	{
+		berval** values = ldap_get_values_len(ldaphandle, entry, attr);
+		auto values_len = ldap_count_values_len(values);
+		out.key(attr);
+		if (values_len == 0)
+		{
+			out.null();
+		}
+		else if (values_len > 1)
+		{
+			// FIXME: decode ber-values
+			out.begin_array();
+			for (decltype(values_len) i=0; i<values_len; i++)
+			{
+				out.value(std::string(values[i]->bv_val, values[i]->bv_len));
+			}
+			out.end_array();
+		}
+		else
+		{
+			// FIXME: decode ber-values
+			out.value(std::string(values[0]->bv_val, values[0]->bv_len));
+		}
+		ldap_value_free_len(values);
+		attr = ldap_next_attribute(ldaphandle, entry, berp);
+	}
+
+	if (berp)
+	{
+		ber_free(berp, 0);
+	}
+}
+
+void write_search_result(::LDAP* ldaphandle, ::LDAPMessage* res, JSON::Writer& out, SteamWorks::Logging::Logger& log)
+{
+	log.infoStream() << "Search message count=" << ldap_count_messages(ldaphandle, res);
+
+	LDAPMessage *entry = ldap_first_entry(ldaphandle, res);
+	while (entry != nullptr)
+	{
+		char* dn = ldap_get_dn(ldaphandle, entry);
+		log.debugStream() << " .. entry dn=" << dn;
+
+		out.key(dn).begin_object();
+		out.key("dn").value(dn);
+		write_entry(ldaphandle, entry, out);
+		out.end_object();
+		ldap_memfree(dn);
+
+		entry = ldap_next_entry(ldaphandle, entry);
+	}
+	log.infoStream() << " .. search OK.";
+}
+
 }  // namespace LDAP
 }  // namespace Steamworks
@@ -14,6 +14,7 @@ Adriaan de Groot <groot@kde.org>
 
 #include <string>
 
+#include "../jsonwriter.h"
 #include "../logger.h"
 #include "picojson.h"
 
@@ -39,6 +40,18 @@ void copy_entry(::LDAP* ldaphandle, ::LDAPMessage* entry, Result results);
  */
 void copy_search_result(::LDAP* ldaphandle, ::LDAPMessage* res, Result results, Logging::Logger& log);
 
+/**
+ * As copy_entry(), but write the attributes as members of the JSON
+ * object that is open in @p out.
+ */
+void write_entry(::LDAP* ldaphandle, ::LDAPMessage* entry, JSON::Writer& out);
+/**
+ * As copy_search_result(), but write each entry to @p out as it
+ * is found (as a member of the JSON object that is open there),
+ * without building a copy of the results first.
+ */
+void write_search_result(::LDAP* ldaphandle, ::LDAPMessage* res, JSON::Writer& out, Logging::Logger& log);
+
 }  // namespace LDAP
 }  // namespace Steamworks
 
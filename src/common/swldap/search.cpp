@@ -44,7 +44,7 @@ SteamWorks::LDAP::Search::~Search()
 {
 }
 
-void SteamWorks::LDAP::Search::execute(Connection& conn, Result results)
+::LDAPMessage* SteamWorks::LDAP::Search::search(Connection& conn)
 {
 	::LDAP* ldaphandle = handle(conn);
 
@@ -71,14 +71,99 @@ void SteamWorks::LDAP::Search::execute(Connection& conn, Result results)
 	{
 		log.errorStream() << "Search result " << r << " " << ldap_err2string(r);
 		ldap_msgfree(res);  // Should be freed regardless of the return value
+		return nullptr;
+	}
+	return res;
+}
+
+int SteamWorks::LDAP::Search::start(Connection& conn)
+{
+	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.ldap");
+
+	struct timeval tv;
+	tv.tv_sec = 2;
+	tv.tv_usec = 0;
+
+	int msgid = -1;
+	int r = ldap_search_ext(handle(conn),
+		d->base().c_str(),
+		d->scope(),
+		d->filter().c_str(),
+		nullptr,  // attrs
+		0,
+		server_controls(conn),
+		client_controls(conn),
+		&tv,
+		1024*1024,
+		&msgid);
+	if (r)
+	{
+		log.errorStream() << "Search start " << r << " " << ldap_err2string(r);
+		return -1;
+	}
+	return msgid;
+}
+
+void SteamWorks::LDAP::Search::finish(Connection& conn, int msgid, JSON::Writer& results)
+{
+	::LDAP* ldaphandle = handle(conn);
+
+	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.ldap");
+
+	if (msgid < 0)
+	{
 		return;
 	}
 
-	copy_search_result(ldaphandle, res, results, log);
+	struct timeval tv;
+	tv.tv_sec = 2;
+	tv.tv_usec = 0;
+
+	LDAPMessage* res = nullptr;
+	int r = ldap_result(ldaphandle, msgid, LDAP_MSG_ALL, &tv, &res);
+	if (r <= 0)
+	{
+		log.errorStream() << "Search result " << (r ? "failed" : "timed out") << " for message " << msgid;
+		ldap_msgfree(res);
+		ldap_abandon_ext(ldaphandle, msgid, server_controls(conn), client_controls(conn));
+		return;
+	}
+
+	int err = LDAP_SUCCESS;
+	r = ldap_parse_result(ldaphandle, res, &err, nullptr, nullptr, nullptr, nullptr, 0);
+	if (r || err)
+	{
+		log.errorStream() << "Search result " << (r ? r : err) << " " << ldap_err2string(r ? r : err);
+		ldap_msgfree(res);
+		return;
+	}
 
+	write_search_result(ldaphandle, res, results, log);
 	ldap_msgfree(res);
 }
 
+void SteamWorks::LDAP::Search::execute(Connection& conn, Result results)
+{
+	LDAPMessage* res = search(conn);
+	if (res)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.ldap");
+		copy_search_result(handle(conn), res, results, log);
+		ldap_msgfree(res);
+	}
+}
+
+void SteamWorks::LDAP::Search::execute(Connection& conn, JSON::Writer& results)
+{
+	LDAPMessage* res = search(conn);
+	if (res)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.ldap");
+		write_search_result(handle(conn), res, results, log);
+		ldap_msgfree(res);
+	}
+}
+
 
 
 
@@ -225,6 +310,38 @@ SteamWorks::LDAP::Update::Update(const picojson::value& json) :
 	}
 }
 
+SteamWorks::LDAP::Update::Update(const SteamWorks::JSON::Node& json) :
+	Action(false),
+	d(nullptr)
+{
+	if (!json.is_object())
+	{
+		return;
+	}
+
+	std::string dn = json.get("dn").to_str();
+	if (!dn.empty())
+	{
+		d.reset(new Private(dn));
+	}
+	else
+	{
+		return;  // no dn? remain invalid
+	}
+
+	if (json.size() > 1)  // "dn" plus one more
+	{
+		for (const auto& m : json)
+		{
+			if (!(m.key == "dn"))
+			{
+				d->update(m.key.str(), m.value.to_str());
+			}
+		}
+		m_valid = true;
+	}
+}
+
 SteamWorks::LDAP::Update::~Update()
 {
 }
@@ -267,6 +384,10 @@ SteamWorks::LDAP::Addition::Addition(const picojson::value& v): Update(v)
 {
 }
 
+SteamWorks::LDAP::Addition::Addition(const SteamWorks::JSON::Node& v): Update(v)
+{
+}
+
 
 void SteamWorks::LDAP::Addition::execute(Connection& conn, Result result)
 {
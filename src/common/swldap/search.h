@@ -18,6 +18,8 @@ Adriaan de Groot <groot@kde.org>
 
 #include <string>
 
+#include "../jsondom.h"
+#include "../jsonwriter.h"
 #include "../logger.h"
 #include "picojson.h"
 
@@ -39,11 +41,28 @@ class Search : public Action
 private:
 	class Private;
 	std::unique_ptr<Private> d;
+
+	::LDAPMessage* search(Connection&);
 public:
 	Search(const std::string& base, const std::string& filter, LDAPScope scope=ScopeSubtree);
 	~Search();
 
 	virtual void execute(Connection&, Result result=nullptr);
+	/**
+	 * As execute() above, but write the results as members of the
+	 * JSON object that is open in @p result, one entry at a time.
+	 */
+	void execute(Connection&, JSON::Writer& result);
+
+	/**
+	 * Pipelining: start() sends the search to the server without
+	 * waiting for the results, and returns its message id (or -1
+	 * if it could not be sent). finish() then waits for the results
+	 * of that message and writes them as execute() above does, so
+	 * several searches can be underway on one connection at once.
+	 */
+	int start(Connection&);
+	void finish(Connection&, int msgid, JSON::Writer& result);
 
 	typedef enum {
 		ScopeSubtree = LDAP_SCOPE_SUBTREE,
@@ -67,6 +86,7 @@ public:
 	Update(const std::string& dn);  // Empty update (not valid)
 	Update(const std::string& dn, const Attributes& attr);  // Update one attribute
 	Update(const picojson::value& json);  // Update multiple attributes
+	Update(const JSON::Node& json);  // The same, from a request document
 	~Update();
 
 	virtual void execute(Connection&, Result result=nullptr);
@@ -81,6 +101,7 @@ class Addition : public Update
 {
 public:
 	Addition(const picojson::value& v);
+	Addition(const JSON::Node& v);
 
 	virtual void execute(Connection&, Result result=nullptr);
 } ;
@@ -9,7 +9,11 @@ Adriaan de Groot <groot@kde.org>
 
 #include "private.h"
 
+#include <algorithm>
 #include <unordered_set>
+#include <vector>
+
+#include <ctype.h>
 
 SteamWorks::LDAP::APIInfo::APIInfo()
 {
@@ -199,11 +203,150 @@ private:
 	std::string m_objectclass;
 
 public:
+	Syntaxes m_syntaxes;
+
 	Private()
 	{
 	}
+
+	void parse_attribute_types(::LDAP* ldaphandle, LDAPMessage* res);
 } ;
 
+/**
+ * Split an attribute type description (RFC 4512 section 4.1.2) into
+ * tokens: parentheses, 'quoted strings' (without the quotes) and words.
+ */
+static std::vector<std::string> tokenize_description(const char* p, size_t len)
+{
+	std::vector<std::string> tokens;
+	const char* end = p + len;
+	while (p < end)
+	{
+		if (isspace((unsigned char)*p))
+		{
+			p++;
+		}
+		else if ((*p == '(') || (*p == ')'))
+		{
+			tokens.emplace_back(p++, 1);
+		}
+		else if (*p == '\'')
+		{
+			const char* q = std::find(++p, end, '\'');
+			tokens.emplace_back(p, q);
+			p = (q < end) ? q + 1 : end;
+		}
+		else
+		{
+			const char* q = p;
+			while ((q < end) && !isspace((unsigned char)*q) && (*q != '(') && (*q != ')'))
+			{
+				q++;
+			}
+			tokens.emplace_back(p, q);
+			p = q;
+		}
+	}
+	return tokens;
+}
+
+static std::string lower(std::string s)
+{
+	for (auto& c : s)
+	{
+		c = tolower((unsigned char)c);
+	}
+	return s;
+}
+
+void SteamWorks::LDAP::TypeInfo::Private::parse_attribute_types(::LDAP* ldaphandle, LDAPMessage* res)
+{
+	m_syntaxes.clear();
+	LDAPMessage* entry = ldap_first_entry(ldaphandle, res);
+	if (!entry)
+	{
+		return;
+	}
+	berval** values = ldap_get_values_len(ldaphandle, entry, "attributeTypes");
+	if (!values)
+	{
+		return;
+	}
+
+	// Name (lower case) to its SUP type, for attributes without a SYNTAX
+	std::unordered_map<std::string, std::string> supertypes;
+
+	auto count = ldap_count_values_len(values);
+	for (decltype(count) i=0; i<count; i++)
+	{
+		auto tokens = tokenize_description(values[i]->bv_val, values[i]->bv_len);
+		std::vector<std::string> names;
+		std::string syntax, sup;
+		for (size_t t = 0; t < tokens.size(); t++)
+		{
+			if ((tokens[t] == "NAME") && (t + 1 < tokens.size()))
+			{
+				if (tokens[t+1] == "(")
+				{
+					for (t += 2; (t < tokens.size()) && (tokens[t] != ")"); t++)
+					{
+						names.push_back(lower(tokens[t]));
+					}
+				}
+				else
+				{
+					names.push_back(lower(tokens[++t]));
+				}
+			}
+			else if ((tokens[t] == "SYNTAX") && (t + 1 < tokens.size()))
+			{
+				// Drop the length bound, as in 1.3.6.1.4.1.1466.115.121.1.15{32768}
+				const std::string& noidlen = tokens[++t];
+				syntax = noidlen.substr(0, noidlen.find('{'));
+			}
+			else if ((tokens[t] == "SUP") && (t + 1 < tokens.size()))
+			{
+				sup = lower(tokens[++t]);
+			}
+		}
+
+		for (const auto& name : names)
+		{
+			if (!syntax.empty())
+			{
+				m_syntaxes[name] = syntax;
+			}
+			else if (!sup.empty())
+			{
+				supertypes[name] = sup;
+			}
+		}
+	}
+	ldap_value_free_len(values);
+
+	// Inherit syntaxes from supertypes, which may themselves inherit;
+	// the depth bound stops cycles in broken schemas.
+	for (const auto& st : supertypes)
+	{
+		std::string sup = st.second;
+		for (int depth = 0; depth < 16; depth++)
+		{
+			auto it = m_syntaxes.find(sup);
+			if (it != m_syntaxes.end())
+			{
+				m_syntaxes[st.first] = it->second;
+				break;
+			}
+			auto up = supertypes.find(sup);
+			if (up == supertypes.end())
+			{
+				break;
+			}
+			sup = up->second;
+		}
+	}
+}
+
 SteamWorks::LDAP::TypeInfo::TypeInfo() :
 	Action(true),
 	d(new Private())
@@ -227,7 +370,7 @@ void SteamWorks::LDAP::TypeInfo::execute(Connection& conn, Result result)
 	tv.tv_sec = 2;
 	tv.tv_usec = 0;
 
-	const char *attrs[] = {"objectClasses", nullptr};
+	const char *attrs[] = {"objectClasses", "attributeTypes", nullptr};
 
 	// TODO: cn=Subschema is OpenLDAP-specific and specifically warned-against
 	//       at http://www.openldap.org/faq/data/cache/1366.html
@@ -250,9 +393,17 @@ void SteamWorks::LDAP::TypeInfo::execute(Connection& conn, Result result)
 		return;
 	}
 
+	d->parse_attribute_types(ldaphandle, res);
+	log.debugStream() << "Typeinfo has syntaxes for " << d->m_syntaxes.size() << " attributes.";
+
 	if (result)
 	{
 		copy_search_result(ldaphandle, res, result, log);
 	}
 	ldap_msgfree(res);
 }
+
+const SteamWorks::LDAP::TypeInfo::Syntaxes& SteamWorks::LDAP::TypeInfo::syntaxes() const
+{
+	return d->m_syntaxes;
+}
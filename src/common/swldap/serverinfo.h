@@ -9,6 +9,7 @@ Adriaan de Groot <groot@kde.org>
 #define SWLDAP_SERVERINFO_H
 
 #include <string>
+#include <unordered_map>
 
 #include "../logger.h"
 #include "../jsonresponse.h"
@@ -87,12 +88,18 @@ bool require_syncrepl(ConnectionUPtr& connection, JSON::Object response, Logging
 
 /**
  * Class representing a query for type information related to all
- * objectclasses. Returns the complete subschema-definition, which
- * isn't all that useful because it needs parsing to find out what
- * types apply to what attributes.
+ * objectclasses and attribute types. Returns the complete
+ * subschema-definition, which isn't all that useful because it
+ * needs parsing to find out what types apply to what attributes.
+ *
+ * The attribute types are parsed, though, to find the syntax of
+ * each attribute; see syntaxes().
  */
 class TypeInfo : public Action
 {
+public:
+	using Syntaxes = std::unordered_map<std::string, std::string>;
+
 private:
 	class Private;
 	std::unique_ptr<Private> d;
@@ -102,6 +109,15 @@ public:
 	~TypeInfo();
 
 	virtual void execute(Connection&, Result result=nullptr);
+
+	/**
+	 * After execute(), maps each attribute name (in lower case; an
+	 * attribute with several names has an entry for each) to the
+	 * OID of its LDAP syntax, e.g. "1.3.6.1.4.1.1466.115.121.1.27"
+	 * for INTEGER. Attributes without a SYNTAX of their own take
+	 * the syntax of their SUP type.
+	 */
+	const Syntaxes& syntaxes() const;
 } ;
 
 } // namespace LDAP
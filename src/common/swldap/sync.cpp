@@ -165,6 +165,18 @@ struct DITCore
 		}
 	}
 
+	/**
+	 * Write the DIT-tree to @p out as members (UUID to entry)
+	 * of the JSON object open there, one entry at a time.
+	 */
+	void dump(SteamWorks::JSON::Writer& out) const
+	{
+		for (auto& d: m_dit)
+		{
+			out.key(d.first).begin_object().members(d.second).end_object();
+		}
+	}
+
 	/**
 	 * Update the old DIT entry @p at (retrieved from m_dit) with values
 	 * from the newly-received value @p new_v.
@@ -471,6 +483,19 @@ void SteamWorks::LDAP::SyncRepl::dump_dit(Result result)
 	d->dit().dump(result);
 }
 
+void SteamWorks::LDAP::SyncRepl::dump_dit(JSON::Writer& out)
+{
+	d->dit().dump(out);
+}
+
+void SteamWorks::LDAP::SyncRepl::for_each_entry(const std::function<void(const std::string&, const picojson::object&)>& f) const
+{
+	for (const auto& entry : d->dit().m_dit)
+	{
+		f(entry.first, entry.second);
+	}
+}
+
 void SteamWorks::LDAP::SyncRepl::resync()
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.ldap");
@@ -14,8 +14,10 @@ Adriaan de Groot <groot@kde.org>
 #ifndef SWLDAP_SEARCH_H
 #define SWLDAP_SEARCH_H
 
+#include <functional>
 #include <string>
 
+#include "../jsonwriter.h"
 #include "connection.h"
 
 namespace SteamWorks
@@ -50,6 +52,15 @@ public:
 
 	/** Debugging, dump the DIT entries stored in this SyncRepl into @p result */
 	void dump_dit(Result result);
+	/** As above, writing the entries to the JSON object open in @p out */
+	void dump_dit(JSON::Writer& out);
+
+	/**
+	 * Call @p f with the UUID and values of each of the DIT entries
+	 * stored in this SyncRepl, e.g. to feed them to something that
+	 * started following after the entries were received.
+	 */
+	void for_each_entry(const std::function<void(const std::string&, const picojson::object&)>& f) const;
 } ;
 
 }  // namespace LDAP
@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Checks CBOR reading and writing: the examples of RFC 7049 appendix A
+ * that map onto JSON, values written by put_value() and by a CBOR
+ * JSON::Writer reading back the same, and that truncated data, broken
+ * indefinite-length items, lengths past the end of the data and
+ * numbers that JSON does not have are refused. Exits with a non-zero
+ * status if any check fails.
+ */
+
+#include "cbor.h"
+#include "jsonwriter.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <string>
+
+namespace CBOR = SteamWorks::CBOR;
+
+static int failures = 0;
+
+#define CHECK(cond, what) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s\n", what); \
+		failures++; \
+	} \
+} while (0)
+
+/// Bytes from hex digits, e.g. "1903e8"
+static std::string bytes(const char* hex)
+{
+	std::string s;
+	for (; hex[0] && hex[1]; hex += 2)
+	{
+		s.push_back(char(strtoul(std::string(hex, 2).c_str(), nullptr, 16)));
+	}
+	return s;
+}
+
+/// Parses @p data from a buffer of exactly its own length.
+static bool parse(const std::string& data, picojson::value& v, std::string& error)
+{
+	std::unique_ptr<char[]> buffer(new char[data.size() + 1]);
+	data.copy(buffer.get(), data.size());
+	return CBOR::parse(buffer.get(), buffer.get() + data.size(), v, error);
+}
+
+/// True if @p data (hex) is read as the JSON text @p json.
+static bool reads_as(const char* data, const char* json)
+{
+	picojson::value v, expected;
+	std::string error;
+	if (!picojson::parse(expected, json).empty())
+	{
+		return false;
+	}
+	return parse(bytes(data), v, error) && (v == expected);
+}
+
+/// True if @p data is refused, with an error message.
+static bool refused(const std::string& data)
+{
+	picojson::value v;
+	std::string error;
+	return !parse(data, v, error) && (error.compare(0, 5, "CBOR ") == 0);
+}
+
+static std::string written(const picojson::value& v)
+{
+	std::string out;
+	CBOR::put_value(out, v);
+	return out;
+}
+
+static void check_rfc_examples()
+{
+	static const char* const examples[][2] =
+	{
+		{ "00", "0" }, { "17", "23" }, { "1818", "24" }, { "1864", "100" },
+		{ "1903e8", "1000" }, { "1a000f4240", "1000000" }, { "1b000000e8d4a51000", "1000000000000" },
+		{ "20", "-1" }, { "3863", "-100" }, { "3903e7", "-1000" },
+		{ "f90000", "0.0" }, { "f93c00", "1.0" }, { "f93e00", "1.5" }, { "f97bff", "65504.0" },
+		{ "fa47c35000", "100000.0" }, { "fb3ff199999999999a", "1.1" }, { "f9c400", "-4.0" },
+		{ "f4", "false" }, { "f5", "true" }, { "f6", "null" }, { "f7", "null" },
+		{ "c11a514b67b0", "1363896240" },
+		{ "60", "\"\"" }, { "6161", "\"a\"" }, { "6449455446", "\"IETF\"" }, { "62225c", "\"\\\"\\\\\"" },
+		{ "62c3bc", "\"\\u00fc\"" }, { "64f0908591", "\"\\ud800\\udd51\"" },
+		{ "80", "[]" }, { "83010203", "[1,2,3]" }, { "8301820203820405", "[1,[2,3],[4,5]]" },
+		{ "a0", "{}" }, { "a26161016162820203", "{\"a\":1,\"b\":[2,3]}" },
+		{ "826161a161626163", "[\"a\",{\"b\":\"c\"}]" },
+		// Indefinite lengths
+		{ "7f657374726561646d696e67ff", "\"streaming\"" }, { "5f42010243030405ff", "\"\\u0001\\u0002\\u0003\\u0004\\u0005\"" },
+		{ "9fff", "[]" }, { "9f018202039f0405ffff", "[1,[2,3],[4,5]]" }, { "83018202039f0405ff", "[1,[2,3],[4,5]]" },
+		{ "bf61610161629f0203ffff", "{\"a\":1,\"b\":[2,3]}" }, { "826161bf61626163ff", "[\"a\",{\"b\":\"c\"}]" },
+		{ "bf6346756ef563416d7421ff", "{\"Fun\":true,\"Amt\":-2}" },
+	} ;
+	for (const auto& e : examples)
+	{
+		if (!reads_as(e[0], e[1]))
+		{
+			fprintf(stderr, "FAIL %s does not read as %s\n", e[0], e[1]);
+			failures++;
+		}
+	}
+
+	picojson::value v;
+	std::string error;
+	CHECK(parse(bytes("f90001"), v, error) && (v.get<double>() == ldexp(1.0, -24)), "half-precision subnormal");
+}
+
+static void check_round_trip()
+{
+	static const double numbers[] =
+	{
+		0, 1, 23, 24, 255, 256, 65535, 65536, 4294967295.0, 4294967296.0, 9007199254740992.0, 1e19,
+		-1, -24, -25, -256, -257, -4294967296.0, -4294967297.0, -9007199254740992.0,
+		0.5, -0.5, 1.1, 1e300, -1e-300, 18446744073709551616.0, -18446744073709551617.0,
+	} ;
+	for (double d : numbers)
+	{
+		picojson::value v, back;
+		std::string error;
+		if (!parse(written(picojson::value(d)), back, error) || !back.is<double>() || (back.get<double>() != d))
+		{
+			fprintf(stderr, "FAIL number %g does not round-trip\n", d);
+			failures++;
+		}
+	}
+	CHECK(written(picojson::value(1000.0)) == bytes("1903e8"), "integral numbers as integers");
+	CHECK(written(picojson::value(-1000.0)) == bytes("3903e7"), "negative integers");
+	CHECK(written(picojson::value(1.1)) == bytes("fb3ff199999999999a"), "other numbers as doubles");
+
+	picojson::value back;
+	std::string error;
+	CHECK(parse(written(picojson::value(-0.0)), back, error) && signbit(back.get<double>()), "negative zero");
+
+	// Strings that are not UTF-8 go as byte strings, and come back unchanged
+	std::string binary("\xff\x00\xc3\x28\xed\xa0\x80", 7);
+	CHECK(written(picojson::value(binary))[0] == char(0x47), "binary as byte string");
+	CHECK(written(picojson::value(std::string("\xc3\xbc")))[0] == char(0x62), "UTF-8 as text string");
+	CHECK(parse(written(picojson::value(binary)), back, error) && (back.get<std::string>() == binary), "binary round-trip");
+
+	picojson::value v;
+	const char* json = "{\"a\":[1,-2.5,\"x\\u00fc\",true,false,null,[],{}],\"b\":{\"c\":\"d\",\"e\":[[[1e300]]]},\"\":\"\"}";
+	CHECK(picojson::parse(v, json).empty(), "test JSON");
+	CHECK(parse(written(v), back, error) && (back == v), "put_value round-trip");
+
+	// What a CBOR JSON::Writer writes, with indefinite-length objects and arrays
+	std::string out;
+	{
+		SteamWorks::JSON::Writer writer([&out](const char* data, size_t len) { out.append(data, len); return true; },
+			16, SteamWorks::JSON::Writer::Encoding::CBOR);
+		writer.begin_object();
+		writer.key("items").begin_array().value("a").value(2.0).value(true).null().begin_object().end_object().end_array();
+		writer.key("value").value(v);
+		writer.end_object();
+	}
+	picojson::value expected;
+	std::string expected_json = std::string("{\"items\":[\"a\",2,true,null,{}],\"value\":") + json + "}";
+	CHECK(picojson::parse(expected, expected_json).empty(), "test JSON for the writer");
+	CHECK(parse(out, back, error) && (back == expected), "writer round-trip");
+}
+
+static void check_refused()
+{
+	static const char* const malformed[][2] =
+	{
+		{ "", "empty" },
+		{ "0000", "data after the item" },
+		{ "1c", "reserved additional information" },
+		{ "5e", "reserved additional information in a string" },
+		{ "a10102", "map key that is not a string" },
+		{ "ff", "break outside an indefinite-length item" },
+		{ "f8ff", "unsupported simple value" },
+		{ "8201ff", "break in a definite-length array" },
+		{ "f97c00", "half-precision infinity" },
+		{ "f97e00", "half-precision NaN" },
+		{ "fa7f800000", "single-precision infinity" },
+		{ "fbfff0000000000000", "double-precision -infinity" },
+		{ "fb7ff8000000000000", "double-precision NaN" },
+		// Indefinite lengths
+		{ "1f", "indefinite-length unsigned integer" },
+		{ "3f", "indefinite-length negative integer" },
+		{ "df00", "indefinite-length tag" },
+		{ "9f0102", "indefinite-length array without break" },
+		{ "bf616101", "indefinite-length map without break" },
+		{ "bf6161ff", "indefinite-length map with a key only" },
+		{ "5f4201026161ff", "text chunk in a byte string" },
+		{ "7f61617f6162ffff", "indefinite chunk in a text string" },
+		{ "7f01ff", "integer chunk in a text string" },
+		{ "7f6161", "indefinite-length string without break" },
+		// Lengths past the end of the data
+		{ "5b7fffffffffffffff00", "byte string of 2^63 bytes" },
+		{ "7bffffffffffffffff", "text string of 2^64-1 bytes" },
+		{ "7a0000000461", "text string longer than the data" },
+		{ "9bffffffffffffffff01", "array of 2^64-1 elements" },
+		{ "9a0100000001", "array of 2^24 elements" },
+		{ "bbffffffffffffffff616101", "map of 2^64-1 pairs" },
+		{ "7f7bffffffffffffffff61ff", "chunk of 2^64-1 bytes" },
+		{ "1b0000", "truncated argument" },
+	} ;
+	for (const auto& m : malformed)
+	{
+		if (!refused(bytes(m[0])))
+		{
+			fprintf(stderr, "FAIL %s (%s) accepted\n", m[1], m[0]);
+			failures++;
+		}
+	}
+
+	CHECK(refused(std::string(1000, char(0x81)) + bytes("00")), "nested too deeply");
+	CHECK(refused(std::string(1000, char(0x9f)) + std::string(1000, char(0xff))), "indefinite nested too deeply");
+	CHECK(refused(std::string(1000, char(0xc0)) + bytes("00")), "too many tags");
+
+	// No proper prefix of an encoded value is a data item
+	picojson::value v;
+	picojson::parse(v, "{\"a\":[1,-2.5,1000000,\"x\\u00fc\",true,null],\"b\":{\"c\":\"dd\"}}");
+	std::string data = written(v);
+	const char* indefinite_hex = "bf61619f01f93e001a000f42407f617862c3bcfff5f6ff6162bf6163626464ffff";
+	CHECK(reads_as(indefinite_hex, "{\"a\":[1,1.5,1000000,\"x\\u00fc\",true,null],\"b\":{\"c\":\"dd\"}}"), "indefinite test data");
+	std::string indefinite = bytes(indefinite_hex);
+	for (const std::string& d : { data, indefinite })
+	{
+		for (size_t len = 0; len < d.size(); len++)
+		{
+			if (!refused(d.substr(0, len)))
+			{
+				fprintf(stderr, "FAIL truncated to %lu of %lu bytes accepted\n", (unsigned long)len, (unsigned long)d.size());
+				failures++;
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	check_rfc_examples();
+	check_round_trip();
+	check_refused();
+	return (failures == 0) ? 0 : 1;
+}
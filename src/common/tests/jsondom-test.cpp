@@ -0,0 +1,202 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Checks the JSON::Document parser: escapes and \u surrogate pairs in
+ * strings, numbers, nesting and duplicate keys, nodes as text and as
+ * picojson, and that malformed or truncated text and numbers out of
+ * range are refused. Each text is parsed from a copy of exactly its
+ * own length, so reading past the end shows up under a sanitizer.
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include "jsondom.h"
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+using SteamWorks::JSON::Document;
+using SteamWorks::JSON::Node;
+
+static int failures = 0;
+
+#define CHECK(cond, what) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s\n", what); \
+		failures++; \
+	} \
+} while (0)
+
+/// Parses @p text into @p doc from a buffer of its own, kept in @p buffer.
+static bool parse(Document& doc, std::unique_ptr<char[]>& buffer, const std::string& text)
+{
+	buffer.reset(new char[text.size() + 1]);
+	text.copy(buffer.get(), text.size());
+	return doc.parse(buffer.get(), buffer.get() + text.size());
+}
+
+/// The string that @p text (a JSON string) parses to; "<fail>" if it does not.
+static std::string string(const std::string& text)
+{
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+	if (!parse(doc, buffer, text) || !doc.root().is_string())
+	{
+		return "<fail>";
+	}
+	return doc.root().string().str();
+}
+
+/// True if @p text is refused, with an error message.
+static bool refused(const std::string& text)
+{
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+	return !parse(doc, buffer, text) && (doc.error().compare(0, 5, "JSON ") == 0) && doc.root().is_null();
+}
+
+static void check_strings()
+{
+	CHECK(string("\"plain\"") == "plain", "plain string");
+	CHECK(string("\"\"") == "", "empty string");
+	CHECK(string("\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"") == "\"\\/\b\f\n\r\t", "simple escapes");
+	CHECK(string("\"a\\nb\\tc\"") == "a\nb\tc", "escapes between plain text");
+	CHECK(string("\"this is a string longer than sixteen bytes \\\" with an escape\"") == "this is a string longer than sixteen bytes \" with an escape", "long string");
+	CHECK(string("\"\\u0041\\u00e9\\u20AC\"") == "A\xc3\xa9\xe2\x82\xac", "\\u escapes");
+	CHECK(string("\"\\u0000\"") == std::string(1, '\0'), "\\u0000");
+	CHECK(string("\"\\ud83d\\ude00\"") == "\xf0\x9f\x98\x80", "surrogate pair");
+	CHECK(string("\"x\\uD834\\uDD1Ey\"") == "x\xf0\x9d\x84\x9ey", "surrogate pair in upper case");
+	CHECK(string("\"\xc3\xa9\"") == "\xc3\xa9", "UTF-8 passes as-is");
+
+	// Without escapes, strings point into the buffer
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+	CHECK(parse(doc, buffer, "[\"abc\"]") && (doc.root()[0].string().data == buffer.get() + 2), "plain string in the buffer");
+
+	CHECK(refused("\"\\ud83d\""), "lone high surrogate");
+	CHECK(refused("\"\\ud83dx\""), "high surrogate followed by text");
+	CHECK(refused("\"\\ud83d\\u0041\""), "high surrogate followed by non-surrogate");
+	CHECK(refused("\"\\ud83d\\ud83d\""), "two high surrogates");
+	CHECK(refused("\"\\ude00\""), "lone low surrogate");
+	CHECK(refused("\"\\u12g4\""), "bad hex digit");
+	CHECK(refused("\"\\u12\""), "short \\u escape");
+	CHECK(refused("\"\\x\""), "unknown escape");
+	CHECK(refused("\"a\nb\""), "control character");
+	CHECK(refused("\"a\\\nb\""), "escaped control character");
+}
+
+static void check_values()
+{
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+
+	CHECK(parse(doc, buffer, " [0, -1, 42, -0.5e2, 1.25E+1, 123456789012345678, 1e-3] ") && (doc.root().size() == 7), "numbers");
+	const Node& n = doc.root();
+	CHECK((n[0].number() == 0) && (n[1].number() == -1) && (n[2].number() == 42), "integers");
+	CHECK((n[3].number() == -50) && (n[4].number() == 12.5) && (n[6].number() == 0.001), "fractions and exponents");
+	CHECK(n[5].number() == 123456789012345678.0, "long integer");
+	CHECK(parse(doc, buffer, "[1e-400, 1e308]") && (doc.root()[0].number() == 0), "underflow");
+	CHECK(!parse(doc, buffer, "[1e400]") && (doc.error() == "JSON number out of range at offset 1."), "overflow");
+	CHECK(!parse(doc, buffer, "-1e309"), "negative overflow");
+
+	CHECK(parse(doc, buffer, "[true, false, null]"), "literals");
+	CHECK(doc.root()[0].is_bool() && doc.root()[0].boolean(), "true");
+	CHECK(doc.root()[1].is_bool() && !doc.root()[1].boolean(), "false");
+	CHECK(doc.root()[2].is_null() && doc.root()[3].is_null(), "null, and past the end");
+
+	CHECK(parse(doc, buffer, "{\"b\": 2, \"a\": 1, \"c\": {\"d\": [1, {\"e\": \"f\"}]}, \"a\": 3}"), "object");
+	const Node& o = doc.root();
+	CHECK(o.is_object() && (o.size() == 3), "duplicate keys are merged");
+	CHECK(o.get("a").number() == 3, "last duplicate counts");
+	CHECK((o.begin()[0].key == "a") && (o.begin()[1].key == "b") && (o.begin()[2].key == "c"), "members sorted");
+	CHECK(o.get("c").get("d")[1].get("e").string() == "f", "nested lookup");
+	CHECK(o.get("x").is_null() && o.get("a").get("x").is_null(), "missing member");
+
+	picojson::value v;
+	std::string text("{\"a\":[1,2.5,\"x\\u00e9\",true,null],\"b\":{}}");
+	CHECK(parse(doc, buffer, text) && picojson::parse(v, text).empty() && (doc.root().to_picojson() == v), "to_picojson");
+
+	// Scalars as text and as truth, the way picojson has them
+	text = "[\"s\", \"\", 0, -1.5, 1e21, 123456789, true, false, null, [], [0], {}, {\"a\": 0}]";
+	CHECK(parse(doc, buffer, text) && picojson::parse(v, text).empty(), "scalars");
+	for (size_t i = 0; i < doc.root().size(); i++)
+	{
+		const picojson::value& p = v.get(i);
+		if ((doc.root()[i].to_str() != p.to_str()) || (doc.root()[i].evaluate_as_boolean() != p.evaluate_as_boolean()))
+		{
+			fprintf(stderr, "FAIL element %lu is '%s', expected '%s'\n", (unsigned long)i, doc.root()[i].to_str().c_str(), p.to_str().c_str());
+			failures++;
+		}
+	}
+
+	// Nesting: deep is fine, too deep is not
+	std::string deep = std::string(200, '[') + std::string(200, ']');
+	CHECK(parse(doc, buffer, deep) && (doc.root()[0][0][0].size() == 1), "deep nesting");
+	std::string too_deep = std::string(1000, '[') + std::string(1000, ']');
+	CHECK(!parse(doc, buffer, too_deep) && (doc.error().find("nested too deeply") != std::string::npos), "too deep nesting");
+	std::string objects;
+	for (int i = 0; i < 1000; i++)
+	{
+		objects.append("{\"a\":");
+	}
+	objects.append("1").append(1000, '}');
+	CHECK(!parse(doc, buffer, objects), "too deep nesting of objects");
+
+	// The document can be used again after a failure
+	CHECK(parse(doc, buffer, "{\"k\": \"v\"}") && (doc.root().get("k").string() == "v") && doc.error().empty(), "parse again");
+}
+
+static void check_malformed()
+{
+	static const char* const texts[] =
+	{
+		"", "   ", "tru", "nul", "falsy", "-", "+1", "01", "1.", ".5", "1e", "1e+", "0x10",
+		"[1,]", "[,1]", "[1 2]", "[", "]", "{", "}", "{}}", "[]]", "[] []",
+		"{\"a\" 1}", "{\"a\":}", "{1:2}", "{a:1}", "{\"a\":1,}", "{\"a\":1 \"b\":2}",
+		"\"abc", "\"abc\\\"", "'a'", "nan", "[1]x",
+	} ;
+	for (const char* text : texts)
+	{
+		if (!refused(text))
+		{
+			fprintf(stderr, "FAIL malformed '%s' accepted\n", text);
+			failures++;
+		}
+	}
+
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+	CHECK(!parse(doc, buffer, "[1, 2, x]") && (doc.error() == "JSON syntax error at offset 7."), "error offset");
+}
+
+static void check_truncated()
+{
+	// No proper prefix of this is a JSON value
+	std::string text("{\"a\":[1,-2.5e3,\"x\\u00e9\\ud83d\\ude00\\n\",true,false,null],\"b\":{\"c\":\"d\"}}");
+	Document doc;
+	std::unique_ptr<char[]> buffer;
+	CHECK(parse(doc, buffer, text), "whole text");
+	for (size_t len = 0; len < text.size(); len++)
+	{
+		if (!refused(text.substr(0, len)))
+		{
+			fprintf(stderr, "FAIL truncated to %lu bytes accepted\n", (unsigned long)len);
+			failures++;
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	check_strings();
+	check_values();
+	check_malformed();
+	check_truncated();
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Feeds FastCGI records to mainloop_multiplexed() over a socket: one
+ * request byte by byte, and two requests with their records interleaved,
+ * padded and with headers split between reads. Each request must get
+ * its own response. Exits with a non-zero status if any check fails.
+ */
+
+#include "fcgi.h"
+#include "fastcgi.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond, what) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s\n", what); \
+		failures++; \
+	} \
+} while (0)
+
+class EchoDispatcher : public VerbDispatcher
+{
+public:
+	int exec(const std::string& verb, const Values& values, Object& response) override
+	{
+		if (verb == "stop")
+		{
+			return -1;
+		}
+		response.emplace("echo", values.get("x"));
+		return 0;
+	}
+} ;
+
+static std::string record(unsigned char type, uint16_t id, const std::string& content, unsigned char padding)
+{
+	std::string r;
+	r.push_back(char(FCGI_VERSION_1));
+	r.push_back(char(type));
+	r.push_back(char(id >> 8));
+	r.push_back(char(id & 0xff));
+	r.push_back(char(content.size() >> 8));
+	r.push_back(char(content.size() & 0xff));
+	r.push_back(char(padding));
+	r.push_back(0);
+	r.append(content);
+	r.append(padding, '\xee');  // Must be skipped, whatever it holds
+	return r;
+}
+
+static std::string pair(const std::string& name, const std::string& value)
+{
+	std::string p;
+	p.push_back(char(name.size()));
+	p.push_back(char(value.size()));
+	return p + name + value;
+}
+
+/**
+ * The records of request @p id with JSON @p body; the parameters and
+ * the body are each split over two records.
+ */
+static std::vector<std::string> request(uint16_t id, const std::string& body, unsigned char padding)
+{
+	const char begin[] = { 0, FCGI_RESPONDER, FCGI_KEEP_CONN, 0, 0, 0, 0, 0 };
+	std::string params = pair("CONTENT_TYPE", "application/json") + pair("CONTENT_LENGTH", std::to_string(body.size()));
+	size_t half = params.size() / 2;
+	return {
+		record(FCGI_BEGIN_REQUEST, id, std::string(begin, sizeof(begin)), padding),
+		record(FCGI_PARAMS, id, params.substr(0, half), padding),
+		record(FCGI_PARAMS, id, params.substr(half), padding),
+		record(FCGI_PARAMS, id, "", padding),
+		record(FCGI_STDIN, id, body.substr(0, 3), padding),
+		record(FCGI_STDIN, id, body.substr(3), padding),
+		record(FCGI_STDIN, id, "", padding)
+	};
+}
+
+/** Send @p data in pieces of @p chunk bytes, pausing so that each is read on its own. */
+static void send_slowly(int fd, const std::string& data, size_t chunk)
+{
+	for (size_t p = 0; p < data.size(); p += chunk)
+	{
+		size_t n = std::min(chunk, data.size() - p);
+		if (::send(fd, data.data() + p, n, MSG_NOSIGNAL) != ssize_t(n))
+		{
+			perror("send");
+			exit(1);
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+}
+
+/**
+ * Read records until @p ids have all ended; returns the output of each
+ * request (and of the management records, as id 0).
+ */
+static std::map<uint16_t, std::string> responses(int fd, std::vector<uint16_t> ids)
+{
+	std::map<uint16_t, std::string> out;
+	std::string input;
+	while (!ids.empty())
+	{
+		char buffer[4096];
+		ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+		if (n <= 0)
+		{
+			fprintf(stderr, "FAIL no response\n");
+			failures++;
+			break;
+		}
+		input.append(buffer, n);
+		while (input.size() >= FCGI_HEADER_LEN)
+		{
+			const unsigned char* h = reinterpret_cast<const unsigned char*>(input.data());
+			uint16_t id = (h[2] << 8) | h[3];
+			size_t length = (h[4] << 8) | h[5];
+			size_t size = FCGI_HEADER_LEN + length + h[6];
+			if (input.size() < size)
+			{
+				break;
+			}
+			if ((h[1] == FCGI_STDOUT) || (h[1] == FCGI_GET_VALUES_RESULT))
+			{
+				out[id].append(input, FCGI_HEADER_LEN, length);
+			}
+			if ((h[1] == FCGI_END_REQUEST) || (h[1] == FCGI_GET_VALUES_RESULT))
+			{
+				CHECK((h[1] != FCGI_END_REQUEST) || (h[FCGI_HEADER_LEN + 4] == FCGI_REQUEST_COMPLETE), "request complete");
+				ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+			}
+			input.erase(0, size);
+		}
+	}
+	return out;
+}
+
+static bool contains(const std::string& s, const char* part)
+{
+	return s.find(part) != std::string::npos;
+}
+
+int main(int argc, char* argv[])
+{
+	char path[] = "/tmp/mux-test-XXXXXX";
+	if (!mkdtemp(path))
+	{
+		perror("mkdtemp");
+		return 1;
+	}
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s/socket", path);
+
+	// The main loop accepts connections on FCGI_LISTENSOCK_FILENO
+	int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if ((listener < 0) ||
+		(::bind(listener, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0) ||
+		(::listen(listener, 4) != 0) ||
+		(::dup2(listener, FCGI_LISTENSOCK_FILENO) < 0))
+	{
+		perror("listen");
+		return 1;
+	}
+
+	EchoDispatcher dispatcher;
+	int result = -1;
+	std::thread server([&]() { result = SteamWorks::FCGI::mainloop_multiplexed(&dispatcher); });
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	struct timeval timeout = { 5, 0 };
+	if ((fd < 0) ||
+		(::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) ||
+		(::connect(fd, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0))
+	{
+		perror("connect");
+		return 1;
+	}
+
+	// Management record, byte by byte
+	send_slowly(fd, record(FCGI_GET_VALUES, FCGI_NULL_REQUEST_ID, pair(FCGI_MPXS_CONNS, ""), 0), 1);
+	auto out = responses(fd, { FCGI_NULL_REQUEST_ID });
+	CHECK(contains(out[0], FCGI_MPXS_CONNS), "get values");
+
+	// One request, byte by byte
+	std::string one;
+	for (const auto& r : request(1, "{\"verb\":\"x\",\"x\":\"one\"}", 0))
+	{
+		one.append(r);
+	}
+	send_slowly(fd, one, 1);
+	out = responses(fd, { 1 });
+	CHECK(contains(out[1], "\"echo\":\"one\""), "byte by byte");
+
+	// Two requests, their records interleaved and padded, sent in
+	// pieces that split the headers
+	auto two = request(2, "{\"verb\":\"x\",\"x\":\"two\"}", 7);
+	auto three = request(3, "{\"verb\":\"x\",\"x\":\"three\"}", 3);
+	std::string interleaved;
+	for (size_t i = 0; i < two.size(); i++)
+	{
+		interleaved.append(three[i]);
+		interleaved.append(two[i]);
+	}
+	send_slowly(fd, interleaved, 5);
+	out = responses(fd, { 2, 3 });
+	CHECK(contains(out[2], "\"echo\":\"two\"") && !contains(out[2], "three"), "interleaved, first");
+	CHECK(contains(out[3], "\"echo\":\"three\"") && !contains(out[3], "two"), "interleaved, second");
+
+	// A request with a new id on the kept connection stops the loop
+	std::string stop;
+	for (const auto& r : request(4, "{\"verb\":\"stop\"}", 0))
+	{
+		stop.append(r);
+	}
+	send_slowly(fd, stop, stop.size());
+	responses(fd, { 4 });
+	server.join();
+	CHECK(result == 0, "stopped");
+
+	::close(fd);
+	::unlink(address.sun_path);
+	::rmdir(path);
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * A small pool of worker threads for running a set of independent
+ * tasks at once, and waiting until they are all done. This is meant
+ * for work that is mostly waiting (e.g. on fsync), such as having
+ * each backend prepare a transaction, so the number of threads is
+ * chosen by the caller rather than from the number of CPUs.
+ *
+ * The calling thread runs tasks too, so a pool of N threads runs up
+ * to N+1 tasks in parallel. Only one thread at a time may call run().
+ */
+#ifndef STEAMWORKS_COMMON_THREADPOOL_H
+#define STEAMWORKS_COMMON_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+	using task_t = std::function<void()>;
+
+private:
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_work;  // Tasks available, or stopping
+	std::condition_variable m_done;  // Last task finished
+
+	// Protected by m_mutex
+	const std::vector<task_t>* m_tasks;
+	size_t m_next;  // Next task to start
+	size_t m_pending;  // Tasks not finished yet
+	bool m_stopping;
+
+	bool has_work() const
+	{
+		return m_tasks && (m_next < m_tasks->size());
+	}
+
+	/**
+	 * Start the next task, with @p lock held on entry and exit.
+	 */
+	void run_one(std::unique_lock<std::mutex>& lock)
+	{
+		const task_t& task = (*m_tasks)[m_next++];
+		lock.unlock();
+		task();
+		lock.lock();
+		if (--m_pending == 0)
+		{
+			m_done.notify_all();
+		}
+	}
+
+	void work()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_work.wait(lock, [this]{ return m_stopping || has_work(); });
+			if (m_stopping)
+			{
+				break;
+			}
+			run_one(lock);
+		}
+	}
+
+public:
+	ThreadPool(unsigned int threads) :
+		m_tasks(nullptr),
+		m_next(0),
+		m_pending(0),
+		m_stopping(false)
+	{
+		for (unsigned int i = 0; i < threads; i++)
+		{
+			m_threads.emplace_back(&ThreadPool::work, this);
+		}
+	}
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_work.notify_all();
+		for (auto& t : m_threads)
+		{
+			t.join();
+		}
+	}
+
+	/** Number of threads in the pool, not counting the caller. */
+	size_t size() const { return m_threads.size(); }
+
+	/**
+	 * Run all the @p tasks and return when every one of them has
+	 * finished. Tasks must not throw.
+	 */
+	void run(const std::vector<task_t>& tasks)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_tasks = &tasks;
+		m_next = 0;
+		m_pending = tasks.size();
+		m_work.notify_all();
+
+		while (has_work())
+		{
+			run_one(lock);
+		}
+		m_done.wait(lock, [this]{ return m_pending == 0; });
+		m_tasks = nullptr;
+	}
+} ;
+
+#endif
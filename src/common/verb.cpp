@@ -7,9 +7,105 @@ Adriaan de Groot <groot@kde.org>
 
 #include "verb.h"
 
+#include "jsonresponse.h"
+
 #include <sys/select.h>
 
 void VerbDispatcher::poll()
 {
 }
 
+int VerbDispatcher::exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response)
+{
+	return exec(verb, values.to_picojson(), response);
+}
+
+int VerbDispatcher::verb_index(const std::string& verb) const
+{
+	return -1;
+}
+
+const char* VerbDispatcher::verb_name(size_t i) const
+{
+	return nullptr;
+}
+
+bool VerbDispatcher::is_streamed(const std::string& verb) const
+{
+	return false;
+}
+
+int VerbDispatcher::exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response)
+{
+	Object object;
+	int r = exec(verb, values, object);
+	response.begin_object().members(object).end_object();
+	return r;
+}
+
+int VerbDispatcher::exec_streamed_document(const std::string& verb, const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response)
+{
+	return exec_streamed(verb, values.to_picojson(), response);
+}
+
+int VerbDispatcher::exec_one(const Values& request, SteamWorks::JSON::Writer& response)
+{
+	std::string verb;
+	if (request.is<picojson::object>() && request.get("verb").is<std::string>())
+	{
+		verb = request.get("verb").get<std::string>();
+	}
+	if (!verb.empty() && (verb != "batch") && is_streamed(verb))
+	{
+		return exec_streamed(verb, request, response);
+	}
+
+	Object object;
+	int r = 0;
+	if (verb.empty())
+	{
+		SteamWorks::JSON::simple_output(object, 500, "No verb.");
+	}
+	else if (verb == "batch")
+	{
+		SteamWorks::JSON::simple_output(object, 500, "Batches do not nest.");
+	}
+	else if ((r = exec(verb, request, object)) < 0)
+	{
+		SteamWorks::JSON::simple_output(object, 500, "Bad request", -r);
+	}
+	response.begin_object().members(object).end_object();
+	return r;
+}
+
+int VerbDispatcher::exec_batch(const Values& values, SteamWorks::JSON::Writer& response)
+{
+	const Values& requests = values.get("requests");
+	bool pipeline = values.get("pipeline").evaluate_as_boolean();  // False if absent
+	int r = 0;
+
+	response.begin_object().key("responses").begin_array();
+	if (requests.is<picojson::array>())
+	{
+		const picojson::array& a = requests.get<picojson::array>();
+		for (size_t i = 0; (i < a.size()) && (r >= 0); )
+		{
+			size_t n = pipeline ? exec_pipelined(a, i, response) : 0;
+			if (n)
+			{
+				i += n;
+			}
+			else
+			{
+				r = exec_one(a[i++], response);
+			}
+		}
+	}
+	response.end_array().end_object();
+	return r;
+}
+
+size_t VerbDispatcher::exec_pipelined(const picojson::array& requests, size_t first, SteamWorks::JSON::Writer& response)
+{
+	return 0;
+}
@@ -10,15 +10,160 @@ Adriaan de Groot <groot@kde.org>
 
 #include "picojson.h"
 
+#include "jsondom.h"
+#include "jsonwriter.h"
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * Table of the verbs of a dispatcher, mapping each verb name to a
+ * handler (usually a pointer to a member function). Lookup is one
+ * hash of the verb and one comparison: the table is built once,
+ * with a hash seed for which no two verbs share a slot.
+ *
+ *     static const VerbTable<Handler> verbs = {
+ *         { "connect", &MyDispatcher::do_connect },
+ *         { "stop", &MyDispatcher::do_stop },
+ *     };
+ *     auto handler = verbs.find(verb);
+ *     if (handler) return (this->*(*handler))(values, response);
+ *
+ * Each verb also gets an index (in the order given), for keeping
+ * per-verb data in an array beside the table.
+ */
+template<typename Handler>
+class VerbTable
+{
+public:
+	struct Entry
+	{
+		const char* name;
+		Handler handler;
+	} ;
+
+	/** FNV-1a hash of @p s, starting from @p h; also usable at compile-time. */
+	static constexpr uint32_t hash(const char* s, uint32_t h=2166136261u)
+	{
+		return *s ? hash(s + 1, (h ^ uint8_t(*s)) * 16777619u) : h;
+	}
+
+	static uint32_t hash(const std::string& s, uint32_t h)
+	{
+		for (char c : s)
+		{
+			h = (h ^ uint8_t(c)) * 16777619u;
+		}
+		return h;
+	}
+
+private:
+	std::vector<Entry> m_entries;
+	std::vector<int> m_slots;  // Index in m_entries, or -1
+	uint32_t m_seed;
+	uint32_t m_mask;
+
+	/** Try to place all entries with @p seed; false if two collide. */
+	bool place(uint32_t seed)
+	{
+		m_slots.assign(m_mask + 1, -1);
+		for (size_t i = 0; i < m_entries.size(); i++)
+		{
+			int& slot = m_slots[hash(m_entries[i].name, seed) & m_mask];
+			if (slot >= 0)
+			{
+				return false;
+			}
+			slot = int(i);
+		}
+		m_seed = seed;
+		return true;
+	}
+
+public:
+	VerbTable(std::initializer_list<Entry> entries) :
+		m_entries(entries),
+		m_seed(0),
+		m_mask(1)
+	{
+		while (m_mask + 1 < 2 * m_entries.size())
+		{
+			m_mask = (m_mask << 1) | 1;
+		}
+		for (uint32_t attempt = 0; !place(2166136261u + attempt * 0x9e3779b9u); attempt++)
+		{
+			// After a while, try a bigger table
+			if (attempt % 64 == 63)
+			{
+				m_mask = (m_mask << 1) | 1;
+			}
+		}
+	}
+
+	/** Index of @p verb in the table, or -1 if it is not there. */
+	int index(const std::string& verb) const
+	{
+		int i = m_slots[hash(verb, m_seed) & m_mask];
+		return ((i >= 0) && (verb == m_entries[i].name)) ? i : -1;
+	}
+
+	/** Handler for @p verb, or nullptr if it is not in the table. */
+	const Handler* find(const std::string& verb) const
+	{
+		int i = index(verb);
+		return (i >= 0) ? &m_entries[i].handler : nullptr;
+	}
+
+	size_t size() const { return m_entries.size(); }
+	const char* name(size_t i) const { return m_entries[i].name; }
+} ;
+
 class VerbDispatcher
 {
 public:
 	using Values = picojson::value;
 	using Object = picojson::value::object;
 
-
 	virtual int exec(const std::string& verb, const Values& values, Object& response) = 0;
 
+	/**
+	 * Like exec(), with the request as it was parsed from the input
+	 * (see jsondom.h) instead of picojson. Dispatchers can override
+	 * this to read requests without copying them; the default
+	 * implementation converts @p values to picojson and calls exec().
+	 */
+	virtual int exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response);
+
+	/**
+	 * Verbs whose response can be too large to build in memory
+	 * first (e.g. search results) may write it straight to the
+	 * output instead: if is_streamed() returns true for a verb,
+	 * exec_streamed() is called for it instead of exec().
+	 *
+	 * The response is then sent with HTTP status 200 before
+	 * the verb has run. The default implementations stream
+	 * nothing, and call exec() and write the whole response.
+	 */
+	virtual bool is_streamed(const std::string& verb) const;
+	virtual int exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response);
+	/// Like exec_document(), for exec_streamed(); the default converts to picojson
+	virtual int exec_streamed_document(const std::string& verb, const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response);
+
+	/**
+	 * The batch verb: runs each of the requests in the array
+	 * @p values["requests"] (objects with a verb, as in a single
+	 * request) in order, and writes an object with key "responses",
+	 * an array with the response to each. A request that returns
+	 * an error stops the batch.
+	 *
+	 * If @p values["pipeline"] is true, exec_pipelined() may
+	 * take over runs of requests.
+	 */
+	int exec_batch(const Values& values, SteamWorks::JSON::Writer& response);
+
 	/**
 	 * If this dispatcher has anything to poll (regardless of
 	 * select() on the file-descriptors it might be watching)
@@ -27,6 +172,32 @@ public:
 	 * The default implementation does nothing.
 	 */
 	virtual void poll();
+
+	/**
+	 * Index of @p verb among the verbs of this dispatcher (the order
+	 * of its VerbTable), or -1 if it has no such verb; and the name
+	 * of the verb at index @p i, or nullptr if there is none. These
+	 * are for keeping metrics per verb.
+	 *
+	 * The default implementations know no verbs.
+	 */
+	virtual int verb_index(const std::string& verb) const;
+	virtual const char* verb_name(size_t i) const;
+
+protected:
+	/**
+	 * Run (part of) the run of requests starting at @p first in a
+	 * pipelined batch, e.g. by sending all the LDAP searches before
+	 * waiting for the results of the first one. Write a response
+	 * object for each request that is run, and return the number
+	 * of requests run (which may be 0, to run the first as usual).
+	 *
+	 * The default implementation runs none.
+	 */
+	virtual size_t exec_pipelined(const picojson::array& requests, size_t first, SteamWorks::JSON::Writer& response);
+
+	/** Run one @p request of a batch, and write its response. */
+	int exec_one(const Values& request, SteamWorks::JSON::Writer& response);
 } ;
 
 #endif
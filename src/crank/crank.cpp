@@ -7,70 +7,216 @@ Adriaan de Groot <groot@kde.org>
 
 #include "crank.h"
 
+#include "swldap/pool.h"
 #include "swldap/search.h"
 #include "swldap/serverinfo.h"
 
+#include "jobs.h"
 #include "jsonresponse.h"
 #include "logger.h"
 
+#include <mutex>
+#include <vector>
+
+static unsigned int connections = 1;
+
+/**
+ * Requests may be handled in several threads at once, so each
+ * one leases a connection from the pool (which is replaced by
+ * connect and stop).
+ */
 class CrankDispatcher::Private
 {
 friend class CrankDispatcher;
 private:
-	std::unique_ptr<SteamWorks::LDAP::Connection> connection;
+	std::mutex mutex;
+	SteamWorks::LDAP::ConnectionPoolSPtr pool;
+
+	// Verbs that were asked to run in the background
+	SteamWorks::JobQueue jobs;
 
 public:
 	Private() :
-		connection(nullptr)
+		pool(nullptr)
 	{
 	}
 
 	~Private()
 	{
 	}
+
+	SteamWorks::LDAP::ConnectionPoolSPtr get_pool()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return pool;
+	}
+
+	void set_pool(const SteamWorks::LDAP::ConnectionPoolSPtr& p)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pool = p;
+	}
+
+	/**
+	 * Lease a connection from the pool, or log @p what and return
+	 * false if there is no (working) connection.
+	 */
+	bool lease(std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease>& connection, const char* what, Object& response)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
+
+		auto p = get_pool();
+		if (!p)
+		{
+			log.debugStream() << what << " on disconnected server.";
+			return false;
+		}
+		connection.reset(new SteamWorks::LDAP::ConnectionPool::Lease(p->acquire()));
+		if (!connection->is_valid())
+		{
+			log.debugStream() << what << " could not connect to " << p->get_uri();
+			SteamWorks::JSON::simple_output(response, 503, "Could not connect to server");
+			return false;
+		}
+		return true;
+	}
 } ;
 
+void CrankDispatcher::set_connections(unsigned int n)
+{
+	connections = n ? n : 1;
+}
+
 CrankDispatcher::CrankDispatcher() :
 	m_state(disconnected),
 	d(new CrankDispatcher::Private())
 {
 }
 
+CrankDispatcher::~CrankDispatcher()
+{
+	// Jobs run verbs on this dispatcher
+	d->jobs.stop();
+}
+
+const VerbTable<CrankDispatcher::Handler> CrankDispatcher::s_verbs =
+{
+	{ "connect", &CrankDispatcher::do_connect },
+	{ "stop", &CrankDispatcher::do_stop },
+	{ "search", &CrankDispatcher::do_search },
+	{ "typeinfo", &CrankDispatcher::do_typeinfo },
+	{ "update", &CrankDispatcher::do_update },
+	{ "delete", &CrankDispatcher::do_delete },
+	{ "add", &CrankDispatcher::do_add },
+	{ "serverinfo", &CrankDispatcher::do_serverinfo },
+	{ "serverstatus", &CrankDispatcher::do_serverstatus },
+	{ "job", &CrankDispatcher::do_job },
+} ;
+
+const VerbTable<CrankDispatcher::StreamHandler> CrankDispatcher::s_streamed_verbs =
+{
+	{ "search", &CrankDispatcher::do_search },
+} ;
+
+const VerbTable<CrankDispatcher::DocumentHandler> CrankDispatcher::s_document_verbs =
+{
+	{ "search", &CrankDispatcher::do_search },
+	{ "update", &CrankDispatcher::do_update },
+	{ "add", &CrankDispatcher::do_add },
+} ;
+
+const VerbTable<CrankDispatcher::StreamDocumentHandler> CrankDispatcher::s_streamed_document_verbs =
+{
+	{ "search", &CrankDispatcher::do_search },
+} ;
+
 int CrankDispatcher::exec(const std::string& verb, const Values& values, Object& response)
 {
-	if (verb == "connect") return do_connect(values, response);
-	else if (verb == "stop") return do_stop(values);
-	else if (verb == "search") return do_search(values, response);
-	else if (verb == "typeinfo") return do_typeinfo(values, response);
-	else if (verb == "update") return do_update(values, response);
-	else if (verb == "delete") return do_delete(values, response);
-	else if (verb == "add") return do_add(values, response);
-	else if (verb == "serverinfo") return do_serverinfo(values, response);
-	else if (verb == "serverstatus") return do_serverstatus(values, response);
-	else {
-		std::string s("Unknown verb '");
-		s.append(verb);
-		s.append("', ignored.");
-		SteamWorks::JSON::simple_output(response, 500, s.c_str());
-		return 0;
+	auto handler = s_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
+	}
+
+	std::string s("Unknown verb '");
+	s.append(verb);
+	s.append("', ignored.");
+	SteamWorks::JSON::simple_output(response, 500, s.c_str());
+	return 0;
+}
+
+int CrankDispatcher::exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response)
+{
+	auto handler = s_document_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
+	}
+	return VerbDispatcher::exec_document(verb, values, response);
+}
+
+int CrankDispatcher::verb_index(const std::string& verb) const
+{
+	return s_verbs.index(verb);
+}
+
+const char* CrankDispatcher::verb_name(size_t i) const
+{
+	return i < s_verbs.size() ? s_verbs.name(i) : nullptr;
+}
+
+bool CrankDispatcher::is_streamed(const std::string& verb) const
+{
+	return s_streamed_verbs.find(verb) != nullptr;
+}
+
+int CrankDispatcher::exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response)
+{
+	auto handler = s_streamed_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
 	}
+	return VerbDispatcher::exec_streamed(verb, values, response);
+}
+
+int CrankDispatcher::exec_streamed_document(const std::string& verb, const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response)
+{
+	auto handler = s_streamed_document_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
+	}
+	return VerbDispatcher::exec_streamed_document(verb, values, response);
 }
 
 int CrankDispatcher::do_connect(const Values& values, Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
-	if (SteamWorks::LDAP::do_connect(d->connection, values, response, log))
+	SteamWorks::LDAP::ConnectionUPtr connection;
+	if (SteamWorks::LDAP::do_connect(connection, values, response, log))
 	{
+		SteamWorks::LDAP::ConnectionPoolSPtr pool(new SteamWorks::LDAP::ConnectionPool(
+			values.get("uri").to_string(),
+			values.get("user").to_string(),
+			values.get("password").to_string(),
+			connections));
+		pool->add(std::move(connection));
+		d->set_pool(pool);
 		m_state = connected;
 	}
+	else
+	{
+		d->set_pool(nullptr);
+	}
 	// Always return 0 because we don't want the FCGI to stop.
 	return 0;
 }
 
-int CrankDispatcher::do_stop(const Values& values)
+int CrankDispatcher::do_stop(const Values& values, Object& response)
 {
 	m_state = stopped;
-	d->connection.reset(nullptr);
+	d->set_pool(nullptr);
 	return -1;
 }
 
@@ -115,131 +261,237 @@ int CrankDispatcher::do_serverstatus(const Values& values, Object& response)
 	return 0;
 }
 
-int CrankDispatcher::do_search(const Values& values, Object& response)
+/** Runs the search for @p base and @p filter on @p connection. */
+static int _search(SteamWorks::LDAP::Connection& connection, const std::string& base, const std::string& filter, VerbDispatcher::Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
 
-	if (m_state != connected)
-	{
-		log.debugStream() << "Search on disconnected server.";
-		return 0;
-	}
-
-	std::string base = values.get("base").to_string();
-	std::string filter = values.get("filter").to_string();
-
 	log.debugStream() << "Search parameter base=" << base;
 	log.debugStream() << "Search         filter=" << filter;
 
 	// TODO: check authorization for this query
 	SteamWorks::LDAP::Search search(base, filter);
-	search.execute(*d->connection, &response);
+	search.execute(connection, &response);
 	return 0;
 }
 
-int CrankDispatcher::do_typeinfo(const Values& values, Object& response)
+/** The search of the request @p values, as a job. */
+static int _search_job(SteamWorks::LDAP::Connection& connection, const VerbDispatcher::Values& values, VerbDispatcher::Object& response)
+{
+	return _search(connection, values.get("base").to_string(), values.get("filter").to_string(), response);
+}
+
+int CrankDispatcher::search(const std::string& base, const std::string& filter, Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
 
 	if (m_state != connected)
 	{
-		log.debugStream() << "Typeinfo on disconnected server.";
+		log.debugStream() << "Search on disconnected server.";
 		return 0;
 	}
 
-	SteamWorks::LDAP::TypeInfo search;
-	search.execute(*d->connection, &response);
-	return 0;
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, "Search", response))
+	{
+		return 0;
+	}
+	return _search(**connection, base, filter, response);
 }
 
+int CrankDispatcher::search(const std::string& base, const std::string& filter, SteamWorks::JSON::Writer& response)
+{
+	// Results are written as they are found; only the error
+	// messages (if any) are built up first.
+	Object errors;
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
 
+	response.begin_object();
+	if ((m_state == connected) && d->lease(connection, "Search", errors))
+	{
+		// TODO: check authorization for this query
+		SteamWorks::LDAP::Search search(base, filter);
+		search.execute(**connection, response);
+	}
+	response.members(errors);
+	response.end_object();
+	return 0;
+}
 
-int CrankDispatcher::do_update(const Values& values, Object& response)
+int CrankDispatcher::do_search(const Values& values, Object& response)
 {
-	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
+	if (SteamWorks::JobQueue::wants_job(values))
+	{
+		return submit_job("search", _search_job, values, response);
+	}
+	return search(values.get("base").to_string(), values.get("filter").to_string(), response);
+}
 
-	if (m_state != connected)
+int CrankDispatcher::do_search(const Values& values, SteamWorks::JSON::Writer& response)
+{
+	if (SteamWorks::JobQueue::wants_job(values))
 	{
-		log.debugStream() << "Update on disconnected server.";
+		Object job;
+		submit_job("search", _search_job, values, job);
+		response.begin_object().members(job).end_object();
 		return 0;
 	}
+	return search(values.get("base").to_string(), values.get("filter").to_string(), response);
+}
 
-	picojson::value v = values.get("values");
-	if (!v.is<picojson::array>())
+int CrankDispatcher::do_search(const SteamWorks::JSON::Node& values, Object& response)
+{
+	if (SteamWorks::JobQueue::wants_job(values))
 	{
-		log.debugStream() << "Update json is not an array of updates.";
-		return 0;
+		return do_search(values.to_picojson(), response);  // The job keeps a copy
 	}
+	return search(values.get("base").to_str(), values.get("filter").to_str(), response);
+}
 
-	for (unsigned int count = 0; ; count++)
+int CrankDispatcher::do_search(const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response)
+{
+	if (SteamWorks::JobQueue::wants_job(values))
 	{
-		log.debugStream() << "Updating #" << count;
+		return do_search(values.to_picojson(), response);
+	}
+	return search(values.get("base").to_str(), values.get("filter").to_str(), response);
+}
 
-		SteamWorks::LDAP::Update u(v.get(count));
-		if (u.is_valid())
+size_t CrankDispatcher::exec_pipelined(const picojson::array& requests, size_t first, SteamWorks::JSON::Writer& response)
+{
+	size_t last = first;
+	while ((last < requests.size()) &&
+		requests[last].is<picojson::object>() &&
+		(requests[last].get("verb").to_string() == "search") &&
+		!SteamWorks::JobQueue::wants_job(requests[last]))
+	{
+		last++;
+	}
+	if ((last - first < 2) || (m_state != connected))
+	{
+		return 0;  // Nothing to overlap
+	}
+
+	Object errors;
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, "Search", errors))
+	{
+		return 0;  // Each search reports this on its own
+	}
+
+	std::vector<std::unique_ptr<SteamWorks::LDAP::Search>> searches;
+	std::vector<int> msgids;
+	for (size_t i = first; i < last; i++)
+	{
+		// TODO: check authorization for this query
+		searches.emplace_back(new SteamWorks::LDAP::Search(requests[i].get("base").to_string(), requests[i].get("filter").to_string()));
+		msgids.push_back(searches.back()->start(**connection));
+	}
+	for (size_t i = 0; i < searches.size(); i++)
+	{
+		response.begin_object();
+		searches[i]->finish(**connection, msgids[i], response);
+		response.end_object();
+	}
+	return last - first;
+}
+
+int CrankDispatcher::do_job(const Values& values, Object& response)
+{
+	return d->jobs.do_job(values, response);
+}
+
+int CrankDispatcher::submit_job(const char* verb, JobHandler handler, const Values& values, Object& response)
+{
+	// The job takes what it needs now: the request, and the pool of
+	// the server it is connected to. It does not look at the state of
+	// the dispatcher, which a connect or stop may change meanwhile.
+	// It opens a connection of its own, like the jobs of the Pulley,
+	// rather than holding one of the pool that requests wait for.
+	Values request(values);
+	request.get<picojson::object>().erase("job");
+	SteamWorks::LDAP::ConnectionPoolSPtr pool = (m_state == connected) ? d->get_pool() : nullptr;
+	std::string what(verb);
+	d->jobs.submit(verb, [handler, request, pool, what](Object& result)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
+		if (!pool)
 		{
-			u.execute(*d->connection, &response);
-			log.debugStream() << "Completed #" << count;
+			log.debugStream() << what << " job on disconnected server.";
+			return 0;
 		}
-		else
+		SteamWorks::LDAP::ConnectionUPtr connection = pool->connect();
+		if (!connection->is_valid())
 		{
-			break;
+			log.debugStream() << what << " job could not connect to " << pool->get_uri();
+			SteamWorks::JSON::simple_output(result, 503, "Could not connect to server");
+			return 0;
 		}
-	}
+		return handler(*connection, request, result);
+	}, response);
 	return 0;
 }
 
-int CrankDispatcher::do_delete(const Values& values, Object& response)
+int CrankDispatcher::do_typeinfo(const Values& values, Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
 
 	if (m_state != connected)
 	{
-		log.debugStream() << "Update on disconnected server.";
+		log.debugStream() << "Typeinfo on disconnected server.";
 		return 0;
 	}
 
-	std::string dn = values.get("dn").to_string();
-	if (dn.empty())
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, "Typeinfo", response))
 	{
-		log.debugStream() << "Can't delete with an empty DN.";
-		// TODO: error in the response object?
 		return 0;
 	}
 
-	SteamWorks::LDAP::Remove r(dn);
-	if (r.is_valid())
-	{
-		r.execute(*d->connection, &response);
-	}
+	SteamWorks::LDAP::TypeInfo search;
+	search.execute(**connection, &response);
 	return 0;
 }
 
-int CrankDispatcher::do_add(const Values& values, Object& response)
+
+
+static bool _is_array(const picojson::value& v) { return v.is<picojson::array>(); }
+static bool _is_array(const SteamWorks::JSON::Node& v) { return v.is_array(); }
+static const picojson::value& _element(const picojson::value& v, size_t i) { return v.get(i); }
+static const SteamWorks::JSON::Node& _element(const SteamWorks::JSON::Node& v, size_t i) { return v[i]; }
+
+template<typename Action, typename V>
+int CrankDispatcher::modify(const char* what, const V& values, Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
 
 	if (m_state != connected)
 	{
-		log.debugStream() << "Add on disconnected server.";
+		log.debugStream() << what << " on disconnected server.";
 		return 0;
 	}
 
-	picojson::value v = values.get("values");
-	if (!v.is<picojson::array>())
+	const V& v = values.get("values");
+	if (!_is_array(v))
+	{
+		log.debugStream() << what << " json is not an array of changes.";
+		return 0;
+	}
+
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, what, response))
 	{
-		log.debugStream() << "Add json is not an array of additions.";
 		return 0;
 	}
 
 	for (unsigned int count = 0; ; count++)
 	{
-		log.debugStream() << "Add #" << count;
+		log.debugStream() << what << " #" << count;
 
-		SteamWorks::LDAP::Addition u(v.get(count));
+		Action u(_element(v, count));
 		if (u.is_valid())
 		{
-			u.execute(*d->connection, &response);
+			u.execute(**connection, &response);
 			log.debugStream() << "Completed #" << count;
 		}
 		else
@@ -248,11 +500,59 @@ int CrankDispatcher::do_add(const Values& values, Object& response)
 		}
 	}
 	return 0;
+}
 
+int CrankDispatcher::do_update(const Values& values, Object& response)
+{
+	return modify<SteamWorks::LDAP::Update>("Update", values, response);
+}
 
+int CrankDispatcher::do_update(const SteamWorks::JSON::Node& values, Object& response)
+{
+	return modify<SteamWorks::LDAP::Update>("Update", values, response);
 }
 
+int CrankDispatcher::do_delete(const Values& values, Object& response)
+{
+	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.crank");
 
+	if (m_state != connected)
+	{
+		log.debugStream() << "Update on disconnected server.";
+		return 0;
+	}
+
+	std::string dn = values.get("dn").to_string();
+	if (dn.empty())
+	{
+		log.debugStream() << "Can't delete with an empty DN.";
+		// TODO: error in the response object?
+		return 0;
+	}
+
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, "Delete", response))
+	{
+		return 0;
+	}
+
+	SteamWorks::LDAP::Remove r(dn);
+	if (r.is_valid())
+	{
+		r.execute(**connection, &response);
+	}
+	return 0;
+}
+
+int CrankDispatcher::do_add(const Values& values, Object& response)
+{
+	return modify<SteamWorks::LDAP::Addition>("Add", values, response);
+}
+
+int CrankDispatcher::do_add(const SteamWorks::JSON::Node& values, Object& response)
+{
+	return modify<SteamWorks::LDAP::Addition>("Add", values, response);
+}
 
 int CrankDispatcher::do_serverinfo(const Values& values, Object& response)
 {
@@ -264,8 +564,14 @@ int CrankDispatcher::do_serverinfo(const Values& values, Object& response)
 		return 0;
 	}
 
+	std::unique_ptr<SteamWorks::LDAP::ConnectionPool::Lease> connection;
+	if (!d->lease(connection, "ServerInfo", response))
+	{
+		return 0;
+	}
+
 	SteamWorks::LDAP::ServerControlInfo info;
-	info.execute(*d->connection, &response);
+	info.execute(**connection, &response);
 
 	return 0;
 }
@@ -8,10 +8,19 @@ Adriaan de Groot <groot@kde.org>
 #ifndef STEAMWORKS_CRANK_H
 #define STEAMWORKS_CRANK_H
 
+#include <atomic>
 #include <memory>
 
 #include "verb.h"
 
+namespace SteamWorks
+{
+namespace LDAP
+{
+class Connection;
+}
+}
+
 class CrankDispatcher : public VerbDispatcher
 {
 private:
@@ -19,30 +28,70 @@ private:
 	std::unique_ptr<Private> d;
 
 	typedef enum { disconnected=0, connected, stopped } State;
-	State m_state;
+	std::atomic<State> m_state;
+
+	using Handler = int (CrankDispatcher::*)(const Values&, Object&);
+	using StreamHandler = int (CrankDispatcher::*)(const Values&, SteamWorks::JSON::Writer&);
+	// Verbs that read the request document without converting it (see VerbDispatcher::exec_document())
+	using DocumentHandler = int (CrankDispatcher::*)(const SteamWorks::JSON::Node&, Object&);
+	using StreamDocumentHandler = int (CrankDispatcher::*)(const SteamWorks::JSON::Node&, SteamWorks::JSON::Writer&);
+	static const VerbTable<DocumentHandler> s_document_verbs;
+	static const VerbTable<StreamDocumentHandler> s_streamed_document_verbs;
+	/// Runs a verb as a job, on a connection of its own
+	using JobHandler = int (*)(SteamWorks::LDAP::Connection&, const Values&, Object&);
+	static const VerbTable<Handler> s_verbs;
+	static const VerbTable<StreamHandler> s_streamed_verbs;
 
 public:
 	CrankDispatcher();
+	~CrankDispatcher();
+
+	/** Each connect opens up to @p n connections to the LDAP server,
+	 *  so that @p n requests can use it at once; the default is 1. */
+	static void set_connections(unsigned int n);
 
 	virtual int exec(const std::string& verb, const Values& values, Object& response) override;
+	virtual int exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response) override;
+	virtual bool is_streamed(const std::string& verb) const override;
+	virtual int exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response) override;
+	virtual int exec_streamed_document(const std::string& verb, const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response) override;
+	virtual int verb_index(const std::string& verb) const override;
+	virtual const char* verb_name(size_t i) const override;
 
 	State state() const { return m_state; }
 
 protected:
 	// Generic commands
 	int do_connect(const Values& values, Object& response);
-	int do_stop(const Values& values);
+	int do_stop(const Values& values, Object& response);
 	int do_serverinfo(const Values& values, Object& response);
 	int do_serverstatus(const Values& values, Object& response);
 
 	// LDAP search / update etc.
 	int do_search(const Values& values, Object& response);
+	int do_search(const Values& values, SteamWorks::JSON::Writer& response);
+	int do_search(const SteamWorks::JSON::Node& values, Object& response);
+	int do_search(const SteamWorks::JSON::Node& values, SteamWorks::JSON::Writer& response);
 	int do_update(const Values& values, Object& response);
+	int do_update(const SteamWorks::JSON::Node& values, Object& response);
 	int do_delete(const Values& values, Object& response);
 	int do_add(const Values& values, Object& response);
+	int do_add(const SteamWorks::JSON::Node& values, Object& response);
+
+	// Search, add and update, for requests in either form
+	int search(const std::string& base, const std::string& filter, Object& response);
+	int search(const std::string& base, const std::string& filter, SteamWorks::JSON::Writer& response);
+	template<typename Action, typename V> int modify(const char* what, const V& values, Object& response);
 
 	// Meta-information about the server
 	int do_typeinfo(const Values& values, Object& response);
+
+	// Status and results of verbs run as jobs (e.g. search with "job": true)
+	int do_job(const Values& values, Object& response);
+	int submit_job(const char* verb, JobHandler handler, const Values& values, Object& response);
+
+	// Sends consecutive searches in a batch before waiting for results
+	virtual size_t exec_pipelined(const picojson::array& requests, size_t first, SteamWorks::JSON::Writer& response) override;
 } ;
 
 
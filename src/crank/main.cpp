@@ -5,20 +5,139 @@ All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
 Adriaan de Groot <groot@kde.org>
 */
 
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
 #include "fcgi.h"
 #include "logger.h"
 
 #include "crank.h"
 
+static const char progname[] = "Crank";
+static const char version[] = "v0.1";
 static const char* copyright = "Copyright (C) 2014, 2015 InternetWide.org and the ARPA2.net project";
 
+static void version_info()
+{
+	printf("SteamWorks %s %s\n", progname, version);
+	printf("%s\n", copyright);
+}
+
+static void version_usage()
+{
+	printf(R"(
+Usage:
+    crank [-w workers] [-c connections] [-m bytes] [-k]
+\n\n)");
+}
+
+static void version_help()
+{
+	version_info();
+	printf(R"(
+Use the Crank to view and edit the LDAP server it connects to,
+through a web interface.
+
+With -w, the Crank handles up to <workers> requests at once,
+each in a thread of its own, so that a slow LDAP search does
+not hold up other users. Each connect then opens up to
+<connections> connections to the LDAP server, which the
+requests take turns using; by default, one per worker.
+Searches that run as a job ("job": true) open a connection of
+their own, so they do not keep requests waiting.
+
+Requests with more than <bytes> of JSON data (the default is
+1MiB) are refused; -m raises this for large updates.
+
+With -k, connections from the web server are kept open for more
+requests, and one connection may carry several requests at once,
+if the web server asks for that. The requests are then handled
+one at a time, so -w does not apply.
+
+)");
+	version_usage();
+}
+
 int main(int argc, char** argv)
 {
 	SteamWorks::Logging::Manager logManager("crank.properties");
 	SteamWorks::Logging::getRoot().debugStream() << "Steamworks Crank " << copyright;
 
+	const struct option longopts[] =
+	{
+		{"version",     no_argument,        0, 'v'},
+		{"help",        no_argument,        0, 'h'},
+		{"workers",     required_argument,  0, 'w'},
+		{"connections", required_argument,  0, 'c'},
+		{"max-request", required_argument,  0, 'm'},
+		{"keep-alive",  no_argument,        0, 'k'},
+		{0,0,0,0},
+	};
+
+	bool carry_on = true;
+	int index;
+	int iarg = 0;
+	int workers = 1;
+	int connections = 0;
+	bool keep_alive = false;
+
+	while (iarg != -1)
+	{
+		iarg = getopt_long(argc, argv, "vhw:c:m:k", longopts, &index);
+
+		switch (iarg)
+		{
+		case 'v':
+			version_info();
+			carry_on = false;
+			break;
+		case 'h':
+			version_help();
+			carry_on = false;
+			break;
+		case 'w':
+			workers = atoi(optarg);
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'm':
+			SteamWorks::FCGI::set_max_request(strtoul(optarg, nullptr, 10));
+			break;
+		case 'k':
+			keep_alive = true;
+			break;
+		case '?':
+			carry_on = false;
+			break;
+		case -1:
+			// End of options, detected next time around
+			break;
+		default:
+			abort();
+		}
+	}
+	if (!carry_on)
+	{
+		// Either --help or --version or an option error
+		return 1;
+	}
+	if (workers < 1)
+	{
+		workers = 1;
+	}
+	CrankDispatcher::set_connections(connections > 0 ? connections : workers);
+
 	CrankDispatcher* dispatcher = new CrankDispatcher();
 	SteamWorks::FCGI::init_logging("crank.fcgi");
-	SteamWorks::FCGI::mainloop(dispatcher);
+	if (keep_alive)
+	{
+		SteamWorks::FCGI::mainloop_multiplexed(dispatcher);
+	}
+	else
+	{
+		SteamWorks::FCGI::mainloop(dispatcher, workers);
+	}
 	return 0;
 }
@@ -6,6 +6,7 @@ Adriaan de Groot <groot@kde.org>
 */
 
 #include <getopt.h>
+#include <stdlib.h>
 
 #include "fcgi.h"
 #include "logger.h"
@@ -28,7 +29,7 @@ static void version_usage()
 {
 	printf(R"(
 Usage:
-    pulley [-L libdir] scriptfile [...]
+    pulley [-L libdir] [-q depth] [-j journaldir] [-s statsfile] [-k] scriptfile [...]
 \n\n)");
 }
 
@@ -43,6 +44,23 @@ backends available on the system.
 Backend plug-ins will be loaded from <libdir>. The PulleyScript
 scripts are read once, at start-up.
 
+With -q, each backend instance gets a queue of <depth> operations
+and a thread of its own that delivers them, so that slow backends
+do not hold up the Pulley. Such backends finish transactions on
+their own and cannot veto the commit of other backends.
+
+With -j, output that a backend could not take is kept in a journal
+in <journaldir> and delivered again with the next transaction, also
+after a restart. Without -j, that output is lost.
+
+With -s, the Pulley counts the calls into each backend and how
+long they take, and writes this to <statsfile> every 10 seconds,
+in the Prometheus text format. The stats verb returns it too.
+
+With -k, connections from the web server are kept open for more
+requests, and one connection may carry several requests at once,
+if the web server asks for that.
+
 )");
 	version_usage();
 }
@@ -57,6 +75,10 @@ int main(int argc, char** argv)
 	{
 		{"version",   no_argument,        0, 'v'},
 		{"help",      no_argument,        0, 'h'},
+		{"queue",     required_argument,  0, 'q'},
+		{"journal",   required_argument,  0, 'j'},
+		{"stats",     required_argument,  0, 's'},
+		{"keep-alive", no_argument,       0, 'k'},
 		/* {"libdir",    required_argument,  0, 'L'}, */
 		{0,0,0,0},
 	};
@@ -65,10 +87,11 @@ int main(int argc, char** argv)
 	bool carry_on = true;
 	int index;
 	int iarg = 0;
+	bool keep_alive = false;
 
 	while (iarg != -1)
 	{
-		iarg = getopt_long(argc, argv, "vh", longopts, &index);
+		iarg = getopt_long(argc, argv, "vhq:j:s:k", longopts, &index);
 
 		switch (iarg)
 		{
@@ -80,6 +103,18 @@ int main(int argc, char** argv)
 			version_help();
 			carry_on = false;
 			break;
+		case 'q':
+			SteamWorks::PulleyBack::Loader::set_queue_depth(atoi(optarg));
+			break;
+		case 'j':
+			SteamWorks::PulleyScript::Parser::set_journal_dir(optarg);
+			break;
+		case 's':
+			PulleyDispatcher::set_stats_file(optarg);
+			break;
+		case 'k':
+			keep_alive = true;
+			break;
 /*
 		case 'L':
 			log.debugStream() << "-L" << optarg;
@@ -116,7 +151,14 @@ int main(int argc, char** argv)
 	}
 
 	SteamWorks::FCGI::init_logging("pulley.fcgi");
-	SteamWorks::FCGI::mainloop(dispatcher);
+	if (keep_alive)
+	{
+		SteamWorks::FCGI::mainloop_multiplexed(dispatcher);
+	}
+	else
+	{
+		SteamWorks::FCGI::mainloop(dispatcher);
+	}
 
 	return 0;
 }
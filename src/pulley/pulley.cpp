@@ -5,15 +5,22 @@ All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
 Adriaan de Groot <groot@kde.org>
 */
 
+#include <algorithm>
+#include <chrono>
 #include <forward_list>
+#include <mutex>
+#include <set>
+#include <sstream>
 
 #include "pulley.h"
 #include "pulleyscript/parserpp.h"
+#include "pulleyscript/stats.h"
 
 #include "swldap/connection.h"
 #include "swldap/serverinfo.h"
 #include "swldap/sync.h"
 
+#include "jobs.h"
 #include "jsonresponse.h"
 #include "logger.h"
 
@@ -21,12 +28,32 @@ class PulleySyncRepl : public SteamWorks::LDAP::SyncRepl
 {
 protected:
 	std::shared_ptr<SteamWorks::PulleyScript::Parser> m_prs;
+	std::mutex* m_lock;  // Held around changes to the parser
+
+	// Followers that were started by a job have a connection of their own
+	std::shared_ptr<SteamWorks::LDAP::Connection> m_connection;
 
 public:
-	PulleySyncRepl(const std::string& base, const std::string& filter, std::shared_ptr<SteamWorks::PulleyScript::Parser> parser) :
+	PulleySyncRepl(const std::string& base, const std::string& filter, std::shared_ptr<SteamWorks::PulleyScript::Parser> parser, std::mutex* lock) :
 		SyncRepl(base, filter),
-		m_prs(parser)
+		m_prs(parser),
+		m_lock(lock)
+	{
+	}
+
+	void set_parser(std::shared_ptr<SteamWorks::PulleyScript::Parser> parser)
+	{
+		m_prs = parser;
+	}
+
+	SteamWorks::LDAP::Connection* connection() const
 	{
+		return m_connection.get();
+	}
+
+	void set_connection(const std::shared_ptr<SteamWorks::LDAP::Connection>& connection)
+	{
+		m_connection = connection;
 	}
 
 protected:
@@ -37,12 +64,14 @@ protected:
 void PulleySyncRepl::after_modification(const std::string& removed)
 {
 	// SteamWorks::LDAP::SyncRepl::after_modification(removed);
+	std::lock_guard<std::mutex> lock(*m_lock);
 	m_prs->remove_entry(removed);
 }
 
 void PulleySyncRepl::after_modification(const std::string& modified, const picojson::object& values)
 {
 	// SteamWorks::LDAP::SyncRepl::after_modification(modified, values);
+	std::lock_guard<std::mutex> lock(*m_lock);
 	m_prs->remove_entry(modified);
 	m_prs->add_entry(modified, values);
 }
@@ -54,6 +83,7 @@ friend class PulleyDispatcher;
 private:
 	using ConnectionUPtr = std::unique_ptr<SteamWorks::LDAP::Connection>;
 	ConnectionUPtr m_connection;
+	std::string m_uri;
 
 	using SyncReplUPtr = std::unique_ptr<PulleySyncRepl>;
 	std::forward_list<SyncReplUPtr> m_following;
@@ -61,10 +91,26 @@ private:
 	using ParserSPtr = std::shared_ptr<SteamWorks::PulleyScript::Parser>;
 	ParserSPtr m_parser;
 
+	// Attribute syntaxes from the server, for typed backend output
+	SteamWorks::LDAP::TypeInfo::Syntaxes m_syntaxes;
+
+	// Jobs run SyncRepl refreshes in another thread, on a connection
+	// of their own, while the followers here keep being polled. Their
+	// followers are handed back through m_done, and join m_following
+	// in the next poll().
+	SteamWorks::JobQueue m_jobs;
+	std::mutex m_parser_mutex;
+	std::mutex m_done_mutex;
+	std::forward_list<SyncReplUPtr> m_done;
+	unsigned int m_done_jobs;  // Protected by m_done_mutex
+	unsigned int m_pending;  // Jobs whose followers have not joined yet
+
 public:
 	Private() :
 		m_connection(nullptr),
-		m_parser(nullptr)
+		m_parser(nullptr),
+		m_done_jobs(0),
+		m_pending(0)
 	{
 	}
 
@@ -74,7 +120,7 @@ public:
 
 	int add_follower(const std::string& base, const std::string& filter, Object& response)
 	{
-		m_following.emplace_front(new PulleySyncRepl(base, filter, m_parser));
+		m_following.emplace_front(new PulleySyncRepl(base, filter, m_parser, &m_parser_mutex));
 		m_following.front()->execute(*m_connection, &response);
 		return 0;
 	}
@@ -96,6 +142,72 @@ public:
 		return 0;
 	}
 
+	SteamWorks::LDAP::Connection& connection_for(const SyncReplUPtr& f)
+	{
+		return f->connection() ? *f->connection() : *m_connection;
+	}
+
+	/**
+	 * Open a connection for a job (in the job's thread), to the
+	 * server at @p uri; returns nullptr if that fails.
+	 */
+	static std::shared_ptr<SteamWorks::LDAP::Connection> job_connection(const std::string& uri, Object& result)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.pulley");
+		ConnectionUPtr connection;
+		if (!SteamWorks::LDAP::do_connect(connection, uri, result, log))
+		{
+			return nullptr;
+		}
+		return std::shared_ptr<SteamWorks::LDAP::Connection>(connection.release());
+	}
+
+	/** Called by a job when it is done with its @p followers. */
+	void job_done(std::forward_list<SyncReplUPtr>& followers)
+	{
+		std::lock_guard<std::mutex> lock(m_done_mutex);
+		m_done.splice_after(m_done.before_begin(), followers);
+		m_done_jobs++;
+	}
+
+	/** Let the followers of finished jobs join the others. */
+	void collect_jobs()
+	{
+		std::lock_guard<std::mutex> lock(m_done_mutex);
+		m_following.splice_after(m_following.before_begin(), m_done);
+		m_pending -= m_done_jobs;
+		m_done_jobs = 0;
+	}
+
+	/**
+	 * Start (or restart, after a resync) the @p followers in a job
+	 * for @p verb. If the job cannot connect, they are handed back
+	 * as they are if @p keep, and dropped otherwise.
+	 */
+	void followers_job(const char* verb, std::shared_ptr<std::forward_list<SyncReplUPtr>> followers, bool keep, Object& response)
+	{
+		std::string uri = m_uri;
+		m_pending++;
+		m_jobs.submit(verb, [this, uri, followers, keep](Object& result)
+		{
+			auto connection = job_connection(uri, result);
+			if (connection)
+			{
+				for (auto& f : *followers)
+				{
+					f->set_connection(connection);
+					f->execute(*connection, &result);
+				}
+			}
+			else if (!keep)
+			{
+				followers->clear();
+			}
+			job_done(*followers);
+			return 0;
+		}, response);
+	}
+
 	void dump_followers(Object& response)
 	{
 		for(auto& f : m_following)
@@ -104,6 +216,14 @@ public:
 		}
 	}
 
+	void dump_followers(SteamWorks::JSON::Writer& response)
+	{
+		for(auto& f : m_following)
+		{
+			f->dump_dit(response);
+		}
+	}
+
 	void resync_followers()
 	{
 		for(auto& f : m_following)
@@ -116,36 +236,234 @@ public:
 	{
 		return std::distance(m_following.cbegin(), m_following.cend());
 	}
+
+	int reload_script(const std::string& filename, std::string base, Object& response)
+	{
+		SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.pulley");
+		log.debugStream() << "Reloading script from '" << filename << '\'';
+
+		if (!m_parser || (m_parser->state() != SteamWorks::PulleyScript::Parser::State::Ready))
+		{
+			log.warnStream() << "No running script to reload.";
+			return 1;
+		}
+
+		ParserSPtr parser(new SteamWorks::PulleyScript::Parser());
+		if (parser->read_file(filename.c_str()) || parser->structural_analysis())
+		{
+			log.warnStream() << "Parser error on reading " << filename;
+			return 1;
+		}
+		parser->set_attribute_syntaxes(m_syntaxes);
+		auto synclist = parser->find_subscriptions();
+		auto needed = [&](const SyncReplUPtr& f) { return std::find(synclist.cbegin(), synclist.cend(), f->filter()) != synclist.cend(); };
+
+		// Take over before the transaction starts, so that it includes
+		// the backends that were taken over. Then, in one transaction,
+		// refill the new generators from the stored DIT, re-drive
+		// output, and remove the entries that only the followers
+		// that are dropped hold.
+		if (parser->take_over(*m_parser))
+		{
+			log.errorStream() << "Could not take over the running script.";
+			return 1;
+		}
+		{
+			auto transaction = parser->begin();
+
+			std::set<std::string> refilled;
+			for (auto& f : m_following)
+			{
+				if (!needed(f))
+				{
+					continue;
+				}
+				f->for_each_entry([&](const std::string& uuid, const picojson::object& values)
+				{
+					if (refilled.insert(uuid).second)
+					{
+						parser->refill_entry(uuid, values);
+					}
+				});
+			}
+			parser->redrive();
+
+			std::set<std::string> removed;
+			for (auto& f : m_following)
+			{
+				if (needed(f))
+				{
+					continue;
+				}
+				f->for_each_entry([&](const std::string& uuid, const picojson::object&)
+				{
+					if (!refilled.count(uuid) && removed.insert(uuid).second)
+					{
+						parser->remove_entry(uuid);
+					}
+				});
+			}
+			log.debugStream() << "  .. removed " << removed.size() << " entries of dropped subscriptions.";
+		}
+
+		m_parser = parser;
+		if (base.empty() && !m_following.empty())
+		{
+			base = m_following.front()->base();
+		}
+
+		// Keep the followers whose filter is still needed, and follow
+		// the filters that are new in a job; their initial refresh
+		// does not hold up the mainloop.
+		m_following.remove_if([&](const SyncReplUPtr& f) { return !needed(f); });
+		for (auto& f : m_following)
+		{
+			f->set_parser(m_parser);
+		}
+		auto followers = std::make_shared<std::forward_list<SyncReplUPtr>>();
+		for (const auto& filter : synclist)
+		{
+			if (std::none_of(m_following.cbegin(), m_following.cend(), [&](const SyncReplUPtr& f) { return f->filter() == filter; }) &&
+				std::none_of(followers->cbegin(), followers->cend(), [&](const SyncReplUPtr& f) { return f->filter() == filter; }))
+			{
+				followers->emplace_front(new PulleySyncRepl(base, filter, m_parser, &m_parser_mutex));
+			}
+		}
+		auto added = std::distance(followers->cbegin(), followers->cend());
+		if (added)
+		{
+			followers_job("script", followers, false, response);
+		}
+
+		log.debugStream() << "Pulleyscript reloaded, " << count_followers() << " subscriptions kept, " << added << " new.";
+		return 0;
+	}
 } ;
 
+static std::string stats_file;
+
+void PulleyDispatcher::set_stats_file(const std::string& path)
+{
+	stats_file = path;
+	SteamWorks::PulleyBack::Stats::set_enabled(!path.empty());
+}
+
 PulleyDispatcher::PulleyDispatcher() :
 	m_state(disconnected),
 	d(new PulleyDispatcher::Private())
 {
 }
 
+PulleyDispatcher::~PulleyDispatcher()
+{
+	// Jobs hand their followers back to d
+	d->m_jobs.stop();
+}
+
 void PulleyDispatcher::poll()
 {
 	VerbDispatcher::poll();
 
+	if (!stats_file.empty())
+	{
+		static const std::chrono::seconds interval(10);
+		static std::chrono::steady_clock::time_point last_dump;
+		auto now = std::chrono::steady_clock::now();
+		if (now - last_dump >= interval)
+		{
+			last_dump = now;
+			if (!SteamWorks::PulleyBack::Stats::dump(stats_file))
+			{
+				SteamWorks::Logging::getLogger("steamworks.pulley").warnStream() << "Could not write statistics to " << stats_file;
+			}
+		}
+	}
+
+	d->collect_jobs();
+
+	// Backends with a full-ish queue; leave the changes upstream
+	// rather than pile them up in the Pulley.
+	if (d->m_parser)
+	{
+		std::lock_guard<std::mutex> lock(d->m_parser_mutex);
+		if (d->m_parser->congested())
+		{
+			return;
+		}
+	}
+
 	for (auto i=d->m_following.cbegin(); i!=d->m_following.cend(); ++i)
 	{
-		(*i)->poll(*d->m_connection);
+		(*i)->poll(d->connection_for(*i));
 	}
 }
 
 
+const VerbTable<PulleyDispatcher::Handler> PulleyDispatcher::s_verbs =
+{
+	{ "connect", &PulleyDispatcher::do_connect },
+	{ "stop", &PulleyDispatcher::do_stop },
+	{ "serverinfo", &PulleyDispatcher::do_serverinfo },
+	{ "follow", &PulleyDispatcher::do_follow },
+	{ "unfollow", &PulleyDispatcher::do_unfollow },
+	{ "dump_dit", &PulleyDispatcher::do_dump_dit },
+	{ "resync", &PulleyDispatcher::do_resync },
+	{ "script", &PulleyDispatcher::do_script },
+	{ "pull", &PulleyDispatcher::do_pull },
+	{ "stats", &PulleyDispatcher::do_stats },
+	{ "job", &PulleyDispatcher::do_job },
+} ;
+
+const VerbTable<PulleyDispatcher::StreamHandler> PulleyDispatcher::s_streamed_verbs =
+{
+	{ "dump_dit", &PulleyDispatcher::do_dump_dit },
+} ;
+
+const VerbTable<PulleyDispatcher::DocumentHandler> PulleyDispatcher::s_document_verbs =
+{
+	{ "follow", &PulleyDispatcher::do_follow },
+	{ "script", &PulleyDispatcher::do_script },
+} ;
+
 int PulleyDispatcher::exec(const std::string& verb, const Values& values, Object& response)
 {
-	if (verb == "connect") return do_connect(values, response);
-	else if (verb == "stop") return do_stop(values);
-	else if (verb == "serverinfo") return do_serverinfo(values, response);
-	else if (verb == "follow") return do_follow(values, response);
-	else if (verb == "unfollow") return do_unfollow(values, response);
-	else if (verb == "dump_dit") return do_dump_dit(values, response);
-	else if (verb == "resync") return do_resync(values, response);
-	else if (verb == "script") return do_script(values, response);
-	return -1;
+	auto handler = s_verbs.find(verb);
+	return handler ? (this->*(*handler))(values, response) : -1;
+}
+
+int PulleyDispatcher::exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response)
+{
+	auto handler = s_document_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
+	}
+	return VerbDispatcher::exec_document(verb, values, response);
+}
+
+int PulleyDispatcher::verb_index(const std::string& verb) const
+{
+	return s_verbs.index(verb);
+}
+
+const char* PulleyDispatcher::verb_name(size_t i) const
+{
+	return i < s_verbs.size() ? s_verbs.name(i) : nullptr;
+}
+
+bool PulleyDispatcher::is_streamed(const std::string& verb) const
+{
+	return s_streamed_verbs.find(verb) != nullptr;
+}
+
+int PulleyDispatcher::exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response)
+{
+	auto handler = s_streamed_verbs.find(verb);
+	if (handler)
+	{
+		return (this->*(*handler))(values, response);
+	}
+	return VerbDispatcher::exec_streamed(verb, values, response);
 }
 
 int PulleyDispatcher::do_connect(const Values& values, Object& response)
@@ -153,17 +471,27 @@ int PulleyDispatcher::do_connect(const Values& values, Object& response)
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.pulley");
 	std::string name = values.get("uri").to_str();
 
+	d->m_uri = name;
 	if (SteamWorks::LDAP::do_connect(d->m_connection, name, response, log) &&
 	    SteamWorks::LDAP::require_syncrepl(d->m_connection, response, log)
 	)
 	{
 		m_state = connected;
+
+		// The attribute syntaxes decide the DER types of output
+		SteamWorks::LDAP::TypeInfo typeinfo;
+		typeinfo.execute(*d->m_connection);
+		d->m_syntaxes = typeinfo.syntaxes();
+		if (d->m_parser)
+		{
+			d->m_parser->set_attribute_syntaxes(d->m_syntaxes);
+		}
 	}
 	// Always return 0 because we don't want the FCGI to stop.
 	return 0;
 }
 
-int PulleyDispatcher::do_stop(const Values& values)
+int PulleyDispatcher::do_stop(const Values& values, Object& response)
 {
 	m_state = stopped;
 	d->m_connection.reset(nullptr);
@@ -196,7 +524,27 @@ static inline std::string _get_parameter(const PulleyDispatcher::Values& values,
 	return v.to_str();
 }
 
+static inline std::string _get_parameter(const SteamWorks::JSON::Node& values, const char* key)
+{
+	const auto& v = values.get(key);
+	if (v.is_null())
+	{
+		return std::string();
+	}
+	return v.to_str();
+}
+
 int PulleyDispatcher::do_follow(const Values& values, Object& response)
+{
+	return follow(_get_parameter(values, "base"), _get_parameter(values, "filter"), SteamWorks::JobQueue::wants_job(values), response);
+}
+
+int PulleyDispatcher::do_follow(const SteamWorks::JSON::Node& values, Object& response)
+{
+	return follow(_get_parameter(values, "base"), _get_parameter(values, "filter"), SteamWorks::JobQueue::wants_job(values), response);
+}
+
+int PulleyDispatcher::follow(const std::string& base, const std::string& filter, bool job, Object& response)
 {
 	SteamWorks::Logging::Logger& log = SteamWorks::Logging::getLogger("steamworks.pulley");
 
@@ -206,9 +554,6 @@ int PulleyDispatcher::do_follow(const Values& values, Object& response)
 		return 0;
 	}
 
-	std::string base = _get_parameter(values, "base");
-	std::string filter = _get_parameter(values, "filter");
-
 	if (base.empty())
 	{
 		log.warnStream() << "No base given for follow.";
@@ -220,6 +565,13 @@ int PulleyDispatcher::do_follow(const Values& values, Object& response)
 		return 0;
 	}
 
+	if (job)
+	{
+		auto followers = std::make_shared<std::forward_list<Private::SyncReplUPtr>>();
+		followers->emplace_front(new PulleySyncRepl(base, filter, d->m_parser, &d->m_parser_mutex));
+		d->followers_job("follow", followers, false, response);
+		return 0;
+	}
 	return d->add_follower(base, filter, response);
 }
 
@@ -257,9 +609,24 @@ int PulleyDispatcher::do_dump_dit(const Values& values, Object& response)
 	return 0;
 }
 
+int PulleyDispatcher::do_dump_dit(const Values& values, SteamWorks::JSON::Writer& response)
+{
+	response.begin_object();
+	d->dump_followers(response);
+	response.end_object();
+	return 0;
+}
+
 int PulleyDispatcher::do_resync(const Values& values, Object& response)
 {
 	d->resync_followers();
+	if (SteamWorks::JobQueue::wants_job(values) && (m_state == connected))
+	{
+		// The refresh happens in the job, instead of in the next poll()
+		auto followers = std::make_shared<std::forward_list<Private::SyncReplUPtr>>();
+		followers->swap(d->m_following);
+		d->followers_job("resync", followers, true, response);
+	}
 	return 0;
 }
 
@@ -283,23 +650,44 @@ int PulleyDispatcher::do_script(const char* filename)
 
 	d->m_parser->structural_analysis();
 	d->m_parser->setup_sql();
+	d->m_parser->set_attribute_syntaxes(d->m_syntaxes);
 
 	return 0;
 }
 
 int PulleyDispatcher::do_script(const Values& values, Object& response)
+{
+	auto a = values.get("autofollow");
+	return script(_get_parameter(values, "filename"), _get_parameter(values, "base"), a.is<bool>() && a.get<bool>(), response);
+}
+
+int PulleyDispatcher::do_script(const SteamWorks::JSON::Node& values, Object& response)
+{
+	return script(_get_parameter(values, "filename"), _get_parameter(values, "base"), values.get("autofollow").boolean(), response);
+}
+
+int PulleyDispatcher::script(const std::string& filename, const std::string& base, bool autofollow, Object& response)
 {
 	auto& log = SteamWorks::Logging::getLogger("steamworks.pulley");
 
-	std::string filename = _get_parameter(values, "filename");
 	if (filename.empty())
 	{
 		log.warnStream() << "No filename given.";
 		return 0;
 	}
+	if (d->m_pending)
+	{
+		// Their followers would keep feeding the old script
+		SteamWorks::JSON::simple_output(response, 409, "Follow or resync jobs are still running.");
+		return 0;
+	}
 	if (d->count_followers())
 	{
-		log.warnStream() << "Can't read script file after connecting to server.";
+		// Hot reload; the followers keep running
+		if (d->reload_script(filename, base, response))
+		{
+			SteamWorks::JSON::simple_output(response, 500, "Could not reload script; the running script is kept.");
+		}
 		return 0;
 	}
 
@@ -313,14 +701,6 @@ int PulleyDispatcher::do_script(const Values& values, Object& response)
 		return 0;
 	}
 
-	std::string base = _get_parameter(values, "base");
-	bool autofollow = false;
-	auto a = values.get("autofollow");
-	if (!a.is<picojson::null>())
-	{
-		autofollow = a.is<bool>() && a.get<bool>();
-	}
-
 	if (autofollow && base.empty())
 	{
 		log.warnStream() << "Pulleyscript autoload is on, but no base is set.";
@@ -343,3 +723,117 @@ int PulleyDispatcher::do_script(const Values& values, Object& response)
 
 	return 0;
 }
+
+int PulleyDispatcher::do_pull(const Values& values, Object& response)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulley");
+
+	if (!d->m_parser)
+	{
+		log.warnStream() << "No script loaded to pull from.";
+		return 0;
+	}
+
+	auto v = values.get("driver");
+	if (!v.is<double>() || (v.get<double>() < 0))
+	{
+		log.warnStream() << "No driver given for pull.";
+		return 0;
+	}
+	drvnum_t driver = v.get<double>();
+
+	unsigned long cursor = 0;
+	v = values.get("cursor");
+	if (v.is<double>() && (v.get<double>() > 0))
+	{
+		cursor = v.get<double>();
+	}
+
+	unsigned long limit = 0;
+	v = values.get("limit");
+	if (v.is<double>() && (v.get<double>() > 0))
+	{
+		limit = v.get<double>();
+	}
+
+	long count;
+	{
+		std::lock_guard<std::mutex> lock(d->m_parser_mutex);
+		count = d->m_parser->pull(driver, cursor, limit);
+	}
+	if (count < 0)
+	{
+		SteamWorks::JSON::simple_output(response, 500, "Could not pull driver.");
+		return 0;
+	}
+
+	response.emplace("driver", picojson::value(double(driver)));
+	response.emplace("count", picojson::value(double(count)));
+	if ((limit == 0) || ((unsigned long)count < limit))
+	{
+		response.emplace("done", picojson::value(true));
+	}
+	else
+	{
+		response.emplace("cursor", picojson::value(double(cursor + count)));
+	}
+	return 0;
+}
+
+int PulleyDispatcher::do_stats(const Values& values, Object& response)
+{
+	using SteamWorks::PulleyBack::Stats;
+
+	auto v = values.get("enable");
+	if (v.is<bool>())
+	{
+		Stats::set_enabled(v.get<bool>());
+	}
+	response.emplace("enabled", picojson::value(Stats::enabled()));
+
+	picojson::array bounds;
+	for (unsigned int b = 0; b + 1 < SteamWorks::Sharded::num_buckets; b++)
+	{
+		bounds.emplace_back(double(SteamWorks::Sharded::bucket_bound(b)));
+	}
+	response.emplace("latency_bounds_us", picojson::value(bounds));
+
+	auto snapshots = Stats::collect();
+	picojson::array backends;
+	for (const auto& snap : snapshots)
+	{
+		picojson::object backend;
+		backend.emplace("backend", picojson::value(snap.backend));
+		backend.emplace("instance", picojson::value(double(snap.instance)));
+		for (unsigned int op = 0; op < Stats::num_ops; op++)
+		{
+			picojson::object counters;
+			counters.emplace("calls", picojson::value(double(snap.calls[op])));
+			counters.emplace("forks", picojson::value(double(snap.forks[op])));
+			counters.emplace("errors", picojson::value(double(snap.errors[op])));
+			counters.emplace("seconds", picojson::value(snap.latency[op].nanoseconds / 1e9));
+			picojson::array latency;
+			for (unsigned int b = 0; b < SteamWorks::Sharded::num_buckets; b++)
+			{
+				latency.emplace_back(double(snap.latency[op].buckets[b]));
+			}
+			counters.emplace("latency", picojson::value(latency));
+			backend.emplace(Stats::op_name(op), picojson::value(counters));
+		}
+		backends.emplace_back(backend);
+	}
+	response.emplace("backends", picojson::value(backends));
+
+	if (_get_parameter(values, "format") == "prometheus")
+	{
+		std::ostringstream text;
+		Stats::write_prometheus(text, snapshots);
+		response.emplace("prometheus", picojson::value(text.str()));
+	}
+	return 0;
+}
+
+int PulleyDispatcher::do_job(const Values& values, Object& response)
+{
+	return d->m_jobs.do_job(values, response);
+}
@@ -9,6 +9,7 @@ Adriaan de Groot <groot@kde.org>
 #define STEAMWORKS_PULLEY_H
 
 #include <memory>
+#include <string>
 
 #include "verb.h"
 
@@ -21,11 +22,29 @@ private:
 	typedef enum { disconnected=0, connected, stopped } State;
 	State m_state;
 
+	using Handler = int (PulleyDispatcher::*)(const Values&, Object&);
+	using StreamHandler = int (PulleyDispatcher::*)(const Values&, SteamWorks::JSON::Writer&);
+	static const VerbTable<Handler> s_verbs;
+	static const VerbTable<StreamHandler> s_streamed_verbs;
+	// Verbs that read the request document without converting it (see VerbDispatcher::exec_document())
+	using DocumentHandler = int (PulleyDispatcher::*)(const SteamWorks::JSON::Node&, Object&);
+	static const VerbTable<DocumentHandler> s_document_verbs;
+
+	// Follow and script, for requests in either form
+	int follow(const std::string& base, const std::string& filter, bool job, Object& response);
+	int script(const std::string& filename, const std::string& base, bool autofollow, Object& response);
+
 public:
 	PulleyDispatcher();
+	~PulleyDispatcher();
 
 	int exec(const std::string& verb, const Values& values, Object& response) override;
+	int exec_document(const std::string& verb, const SteamWorks::JSON::Node& values, Object& response) override;
+	bool is_streamed(const std::string& verb) const override;
+	int exec_streamed(const std::string& verb, const Values& values, SteamWorks::JSON::Writer& response) override;
 	void poll() override;
+	int verb_index(const std::string& verb) const override;
+	const char* verb_name(size_t i) const override;
 
 	State state() const { return m_state; }
 
@@ -35,28 +54,50 @@ public:
 	 */
 	int do_script(const char* filename);
 
+	/** Collect backend statistics, and write them to the file at
+	 *  @p path (in the Prometheus text format) every 10 seconds.
+	 *  An empty path turns collecting off; it is off by default.
+	 */
+	static void set_stats_file(const std::string& path);
+
 protected:
 	/** Connect to the upstream (e.g. source) LDAP server.
 	 *  This is where the pulley gets its information. */
 	int do_connect(const Values& values, Object& response);
-	int do_stop(const Values& values);
+	int do_stop(const Values& values, Object& response);
 	int do_serverinfo(const Values& values, Object& response);
 
 	/** Start following a (subtree-) DIT. This starts up SyncRepl
 	 *  for that DIT. */
 	int do_follow(const Values& values, Object& response);
+	int do_follow(const SteamWorks::JSON::Node& values, Object& response);
 	/** Stop following a previously followed DIT. This terminates
 	 *  SyncRepl for that DIT. */
 	int do_unfollow(const Values& values, Object& response);
 
 	/** Debugging method, dump the tree of stored DIT entries. */
 	int do_dump_dit(const Values& values, Object& response);
+	int do_dump_dit(const Values& values, SteamWorks::JSON::Writer& response);
 
 	/** Drop all stored state, and restart LDAP SyncRepl. */
 	int do_resync(const Values& values, Object& response);
 
 	/** Load a PulleyScript script. */
 	int do_script(const Values& values, Object& response);
+	int do_script(const SteamWorks::JSON::Node& values, Object& response);
+
+	/** Regenerate the output of one driver of the script (pull mode),
+	 *  in batches; for rebuilding a single backend. */
+	int do_pull(const Values& values, Object& response);
+
+	/** Counters and latencies of the calls into each backend
+	 *  instance; also turns collecting them on or off. */
+	int do_stats(const Values& values, Object& response);
+
+	/** Status and results of follow and resync run as jobs
+	 *  (with "job": true); their followers are polled once
+	 *  the job is done. */
+	int do_job(const Values& values, Object& response);
 } ;
 
 
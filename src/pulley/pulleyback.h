@@ -74,6 +74,11 @@ void pulleyback_close (void *pbh);
 // call to `pulleyback_open()` should be matched by one later call to
 // `pulleyback_close()` and there should be no other invocations to the latter.
 //
+// When the Pulley delivers asynchronously, the calls between opening and
+// closing an instance are made from a thread of that instance, not from the
+// thread that opened it.  The calls for one instance are never concurrent,
+// but calls for different instances of the same backend may be.
+//
 //
 // ## Adding and Removing Forks
 //
@@ -107,6 +112,41 @@ int pulleyback_del (void *pbh, der_t *forkdata);
 // `der_t` as the number of variables promised to be supplied in `varc`
 // during `pulleyback_open()`.
 //
+// Backends that benefit from handling many forks at once, such as those
+// that write to a database with bulk inserts, may also offer
+
+int pulleyback_add_batch (void *pbh, der_t **forks, unsigned int numforks);  /* OPTIONAL */
+int pulleyback_del_batch (void *pbh, der_t **forks, unsigned int numforks);  /* OPTIONAL */
+
+// These take an array of `numforks` forks, each of which is a `forkdata`
+// array as passed to `pulleyback_add()` and `pulleyback_del()`, and they
+// have the same result as calling those on each fork in turn, with the
+// same return values.  The data passed in is only valid during the call.
+// The functions are used only when both of them resolve.  Pulley then
+// buffers forks until a transaction ends or until it switches between
+// addition and removal, so a batch never mixes the two and the order of
+// forks is retained.  Failures that surface from a batch are reported by
+// `pulleyback_prepare()` or `pulleyback_commit()`.
+//
+// Values are passed as DER OCTET STRINGs that hold the attribute value as
+// it comes from LDAP.  Backends that prefer values with a type that matches
+// their LDAP syntax may also offer
+
+int pulleyback_types (void *pbh, int varc, const uint8_t *tags);  /* OPTIONAL */
+
+// Pulley calls this outside of transactions, after `pulleyback_open()`
+// and whenever it learns about the LDAP schema, with the DER tag that it
+// would use for each of the `varc` variables: 0x01 for BOOLEAN, 0x02 for
+// INTEGER, 0x0c for UTF8String, 0x12 for NumericString, 0x13 for
+// PrintableString, 0x16 for IA5String, 0x18 for GeneralizedTime and 0x04
+// for OCTET STRING.  The backend returns 1 to receive values with these tags
+// from the next transaction on, or 0 to keep receiving OCTET STRINGs.  A
+// value that does not fit its type, such as an INTEGER that is too large,
+// is still passed as an OCTET STRING, so backends should check the tag of
+// each value.  GeneralizedTime values are rewritten into the DER form,
+// YYYYMMDDHHMMSS[.f]Z in UTC; those that cannot be rewritten exactly (a
+// fraction of an hour or minute) are passed as an OCTET STRING as well.
+//
 // Finally, a call exists to clear out an entire database, so it can be
 // filled from scratch:
 
@@ -159,12 +199,16 @@ void pulleyback_rollback (void *pbh);
 // this should not happen, but it might in a multithreaded future version,
 // and backends should already be prepared to inform such future versions
 // with this special return value.
+// The Pulley rolls back a transaction that failed with `EAGAIN` and tries
+// it again after a short wait, delivering the same forks once more.
 //
 // ## Normal Transactional Sequence
 //
 // The normal Pulley sequence is to perform `pulleyback_prepare()` on all
 // backends, and when all succeed to run `pulleyback_commit()` on them,
 // and otherwise run `pulleyback_rollback()` on all of them.
+// The Pulley does this for the backends in parallel, from separate
+// threads, so that their wait for stable storage overlaps.
 //
 // It is permitted to invoke `pulleyback_rollback()` or `pulleyback_commit()`
 // on an instance
@@ -214,6 +258,11 @@ int pulleyback_collaborate   (void *pbh1, void *pbh2);
 // is why it is not optional -- it can easily return 0 in all cases, if it
 // wants to.
 //
+// The Pulley asks for collaboration when it starts a transaction.  It tries
+// each instance with the instances of the same backend that lead a
+// transaction so far, in the scheme above, and then prepares and commits
+// on the leaders only.
+//
 
 /**
  * Logging facility provided by the Pulley. This logs to the
@@ -0,0 +1,448 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/*
+ * JSON-lines backend. Each committed transaction becomes one file,
+ * with one line per change:
+ *
+ *     {"add":["value1","value2"]}
+ *     {"del":["value1","value2"]}
+ *     {"reset":[]}
+ *
+ * Parameters: file="path" (required); transactions are written to
+ * path.NNNNNNNNNN.jsonl, numbered on from the files that are there.
+ *
+ * Output is buffered in memory during the transaction. Prepare writes
+ * it to a temporary file and syncs it; commit renames that into place,
+ * so readers only ever see whole transactions.
+ */
+
+#include "../pulleyback.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char logger[] = "steamworks.pulleyback.jsonl";
+
+typedef struct {
+	int varc;
+	char *path;  /* From the file parameter */
+	unsigned long seq;  /* Number of the next transaction file */
+
+	char *buf;  /* JSON-lines of this transaction */
+	size_t len;
+	size_t cap;
+	int failed;
+	int prepared;
+	int written;  /* Temporary file exists */
+} handle_t;
+
+/*
+ * Return the value of parameter @p name from the argv of
+ * pulleyback_open(), without quotes, or NULL. The result
+ * is malloc()ed.
+ */
+static char *get_parameter(int argc, char **argv, const char *name)
+{
+	size_t namelen = strlen(name);
+	for (int i = 0; i < argc; i++)
+	{
+		if ((strncmp(argv[i], name, namelen) == 0) && (argv[i][namelen] == '='))
+		{
+			const char *v = argv[i] + namelen + 1;
+			size_t vlen = strlen(v);
+			if ((vlen >= 2) && (v[0] == '"') && (v[vlen-1] == '"'))
+			{
+				v++;
+				vlen -= 2;
+			}
+			return strndup(v, vlen);
+		}
+	}
+	return NULL;
+}
+
+static void file_name(const handle_t *handle, char *buf, size_t size, int temporary)
+{
+	snprintf(buf, size, "%s.%010lu.jsonl%s", handle->path, handle->seq, temporary ? ".tmp" : "");
+}
+
+/*
+ * Find the number after the last transaction file that exists.
+ */
+static unsigned long next_seq(const char *path)
+{
+	char *dir = strdup(path);
+	const char *base = path;
+	char *slash = strrchr(dir, '/');
+	if (slash)
+	{
+		*slash = 0;
+		base = path + (slash - dir) + 1;
+	}
+	size_t baselen = strlen(base);
+
+	unsigned long seq = 0;
+	DIR *d = opendir(slash ? (*dir ? dir : "/") : ".");
+	struct dirent *e;
+	while (d && ((e = readdir(d)) != NULL))
+	{
+		unsigned long n;
+		char tail[8];
+		if ((strncmp(e->d_name, base, baselen) == 0) &&
+			(e->d_name[baselen] == '.') &&
+			(sscanf(e->d_name + baselen + 1, "%lu.%7s", &n, tail) == 2) &&
+			(strcmp(tail, "jsonl") == 0) &&
+			(n >= seq))
+		{
+			seq = n + 1;
+		}
+	}
+	if (d)
+	{
+		closedir(d);
+	}
+	free(dir);
+	return seq;
+}
+
+static int reserve(handle_t *handle, size_t more)
+{
+	if (handle->len + more <= handle->cap)
+	{
+		return 1;
+	}
+	size_t cap = handle->cap ? handle->cap : 65536;
+	while (cap < handle->len + more)
+	{
+		cap *= 2;
+	}
+	char *buf = realloc(handle->buf, cap);
+	if (!buf)
+	{
+		handle->failed = 1;
+		return 0;
+	}
+	handle->buf = buf;
+	handle->cap = cap;
+	return 1;
+}
+
+/*
+ * Length of the valid UTF-8 sequence at @p p (at most @p len bytes),
+ * or 0 if it is not valid.
+ */
+static size_t utf8_length(const uint8_t *p, size_t len)
+{
+	size_t n = (p[0] < 0xc2) ? 0 : (p[0] < 0xe0) ? 2 : (p[0] < 0xf0) ? 3 : (p[0] < 0xf5) ? 4 : 0;
+	if ((n == 0) || (n > len))
+	{
+		return 0;
+	}
+	for (size_t i = 1; i < n; i++)
+	{
+		if ((p[i] & 0xc0) != 0x80)
+		{
+			return 0;
+		}
+	}
+	return n;
+}
+
+/*
+ * Append the contents of DER value @p der as a JSON string. Bytes
+ * that are not valid UTF-8 are taken as Latin-1 characters.
+ */
+static int append_string(handle_t *handle, der_t der)
+{
+	static const char hex[] = "0123456789abcdef";
+
+	size_t len = der[1];
+	const uint8_t *p = der + 2;
+	if (len & 0x80)
+	{
+		unsigned int len_len = len & 0x7f;
+		len = 0;
+		for (unsigned int i = 0; i < len_len; i++)
+		{
+			len = (len << 8) | der[2 + i];
+		}
+		p += len_len;
+	}
+
+	/* Worst case, every byte becomes \u00XX */
+	if (!reserve(handle, 6 * len + 2))
+	{
+		return 0;
+	}
+	char *out = handle->buf + handle->len;
+	*out++ = '"';
+	for (size_t i = 0; i < len; i++)
+	{
+		uint8_t c = p[i];
+		if ((c >= 0x20) && (c < 0x80) && (c != '"') && (c != '\\'))
+		{
+			*out++ = c;
+		}
+		else if ((c == '"') || (c == '\\'))
+		{
+			*out++ = '\\';
+			*out++ = c;
+		}
+		else
+		{
+			size_t n = (c >= 0x80) ? utf8_length(p + i, len - i) : 0;
+			if (n)
+			{
+				memcpy(out, p + i, n);
+				out += n;
+				i += n - 1;
+			}
+			else
+			{
+				*out++ = '\\';
+				*out++ = 'u';
+				*out++ = '0';
+				*out++ = '0';
+				*out++ = hex[c >> 4];
+				*out++ = hex[c & 0xf];
+			}
+		}
+	}
+	*out++ = '"';
+	handle->len = out - handle->buf;
+	return 1;
+}
+
+static int append(handle_t *handle, const char *s)
+{
+	size_t len = strlen(s);
+	if (!reserve(handle, len))
+	{
+		return 0;
+	}
+	memcpy(handle->buf + handle->len, s, len);
+	handle->len += len;
+	return 1;
+}
+
+static int append_fork(handle_t *handle, const char *op, der_t *forkdata)
+{
+	if (handle->failed)
+	{
+		return 0;
+	}
+	size_t mark = handle->len;
+	int ok = append(handle, "{\"") && append(handle, op) && append(handle, "\":[");
+	for (int i = 0; ok && (i < handle->varc); i++)
+	{
+		ok = ((i == 0) || append(handle, ",")) && append_string(handle, forkdata[i]);
+	}
+	ok = ok && append(handle, "]}\n");
+	if (!ok)
+	{
+		handle->len = mark;
+		handle->failed = 1;
+	}
+	return ok;
+}
+
+static int write_all(int fd, const char *p, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t wrote = write(fd, p, len);
+		if (wrote < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return 0;
+		}
+		p += wrote;
+		len -= wrote;
+	}
+	return 1;
+}
+
+static void clear(handle_t *handle)
+{
+	if (handle->written)
+	{
+		char name[4096];
+		file_name(handle, name, sizeof(name), 1);
+		unlink(name);
+	}
+	handle->len = 0;
+	handle->failed = 0;
+	handle->prepared = 0;
+	handle->written = 0;
+}
+
+void *pulleyback_open(int argc, char **argv, int varc)
+{
+	char ibuf[128];
+
+	char *path = get_parameter(argc, argv, "file");
+	if (!path || !*path)
+	{
+		write_logger(logger, "JSONL backend needs a file parameter.");
+		free(path);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	handle_t *handle = calloc(1, sizeof(handle_t));
+	if (!handle)
+	{
+		free(path);
+		return NULL;
+	}
+	handle->varc = varc;
+	handle->path = path;
+	handle->seq = next_seq(path);
+
+	snprintf(ibuf, sizeof(ibuf), "JSONL backend writing %s from transaction %lu", path, handle->seq);
+	write_logger(logger, ibuf);
+	return handle;
+}
+
+void pulleyback_close(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	clear(handle);
+	free(handle->buf);
+	free(handle->path);
+	free(handle);
+}
+
+int pulleyback_add(void *pbh, der_t *forkdata)
+{
+	return append_fork(pbh, "add", forkdata);
+}
+
+int pulleyback_del(void *pbh, der_t *forkdata)
+{
+	return append_fork(pbh, "del", forkdata);
+}
+
+int pulleyback_add_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!append_fork(pbh, "add", forks[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_del_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!append_fork(pbh, "del", forks[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_reset(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	/* What came before in this transaction is moot */
+	handle->len = 0;
+	if (!handle->failed && !append(handle, "{\"reset\":[]}\n"))
+	{
+		handle->failed = 1;
+	}
+	return handle->failed ? 0 : 1;
+}
+
+int pulleyback_prepare(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	if (handle->failed)
+	{
+		return 0;
+	}
+	if (handle->prepared || (handle->len == 0))
+	{
+		handle->prepared = 1;
+		return 1;
+	}
+
+	char name[4096];
+	file_name(handle, name, sizeof(name), 1);
+	int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		return 0;
+	}
+	handle->written = 1;
+	int ok = write_all(fd, handle->buf, handle->len) && (fdatasync(fd) == 0);
+	ok = (close(fd) == 0) && ok;
+	if (!ok)
+	{
+		char ibuf[128];
+		snprintf(ibuf, sizeof(ibuf), "JSONL backend could not write transaction %lu", handle->seq);
+		write_logger(logger, ibuf);
+		return 0;
+	}
+	handle->prepared = 1;
+	return 1;
+}
+
+int pulleyback_commit(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	if (!pulleyback_prepare(pbh))
+	{
+		clear(handle);
+		return 0;
+	}
+	if (handle->written)
+	{
+		char tmpname[4096];
+		char name[4096];
+		file_name(handle, tmpname, sizeof(tmpname), 1);
+		file_name(handle, name, sizeof(name), 0);
+		if (rename(tmpname, name) != 0)
+		{
+			clear(handle);
+			return 0;
+		}
+		handle->written = 0;
+		handle->seq++;
+	}
+	clear(handle);
+	return 1;
+}
+
+void pulleyback_rollback(void *pbh)
+{
+	clear(pbh);
+}
+
+int pulleyback_collaborate(void *pbh1, void *pbh2)
+{
+	/* Each instance has its own files */
+	return 0;
+}
@@ -0,0 +1,579 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/*
+ * LMDB backend. Each fork is stored in a named database with the
+ * contents of its first value as key, and the DER encoding of the other
+ * values, back-to-back, as data; the database allows duplicate keys, so
+ * a key has one data item per fork.
+ *
+ * LMDB limits keys, and data items of duplicate keys, to its maximum
+ * key size (511 bytes by default). A fork with a larger key or data is
+ * stored in the database "<db>.large" instead, under the (big-endian)
+ * 64-bit FNV-1a hash of the DER encoding of all its values, with that
+ * encoding as data.
+ *
+ * Parameters: env="path" (required) is the LMDB environment directory,
+ * db="name" names the database in it (the default is "forks"), and
+ * mapsize=N sets the size of the map in MiB (the default is 1024).
+ *
+ * All instances on the same environment share it, and one write
+ * transaction, so they collaborate. LMDB cannot prepare a transaction
+ * and commit it later, so this backend does not offer prepare; the
+ * transaction is written out in commit. The environment is opened
+ * without LMDB's lock file, because transactions may be committed from
+ * different threads; other processes must not write to it while the
+ * Pulley runs.
+ */
+
+#include "../pulleyback.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <lmdb.h>
+
+static const char logger[] = "steamworks.pulleyback.lmdb";
+
+typedef struct env {
+	struct env *next;
+	char *path;
+	int refs;
+	MDB_env *env;
+
+	/* Protected by lock */
+	pthread_mutex_t lock;
+	MDB_txn *txn;  /* The write transaction, begun on first use */
+	unsigned long txn_seq;  /* Number of txn */
+	int failed;  /* Something went wrong in txn */
+} env_t;
+
+/* Open environments, by path */
+static env_t *envs = NULL;
+static pthread_mutex_t envs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef struct {
+	env_t *env;
+	char *db;
+	char *large_db;
+	MDB_dbi dbi;
+	MDB_dbi large_dbi;  /* For forks too large for dbi */
+	unsigned long txn_seq;  /* The transaction that the dbis were opened in */
+	int varc;
+	uint8_t *buf;  /* For the data of a fork, grows as needed */
+	size_t bufsize;
+} handle_t;
+
+/*
+ * Return the value of parameter @p name from the argv of
+ * pulleyback_open(), without quotes, or NULL. The result
+ * is malloc()ed.
+ */
+static char *get_parameter(int argc, char **argv, const char *name)
+{
+	size_t namelen = strlen(name);
+	for (int i = 0; i < argc; i++)
+	{
+		if ((strncmp(argv[i], name, namelen) == 0) && (argv[i][namelen] == '='))
+		{
+			const char *v = argv[i] + namelen + 1;
+			size_t vlen = strlen(v);
+			if ((vlen >= 2) && (v[0] == '"') && (v[vlen-1] == '"'))
+			{
+				v++;
+				vlen -= 2;
+			}
+			return strndup(v, vlen);
+		}
+	}
+	return NULL;
+}
+
+static void log_error(const char *what, int rc)
+{
+	char ibuf[128];
+	snprintf(ibuf, sizeof(ibuf), "LMDB backend %s: %s", what, mdb_strerror(rc));
+	write_logger(logger, ibuf);
+}
+
+static env_t *env_acquire(const char *path, size_t mapsize)
+{
+	pthread_mutex_lock(&envs_lock);
+	env_t *e = envs;
+	while (e && strcmp(e->path, path))
+	{
+		e = e->next;
+	}
+	if (e)
+	{
+		e->refs++;
+		pthread_mutex_unlock(&envs_lock);
+		return e;
+	}
+
+	e = calloc(1, sizeof(env_t));
+	int rc = e ? mdb_env_create(&e->env) : ENOMEM;
+	if (rc == 0)
+	{
+		mdb_env_set_maxdbs(e->env, 64);
+		mdb_env_set_mapsize(e->env, mapsize);
+		rc = mdb_env_open(e->env, path, MDB_NOLOCK | MDB_NOTLS, 0644);
+		if (rc != 0)
+		{
+			mdb_env_close(e->env);
+		}
+	}
+	if (rc != 0)
+	{
+		log_error(path, rc);
+		free(e);
+		pthread_mutex_unlock(&envs_lock);
+		return NULL;
+	}
+
+	e->path = strdup(path);
+	e->refs = 1;
+	pthread_mutex_init(&e->lock, NULL);
+	e->next = envs;
+	envs = e;
+	pthread_mutex_unlock(&envs_lock);
+	return e;
+}
+
+static void env_release(env_t *e)
+{
+	pthread_mutex_lock(&envs_lock);
+	if (--e->refs > 0)
+	{
+		pthread_mutex_unlock(&envs_lock);
+		return;
+	}
+	env_t **p = &envs;
+	while (*p != e)
+	{
+		p = &(*p)->next;
+	}
+	*p = e->next;
+	pthread_mutex_unlock(&envs_lock);
+
+	if (e->txn)
+	{
+		mdb_txn_abort(e->txn);
+	}
+	mdb_env_close(e->env);
+	pthread_mutex_destroy(&e->lock);
+	free(e->path);
+	free(e);
+}
+
+/*
+ * Get the write transaction of @p e, with its lock held; begins
+ * one if needed. Returns NULL (with the lock released) on failure.
+ */
+static MDB_txn *txn_acquire(env_t *e)
+{
+	pthread_mutex_lock(&e->lock);
+	if (!e->txn)
+	{
+		int rc = mdb_txn_begin(e->env, NULL, 0, &e->txn);
+		if (rc != 0)
+		{
+			log_error("begin", rc);
+			e->txn = NULL;
+			e->failed = 1;
+			pthread_mutex_unlock(&e->lock);
+			return NULL;
+		}
+		e->txn_seq++;
+	}
+	return e->txn;
+}
+
+/*
+ * Ends the write transaction of @p e, whose lock is held: commits it
+ * if @p commit is set and nothing went wrong in it, otherwise aborts
+ * it. Either way, the next transaction starts afresh. Returns 1 if
+ * the transaction was committed.
+ */
+static int txn_end(env_t *e, int commit)
+{
+	int ok = commit && !e->failed;
+	if (e->txn)
+	{
+		if (ok)
+		{
+			/* On failure, LMDB aborts the transaction */
+			int rc = mdb_txn_commit(e->txn);
+			if (rc != 0)
+			{
+				log_error("commit", rc);
+				ok = 0;
+			}
+		}
+		else
+		{
+			mdb_txn_abort(e->txn);
+		}
+		e->txn = NULL;
+	}
+	e->failed = 0;
+	return ok;
+}
+
+/*
+ * As txn_acquire(), for the databases of @p handle. They are
+ * opened once in each transaction; that is cheap after the first
+ * time, and a handle that was opened in an aborted transaction is
+ * closed by LMDB.
+ */
+static MDB_txn *handle_txn(handle_t *handle)
+{
+	env_t *e = handle->env;
+	MDB_txn *txn = txn_acquire(e);
+	if (txn && (handle->txn_seq != e->txn_seq))
+	{
+		int rc = mdb_dbi_open(txn, handle->db, MDB_CREATE | MDB_DUPSORT, &handle->dbi);
+		if (rc == 0)
+		{
+			rc = mdb_dbi_open(txn, handle->large_db, MDB_CREATE, &handle->large_dbi);
+		}
+		if (rc != 0)
+		{
+			log_error("open database", rc);
+			e->failed = 1;
+			pthread_mutex_unlock(&e->lock);
+			return NULL;
+		}
+		handle->txn_seq = e->txn_seq;
+	}
+	return txn;
+}
+
+static size_t der_header(der_t der, size_t *len)
+{
+	*len = der[1];
+	if (!(*len & 0x80))
+	{
+		return 2;
+	}
+	unsigned int len_len = *len & 0x7f;
+	*len = 0;
+	for (unsigned int i = 0; i < len_len; i++)
+	{
+		*len = (*len << 8) | der[2 + i];
+	}
+	return 2 + len_len;
+}
+
+static size_t der_size(der_t der)
+{
+	size_t len;
+	size_t header = der_header(der, &len);
+	return header + len;
+}
+
+/*
+ * Store the DER values of @p forkdata from @p first on, @p size bytes
+ * back-to-back, in the buffer of @p handle; @p data points to them.
+ */
+static int concat(handle_t *handle, der_t *forkdata, int first, size_t size, MDB_val *data)
+{
+	if (size > handle->bufsize)
+	{
+		uint8_t *buf = realloc(handle->buf, size);
+		if (!buf)
+		{
+			return 0;
+		}
+		handle->buf = buf;
+		handle->bufsize = size;
+	}
+	data->mv_data = handle->buf;
+	data->mv_size = 0;
+	for (int i = first; i < handle->varc; i++)
+	{
+		size_t der_len = der_size(forkdata[i]);
+		memcpy(handle->buf + data->mv_size, forkdata[i], der_len);
+		data->mv_size += der_len;
+	}
+	return 1;
+}
+
+static uint64_t fnv1a(const uint8_t *p, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < len; i++)
+	{
+		h = (h ^ p[i]) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/*
+ * Key and data for @p forkdata, in the database of @p handle or, if
+ * @p large is set on return, in the database for large forks. The data,
+ * and the key of a large fork, may point into the buffer of @p handle
+ * and into @p hash.
+ */
+static int fork_to_kv(handle_t *handle, der_t *forkdata, MDB_val *key, MDB_val *data, uint8_t hash[8], int *large)
+{
+	size_t maxsize = mdb_env_get_maxkeysize(handle->env->env);
+	size_t len;
+	size_t header = der_header(forkdata[0], &len);
+	size_t rest = 0;
+	for (int i = 1; i < handle->varc; i++)
+	{
+		rest += der_size(forkdata[i]);
+	}
+
+	*large = (len > maxsize) || (rest > maxsize);
+	if (*large)
+	{
+		if (!concat(handle, forkdata, 0, header + len + rest, data))
+		{
+			return 0;
+		}
+		uint64_t h = fnv1a(handle->buf, data->mv_size);
+		for (int i = 0; i < 8; i++)
+		{
+			hash[i] = (h >> (56 - 8 * i)) & 0xff;
+		}
+		key->mv_data = hash;
+		key->mv_size = 8;
+		return 1;
+	}
+
+	key->mv_data = forkdata[0] + header;
+	key->mv_size = len;
+	if (handle->varc == 2)
+	{
+		data->mv_data = forkdata[1];
+		data->mv_size = rest;
+		return 1;
+	}
+	return concat(handle, forkdata, 1, rest, data);
+}
+
+void *pulleyback_open(int argc, char **argv, int varc)
+{
+	char *path = get_parameter(argc, argv, "env");
+	char *db = get_parameter(argc, argv, "db");
+	char *mapsize = get_parameter(argc, argv, "mapsize");
+	size_t mapsize_mib = mapsize ? strtoul(mapsize, NULL, 10) : 1024;
+	free(mapsize);
+
+	handle_t *handle = NULL;
+	if (!path || (varc < 1))
+	{
+		write_logger(logger, "LMDB backend needs an env parameter and at least one variable.");
+		errno = EINVAL;
+		goto done;
+	}
+
+	env_t *e = env_acquire(path, mapsize_mib << 20);
+	if (!e)
+	{
+		goto done;
+	}
+
+	handle = calloc(1, sizeof(handle_t));
+	if (!handle)
+	{
+		env_release(e);
+		goto done;
+	}
+	if (!db)
+	{
+		db = strdup("forks");
+	}
+	handle->large_db = db ? malloc(strlen(db) + sizeof(".large")) : NULL;
+	if (!handle->large_db)
+	{
+		free(handle);
+		handle = NULL;
+		env_release(e);
+		goto done;
+	}
+	strcpy(handle->large_db, db);
+	strcat(handle->large_db, ".large");
+	handle->env = e;
+	handle->db = db;  /* The databases are opened on first use */
+	handle->varc = varc;
+	db = NULL;
+
+done:
+	free(db);
+	free(path);
+	return handle;
+}
+
+void pulleyback_close(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	env_release(handle->env);
+	free(handle->db);
+	free(handle->large_db);
+	free(handle->buf);
+	free(handle);
+}
+
+/*
+ * Add or remove a large fork; @p key and @p data are as from fork_to_kv().
+ * Another fork with the same hash is an error, rather than overwritten.
+ */
+static int put_or_del_large(handle_t *handle, MDB_txn *txn, MDB_val *key, MDB_val *data, int add)
+{
+	MDB_val found = *data;
+	int rc = add ?
+		mdb_put(txn, handle->large_dbi, key, &found, MDB_NOOVERWRITE) :
+		mdb_get(txn, handle->large_dbi, key, &found);
+	if ((rc == 0) && !add)
+	{
+		rc = MDB_KEYEXIST;  /* Delete it below, if it is this fork */
+	}
+	if (rc == MDB_KEYEXIST)
+	{
+		if ((found.mv_size != data->mv_size) || memcmp(found.mv_data, data->mv_data, data->mv_size))
+		{
+			write_logger(logger, "LMDB backend large fork has the hash of another one.");
+			return EINVAL;
+		}
+		rc = add ? 0 : mdb_del(txn, handle->large_dbi, key, NULL);
+	}
+	return rc;
+}
+
+static int put_or_del(handle_t *handle, der_t *forkdata, int add)
+{
+	MDB_val key, data;
+	uint8_t hash[8];
+	int large;
+	if (!fork_to_kv(handle, forkdata, &key, &data, hash, &large))
+	{
+		write_logger(logger, "LMDB backend is out of memory.");
+		return 0;
+	}
+
+	MDB_txn *txn = handle_txn(handle);
+	if (!txn)
+	{
+		return 0;
+	}
+	int rc;
+	if (large)
+	{
+		rc = put_or_del_large(handle, txn, &key, &data, add);
+	}
+	else
+	{
+		rc = add ?
+			mdb_put(txn, handle->dbi, &key, &data, MDB_NODUPDATA) :
+			mdb_del(txn, handle->dbi, &key, &data);
+	}
+	if ((rc == MDB_KEYEXIST) || (rc == MDB_NOTFOUND))
+	{
+		rc = 0;
+	}
+	if (rc != 0)
+	{
+		log_error(add ? "add" : "del", rc);
+		handle->env->failed = 1;
+	}
+	pthread_mutex_unlock(&handle->env->lock);
+	return rc == 0 ? 1 : 0;
+}
+
+int pulleyback_add(void *pbh, der_t *forkdata)
+{
+	return put_or_del(pbh, forkdata, 1);
+}
+
+int pulleyback_del(void *pbh, der_t *forkdata)
+{
+	return put_or_del(pbh, forkdata, 0);
+}
+
+int pulleyback_add_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!put_or_del(pbh, forks[i], 1))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_del_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!put_or_del(pbh, forks[i], 0))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_reset(void *pbh)
+{
+	handle_t *handle = pbh;
+
+	MDB_txn *txn = handle_txn(handle);
+	if (!txn)
+	{
+		return 0;
+	}
+	int rc = mdb_drop(txn, handle->dbi, 0);
+	if (rc == 0)
+	{
+		rc = mdb_drop(txn, handle->large_dbi, 0);
+	}
+	if (rc != 0)
+	{
+		log_error("reset", rc);
+		handle->env->failed = 1;
+	}
+	pthread_mutex_unlock(&handle->env->lock);
+	return rc == 0 ? 1 : 0;
+}
+
+int pulleyback_commit(void *pbh)
+{
+	handle_t *handle = pbh;
+	env_t *e = handle->env;
+
+	pthread_mutex_lock(&e->lock);
+	int ok = txn_end(e, 1);
+	pthread_mutex_unlock(&e->lock);
+	return ok;
+}
+
+void pulleyback_rollback(void *pbh)
+{
+	handle_t *handle = pbh;
+	env_t *e = handle->env;
+
+	pthread_mutex_lock(&e->lock);
+	txn_end(e, 0);
+	pthread_mutex_unlock(&e->lock);
+}
+
+int pulleyback_collaborate(void *pbh1, void *pbh2)
+{
+	handle_t *handle1 = pbh1;
+	handle_t *handle2 = pbh2;
+
+	/* One environment has one write transaction */
+	return handle1->env == handle2->env ? 1 : 0;
+}
@@ -83,7 +83,9 @@ void dump_der(int argc, der_t der)
 		return;
 	}
 
-	if (der[0] != 0x04)
+	// Octet strings and the string-ish types (see pulleyback_types())
+	// are shown as text, anything else only by its tag.
+	if ((der[0] != 0x04) && (der[0] != 0x0c) && (der[0] != 0x12) && (der[0] != 0x13) && (der[0] != 0x16) && (der[0] != 0x18))
 	{
 		snprintf(ibuf, sizeof(ibuf), "  .. arg %d data=TAG(%02x)", argc, (int)(der[0]));
 		write_logger(logger, ibuf);
@@ -147,6 +149,56 @@ int pulleyback_del(void *pbh, der_t *forkdata)
 	return 1;
 }
 
+int pulleyback_add_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	char ibuf[64];
+
+	snprintf(ibuf, sizeof(ibuf), "NULL backend add batch of %u", numforks);
+	write_logger(logger, ibuf);
+
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!pulleyback_add(pbh, forks[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_del_batch(void *pbh, der_t **forks, unsigned int numforks)
+{
+	char ibuf[64];
+
+	snprintf(ibuf, sizeof(ibuf), "NULL backend del batch of %u", numforks);
+	write_logger(logger, ibuf);
+
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		if (!pulleyback_del(pbh, forks[i]))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pulleyback_types(void *pbh, int varc, const uint8_t *tags)
+{
+	char ibuf[64];
+	handle_t* handle = pbh;
+
+	snprintf(ibuf, sizeof(ibuf), "NULL backend types %p", (void *)handle);
+	write_logger(logger, ibuf);
+
+	for (int i = 0; i < varc; i++)
+	{
+		snprintf(ibuf, sizeof(ibuf), "  .. arg %d TAG(%02x)", i, (int)tags[i]);
+		write_logger(logger, ibuf);
+	}
+	return 1;
+}
+
 int pulleyback_reset(void *pbh)
 {
 	char ibuf[64];
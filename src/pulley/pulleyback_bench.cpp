@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Measures how many forks per second a Pulley backend takes: it adds
+ * count generated forks of varc values in one transaction, commits,
+ * then deletes them all again in a second transaction.
+ *
+ *     pulleyback_bench [-n count] [-v varc] backend [parameter ...]
+ *
+ * Parameters are passed as in a PulleyScript, e.g. file="/tmp/out".
+ */
+
+#include "pulleyscript/backend.h"
+
+#include <logger.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char progname[] = "PulleyBack Benchmark";
+static const char version[] = "v0.1";
+static const char copyright[] = "Copyright (C) 2014-2016 InternetWide.org and the ARPA2.net project";
+
+static void version_info()
+{
+	printf("SteamWorks %s %s\n", progname, version);
+	printf("%s\n", copyright);
+}
+
+static void usage()
+{
+	printf("Usage: pulleyback_bench [-n count] [-v varc] backend [parameter ...]\n");
+}
+
+/**
+ * Generate @p count forks of @p varc OCTET STRINGs each, in one
+ * buffer; @p forks gets the varc der_t's of each fork in turn.
+ */
+static void generate(unsigned int count, int varc, std::vector<uint8_t>& data, std::vector<der_t>& forks)
+{
+	std::vector<size_t> offsets;
+	char value[64];
+	for (unsigned int i = 0; i < count; i++)
+	{
+		for (int v = 0; v < varc; v++)
+		{
+			int len = snprintf(value, sizeof(value), "value-%u-%d", i, v);
+			offsets.push_back(data.size());
+			data.push_back(0x04);
+			data.push_back(len);
+			data.insert(data.end(), value, value + len);
+		}
+	}
+	for (auto offset : offsets)
+	{
+		forks.push_back(data.data() + offset);
+	}
+}
+
+static bool run(SteamWorks::PulleyBack::Instance& instance, bool add, unsigned int count, int varc, std::vector<der_t>& forks)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < count; i++)
+	{
+		der_t* fork = forks.data() + i * varc;
+		if (!(add ? instance.add(fork) : instance.del(fork)))
+		{
+			printf("%s of fork %u failed.\n", add ? "Add" : "Del", i);
+			instance.rollback();
+			return false;
+		}
+	}
+	if (!instance.prepare() || !instance.commit())
+	{
+		printf("Commit failed.\n");
+		instance.rollback();
+		return false;
+	}
+	std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+	printf("%s %u forks in %.3fs, %.0f forks/s\n", add ? "Added" : "Deleted", count, seconds.count(), count / seconds.count());
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	SteamWorks::Logging::Manager logManager("pulleyscript.properties", SteamWorks::Logging::INFO);
+
+	unsigned int count = 1000000;
+	int varc = 2;
+	int opt;
+	while ((opt = getopt(argc, argv, "hn:v:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			count = strtoul(optarg, nullptr, 10);
+			break;
+		case 'v':
+			varc = atoi(optarg);
+			break;
+		case 'h':
+		default:
+			version_info();
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if ((optind >= argc) || (varc < 1) || (varc > 64))
+	{
+		usage();
+		return 1;
+	}
+
+	SteamWorks::PulleyBack::Loader loader(argv[optind]);
+	auto instance(loader.get_instance(argc - optind - 1, argv + optind + 1, varc));
+	if (!instance.is_valid())
+	{
+		printf("Could not load backend %s\n", argv[optind]);
+		return 1;
+	}
+
+	std::vector<uint8_t> data;
+	std::vector<der_t> forks;
+	generate(count, varc, data, forks);
+
+	return (run(instance, true, count, varc, forks) && run(instance, false, count, varc, forks)) ? 0 : 1;
+}
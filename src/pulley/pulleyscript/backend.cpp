@@ -7,6 +7,8 @@ Adriaan de Groot <groot@kde.org>
 
 #include "backend.h"
 #include "parserpp.h"
+#include "squeal.h"
+#include "stats.h"
 #include "../pulleyback.h"
 
 #ifndef HAVE_DLFUNC
@@ -17,8 +19,12 @@ Adriaan de Groot <groot@kde.org>
 #include <dlfcn.h>
 #include <stdio.h>
 
-#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "logger.h"
 
@@ -37,6 +43,39 @@ static_assert(sizeof(plugindir) > 1, "Prefix / plugin directory path is weird.")
 // static_assert(plugindir[sizeof(plugindir)-1] == '/', "Backend must end in /.");
 
 
+SteamWorks::PulleyBack::Sink::~Sink()
+{
+}
+
+int SteamWorks::PulleyBack::Sink::prepare()
+{
+	return -1;  // Not supported
+}
+
+bool SteamWorks::PulleyBack::Sink::collaborate(Sink&)
+{
+	return false;
+}
+
+static std::unordered_map<std::string, SteamWorks::PulleyBack::Sink::Factory>& sinks()
+{
+	// Function-local, so that it exists for static Registrations
+	static std::unordered_map<std::string, SteamWorks::PulleyBack::Sink::Factory> registry;
+	return registry;
+}
+
+void SteamWorks::PulleyBack::Sink::register_sink(const std::string& name, Factory factory)
+{
+	sinks()[name] = factory;
+}
+
+SteamWorks::PulleyBack::Sink::Factory SteamWorks::PulleyBack::Sink::find_sink(const std::string& name)
+{
+	auto it = sinks().find(name);
+	return (it == sinks().end()) ? Factory() : it->second;
+}
+
+
 /**
  * Helper class when loading the API from a DLL. Uses dlfunc()
  * to resolve functions and stores them in referenced function
@@ -95,6 +134,10 @@ public:
 	decltype(pulleyback_commit)* m_pulleyback_commit;
 	decltype(pulleyback_rollback)* m_pulleyback_rollback;
 	decltype(pulleyback_collaborate) *m_pulleyback_collaborate;
+	decltype(pulleyback_add_batch)* m_pulleyback_add_batch;  // OPTIONAL
+	decltype(pulleyback_del_batch)* m_pulleyback_del_batch;  // OPTIONAL
+	decltype(pulleyback_types)* m_pulleyback_types;  // OPTIONAL
+	Sink::Factory m_sink_factory;  // For built-in backends, instead of the above
 
 	Private(const std::string& name) :
 		m_name(name),
@@ -108,11 +151,22 @@ public:
 		m_pulleyback_prepare(nullptr),
 		m_pulleyback_commit(nullptr),
 		m_pulleyback_rollback(nullptr),
-		m_pulleyback_collaborate(nullptr)
+		m_pulleyback_collaborate(nullptr),
+		m_pulleyback_add_batch(nullptr),
+		m_pulleyback_del_batch(nullptr),
+		m_pulleyback_types(nullptr)
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Trying to load backend '" << name << '\'';
 
+		m_sink_factory = Sink::find_sink(name);
+		if (m_sink_factory)
+		{
+			log.debugStream() << "  .. built in.";
+			m_valid = true;
+			return;
+		}
+
 #ifdef NO_SECURITY
 		char soname[128];
 		snprintf(soname, sizeof(soname), "%s", name.c_str());
@@ -157,7 +211,17 @@ public:
 			FuncKeeper<decltype(pulleyback_rollback)> fk7(m_handle, "pulleyback_rollback", m_valid, m_pulleyback_rollback);
 			FuncKeeper<decltype(pulleyback_collaborate)> fk8(m_handle, "pulleyback_collaborate", m_valid, m_pulleyback_collaborate);
 
+			// Batches are used only when both resolve
+			bool batchvalid = true;
+			FuncKeeper<decltype(pulleyback_add_batch)> fk9(m_handle, "pulleyback_add_batch", batchvalid, m_pulleyback_add_batch);
+			FuncKeeper<decltype(pulleyback_del_batch)> fk10(m_handle, "pulleyback_del_batch", batchvalid, m_pulleyback_del_batch);
+
+			bool typesvalid = true;
+			FuncKeeper<decltype(pulleyback_types)> fk11(m_handle, "pulleyback_types", typesvalid, m_pulleyback_types);
+
 			optionalvalid &= m_valid;  // If any required func missing, the optionals are invalid too
+			batchvalid &= m_valid;
+			typesvalid &= m_valid;
 		}
 
 		// If any function has not been resolved, the FuncKeeper will have set m_valid to false
@@ -190,13 +254,15 @@ public:
 
 std::shared_ptr< SteamWorks::PulleyBack::Loader::Private > SteamWorks::PulleyBack::Loader::Private::get_loader_private(const std::string& name)
 {
-	static std::unordered_map<std::string, std::weak_ptr<SteamWorks::PulleyBack::Loader::Private> > loaders;
+	// Plugins stay loaded once they load, so that a script reload
+	// that closes the last instance of a backend and opens a new one
+	// does not dlclose() and dlopen() it again. Failures are retried.
+	static std::unordered_map<std::string, std::shared_ptr<SteamWorks::PulleyBack::Loader::Private> > loaders;
 
-	auto p = loaders[name].lock();
-	if (!p)
+	auto& p = loaders[name];
+	if (!p || !p->is_valid())
 	{
 		p = std::make_shared<SteamWorks::PulleyBack::Loader::Private>(name);
-		loaders[name] = p;
 	}
 
 	return p;
@@ -230,23 +296,268 @@ bool SteamWorks::PulleyBack::Loader::is_valid() const
 	return d->is_valid();
 }
 
+static unsigned int queue_depth = 0;
+
+void SteamWorks::PulleyBack::Loader::set_queue_depth(unsigned int depth)
+{
+	queue_depth = depth;
+}
+
+
+/**
+ * Single-producer single-consumer ring of operations for an Instance.
+ * The Pulley thread fills slots at the tail, the worker thread consumes
+ * them at the head; each side owns its index. The slots keep their
+ * buffers, so that copying forks into them does not allocate once
+ * the queue has warmed up.
+ *
+ * The mutex and condition variable are only used to sleep on an empty
+ * (worker) or full (Pulley) queue, or until the queue has drained. Each
+ * side stores its own index before loading the other's, so at least one
+ * of them sees the other's move, and it is enough to notify on the
+ * transitions from empty, from full and to empty.
+ */
+class SteamWorks::PulleyBack::Instance::Queue
+{
+public:
+	struct Slot
+	{
+		QueueOp op;
+		std::vector<uint8_t> data;
+		std::vector<size_t> offsets;
+	} ;
+
+private:
+	std::vector<Slot> m_slots;
+	std::atomic<size_t> m_head;  // Next slot to consume; written by the worker
+	std::atomic<size_t> m_tail;  // Next slot to fill; written by the Pulley
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	bool m_stopping;  // Protected by m_mutex
+	std::atomic<int> m_result;  // Of the last transaction the worker completed
+	std::thread m_worker;
+
+	void wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+		}
+		m_cond.notify_all();
+	}
+
+	void run(Instance* instance);
+
+public:
+	Queue(unsigned int depth) :
+		m_slots(depth),
+		m_head(0),
+		m_tail(0),
+		m_stopping(false),
+		m_result(1)
+	{
+	}
+
+	/**
+	 * Stops the worker once it has delivered everything in the queue.
+	 */
+	~Queue()
+	{
+		if (m_worker.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_stopping = true;
+			}
+			m_cond.notify_all();
+			m_worker.join();
+		}
+	}
+
+	/**
+	 * Returns the slot at the tail for filling, waiting for the worker
+	 * if the queue is full. The worker is started here for @p instance.
+	 */
+	Slot& claim(Instance* instance)
+	{
+		if (!m_worker.joinable())
+		{
+			m_worker = std::thread(&Queue::run, this, instance);
+		}
+
+		size_t tail = m_tail.load();
+		if (tail - m_head.load() >= m_slots.size())
+		{
+			auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+			log.debugStream() << "Queue for " << instance->name() << " is full, waiting.";
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [&]{ return tail - m_head.load() < m_slots.size(); });
+		}
+		return m_slots[tail % m_slots.size()];
+	}
+
+	/**
+	 * Hands the slot returned by claim() to the worker.
+	 */
+	void publish()
+	{
+		size_t tail = m_tail.load();
+		m_tail.store(tail + 1);
+		if (m_head.load() == tail)
+		{
+			wake();  // Was empty, the worker may be asleep
+		}
+	}
+
+	/**
+	 * Waits until the worker has delivered everything in the queue.
+	 */
+	void drain()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]{ return size() == 0; });
+	}
+
+	/**
+	 * Result of the last Commit that the worker completed: 1 if the
+	 * plugin committed, 0 if the transaction was rolled back.
+	 */
+	int result() const { return m_result.load(); }
+
+	size_t size() const { return m_tail.load() - m_head.load(); }
+	size_t depth() const { return m_slots.size(); }
+} ;
+
+void SteamWorks::PulleyBack::Instance::Queue::run(Instance* instance)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+	log.debugStream() << "Queue worker for " << instance->name() << " started.";
+
+	std::vector<der_t> forkdata(instance->m_varc > 0 ? instance->m_varc : 1);
+	bool failed = false;  // In the current transaction
+
+	while (true)
+	{
+		size_t head = m_head.load();
+		if (m_tail.load() == head)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [&]{ return m_stopping || (m_tail.load() != head); });
+			if (m_tail.load() == head)
+			{
+				break;  // Stopping, and everything has been delivered
+			}
+		}
+
+		Slot& slot = m_slots[head % m_slots.size()];
+		switch (slot.op)
+		{
+		case QueueOp::Add:
+		case QueueOp::Del:
+			for (size_t i = 0; i < slot.offsets.size(); i++)
+			{
+				forkdata[i] = slot.data.data() + slot.offsets[i];
+			}
+			if (!((slot.op == QueueOp::Add) ? instance->call_add(forkdata.data()) : instance->call_del(forkdata.data())))
+			{
+				failed = true;
+			}
+			break;
+		case QueueOp::Reset:
+			if (!instance->call_reset())
+			{
+				failed = true;
+			}
+			break;
+		case QueueOp::Commit:
+			if (!failed && (instance->call_prepare() == 0))
+			{
+				failed = true;
+			}
+			if (failed)
+			{
+				log.errorStream() << "Transaction failed in " << instance->name() << ", rolling back.";
+				instance->call_rollback();
+			}
+			else if (!instance->call_commit())
+			{
+				log.errorStream() << "Commit failed in " << instance->name() << '.';
+				failed = true;
+			}
+			m_result.store(failed ? 0 : 1);
+			failed = false;
+			break;
+		case QueueOp::Rollback:
+			instance->call_rollback();
+			failed = false;
+			break;
+		}
+
+		m_head.store(head + 1);
+		size_t tail = m_tail.load();
+		if ((tail - head >= m_slots.size()) || (tail == head + 1))
+		{
+			wake();  // Was full or is empty, the Pulley may be waiting
+		}
+	}
+
+	log.debugStream() << "Queue worker for " << instance->name() << " done.";
+}
+
 
 
 SteamWorks::PulleyBack::Instance::Instance(std::shared_ptr<Loader::Private>& parent_d, int argc, char** argv, int varc) :
 	d(parent_d),
-	m_handle(nullptr)
+	m_handle(nullptr),
+	m_varc(varc),
+	m_stats(Stats::create(parent_d->name())),
+	m_batch_op(BatchOp::None),
+	m_batch_failed(false)
 {
 	if (d->is_valid())
 	{
-		m_handle = d->m_pulleyback_open(argc, argv, varc);
+		if (d->m_sink_factory)
+		{
+			m_sink.reset(d->m_sink_factory(argc, argv, varc));
+			m_handle = m_sink.get();
+		}
+		else
+		{
+			m_handle = d->m_pulleyback_open(argc, argv, varc);
+		}
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Got instance handle @" << m_handle;
+		if (m_handle && (queue_depth > 0))
+		{
+			m_queue.reset(new Queue(queue_depth));
+		}
 	}
 }
 
+SteamWorks::PulleyBack::Instance::Instance(Instance&& other) :
+	d(other.d),
+	m_handle(other.m_handle),
+	m_varc(other.m_varc),
+	m_sink(std::move(other.m_sink)),
+	m_blobs(std::move(other.m_blobs)),
+	m_stats(std::move(other.m_stats)),
+	m_queue(std::move(other.m_queue)),
+	m_batch_op(other.m_batch_op),
+	m_batch_data(std::move(other.m_batch_data)),
+	m_batch_offsets(std::move(other.m_batch_offsets)),
+	m_batch_failed(other.m_batch_failed)
+{
+	// The handle is closed only once, by this instance
+	other.m_handle = nullptr;
+}
+
 SteamWorks::PulleyBack::Instance::~Instance()
 {
-	if (m_handle and d->is_valid())
+	m_queue.reset();  // Delivers what is still queued
+	if (m_sink)
+	{
+		m_sink.reset();
+	}
+	else if (m_handle and d->is_valid())
 	{
 		d->m_pulleyback_close(m_handle);
 	}
@@ -262,33 +573,164 @@ std::string SteamWorks::PulleyBack::Instance::name() const
 	return d->name();
 }
 
-int SteamWorks::PulleyBack::Instance::add(der_t* forkdata)
+bool SteamWorks::PulleyBack::Instance::has_batch() const
+{
+	return d->m_pulleyback_add_batch && d->m_pulleyback_del_batch && (m_varc > 0);
+}
+
+int SteamWorks::PulleyBack::Instance::buffer(BatchOp op, der_t* forkdata)
 {
+	static const size_t max_batch = 1024;  // Forks
+
+	if ((m_batch_op != op) || (m_batch_offsets.size() >= max_batch * m_varc))
+	{
+		flush();
+	}
+	m_batch_op = op;
+
+	for (int i = 0; i < m_varc; i++)
+	{
+		size_t size = der_size(forkdata[i]);
+		m_batch_offsets.push_back(m_batch_data.size());
+		m_batch_data.insert(m_batch_data.end(), forkdata[i], forkdata[i] + size);
+	}
+	return m_batch_failed ? 0 : 1;
+}
+
+int SteamWorks::PulleyBack::Instance::flush()
+{
+	if (m_batch_offsets.empty())
+	{
+		return m_batch_failed ? 0 : 1;
+	}
+
+	unsigned int numforks = m_batch_offsets.size() / m_varc;
+	std::vector<der_t> ders(m_batch_offsets.size());
+	std::vector<der_t*> forks(numforks);
+	for (size_t i = 0; i < ders.size(); i++)
+	{
+		ders[i] = m_batch_data.data() + m_batch_offsets[i];
+	}
+	for (unsigned int i = 0; i < numforks; i++)
+	{
+		forks[i] = ders.data() + i * m_varc;
+	}
+
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+	log.debugStream() << "Calling into instance " << name() << (m_batch_op == BatchOp::Add ? " add" : " del") << "_batch of " << numforks << " handle@" << m_handle;
+	Stats::Timer timer(m_stats.get());
+	int r = (m_batch_op == BatchOp::Add) ?
+		timer.done(Stats::Add, d->m_pulleyback_add_batch(m_handle, forks.data(), numforks), numforks) :
+		timer.done(Stats::Del, d->m_pulleyback_del_batch(m_handle, forks.data(), numforks), numforks);
+	if (!r)
+	{
+		m_batch_failed = true;
+	}
+
+	m_batch_data.clear();
+	m_batch_offsets.clear();
+	m_batch_op = BatchOp::None;
+	return r;
+}
+
+void SteamWorks::PulleyBack::Instance::discard()
+{
+	m_batch_data.clear();
+	m_batch_offsets.clear();
+	m_batch_op = BatchOp::None;
+	m_batch_failed = false;
+}
+
+const struct squeal_blob* SteamWorks::PulleyBack::Instance::view(der_t* forkdata)
+{
+	if (!m_blobs)
+	{
+		m_blobs.reset(new squeal_blob[m_varc > 0 ? m_varc : 1]);
+	}
+	for (int i = 0; i < m_varc; i++)
+	{
+		size_t size = der_size(forkdata[i]);
+		size_t len_len = (forkdata[i][1] & 0x80) ? (forkdata[i][1] & 0x7f) : 0;
+		size_t header = 2 + len_len;
+		m_blobs[i].data = forkdata[i] + header;
+		m_blobs[i].size = size - header;
+	}
+	return m_blobs.get();
+}
+
+int SteamWorks::PulleyBack::Instance::call_add(der_t* forkdata)
+{
+	Stats::Timer timer(m_stats.get());
+	if (m_sink)
+	{
+		return timer.done(Stats::Add, m_sink->add(view(forkdata)));
+	}
+	if (d->is_valid() && has_batch())
+	{
+		return buffer(BatchOp::Add, forkdata);  // Timed when flushed
+	}
 	if (d->is_valid())
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Calling into instance " << name() << " add@" << (void *)d->m_pulleyback_add << " handle@" << m_handle;
-		return d->m_pulleyback_add(m_handle, forkdata);
+		return timer.done(Stats::Add, d->m_pulleyback_add(m_handle, forkdata));
 	}
 	return 0;
 }
 
-int SteamWorks::PulleyBack::Instance::del(der_t* forkdata)
+int SteamWorks::PulleyBack::Instance::call_del(der_t* forkdata)
 {
+	Stats::Timer timer(m_stats.get());
+	if (m_sink)
+	{
+		return timer.done(Stats::Del, m_sink->del(view(forkdata)));
+	}
+	if (d->is_valid() && has_batch())
+	{
+		return buffer(BatchOp::Del, forkdata);  // Timed when flushed
+	}
 	if (d->is_valid())
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Calling into instance " << name() << " del@" << (void *)d->m_pulleyback_del << " handle@" << m_handle;
-		return d->m_pulleyback_del(m_handle, forkdata);
+		return timer.done(Stats::Del, d->m_pulleyback_del(m_handle, forkdata));
 	}
 	return 0;
 }
 
-int SteamWorks::PulleyBack::Instance::prepare()
+int SteamWorks::PulleyBack::Instance::call_reset()
+{
+	if (m_sink)
+	{
+		Stats::Timer timer(m_stats.get());
+		return timer.done(Stats::Reset, m_sink->reset(), 0);
+	}
+	if (d->is_valid())
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+		log.debugStream() << "Calling into instance " << name() << " reset@" << (void *)d->m_pulleyback_reset << " handle@" << m_handle;
+		flush();
+		Stats::Timer timer(m_stats.get());
+		return timer.done(Stats::Reset, d->m_pulleyback_reset(m_handle), 0);
+	}
+	return 0;
+}
+
+int SteamWorks::PulleyBack::Instance::call_prepare()
 {
+	if (m_sink)
+	{
+		Stats::Timer timer(m_stats.get());
+		return timer.done(Stats::Prepare, m_sink->prepare(), 0);
+	}
 	if (d->is_valid())
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+		if (!flush())
+		{
+			log.debugStream() << "Calling into instance " << name() << " prepare after failed batch.";
+			return 0;
+		}
 		if (!d->m_pulleyback_prepare)
 		{
 			log.debugStream() << "Calling into instance " << name() << " prepare is not supported.";
@@ -297,30 +739,183 @@ int SteamWorks::PulleyBack::Instance::prepare()
 		else
 		{
 			log.debugStream() << "Calling into instance " << name() << " prepare@" << (void *)d->m_pulleyback_prepare << " handle@" << m_handle;
-			return d->m_pulleyback_prepare(m_handle);
+			Stats::Timer timer(m_stats.get());
+			return timer.done(Stats::Prepare, d->m_pulleyback_prepare(m_handle), 0);
 		}
 	}
 	return 0;  // Failed
 }
 
-int SteamWorks::PulleyBack::Instance::commit()
+int SteamWorks::PulleyBack::Instance::call_commit()
 {
+	if (m_sink)
+	{
+		Stats::Timer timer(m_stats.get());
+		return timer.done(Stats::Commit, m_sink->commit(), 0);
+	}
 	if (d->is_valid())
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Calling into instance " << name() << " commit@" << (void *)d->m_pulleyback_commit << " handle@" << m_handle;
-		return d->m_pulleyback_commit(m_handle);
+		int flushed = flush();
+		m_batch_failed = false;
+		Stats::Timer timer(m_stats.get());
+		int r = timer.done(Stats::Commit, d->m_pulleyback_commit(m_handle), 0);
+		return flushed ? r : 0;
 	}
 	return 0;
 
 }
 
-void SteamWorks::PulleyBack::Instance::rollback()
+void SteamWorks::PulleyBack::Instance::call_rollback()
 {
+	Stats::Timer timer(m_stats.get());
+	if (m_sink)
+	{
+		m_sink->rollback();
+		timer.done(Stats::Rollback, 1, 0);
+		return;
+	}
 	if (d->is_valid())
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
 		log.debugStream() << "Calling into instance " << name() << " rollback@" << (void *)d->m_pulleyback_rollback << " handle@" << m_handle;
+		discard();
 		d->m_pulleyback_rollback(m_handle);
+		timer.done(Stats::Rollback, 1, 0);
+	}
+}
+
+int SteamWorks::PulleyBack::Instance::add(der_t* forkdata)
+{
+	return m_queue ? enqueue(QueueOp::Add, forkdata) : call_add(forkdata);
+}
+
+int SteamWorks::PulleyBack::Instance::del(der_t* forkdata)
+{
+	return m_queue ? enqueue(QueueOp::Del, forkdata) : call_del(forkdata);
+}
+
+int SteamWorks::PulleyBack::Instance::add(const struct squeal_blob* forkdata)
+{
+	if (!takes_blobs())
+	{
+		return 0;
+	}
+	Stats::Timer timer(m_stats.get());
+	return timer.done(Stats::Add, m_sink->add(forkdata));
+}
+
+int SteamWorks::PulleyBack::Instance::del(const struct squeal_blob* forkdata)
+{
+	if (!takes_blobs())
+	{
+		return 0;
+	}
+	Stats::Timer timer(m_stats.get());
+	return timer.done(Stats::Del, m_sink->del(forkdata));
+}
+
+int SteamWorks::PulleyBack::Instance::reset()
+{
+	return m_queue ? enqueue(QueueOp::Reset, nullptr) : call_reset();
+}
+
+int SteamWorks::PulleyBack::Instance::prepare()
+{
+	return m_queue ? -1 : call_prepare();
+}
+
+int SteamWorks::PulleyBack::Instance::commit()
+{
+	if (!m_queue)
+	{
+		return call_commit();
+	}
+	if (!enqueue(QueueOp::Commit, nullptr))
+	{
+		return 0;
+	}
+	m_queue->drain();  // The worker has completed the transaction after this
+	return m_queue->result();
+}
+
+void SteamWorks::PulleyBack::Instance::rollback()
+{
+	if (m_queue)
+	{
+		enqueue(QueueOp::Rollback, nullptr);
+	}
+	else
+	{
+		call_rollback();
+	}
+}
+
+bool SteamWorks::PulleyBack::Instance::congested() const
+{
+	// Three quarters full
+	return m_queue && (m_queue->size() * 4 >= m_queue->depth() * 3);
+}
+
+bool SteamWorks::PulleyBack::Instance::collaborate(Instance& other)
+{
+	if ((this == &other) || (d != other.d) || !is_valid() || !other.is_valid() || m_queue || other.m_queue)
+	{
+		return false;
+	}
+
+	if (m_sink || other.m_sink)
+	{
+		return m_sink && other.m_sink && m_sink->collaborate(*other.m_sink);
+	}
+
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+	log.debugStream() << "Calling into instance " << name() << " collaborate@" << (void *)d->m_pulleyback_collaborate << " handle@" << m_handle << " with @" << other.m_handle;
+	return d->m_pulleyback_collaborate(m_handle, other.m_handle) == 1;
+}
+
+bool SteamWorks::PulleyBack::Instance::set_types(const std::vector<uint8_t>& tags)
+{
+	if (!is_valid() || !d->m_pulleyback_types || (tags.size() != (size_t)m_varc))
+	{
+		return false;
+	}
+	if (m_queue)
+	{
+		m_queue->drain();  // The worker is idle after this
+	}
+
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback");
+	log.debugStream() << "Calling into instance " << name() << " types@" << (void *)d->m_pulleyback_types << " handle@" << m_handle;
+	return d->m_pulleyback_types(m_handle, m_varc, tags.data()) == 1;
+}
+
+int SteamWorks::PulleyBack::Instance::deliver()
+{
+	return m_queue ? 1 : flush();
+}
+
+int SteamWorks::PulleyBack::Instance::enqueue(QueueOp op, der_t* forkdata)
+{
+	if (!is_valid())
+	{
+		return 0;
+	}
+
+	Queue::Slot& slot = m_queue->claim(this);
+	slot.op = op;
+	slot.data.clear();
+	slot.offsets.clear();
+	if (forkdata)
+	{
+		for (int i = 0; i < m_varc; i++)
+		{
+			size_t size = der_size(forkdata[i]);
+			slot.offsets.push_back(slot.data.size());
+			slot.data.insert(slot.data.end(), forkdata[i], forkdata[i] + size);
+		}
 	}
+	m_queue->publish();
+	return 1;
 }
@@ -21,11 +21,17 @@ Adriaan de Groot <groot@kde.org>
 #ifndef STEAMWORKS_PULLEY_BACKEND_H
 #define STEAMWORKS_PULLEY_BACKEND_H
 
+#include <functional>
 #include <vector>
 #include <memory>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "../pulleyback.h"
 
+struct squeal_blob;  // See pulleyscript/squeal.h
+
 namespace SteamWorks
 {
 
@@ -36,6 +42,79 @@ namespace PulleyBack
 {
 
 class Instance;
+class Stats;
+
+/**
+ * Size of the DER value at @p der, including its tag and length.
+ */
+inline size_t der_size(const uint8_t* der)
+{
+	size_t len = der[1];
+	size_t header = 2;
+	if (len & 0x80)
+	{
+		unsigned int len_len = len & 0x7f;
+		len = 0;
+		for (unsigned int i = 0; i < len_len; i++)
+		{
+			len = (len << 8) | der[2 + i];
+		}
+		header += len_len;
+	}
+	return header + len;
+}
+
+/**
+ * Backends that are built into the Pulley implement this interface
+ * instead of the C API in pulleyback.h. They are registered by name,
+ * and the Loader looks for a registered Sink before it tries to load
+ * a plugin of that name.
+ *
+ * A Sink receives each fork as an array of varc squeal_blob views of
+ * the values, straight from the middle-end, without DER encoding. The
+ * views are valid only for the duration of the call. The functions
+ * mean the same as their pulleyback_*() counterparts; a Sink that
+ * cannot prepare keeps the default, which returns -1.
+ */
+class Sink
+{
+public:
+	using Factory = std::function<Sink*(int argc, char** argv, int varc)>;
+
+	virtual ~Sink();
+
+	virtual int add(const struct squeal_blob* forkdata) = 0;
+	virtual int del(const struct squeal_blob* forkdata) = 0;
+	virtual int reset() = 0;
+	virtual int prepare();
+	virtual int commit() = 0;
+	virtual void rollback() = 0;
+	virtual bool collaborate(Sink& other);
+
+	/**
+	 * Registers @p factory as the backend called @p name. The factory
+	 * is called for each driver that outputs to the backend, and returns
+	 * a new Sink, or nullptr if the parameters are wrong.
+	 */
+	static void register_sink(const std::string& name, Factory factory);
+	static Factory find_sink(const std::string& name);
+
+	/**
+	 * Registers a Sink from a static object, for example:
+	 *
+	 *     static Sink::Registration r("file", [](int argc, char** argv, int varc) { ... });
+	 *
+	 * The object file must be linked into the Pulley executable
+	 * itself; from a static library, the linker may drop it.
+	 */
+	struct Registration
+	{
+		Registration(const std::string& name, Factory factory)
+		{
+			register_sink(name, factory);
+		}
+	} ;
+} ;
 
 /**
  * Loader for named Pulley backends.
@@ -64,6 +143,15 @@ public:
 	Instance get_instance(PulleyScript::BackendParameters& parameters);
 
 	bool is_valid() const;
+
+	/**
+	 * Deliver to instances asynchronously. Instances obtained
+	 * after setting a @p depth greater than zero get a queue of
+	 * that many operations, which a worker thread (one per
+	 * instance) passes on to the plugin. A depth of 0, the
+	 * default, calls the plugin directly.
+	 */
+	static void set_queue_depth(unsigned int depth);
 } ;
 
 
@@ -73,10 +161,57 @@ friend class Loader;
 private:
 	std::shared_ptr<Loader::Private> d;  // Shared with loaders
 	void* m_handle;
+	int m_varc;
+
+	// For a built-in backend, the Sink; m_handle then points to it too.
+	// Forks that arrive as DER are viewed as blobs in m_blobs.
+	std::unique_ptr<Sink> m_sink;
+	std::unique_ptr<struct squeal_blob[]> m_blobs;
+	const struct squeal_blob* view(der_t* forkdata);
+
+	// Counters and latencies of the calls into the plugin
+	std::shared_ptr<Stats> m_stats;
+
+	// Asynchronous delivery, see Loader::set_queue_depth(). The
+	// queue holds copies of the forks, and its worker thread is
+	// started on first use, so that it never sees an Instance
+	// that is still being moved into place.
+	enum class QueueOp { Add, Del, Reset, Commit, Rollback };
+	class Queue;
+	std::unique_ptr<Queue> m_queue;
+
+	// When the backend has pulleyback_add_batch() and _del_batch(),
+	// forks are copied into a buffer, which is flushed when switching
+	// between add and del, when it is full and at the end of the
+	// transaction. Each fork is m_varc offsets into m_batch_data.
+	enum class BatchOp { None, Add, Del };
+	BatchOp m_batch_op;
+	std::vector<uint8_t> m_batch_data;
+	std::vector<size_t> m_batch_offsets;
+	bool m_batch_failed;
 
 	Instance(std::shared_ptr<Loader::Private>& loader, int argc, char** argv, int varc);
 
+	bool has_batch() const;
+	int buffer(BatchOp op, der_t* forkdata);
+	int flush();
+	void discard();
+
+	// Direct calls into the plugin, from the calling thread
+	// or from the worker thread of the queue.
+	int call_add(der_t* forkdata);
+	int call_del(der_t* forkdata);
+	int call_reset();
+	int call_prepare();
+	int call_commit();
+	void call_rollback();
+
+	int enqueue(QueueOp op, der_t* forkdata);
+
 public:
+	Instance(Instance&& other);
+	Instance(const Instance&) = delete;
+
 	/**
 	 * Close this instance of a Pulley backend-plugin api.
 	 */
@@ -97,9 +232,63 @@ public:
 
 	int add(der_t* forkdata);
 	int del(der_t* forkdata);
+
+	/**
+	 * A built-in backend that is called directly can take forks
+	 * as blobs from the middle-end, rather than DER, through
+	 * add() and del() with squeal_blobs.
+	 */
+	bool takes_blobs() const { return m_sink && !m_queue; }
+	int add(const struct squeal_blob* forkdata);
+	int del(const struct squeal_blob* forkdata);
+
+	int reset();
 	int prepare();
 	int commit();
 	void rollback();
+
+	/**
+	 * With asynchronous delivery, add(), del() and reset() queue
+	 * their work, and commit() and rollback() queue the end of the
+	 * transaction, which the worker completes (with a prepare() if
+	 * the plugin supports it) once it has delivered everything
+	 * before it. Such an instance acts as a one-phase backend:
+	 * prepare() returns -1, and its commit cannot fail the other
+	 * backends. commit() waits for the worker to complete the
+	 * transaction and returns its result, so that output is only
+	 * dropped from the journal once the plugin has it. A queue
+	 * that is full blocks the caller.
+	 *
+	 * Returns true if the queue is filling up, so that callers
+	 * can hold back new work; always false without a queue.
+	 */
+	bool congested() const;
+
+	/**
+	 * Asks the plugin to run the transactions of @p other as part
+	 * of the transactions of this instance, which is what
+	 * pulleyback_collaborate() does. Only instances of the same
+	 * backend that deliver directly can collaborate. On success,
+	 * the transaction only needs to be prepared, committed and
+	 * rolled back on this instance; call deliver() on @p other
+	 * before preparing.
+	 */
+	bool collaborate(Instance& other);
+
+	/**
+	 * Offers values with the DER @p tags (one per variable) to the
+	 * plugin through pulleyback_types(). Returns true if the plugin
+	 * takes them; otherwise values must be passed as OCTET STRINGs.
+	 * Call this outside of transactions.
+	 */
+	bool set_types(const std::vector<uint8_t>& tags);
+
+	/**
+	 * Delivers forks that are buffered for a batch now. The
+	 * transaction functions do this themselves. Returns 0 if
+	 * delivery failed in this transaction.
+	 */
+	int deliver();
 } ;
 
 }  // namespace PulleyBack
@@ -1,26 +1,116 @@
 /* bitset.c -- Handle bitsets of a predefined size and define mathops on them.
+ *
+ * Bits are stored in 64-bit words, so that counting and searching can be
+ * done a word at a time with population count and count-trailing-zeroes
+ * instructions.  Bitsets up to BITSET_INLINE_BITS are stored inside the
+ * bitset structure, which covers most scripts without allocating data.
  *
  * From: Rick van Rein <rick@openfortress.nl>
  */
 
 
+#include <string.h>
+
 #include "bitset.h"
 #include "parser.h"
 
 
+/* The number of words in use for a bitset with the given maxbit.
+ * Since maxbit is always one less than a multiple of 64, this is exact.
+ */
+#define WORDS(maxbit) (((maxbit) + 1) >> 6)
+#define WORDBIT(bit) (((uint64_t) 1) << ((bit) & 63))
+
+
+/* Word-level primitives: population count, count trailing zeroes and
+ * count leading zeroes.  The latter two are undefined for zero words.
+ */
+#if defined(__GNUC__)
+#  define popcount64(w) ((anynum_t) __builtin_popcountll (w))
+#  define ctz64(w) ((anynum_t) __builtin_ctzll (w))
+#  define clz64(w) ((anynum_t) __builtin_clzll (w))
+#else
+static inline anynum_t popcount64 (uint64_t w) {
+	anynum_t count = 0;
+	while (w != 0) {
+		w &= w - 1;
+		count++;
+	}
+	return count;
+}
+
+static inline anynum_t ctz64 (uint64_t w) {
+	anynum_t n = 0;
+	while ((w & 1) == 0) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+}
+
+static inline anynum_t clz64 (uint64_t w) {
+	anynum_t n = 0;
+	while ((w & (((uint64_t) 1) << 63)) == 0) {
+		w <<= 1;
+		n++;
+	}
+	return n;
+}
+#endif
+
+
+/* Bulk operations combine words of two bitsets.  When the compiler has
+ * vector extensions, this is done with vectors of two words (SSE2 or
+ * NEON) and the remaining word is done separately.  The words need not
+ * be aligned, as they are loaded and stored through memcpy().
+ */
+#if defined(__GNUC__)
+typedef uint64_t bitvec_t __attribute__ ((vector_size (16)));
+#  define BITVEC_WORDS (sizeof (bitvec_t) / sizeof (uint64_t))
+#  define WORDS_VECTOR_LOOP(expr) \
+	bitvec_t a, o; \
+	for ( ; i + BITVEC_WORDS <= m; i += BITVEC_WORDS) { \
+		memcpy (&a, accu + i, sizeof (a)); \
+		memcpy (&o, operand + i, sizeof (o)); \
+		a = expr; \
+		memcpy (accu + i, &a, sizeof (a)); \
+	}
+#else
+#  define WORDS_VECTOR_LOOP(expr)
+#endif
+
+#define WORDS_OPERATION(name,expr) \
+static void name (uint64_t *accu, const uint64_t *operand, anynum_t m) { \
+	anynum_t i = 0; \
+	WORDS_VECTOR_LOOP(expr) \
+	for ( ; i < m; i++) { \
+		uint64_t a = accu [i]; \
+		uint64_t o = operand [i]; \
+		accu [i] = expr; \
+	} \
+}
+
+WORDS_OPERATION (words_or,     (a | o))
+WORDS_OPERATION (words_and,    (a & o))
+WORDS_OPERATION (words_andnot, (a & ~o))
+WORDS_OPERATION (words_notand, (o & ~a))
+WORDS_OPERATION (words_xor,    (a ^ o))
+
+
 bitset_t *bitset_new (type_t *elt_type) {
 	bitset_t *retval = malloc (sizeof (bitset_t));
 	if (retval == NULL) {
 		fatal_error ("Out of memory allocating bitset");
 	}
-	retval->maxbit = 0;
-	retval->bits = NULL;
+	retval->maxbit = BITSET_INLINE_BITS - 1;
+	retval->bits = retval->inline_bits;
 	retval->type = elt_type;
+	memset (retval->inline_bits, 0, sizeof (retval->inline_bits));
 	return retval;
 }
 
 void bitset_destroy (bitset_t *bts) {
-	if ((bts != NULL) && (bts->bits != NULL)) {
+	if ((bts != NULL) && (bts->bits != bts->inline_bits)) {
 		free (bts->bits);
 	}
 	if (bts != NULL)
@@ -53,78 +143,77 @@ void bitset_print (bitset_t *bts, char *opt_pfix, FILE *stream) {
 }
 
 void bitset_copy (bitset_t *dest, bitset_t *orig) {
-	anynum_t i, m1, m2;
+	anynum_t m1, m2;
 	bitset_require_maxbit (dest, orig->maxbit);
-	m1 = (orig->maxbit + 1) >> 5;
-	m2 = (dest->maxbit + 1) >> 5;
-	for (i=0; i<m1; i++) {
-		dest->bits [i] = orig->bits [i];
-	}
-	for (   ; i<m2; i++) {
-		dest->bits [i] = 0;
-	}
+	m1 = WORDS (orig->maxbit);
+	m2 = WORDS (dest->maxbit);
+	memcpy (dest->bits, orig->bits, m1 * sizeof (uint64_t));
+	memset (dest->bits + m1, 0, (m2 - m1) * sizeof (uint64_t));
 }
 
 bitset_t *bitset_clone (bitset_t *bts) {
 	bitset_t *new;
-	anynum_t i, m;
 	new = bitset_new (bts->type);
-	bitset_require_maxbit (new, bts->maxbit);
-	m = (bts->maxbit + 1) >> 5;
-	for (i=0; i<m; i++) {
-		new->bits [i] = bts->bits [i];
-	}
+	bitset_copy (new, bts);
 	return new;
 }
 
 void bitset_empty (bitset_t *bts) {
-	anynum_t i, m;
-	m = (bts->maxbit + 1) >> 5;
-	for (i=0; i<m; i++) {
-		bts->bits [i] = 0U;
-	}
+	memset (bts->bits, 0, WORDS (bts->maxbit) * sizeof (uint64_t));
 }
 
+/* Grow the bitset to hold at least reqmaxbit.  Storage at least doubles,
+ * so that setting bits one by one does not reallocate for every word.
+ */
 void bitset_require_maxbit (bitset_t *bts, anynum_t reqmaxbit) {
-	reqmaxbit = reqmaxbit | 31;
-	if ((bts->bits == NULL) || (bts->maxbit < reqmaxbit)) {
-		int i;
-		uint32_t *newbits = realloc (bts->bits, (reqmaxbit + 1) >> 3);
-		if (newbits == NULL) {
-			fatal_error ("Out of memory allocating bitset data");
-		}
-		for (i = ((bts->maxbit + 1) >> 5); i < ((reqmaxbit + 1) >> 5); i++) {
-			newbits [i] = 0;
+	anynum_t oldwords, newwords;
+	uint64_t *newbits;
+	if (reqmaxbit <= bts->maxbit) {
+		return;
+	}
+	oldwords = WORDS (bts->maxbit);
+	newwords = WORDS (reqmaxbit | 63);
+	if (newwords < 2 * oldwords) {
+		newwords = 2 * oldwords;
+	}
+	if (bts->bits == bts->inline_bits) {
+		newbits = malloc (newwords * sizeof (uint64_t));
+		if (newbits != NULL) {
+			memcpy (newbits, bts->inline_bits, oldwords * sizeof (uint64_t));
 		}
-		bts->bits = newbits;
-		bts->maxbit = reqmaxbit;
+	} else {
+		newbits = realloc (bts->bits, newwords * sizeof (uint64_t));
+	}
+	if (newbits == NULL) {
+		fatal_error ("Out of memory allocating bitset data");
 	}
+	memset (newbits + oldwords, 0, (newwords - oldwords) * sizeof (uint64_t));
+	bts->bits = newbits;
+	bts->maxbit = (newwords << 6) - 1;
 }
 
 void bitset_set (bitset_t *bts, anynum_t bit) {
 	bitset_require_maxbit (bts, bit);
-	bts->bits [bit >> 5] |= (((uint32_t) 1) << (bit & 31));
+	bts->bits [bit >> 6] |= WORDBIT (bit);
 }
 
 void bitset_clear (bitset_t *bts, anynum_t bit) {
-	bitset_require_maxbit (bts, bit);
-	bts->bits [bit >> 5] &= ~(((uint32_t) 1) << (bit & 31));
+	if (bit > bts->maxbit) {
+		return;
+	}
+	bts->bits [bit >> 6] &= ~WORDBIT (bit);
 }
 
 void bitset_toggle (bitset_t *bts, anynum_t bit) {
 	bitset_require_maxbit (bts, bit);
-	bts->bits [bit >> 5] ^= (((uint32_t) 1) << (bit & 31));
+	bts->bits [bit >> 6] ^= WORDBIT (bit);
 }
 
 bool bitset_test (bitset_t *bts, anynum_t bit) {
 	if (bit > bts->maxbit) {
 		return false;
 	}
-	if (bts->bits [bit >> 5] & (((uint32_t) 1) << (bit & 31))) {
-		return true;
-	} else {
-		return false;
-	}
+	return (bts->bits [bit >> 6] & WORDBIT (bit)) != 0;
 }
 
 void *bitset_element (bitset_t *bts, anynum_t idx) {
@@ -132,51 +221,34 @@ void *bitset_element (bitset_t *bts, anynum_t idx) {
 }
 
 anynum_t bitset_min (bitset_t *bts) {
-	anynum_t i, j, m;
-	m = (bts->maxbit + 1) >> 5;
-	i = 0;
-	while (bts->bits [i] == 0) {
-		if (i < m) {
-			i++;
-		} else {
-			return BITNUM_BAD;
+	anynum_t i, m;
+	m = WORDS (bts->maxbit);
+	for (i=0; i<m; i++) {
+		if (bts->bits [i] != 0) {
+			return (i << 6) | ctz64 (bts->bits [i]);
 		}
 	}
-	j = 0;
-	while ((bts->bits [i] & (((uint32_t) 1) << j)) == 0) {
-		j++;
-	}
-	return (i<<5) | j;
+	return BITNUM_BAD;
 }
 
 anynum_t bitset_max (bitset_t *bts) {
-	anynum_t i, j;
-	i = (bts->maxbit >> 5) - 1;
-	while (bts->bits [i] == 0) {
-		if (i > 0) {
-			i--;
-		} else {
-			return BITNUM_BAD;
+	anynum_t i;
+	i = WORDS (bts->maxbit);
+	while (i-- > 0) {
+		if (bts->bits [i] != 0) {
+			return (i << 6) | (63 - clz64 (bts->bits [i]));
 		}
 	}
-	j = 31;
-	while ((bts->bits [i] & (((uint32_t) 1) << j)) == 0) {
-		j--;
-	}
-	return (i<<5) | j;
+	return BITNUM_BAD;
 }
 
 /* return |bts| */
 anynum_t bitset_count (bitset_t *bts) {
-	anynum_t i, j, m, count;
-	m = (bts->maxbit + 1) >> 5;
+	anynum_t i, m, count;
+	m = WORDS (bts->maxbit);
 	count = 0;
 	for (i=0; i<m; i++) {
-		for (j=0; j<32; j++) {
-			if (bts->bits [i] & (((int32_t) 1) << j)) {
-				count++;
-			}
-		}
+		count += popcount64 (bts->bits [i]);
 	}
 	return count;
 }
@@ -184,7 +256,7 @@ anynum_t bitset_count (bitset_t *bts) {
 /* return (|bts| == 0) */
 bool bitset_isempty (bitset_t *bts) {
 	anynum_t i, m;
-	m = (bts->maxbit + 1) >> 5;
+	m = WORDS (bts->maxbit);
 	for (i=0; i<m; i++) {
 		if (bts->bits [i] != 0) {
 			return false;
@@ -195,47 +267,32 @@ bool bitset_isempty (bitset_t *bts) {
 
 /* accu := accu | operand */
 void bitset_union (bitset_t *accu, bitset_t *operand) {
-	anynum_t i, m;
-	if (accu->maxbit < operand->maxbit) {
-		bitset_require_maxbit (accu, operand->maxbit);
-	} else {
-		bitset_require_maxbit (operand, accu->maxbit);
-	}
-	m = (1 + accu->maxbit) >> 5;
-	for (i=0; i<m; i++) {
-		accu->bits [i] |= operand->bits [i];
-	}
+	bitset_require_maxbit (accu, operand->maxbit);
+	words_or (accu->bits, operand->bits, WORDS (operand->maxbit));
 }
 
 /* accu := accu & operand */
 void bitset_disjunction (bitset_t *accu, bitset_t *operand) {
-	anynum_t i, m1, m2;
-	if (accu->maxbit < operand->maxbit) {
-		bitset_require_maxbit (accu, operand->maxbit);
-	}
-	m2 = (1 + accu   ->maxbit) >> 5;
-	m1 = (1 + operand->maxbit) >> 5;
+	anynum_t m1, m2;
+	m1 = WORDS (operand->maxbit);
+	m2 = WORDS (accu   ->maxbit);
 	if (m1 > m2) {
 		m1 = m2;
 	}
-	for (i=0; i<m1; i++) {
-		accu->bits [i] &= operand->bits [i];
-	}
-	for (   ; i<m2; i++) {
-		accu->bits [i] = 0U;
-	}
+	words_and (accu->bits, operand->bits, m1);
+	memset (accu->bits + m1, 0, (m2 - m1) * sizeof (uint64_t));
 }
 
 /* return (|accu & operand| == 0) */
 bool bitset_disjoint (bitset_t *left, bitset_t *rigt) {
 	anynum_t i, m1, m2;
-	m1 = (1 + left->maxbit) >> 5;
-	m2 = (1 + rigt->maxbit) >> 5;
+	m1 = WORDS (left->maxbit);
+	m2 = WORDS (rigt->maxbit);
 	if (m1 > m2) {
 		m1 = m2;
 	}
 	for (i=0; i<m1; i++) {
-		if ((left->bits [i] & rigt->bits [i]) != 0U) {
+		if ((left->bits [i] & rigt->bits [i]) != 0) {
 			return false;
 		}
 	}
@@ -244,57 +301,41 @@ bool bitset_disjoint (bitset_t *left, bitset_t *rigt) {
 
 /* accu := accu - operand */
 void bitset_subtract (bitset_t *accu, bitset_t *operand) {
-	int i, m1, m2;
-	m1 = (1 + operand->maxbit) >> 5;
-	m2 = (1 + accu   ->maxbit) >> 5;
+	anynum_t m1, m2;
+	m1 = WORDS (operand->maxbit);
+	m2 = WORDS (accu   ->maxbit);
 	if (m1 > m2) {
 		m1 = m2;
 	}
-	for (i=0; i<m1; i++) {
-		accu->bits [i] &= ~operand->bits [i];
-	}
-	for (   ; i<m2; i++) {
-		accu->bits [i] = 0U;
-	}
+	// Bits beyond the operand's size are not in the operand; they remain
+	words_andnot (accu->bits, operand->bits, m1);
 }
 
 /* accu := operand - accu */
 void bitset_bustract (bitset_t *accu, bitset_t *operand) {
-	int i, m1, m2;
-	m1 = (1 + operand->maxbit) >> 5;
-	m2 = (1 + accu   ->maxbit) >> 5;
+	anynum_t m1, m2;
+	m1 = WORDS (operand->maxbit);
+	m2 = WORDS (accu   ->maxbit);
 	if (m1 > m2) {
-		m1 = m2;
-	}
-	for (i=0; i<m1; i++) {
-		accu->bits [i] = operand->bits [i] & ~accu->bits [i];
-	}
-	for (   ; i<m2; i++) {
-		accu->bits [i] = 0U;
+		bitset_require_maxbit (accu, operand->maxbit);
+		m2 = WORDS (accu->maxbit);
 	}
+	words_notand (accu->bits, operand->bits, m1);
+	memset (accu->bits + m1, 0, (m2 - m1) * sizeof (uint64_t));
 }
 
 /* accu := accu ^ operand */
 void bitset_exor (bitset_t *accu, bitset_t *operand) {
-	anynum_t i, m;
-	if (accu->maxbit < operand->maxbit) {
-		bitset_require_maxbit (accu, operand->maxbit);
-	} else {
-		bitset_require_maxbit (operand, accu->maxbit);
-	}
-	m = (1 + accu->maxbit) >> 5;
-	for (i=0; i<m; i++) {
-		accu->bits [i] ^= operand->bits [i];
-	}
+	bitset_require_maxbit (accu, operand->maxbit);
+	words_xor (accu->bits, operand->bits, WORDS (operand->maxbit));
 }
 
 #ifdef DEPRECATED_BITSET_ITERATION_USING_SEPARATE_FUNCTIONS
 void *bitset_iterate (bitset_t *bts, bitset_iterator_f *it, void *data) {
-	anynum_t i;
-	for (i=0; i<bts->maxbit; i++) {
-		if (bts->bits [i >> 5] & (((uint32_t) 1) << (i & 31))) {
-			data = (*it) (i, data);
-		}
+	bitset_iter_t bi;
+	bitset_iterator_init (&bi, bts);
+	while (bitset_iterator_next_one (&bi, NULL)) {
+		data = (*it) (bitset_iterator_bitnum (&bi), data);
 	}
 	return data;
 }
@@ -327,15 +368,38 @@ bool bitset_iterator_next (bitset_iter_t *bitit) {
 	return (bitit->curbit <= bitit->maxbit);
 }
 
+/* Skip to the next set bit a word at a time, using ctz within a word.
+ * The iterator ends up just beyond maxbit when no set bit is found.
+ */
 bool bitset_iterator_next_one (bitset_iter_t *bitit, bitset_t *bits) {
-	if ((bits != NULL) && (bitit->maxbit < bits->maxbit)) {
+	anynum_t bit, w, m;
+	uint64_t word;
+	if (bits == NULL) {
+		bits = bitit->curset;
+	} else if (bitit->maxbit < bits->maxbit) {
 		bitit->maxbit = bits->maxbit;
 	}
-	while (bitset_iterator_next (bitit)) {
-		if (bitset_iterator_test (bitit, bits)) {
-			return true;
+	bit = bitit->curbit + 1;
+	m = WORDS (bits->maxbit);
+	w = bit >> 6;
+	if ((bit <= bitit->maxbit) && (w < m)) {
+		word = bits->bits [w] & (~(uint64_t) 0 << (bit & 63));
+		while ((word == 0) && (++w < m)) {
+			word = bits->bits [w];
+		}
+		if (word != 0) {
+			bit = (w << 6) | ctz64 (word);
+			if (bit <= bitit->maxbit) {
+				bitit->curbit = bit;
+				bitit->curint = w;
+				bitit->curmsk = WORDBIT (bit);
+				return true;
+			}
 		}
 	}
+	bitit->curbit = bitit->maxbit + 1;
+	bitit->curint = bitit->curbit >> 6;
+	bitit->curmsk = WORDBIT (bitit->curbit);
 	return false;
 }
 
@@ -347,20 +411,15 @@ bool bitset_iterator_test (bitset_iter_t *bitit, bitset_t *bits) {
 	if (bits == NULL) {
 		bits = bitit->curset;
 	}
-	if (bits->bits == NULL) {
-		return false;
-	}
-	if (bits->bits [bitit->curint] & bitit->curmsk) {
-		return true;
-	} else {
+	if (bitit->curbit > bits->maxbit) {
 		return false;
 	}
+	return (bits->bits [bitit->curint] & bitit->curmsk) != 0;
 }
 
 void *bitset_iterator_element (bitset_iter_t *bitit, bitset_t *bits) {
 	if (bits == NULL) {
 		bits = bitit->curset;
 	}
-	return bitset_element (bits, bitit->curint);
+	return bitset_element (bits, bitit->curbit);
 }
-
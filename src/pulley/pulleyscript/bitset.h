@@ -22,10 +22,19 @@ extern "C" {
 #endif
 
 
+/* Bits are stored in 64-bit words.  Small bitsets, with fewer than
+ * BITSET_INLINE_BITS bits, are stored inside the structure itself and
+ * require no further allocation; bits points to inline_bits in that case.
+ * As a result, a bitset_t must not be copied by value; use bitset_copy().
+ */
+#define BITSET_INLINE_WORDS 2
+#define BITSET_INLINE_BITS (64 * BITSET_INLINE_WORDS)
+
 typedef struct bitset {
 	anynum_t maxbit;
-	uint32_t *bits;
+	uint64_t *bits;
 	type_t *type;
+	uint64_t inline_bits [BITSET_INLINE_WORDS];
 } bitset_t;
 
 
@@ -33,7 +42,7 @@ typedef struct bitset_iter {
 	anynum_t maxbit;
 	anynum_t curbit;
 	anynum_t curint;
-	uint32_t     curmsk;
+	uint64_t     curmsk;
 	bitset_t    *curset;
 } bitset_iter_t;
 
@@ -74,7 +83,7 @@ void *bitset_element (bitset_t *bts, anynum_t idx);
  * Returns BITNUM_BAD when none exists.
  */
 anynum_t bitset_min (bitset_t *bts);
-anynum_t bitset_min (bitset_t *bts);
+anynum_t bitset_max (bitset_t *bts);
 anynum_t bitset_count (bitset_t *bts);
 bool bitset_isempty (bitset_t *bts);
 bool bitset_disjoint (bitset_t *left, bitset_t *rigt);
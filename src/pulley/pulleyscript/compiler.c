@@ -30,28 +30,38 @@
 #include "condition.h"
 #include "driver.h"
 #include "squeal.h"
+#include "image.h"
 
 #ifdef ALLOW_INSECURE_DB
 extern const char *squeal_use_dbdir;
 #endif
 
+static const char *image_path = NULL;
+static bool check_image = false;
+
 
 static void version_usage()
 {
 	printf(
 "Usage:\n"
 "    compiler [options] scriptfile [scriptfile...]\n\n");
+	printf("  -o imagefile Writes the compiled script to a precompiled image\n");
+	printf("  -c           Reloads the image, and checks it against the script\n");
 #ifdef ALLOW_INSECURE_DB
 	printf("  -S sqldir    Sets directory to write SQL database\n");
 #endif
 }
 
 
+void print_tables (struct parser *prs, char *status, FILE *stream) {
+	vartab_print (prs->vartab, status, stream, 0);
+	gentab_print (prs->gentab, status, stream, 0);
+	cndtab_print (prs->cndtab, status, stream, 0);
+	drvtab_print (prs->drvtab, status, stream, 0);
+}
+
 void print_status (struct parser *prs, char *status) {
-	vartab_print (prs->vartab, status, stdout, 0);
-	gentab_print (prs->gentab, status, stdout, 0);
-	cndtab_print (prs->cndtab, status, stdout, 0);
-	drvtab_print (prs->drvtab, status, stdout, 0);
+	print_tables (prs, status, stdout);
 }
 
 int collect_input (struct parser *prs, int argc, char *argv []) {
@@ -252,8 +262,91 @@ int generate_paths (struct parser *prs) {
 }
 
 
+/* Load the image that was just written, and check that it holds the same
+ * script: the scanhash, the tables (as printed), attribute names for each
+ * generator, and SQL that the squeal engine can set up.  This runs after
+ * the squeal database of the script itself was closed, since the image
+ * uses the same one.  Return 0 when the image checks out, 1 otherwise.
+ */
+int check_written_image (struct parser *prs) {
+	struct parser loaded;
+	struct image_reader *img;
+	struct squeal *s3db;
+	FILE *expected, *found;
+	int e, f;
+	gennum_t g, gencount;
+	int prsret = 1;
+
+	img = image_reader_open (image_path);
+	if (img == NULL) {
+		fprintf (stderr, "Failed to open image %s\n", image_path);
+		return 1;
+	}
+	pulley_parser_init (&loaded);
+	if (pulley_image_read_script (&loaded, img)) {
+		fprintf (stderr, "Failed to load script from image %s\n", image_path);
+		goto cleanup;
+	}
+	if (memcmp (&loaded.scanhash, &prs->scanhash, sizeof (hash_t)) != 0) {
+		fprintf (stderr, "Image %s has a different scanhash\n", image_path);
+		goto cleanup;
+	}
+	gencount = gentab_count (loaded.gentab);
+	for (g=0; g<gencount; g++) {
+		pulley_image_read_names (img, NULL, 0);
+	}
+	if (!image_reader_ok (img)) {
+		fprintf (stderr, "Failed to load attribute names from image %s\n", image_path);
+		goto cleanup;
+	}
+
+	// The tables must print just like the ones that were written
+	expected = tmpfile ();
+	found = tmpfile ();
+	if ((expected == NULL) || (found == NULL)) {
+		fprintf (stderr, "Failed to compare image %s\n", image_path);
+		goto cleanup;
+	}
+	print_tables (prs, "in image", expected);
+	print_tables (&loaded, "in image", found);
+	rewind (expected);
+	rewind (found);
+	do {
+		e = fgetc (expected);
+		f = fgetc (found);
+	} while ((e == f) && (e != EOF));
+	fclose (expected);
+	fclose (found);
+	if (e != f) {
+		fprintf (stderr, "Image %s has different tables than the script\n", image_path);
+		goto cleanup;
+	}
+
+	s3db = squeal_open (loaded.scanhash, gencount, drvtab_count (loaded.drvtab));
+	if ((s3db == NULL) || squeal_read_image (s3db, img)) {
+		fprintf (stderr, "Failed to set up SQL from image %s\n", image_path);
+	} else {
+		printf ("Checked image %s\n", image_path);
+		prsret = 0;
+	}
+	if (s3db != NULL) {
+		squeal_close (s3db);
+	}
+
+cleanup:
+	image_reader_close (img);
+	pulley_parser_cleanup_syntax (&loaded);
+	pulley_parser_cleanup_semantics (&loaded);
+	return prsret;
+}
+
+
 /* Generate code through the squeal engine.  This constructs SQL code to be run on
  * SQLite3 to implement concepts like co-generator iteration.
+ *
+ * When an image file was requested, the analysed script and the SQL code are
+ * written to it; Pulley can load that image instead of the script, and skip
+ * parsing, analysis and SQL generation at startup.
  */
 int generate_squeal (struct parser *prs) {
 	struct squeal *s3db;
@@ -261,8 +354,12 @@ int generate_squeal (struct parser *prs) {
 	/* No drivers -> empty script -> nothing to generate, but it's not
 	 * a failure.
 	 */
-	if (!drvtab_count (prs->drvtab))
+	if (!drvtab_count (prs->drvtab)) {
+		if (image_path) {
+			fprintf (stderr, "Script has no drivers, not writing image %s\n", image_path);
+		}
 		return 0;
+	}
 
 	s3db = squeal_open(prs->scanhash, gentab_count (prs->gentab), drvtab_count (prs->drvtab));
 	assert (s3db != NULL);
@@ -282,9 +379,31 @@ int generate_squeal (struct parser *prs) {
 			assert (squeal_produce_outputs (s3db, prs->drvtab, g, d) != NULL);
 		}
 	}
+	if (image_path) {
+		struct image_writer *img = image_writer_open (image_path);
+		int imgret = 1;
+		if (img && (squeal_configure_generators (s3db, prs->gentab, prs->drvtab) == 0)) {
+			pulley_image_write_script (prs, img);
+			squeal_write_image (s3db, img);
+			imgret = image_writer_close (img, true);
+		} else if (img) {
+			image_writer_close (img, false);
+		}
+		if (imgret) {
+			fprintf (stderr, "Failed to write image %s\n", image_path);
+			squeal_close (s3db);
+			squeal_unlink (prs->scanhash);
+			return 1;
+		}
+		printf ("Wrote image %s\n", image_path);
+	}
 	squeal_close (s3db);
-	squeal_unlink (prs->scanhash);
 	s3db = NULL;
+	if (image_path && check_image && check_written_image (prs)) {
+		squeal_unlink (prs->scanhash);
+		return 1;
+	}
+	squeal_unlink (prs->scanhash);
 	return 0;
 }
 
@@ -336,6 +455,8 @@ int main (int argc, char *argv []) {
 	const struct option longopts[] =
 	{
 		{"help",      no_argument,        0, 'h'},
+		{"output",    required_argument,  0, 'o'},
+		{"check",     no_argument,        0, 'c'},
 #ifdef ALLOW_INSECURE_DB
 	{"sqldir",    required_argument,  0, 'S'},
 #endif
@@ -346,7 +467,7 @@ int main (int argc, char *argv []) {
 	int index;
 	int iarg = 0;
 
-	static const char shortopts[] = "h"
+	static const char shortopts[] = "hco:"
 #ifdef ALLOW_INSECURE_DB
 		"S:"
 #endif
@@ -361,6 +482,12 @@ int main (int argc, char *argv []) {
 			version_usage();
 			carry_on = false;
 			break;
+		case 'o':
+			image_path = optarg;
+			break;
+		case 'c':
+			check_image = true;
+			break;
 #ifdef ALLOW_INSECURE_DB
 	case 'S':
 		squeal_use_dbdir = optarg;
@@ -31,12 +31,14 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <stdio.h>
 
 #include "variable.h"
 #include "generator.h"
 #include "condition.h"
 #include "parser.h"
+#include "image.h"
 
 #include "qsort_fix.h"
 
@@ -679,3 +681,46 @@ bool cnd_estimate_total_cost (struct cndtab *cctab, cndnum_t cndnum,
 	return true;
 }
 
+
+/* Write the condition table to an image.  The expression is written as
+ * the raw array of int codes, which are either CND_xxx or a varnum_t.
+ */
+void cndtab_write_image (struct cndtab *tab, struct image_writer *img) {
+	cndnum_t i;
+	image_put_uint32 (img, tab->count_cnds);
+	for (i=0; i<tab->count_cnds; i++) {
+		struct condition *cnd = &tab->cnds [i];
+		image_put_float (img, cnd->weight);
+		image_put_uint32 (img, cnd->linehash);
+		image_put_bitset (img, cnd->vars_needed);
+		image_put_blob (img, cnd->calc, cnd->calclen * sizeof (int));
+	}
+}
+
+int cndtab_read_image (struct cndtab *tab, struct image_reader *img) {
+	uint32_t count, i, len;
+	const void *calc;
+	cndnum_t cndnum;
+	struct condition *cnd;
+	if (tab->count_cnds != 0) {
+		return 1;
+	}
+	count = image_get_uint32 (img);
+	for (i=0; (i<count) && image_reader_ok (img); i++) {
+		cndnum = cnd_new (tab);
+		cnd = &tab->cnds [cndnum];
+		cnd->weight = image_get_float (img);
+		cnd->linehash = image_get_uint32 (img);
+		image_get_bitset (img, cnd->vars_needed);
+		calc = image_get_blob (img, &len);
+		if ((calc != NULL) && (len > 0)) {
+			cnd->calc = malloc (len);
+			if (cnd->calc == NULL) {
+				fatal_error ("Out of memory loading condition");
+			}
+			memcpy (cnd->calc, calc, len);
+			cnd->calclen = len / sizeof (int);
+		}
+	}
+	return image_reader_ok (img)? 0: 1;
+}
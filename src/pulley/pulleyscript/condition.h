@@ -94,6 +94,12 @@ bool cnd_estimate_total_cost (struct cndtab *tab, cndnum_t cndnum,
 				unsigned int *soln_generator_count,
 				gennum_t soln_generators []);
 
+/* Write the condition table to an image, or read it back into an empty
+ * condition table.  Reading returns 0 on success, 1 on failure.
+ */
+void cndtab_write_image (struct cndtab *tab, struct image_writer *img);
+int cndtab_read_image (struct cndtab *tab, struct image_reader *img);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <string.h>
 
 #include "types.h"
 #include "bitset.h"
@@ -11,6 +12,7 @@
 #include "generator.h"
 #include "variable.h"
 #include "parser.h"
+#include "image.h"
 #include "resist.h"
 
 #include "generator_int.h"
@@ -568,3 +570,67 @@ void drv_add_path_of_least_resistence (struct drvtab *tab, drvnum_t drvnum, path
 path_t *drv_share_path_of_least_resistence (struct drvtab *tab, drvnum_t drvnum) {
 	return tab->drvs [drvnum].path_of_least_resistence;
 }
+
+/* Write the driver table to an image.  Paths of least resistence and user
+ * callbacks are not part of the image.
+ */
+void drvtab_write_image (struct drvtab *tab, struct image_writer *img) {
+	drvnum_t i;
+	image_put_uint32 (img, tab->count_drvs);
+	for (i=0; i<tab->count_drvs; i++) {
+		struct driverout *drv = &tab->drvs [i];
+		image_put_string (img, drv->module);
+		image_put_float (img, drv->weight);
+		image_put_uint32 (img, drv->linehash);
+		image_put_uint32 (img, drv->module_parameter_binding);
+		image_put_blob (img, drv->outputs, drv->outputs_count * sizeof (varnum_t));
+		image_put_bitset (img, drv->produced_vars);
+		image_put_bitset (img, drv->relevant_vars);
+		image_put_bitset (img, drv->explicit_guards);
+		image_put_bitset (img, drv->implicit_guards);
+		image_put_bitset (img, drv->all_guards);
+		image_put_bitset (img, drv->conditions);
+		image_put_bitset (img, drv->generators);
+	}
+}
+
+int drvtab_read_image (struct drvtab *tab, struct image_reader *img) {
+	uint32_t count, i, len;
+	const char *module;
+	const void *outputs;
+	drvnum_t drvnum;
+	struct driverout *drv;
+	if (tab->count_drvs != 0) {
+		return 1;
+	}
+	count = image_get_uint32 (img);
+	for (i=0; (i<count) && image_reader_ok (img); i++) {
+		drvnum = drv_new (tab);
+		drv = &tab->drvs [drvnum];
+		drv->path_of_least_resistence = NULL;
+		module = image_get_string (img);
+		if (module != NULL) {
+			drv_set_module (tab, drvnum, (char *) module);
+		}
+		drv->weight = image_get_float (img);
+		drv->linehash = image_get_uint32 (img);
+		drv->module_parameter_binding = image_get_uint32 (img);
+		outputs = image_get_blob (img, &len);
+		if ((outputs != NULL) && (len > 0)) {
+			drv->outputs = malloc (len);
+			if (drv->outputs == NULL) {
+				fatal_error ("Out of memory loading driver output array");
+			}
+			memcpy (drv->outputs, outputs, len);
+			drv->outputs_count = drv->outputs_allocated = len / sizeof (varnum_t);
+		}
+		image_get_bitset (img, drv->produced_vars);
+		image_get_bitset (img, drv->relevant_vars);
+		image_get_bitset (img, drv->explicit_guards);
+		image_get_bitset (img, drv->implicit_guards);
+		image_get_bitset (img, drv->all_guards);
+		image_get_bitset (img, drv->conditions);
+		image_get_bitset (img, drv->generators);
+	}
+	return image_reader_ok (img)? 0: 1;
+}
@@ -122,6 +122,13 @@ driver_callback *drv_unregister_callback (struct drvtab *tab, drvnum_t drv);
 
 int drv_callback (struct drvtab *tab, drvnum_t drv);
 
+/* Write the driver table to an image, or read it back into an empty
+ * driver table.  This covers the state after structural analysis.
+ * Reading returns 0 on success, 1 on failure.
+ */
+void drvtab_write_image (struct drvtab *tab, struct image_writer *img);
+int drvtab_read_image (struct drvtab *tab, struct image_reader *img);
+
 #ifdef __cplusplus
 }
 #endif
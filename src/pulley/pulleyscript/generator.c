@@ -25,6 +25,7 @@
 #include "generator.h"
 #include "resist.h"
 #include "parser.h"
+#include "image.h"
 
 #include "generator_int.h"
 
@@ -263,3 +264,43 @@ void gen_add_path_of_least_resistence (struct gentab *tab, gennum_t gennum, path
 path_t *gen_share_path_of_least_resistence (struct gentab *tab, gennum_t gennum) {
 	return tab->gens [gennum].path_of_least_resistence;
 }
+
+/* Write the generator table to an image.  Paths of least resistence are not
+ * part of the image.
+ */
+void gentab_write_image (struct gentab *tab, struct image_writer *img) {
+	gennum_t i;
+	image_put_uint32 (img, tab->count_gens);
+	for (i=0; i<tab->count_gens; i++) {
+		struct generator *gen = &tab->gens [i];
+		image_put_float (img, gen->weight);
+		image_put_uint32 (img, gen->source);
+		image_put_uint32 (img, gen->binding);
+		image_put_uint32 (img, gen->linehash);
+		image_put_uint32 (img, gen->cogenerate);
+		image_put_bitset (img, gen->variables);
+		image_put_bitset (img, gen->driverout);
+	}
+}
+
+int gentab_read_image (struct gentab *tab, struct image_reader *img) {
+	uint32_t count, i;
+	gennum_t gennum;
+	struct generator *gen;
+	if (tab->count_gens != 0) {
+		return 1;
+	}
+	count = image_get_uint32 (img);
+	for (i=0; (i<count) && image_reader_ok (img); i++) {
+		float weight = image_get_float (img);
+		gennum = gen_new (tab, image_get_uint32 (img));
+		gen = &tab->gens [gennum];
+		gen->weight = weight;
+		gen->binding = image_get_uint32 (img);
+		gen->linehash = image_get_uint32 (img);
+		gen->cogenerate = image_get_uint32 (img) != 0;
+		image_get_bitset (img, gen->variables);
+		image_get_bitset (img, gen->driverout);
+	}
+	return image_reader_ok (img)? 0: 1;
+}
@@ -115,6 +115,12 @@ bitset_t *gen_share_driverout (struct gentab *tab, gennum_t gennum);
 void gen_add_path_of_least_resistence (struct gentab *tab, gennum_t gennum, path_t *path);
 path_t *gen_share_path_of_least_resistence (struct gentab *tab, gennum_t gennum);
 
+/* Write the generator table to an image, or read it back into an empty
+ * generator table.  Reading returns 0 on success, 1 on failure.
+ */
+void gentab_write_image (struct gentab *tab, struct image_writer *img);
+int gentab_read_image (struct gentab *tab, struct image_reader *img);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,433 @@
+/* image.c -- Precompiled images of Pulley scripts.
+ *
+ * An image is a sequence of elements, each written in native byte order
+ * without any alignment.  Every module writes and reads its own part of
+ * the image, in a fixed order, so the elements are not tagged.  Strings
+ * and blobs are stored with a 32-bit length, and strings have a trailing
+ * NUL so they can be used straight from the mapped file.
+ *
+ * The image header holds a magic string, a format version and a few
+ * markers for the byte order and type sizes of the platform that wrote
+ * it; an image that does not match is simply not recognised.
+ *
+ * From: Rick van Rein <rick@openfortress.nl>
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+#include "parser.h"
+#include "lexhash.h"
+#include "variable.h"
+#include "generator.h"
+#include "condition.h"
+#include "driver.h"
+#include "binding.h"
+
+
+/* The format version; increment on any change to the order or contents of
+ * the elements written by any module.
+ */
+#define IMAGE_VERSION 1
+
+/* Byte order marker, written as a native uint32_t */
+#define IMAGE_BYTEORDER 0x01020304
+
+/* Sizes of the types that end up in the image as raw bytes, such as the
+ * varnum_t in binding bytecode and the int in condition expressions.
+ */
+#define IMAGE_TYPESIZES ((sizeof (varnum_t) << 24) | (sizeof (int) << 16) | \
+			 (sizeof (float) << 8) | sizeof (hash_t))
+
+/* Length marker for a NULL string */
+#define IMAGE_NULL_STRING ((uint32_t) -1)
+
+
+struct image_writer {
+	char *path;
+	uint8_t *buf;
+	size_t ofs;
+	size_t siz;
+};
+
+struct image_reader {
+	uint8_t *map;
+	size_t len;
+	size_t ofs;
+	bool failed;
+};
+
+
+/********** WRITING IMAGES **********/
+
+
+static void image_put_bytes (struct image_writer *img, const void *ptr, size_t len) {
+	uint8_t *buf2;
+	size_t siz2;
+	if (img->siz < img->ofs + len) {
+		siz2 = img->siz + (img->siz >> 1) + len + 4096;
+		buf2 = realloc (img->buf, siz2);
+		if (buf2 == NULL) {
+			fatal_error ("Out of memory while writing image");
+		}
+		img->buf = buf2;
+		img->siz = siz2;
+	}
+	memcpy (img->buf + img->ofs, ptr, len);
+	img->ofs += len;
+}
+
+struct image_writer *image_writer_open (const char *path) {
+	struct image_writer *img = calloc (1, sizeof (struct image_writer));
+	if (img == NULL) {
+		return NULL;
+	}
+	img->path = strdup (path);
+	if (img->path == NULL) {
+		free (img);
+		return NULL;
+	}
+	image_put_bytes (img, IMAGE_MAGIC, IMAGE_MAGIC_LEN);
+	image_put_uint32 (img, IMAGE_VERSION);
+	image_put_uint32 (img, IMAGE_BYTEORDER);
+	image_put_uint32 (img, IMAGE_TYPESIZES);
+	return img;
+}
+
+int image_writer_close (struct image_writer *img, bool commit) {
+	int retval = 0;
+	char *tmppath = NULL;
+	size_t done = 0;
+	ssize_t wrote;
+	int fd = -1;
+	if (commit) {
+		tmppath = malloc (strlen (img->path) + 5);
+		if (tmppath == NULL) {
+			retval = 1;
+			goto cleanup;
+		}
+		strcpy (tmppath, img->path);
+		strcat (tmppath, ".tmp");
+		fd = open (tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			retval = 1;
+			goto cleanup;
+		}
+		while (done < img->ofs) {
+			wrote = write (fd, img->buf + done, img->ofs - done);
+			if (wrote < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				retval = 1;
+				break;
+			}
+			done += wrote;
+		}
+		if ((retval == 0) && (fsync (fd) != 0)) {
+			retval = 1;
+		}
+		if (close (fd) != 0) {
+			retval = 1;
+		}
+		if ((retval == 0) && (rename (tmppath, img->path) != 0)) {
+			retval = 1;
+		}
+		if (retval != 0) {
+			unlink (tmppath);
+		}
+	}
+cleanup:
+	free (tmppath);
+	free (img->buf);
+	free (img->path);
+	free (img);
+	return retval;
+}
+
+void image_put_uint32 (struct image_writer *img, uint32_t val) {
+	image_put_bytes (img, &val, sizeof (val));
+}
+
+void image_put_uint64 (struct image_writer *img, uint64_t val) {
+	image_put_bytes (img, &val, sizeof (val));
+}
+
+void image_put_float (struct image_writer *img, float val) {
+	image_put_bytes (img, &val, sizeof (val));
+}
+
+void image_put_blob (struct image_writer *img, const void *ptr, uint32_t len) {
+	image_put_uint32 (img, len);
+	image_put_bytes (img, ptr, len);
+}
+
+void image_put_text (struct image_writer *img, const char *txt, uint32_t len) {
+	image_put_uint32 (img, len);
+	image_put_bytes (img, txt, len);
+	image_put_bytes (img, "", 1);
+}
+
+void image_put_string (struct image_writer *img, const char *str) {
+	if (str == NULL) {
+		image_put_uint32 (img, IMAGE_NULL_STRING);
+	} else {
+		image_put_text (img, str, strlen (str));
+	}
+}
+
+/* Write the words of a bitset, up to the last one that has any bits set.
+ */
+void image_put_bitset (struct image_writer *img, bitset_t *bts) {
+	uint32_t words = (bts->maxbit + 1) >> 6;
+	while ((words > 0) && (bts->bits [words-1] == 0)) {
+		words--;
+	}
+	image_put_uint32 (img, words);
+	image_put_bytes (img, bts->bits, words * sizeof (uint64_t));
+}
+
+
+/********** READING IMAGES **********/
+
+
+static const uint8_t *image_get_bytes (struct image_reader *img, size_t len) {
+	const uint8_t *retval;
+	if (img->failed || (img->len - img->ofs < len)) {
+		img->failed = true;
+		return NULL;
+	}
+	retval = img->map + img->ofs;
+	img->ofs += len;
+	return retval;
+}
+
+struct image_reader *image_reader_open (const char *path) {
+	struct image_reader *img;
+	struct stat st;
+	void *map;
+	int fd;
+	fd = open (path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if ((fstat (fd, &st) != 0) || (st.st_size < IMAGE_MAGIC_LEN + 3 * sizeof (uint32_t))) {
+		close (fd);
+		return NULL;
+	}
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+	img = calloc (1, sizeof (struct image_reader));
+	if (img == NULL) {
+		munmap (map, st.st_size);
+		return NULL;
+	}
+	img->map = map;
+	img->len = st.st_size;
+	if ((memcmp (image_get_bytes (img, IMAGE_MAGIC_LEN), IMAGE_MAGIC, IMAGE_MAGIC_LEN) != 0)
+			|| (image_get_uint32 (img) != IMAGE_VERSION)
+			|| (image_get_uint32 (img) != IMAGE_BYTEORDER)
+			|| (image_get_uint32 (img) != IMAGE_TYPESIZES)) {
+		image_reader_close (img);
+		return NULL;
+	}
+	return img;
+}
+
+void image_reader_close (struct image_reader *img) {
+	munmap (img->map, img->len);
+	free (img);
+}
+
+bool image_reader_ok (struct image_reader *img) {
+	return !img->failed;
+}
+
+uint32_t image_get_uint32 (struct image_reader *img) {
+	uint32_t val = 0;
+	const uint8_t *ptr = image_get_bytes (img, sizeof (val));
+	if (ptr != NULL) {
+		memcpy (&val, ptr, sizeof (val));
+	}
+	return val;
+}
+
+uint64_t image_get_uint64 (struct image_reader *img) {
+	uint64_t val = 0;
+	const uint8_t *ptr = image_get_bytes (img, sizeof (val));
+	if (ptr != NULL) {
+		memcpy (&val, ptr, sizeof (val));
+	}
+	return val;
+}
+
+float image_get_float (struct image_reader *img) {
+	float val = 0.0;
+	const uint8_t *ptr = image_get_bytes (img, sizeof (val));
+	if (ptr != NULL) {
+		memcpy (&val, ptr, sizeof (val));
+	}
+	return val;
+}
+
+const void *image_get_blob (struct image_reader *img, uint32_t *len) {
+	const uint8_t *ptr;
+	*len = image_get_uint32 (img);
+	ptr = image_get_bytes (img, *len);
+	if (ptr == NULL) {
+		*len = 0;
+	}
+	return ptr;
+}
+
+const char *image_get_string (struct image_reader *img) {
+	uint32_t len = image_get_uint32 (img);
+	const uint8_t *ptr;
+	if (len == IMAGE_NULL_STRING) {
+		return NULL;
+	}
+	ptr = image_get_bytes (img, (size_t) len + 1);
+	if ((ptr != NULL) && (ptr [len] != '\0')) {
+		img->failed = true;
+		ptr = NULL;
+	}
+	return (const char *) ptr;
+}
+
+void image_get_bitset (struct image_reader *img, bitset_t *bts) {
+	uint32_t words = image_get_uint32 (img);
+	const uint8_t *ptr = image_get_bytes (img, words * sizeof (uint64_t));
+	bitset_empty (bts);
+	if ((ptr != NULL) && (words > 0)) {
+		bitset_require_maxbit (bts, (words << 6) - 1);
+		memcpy (bts->bits, ptr, words * sizeof (uint64_t));
+	}
+}
+
+
+/********** SCRIPT IMAGES **********/
+
+
+/* Collect the variables of a generator that are stored in its gen_xxx table,
+ * in the order of the columns.  Return the number of variables collected.
+ */
+static uint32_t image_generator_variables (struct parser *prs, gennum_t g, varnum_t *vars) {
+	bitset_t *genvars = gen_share_variables (prs->gentab, g);
+	bitset_iter_t it;
+	uint32_t count = 0;
+	varnum_t v;
+	bitset_iterator_init (&it, genvars);
+	while (bitset_iterator_next_one (&it, NULL)) {
+		v = bitset_iterator_bitnum (&it);
+		if (var_get_kind (prs->vartab, v) == VARKIND_VARIABLE) {
+			if (vars != NULL) {
+				vars [count] = v;
+			}
+			count++;
+		}
+	}
+	return count;
+}
+
+/* Write the attribute names that bind the variables of a generator.  This
+ * walks the generator's binding bytecode, as explained in binding.h, and
+ * picks up the attribute of every BIND to one of the generator variables.
+ */
+static void image_put_generator_names (struct image_writer *img, struct parser *prs, gennum_t g) {
+	uint32_t count = image_generator_variables (prs, g, NULL);
+	varnum_t vars [count + 1];
+	const char *names [count + 1];
+	struct var_value *value;
+	uint8_t *p, *end;
+	varnum_t v0, v1;
+	uint32_t i;
+	image_generator_variables (prs, g, vars);
+	for (i=0; i<count; i++) {
+		names [i] = "";
+	}
+	value = var_share_value (prs->vartab, gen_get_binding (prs->gentab, g));
+	if ((value != NULL) && (value->type == VARTP_BLOB)) {
+		p = value->typed_blob.ptr;
+		end = p + value->typed_blob.len;
+		while (p < end) {
+			switch (*p & BNDO_ACT_MASK) {
+			case BNDO_ACT_DOWN:
+			case BNDO_ACT_OBJECT:
+				p += 1;
+				continue;
+			case BNDO_ACT_HAVE:
+				p += 1 + sizeof (varnum_t);
+				continue;
+			case BNDO_ACT_BIND:
+				memcpy (&v0, p + 1, sizeof (varnum_t));
+				memcpy (&v1, p + 1 + sizeof (varnum_t), sizeof (varnum_t));
+				for (i=0; i<count; i++) {
+					if (vars [i] == v1) {
+						names [i] = var_get_name (prs->vartab, v0);
+					}
+				}
+				p += 1 + 2 * sizeof (varnum_t);
+				continue;
+			case BNDO_ACT_CMP:
+				p += 1 + 2 * sizeof (varnum_t);
+				continue;
+			default:
+				break;
+			}
+			break;
+		}
+	}
+	image_put_uint32 (img, count);
+	for (i=0; i<count; i++) {
+		image_put_string (img, names [i]);
+	}
+}
+
+void pulley_image_write_script (struct parser *prs, struct image_writer *img) {
+	gennum_t g, gencount;
+	image_put_uint32 (img, prs->scanhash);
+	vartab_write_image (prs->vartab, img);
+	gentab_write_image (prs->gentab, img);
+	cndtab_write_image (prs->cndtab, img);
+	drvtab_write_image (prs->drvtab, img);
+	gencount = gentab_count (prs->gentab);
+	for (g=0; g<gencount; g++) {
+		image_put_generator_names (img, prs, g);
+	}
+}
+
+int pulley_image_read_script (struct parser *prs, struct image_reader *img) {
+	prs->scanhash = image_get_uint32 (img);
+	if (vartab_read_image (prs->vartab, img)
+			|| gentab_read_image (prs->gentab, img)
+			|| cndtab_read_image (prs->cndtab, img)
+			|| drvtab_read_image (prs->drvtab, img)) {
+		return 1;
+	}
+	return image_reader_ok (img)? 0: 1;
+}
+
+uint32_t pulley_image_read_names (struct image_reader *img, const char **names, uint32_t maxnames) {
+	uint32_t count = image_get_uint32 (img);
+	uint32_t i;
+	const char *name;
+	for (i=0; i<count; i++) {
+		name = image_get_string (img);
+		if (i < maxnames) {
+			names [i] = name? name: "";
+		}
+	}
+	return count;
+}
@@ -0,0 +1,122 @@
+/* image.h -- Precompiled images of Pulley scripts.
+ *
+ * Parsing a Pulley script, running its structural analysis and generating
+ * the SQL for the squeal engine is done at every startup, even though the
+ * result only depends on the script's scanhash.  An image captures that
+ * result in a file: the vartab/gentab/cndtab/drvtab, the SQL text for the
+ * squeal engine and the variable names per generator.  Loading it replaces
+ * the parsing, analysis and SQL generation phases.
+ *
+ * Images are written by the compiler and loaded with mmap(), so that the
+ * larger parts such as SQL text can be used without copying.  They are
+ * not portable between platforms; the header holds a byte order marker
+ * and the sizes of the scalar types, and a mismatch makes the image be
+ * rejected as if it were not an image at all.
+ *
+ * From: Rick van Rein <rick@openfortress.nl>
+ */
+
+#ifndef PULLEYSCRIPT_IMAGE_H
+#define PULLEYSCRIPT_IMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bitset.h"
+#include "types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct parser;
+
+/* The first bytes of an image file, which can be used to tell images from
+ * Pulley script text.
+ */
+#define IMAGE_MAGIC "PULLEYIM"
+#define IMAGE_MAGIC_LEN 8
+
+/* Open an image for writing.  The image is built in memory and written out
+ * by image_writer_close(), so an image file never appears half-written.
+ * Returns NULL on failure.
+ */
+struct image_writer *image_writer_open (const char *path);
+
+/* Close an image writer.  When commit is set, the image is written to a
+ * temporary file that is then renamed over the path given to open; when
+ * it is not set, nothing is written.  Return 0 on success, 1 on failure.
+ */
+int image_writer_close (struct image_writer *img, bool commit);
+
+/* Append elements to an image.  Strings may be NULL.  Bitsets are written
+ * as their words, and their type is implied by the reader.
+ */
+void image_put_uint32 (struct image_writer *img, uint32_t val);
+void image_put_uint64 (struct image_writer *img, uint64_t val);
+void image_put_float  (struct image_writer *img, float val);
+void image_put_blob   (struct image_writer *img, const void *ptr, uint32_t len);
+void image_put_string (struct image_writer *img, const char *str);
+void image_put_text   (struct image_writer *img, const char *txt, uint32_t len);
+void image_put_bitset (struct image_writer *img, bitset_t *bts);
+
+/* Open an image for reading.  The file is mapped into memory.  Returns NULL
+ * if the file cannot be opened, or when it is not an image for this build.
+ */
+struct image_reader *image_reader_open (const char *path);
+
+/* Close an image reader.  Pointers returned by image_get_blob() and
+ * image_get_string() are invalid after this.
+ */
+void image_reader_close (struct image_reader *img);
+
+/* Test whether an image reader has not run into any problems, such as
+ * reading beyond the end of the image.  Errors are sticky; once the
+ * reader has failed, all further reads return zero values and NULL.
+ */
+bool image_reader_ok (struct image_reader *img);
+
+/* Retrieve elements from an image, in the order in which they were put.
+ * Blobs and strings point into the mapped image and must not be modified.
+ * Strings are NUL-terminated.  Bitsets are loaded into an existing bitset
+ * with the right type; its previous contents are replaced.
+ */
+uint32_t image_get_uint32 (struct image_reader *img);
+uint64_t image_get_uint64 (struct image_reader *img);
+float image_get_float (struct image_reader *img);
+const void *image_get_blob (struct image_reader *img, uint32_t *len);
+const char *image_get_string (struct image_reader *img);
+void image_get_bitset (struct image_reader *img, bitset_t *bts);
+
+
+/* Write the compiled form of a Pulley script to an image: the scanhash, the
+ * tables vartab/gentab/cndtab/drvtab and the attribute names bound to the
+ * variables of each generator.  This must follow structural analysis.
+ * The caller may append the squeal engine's part with squeal_write_image().
+ */
+void pulley_image_write_script (struct parser *prs, struct image_writer *img);
+
+/* Load the compiled form of a Pulley script from an image into a freshly
+ * initialised parser.  This sets the scanhash and fills the tables as they
+ * were after structural analysis.  Return 0 on success, 1 on failure.
+ *
+ * The attribute names for the generators follow in the image; retrieve
+ * them with pulley_image_read_names() next.
+ */
+int pulley_image_read_script (struct parser *prs, struct image_reader *img);
+
+/* Load the attribute names that are bound to the variables of generator
+ * gennum.  These are in the order of gen_share_variables() for the
+ * variables with kind VARKIND_VARIABLE, and they must be read for every
+ * generator, in turn.  At most maxnames pointers are stored in names; the
+ * number available is returned.  Names point into the image, and are ""
+ * for variables that are not bound to an attribute.
+ */
+uint32_t pulley_image_read_names (struct image_reader *img, const char **names, uint32_t maxnames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,316 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "journal.h"
+#include "backend.h"
+#include "lexhash.h"
+#include "squeal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+static const size_t compact_size = 1 << 20;  // Empty the file beyond this
+static const size_t max_pending = 64 << 20;  // Give up on output beyond this
+
+static const uint8_t kind_add = 'A';
+static const uint8_t kind_del = 'D';
+static const uint8_t kind_reset = 'R';
+static const uint8_t kind_commit = 'C';
+static const size_t header_size = 3;  // Kind and count
+
+/**
+ * Size of the record at @p p, with @p len bytes available, or 0 if
+ * the record is incomplete or damaged.
+ */
+static size_t record_size(const uint8_t* p, size_t len)
+{
+	if (len < header_size)
+	{
+		return 0;
+	}
+	unsigned int count = (p[1] << 8) | p[2];
+	size_t size = header_size;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		// Just enough of the DER header to find its length
+		if ((len - size < 2) || ((p[size + 1] & 0x80) && (len - size < 2 + (size_t)(p[size + 1] & 0x7f))))
+		{
+			return 0;
+		}
+		size_t value_size = SteamWorks::PulleyBack::der_size(p + size);
+		if (value_size > len - size)
+		{
+			return 0;
+		}
+		size += value_size;
+	}
+	return size;
+}
+
+static bool write_all(int fd, const uint8_t* p, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t wrote = write(fd, p, len);
+		if (wrote < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		p += wrote;
+		len -= wrote;
+	}
+	return true;
+}
+
+SteamWorks::PulleyBack::Journal::Journal() :
+	m_pending(0),
+	m_written(0),
+	m_fd(-1),
+	m_file_size(0)
+{
+}
+
+SteamWorks::PulleyBack::Journal::~Journal()
+{
+	if (m_fd >= 0)
+	{
+		close(m_fd);
+	}
+}
+
+bool SteamWorks::PulleyBack::Journal::open(const std::string& path)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback.journal");
+
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0600);
+	struct stat st;
+	if ((fd < 0) || (fstat(fd, &st) != 0))
+	{
+		log.errorStream() << "Cannot open journal '" << path << "', output that the backend fails to take is lost.";
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+
+	std::vector<uint8_t> contents(st.st_size);
+	size_t done = 0;
+	while (done < contents.size())
+	{
+		ssize_t r = pread(fd, contents.data() + done, contents.size() - done, done);
+		if (r <= 0)
+		{
+			if ((r < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			break;
+		}
+		done += r;
+	}
+
+	// Find the output after the last commit, and drop a damaged
+	// tail (from a crash while writing) from the file.
+	size_t complete = 0;
+	size_t committed = 0;
+	while (complete < done)
+	{
+		size_t size = record_size(contents.data() + complete, done - complete);
+		if (!size)
+		{
+			break;
+		}
+		complete += size;
+		if (contents[complete - size] == kind_commit)
+		{
+			committed = complete;
+		}
+	}
+	if ((complete < contents.size()) && (ftruncate(fd, complete) != 0))
+	{
+		log.warnStream() << "Could not drop the damaged tail of journal '" << path << '\'';
+	}
+
+	m_fd = fd;
+	m_path = path;
+	m_file_size = complete;
+	m_records.assign(contents.begin() + committed, contents.begin() + complete);
+	m_pending = m_written = m_records.size();
+	log.debugStream() << "Journal '" << path << "' has " << m_pending << " bytes pending.";
+	return true;
+}
+
+void SteamWorks::PulleyBack::Journal::append(uint8_t kind, int count, der_t* values)
+{
+	m_records.push_back(kind);
+	m_records.push_back((count >> 8) & 0xff);
+	m_records.push_back(count & 0xff);
+	for (int i = 0; i < count; i++)
+	{
+		m_records.insert(m_records.end(), values[i], values[i] + der_size(values[i]));
+	}
+}
+
+void SteamWorks::PulleyBack::Journal::record(bool add_not_del, int varc, der_t* forkdata)
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+	append(add_not_del ? kind_add : kind_del, varc, forkdata);
+}
+
+void SteamWorks::PulleyBack::Journal::record(bool add_not_del, int varc, const struct squeal_blob* values)
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+	m_records.push_back(add_not_del ? kind_add : kind_del);
+	m_records.push_back((varc >> 8) & 0xff);
+	m_records.push_back(varc & 0xff);
+	for (int i = 0; i < varc; i++)
+	{
+		size_t size = values[i].size;
+		m_records.push_back(0x04);  // OCTET STRING
+		if (size < 0x80)
+		{
+			m_records.push_back(size);
+		}
+		else
+		{
+			uint8_t len_len = 0;
+			for (size_t s = size; s; s >>= 8)
+			{
+				len_len++;
+			}
+			m_records.push_back(0x80 | len_len);
+			for (int shift = 8 * (len_len - 1); shift >= 0; shift -= 8)
+			{
+				m_records.push_back((size >> shift) & 0xff);
+			}
+		}
+		const uint8_t* data = static_cast<const uint8_t*>(values[i].data);
+		m_records.insert(m_records.end(), data, data + size);
+	}
+}
+
+void SteamWorks::PulleyBack::Journal::record_reset()
+{
+	if (m_fd < 0)
+	{
+		return;
+	}
+	append(kind_reset, 0, nullptr);
+}
+
+int SteamWorks::PulleyBack::Journal::replay(Instance& instance, bool pending_only)
+{
+	size_t end = pending_only ? m_pending : m_records.size();
+	std::vector<der_t> forkdata;
+	int r = 1;
+
+	size_t offset = 0;
+	while (offset < end)
+	{
+		const uint8_t* p = m_records.data() + offset;
+		unsigned int count = (p[1] << 8) | p[2];
+		forkdata.resize(count);
+		size_t value = offset + header_size;
+		for (unsigned int i = 0; i < count; i++)
+		{
+			forkdata[i] = m_records.data() + value;
+			value += der_size(forkdata[i]);
+		}
+
+		int ok = 1;
+		switch (p[0])
+		{
+		case kind_add:
+			ok = instance.add(forkdata.data());
+			break;
+		case kind_del:
+			ok = instance.del(forkdata.data());
+			break;
+		case kind_reset:
+			ok = instance.reset();
+			break;
+		}
+		if (!ok)
+		{
+			r = 0;
+		}
+		offset = value;
+	}
+	return r;
+}
+
+int SteamWorks::PulleyBack::Journal::sync()
+{
+	if (m_fd < 0)
+	{
+		return 1;
+	}
+	if (m_written < m_records.size())
+	{
+		if (!write_all(m_fd, m_records.data() + m_written, m_records.size() - m_written))
+		{
+			auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback.journal");
+			log.errorStream() << "Could not write journal '" << m_path << '\'';
+			return 0;
+		}
+		m_file_size += m_records.size() - m_written;
+		m_written = m_records.size();
+	}
+	return fdatasync(m_fd) == 0 ? 1 : 0;
+}
+
+void SteamWorks::PulleyBack::Journal::committed()
+{
+	m_records.clear();
+	m_pending = m_written = 0;
+	if (m_fd < 0)
+	{
+		return;
+	}
+
+	// The commit marker need not be synced; if it is lost, the
+	// output is delivered again, which is allowed.
+	if (m_file_size >= compact_size)
+	{
+		if (ftruncate(m_fd, 0) == 0)
+		{
+			m_file_size = 0;
+			return;
+		}
+	}
+	const uint8_t marker[header_size] = { kind_commit, 0, 0 };
+	if (write_all(m_fd, marker, sizeof(marker)))
+	{
+		m_file_size += sizeof(marker);
+	}
+}
+
+void SteamWorks::PulleyBack::Journal::failed()
+{
+	m_pending = m_records.size();
+	if (m_pending > max_pending)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyback.journal");
+		log.errorStream() << "Journal " << m_path << " has " << m_pending << " bytes pending, giving up; the backend needs a resync.";
+		committed();
+	}
+}
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * A journal of the output delivered to one backend instance, so that
+ * a transaction that the backend could not take can be delivered again:
+ * right away after a deadlock (EAGAIN), or as part of a later transaction
+ * after a harder failure. This makes delivery at-least-once.
+ *
+ * The journal holds the additions, removals and resets since the last
+ * transaction that the backend committed. It is backed by an append-only
+ * file, which is synced before the backend is asked to prepare, so that
+ * the output also survives a restart of the Pulley. A journal without a
+ * file records nothing: output that the backend fails to take is lost.
+ *
+ * The file is a sequence of records, each a kind byte ('A'dd, 'D'el,
+ * 'R'eset or 'C'ommit), a two-byte (big-endian) count and then that many
+ * DER values. Everything before the last 'C' has been delivered; the
+ * file is emptied when it grows large and nothing is outstanding.
+ */
+#ifndef STEAMWORKS_PULLEY_JOURNAL_H
+#define STEAMWORKS_PULLEY_JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "../pulleyback.h"
+
+struct squeal_blob;  // See pulleyscript/squeal.h
+
+namespace SteamWorks
+{
+
+namespace PulleyBack
+{
+
+class Instance;
+
+class Journal
+{
+private:
+	std::vector<uint8_t> m_records;  // Since the last commit
+	size_t m_pending;  // Bytes of m_records from failed transactions
+	size_t m_written;  // Bytes of m_records that are in the file
+	int m_fd;
+	std::string m_path;
+	size_t m_file_size;
+
+	void append(uint8_t kind, int count, der_t* values);
+
+public:
+	/**
+	 * Creates a journal without a file, which records nothing.
+	 */
+	Journal();
+	~Journal();
+
+	/**
+	 * Backs the journal with the file at @p path, which is created
+	 * if needed. Output that was not committed according to the file
+	 * becomes pending. Returns false (and records nothing) if the file
+	 * cannot be used.
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * Returns true if the journal has a file and records output,
+	 * so that a failed transaction can be delivered again.
+	 */
+	bool is_open() const { return m_fd >= 0; }
+
+	/**
+	 * Records what was delivered to the backend in this transaction;
+	 * without a file, this does nothing.
+	 */
+	void record(bool add_not_del, int varc, der_t* forkdata);
+	void record_reset();
+	/**
+	 * As record(), for output passed as blobs to a built-in backend;
+	 * the values are recorded as OCTET STRINGs.
+	 */
+	void record(bool add_not_del, int varc, const struct squeal_blob* values);
+
+	/**
+	 * Returns true if there is output from failed transactions
+	 * that has not been delivered yet.
+	 */
+	bool has_pending() const { return m_pending > 0; }
+
+	/**
+	 * Delivers everything since the last commit to @p instance, or
+	 * only the pending output if @p pending_only is set. Returns 0
+	 * if the instance refused any of it.
+	 */
+	int replay(Instance& instance, bool pending_only);
+
+	/**
+	 * Writes what is not in the file yet and waits for it to reach
+	 * stable storage; call this before preparing the backend.
+	 * Returns 0 on failure. Without a file, this does nothing.
+	 */
+	int sync();
+
+	/**
+	 * End of a transaction: the backend has committed, or it has
+	 * failed and the output remains pending.
+	 */
+	void committed();
+	void failed();
+} ;
+
+}  // namespace PulleyBack
+}  // namespace
+
+#endif
@@ -11,14 +11,28 @@ Adriaan de Groot <groot@kde.org>
 #include "condition.h"
 #include "driver.h"
 #include "generator.h"
+#include "image.h"
+#include "journal.h"
 #include "parser.h"
 #include "squeal.h"
 #include "variable.h"
 
 #include <logger.h>
 #include <jsoniterator.h>
+#include <threadpool.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
 
 class SquealOpener
 {
@@ -71,16 +85,50 @@ private:
 	using generator_variablenames_t = std::vector<std::string>;
 	std::vector<generator_variablenames_t> m_variables_per_generator;
 
+	// The variable names of all generators, interned once so that an
+	// entry's attributes are looked up in one pass, and for each
+	// generator the slots of its variables.
+	AttributeIndex m_attributes;
+	std::vector< std::vector<AttributeIndex::slot_t> > m_slots_per_generator;
+	AttributeIndex::values_t m_entry_values;  // Scratch space per entry
+	std::vector<struct squeal_blob> m_fork_blobs;  // Scratch space per fork
+
 	bool m_valid;
 	State m_state;
 
+	// Set when the script was loaded from a precompiled image, rather
+	// than parsed; the image is kept open until setup_sql() is done.
+	bool m_from_image;
+	struct image_reader* m_image;
+
 	std::forward_list< SteamWorks::PulleyScript::BackendParameters > m_backends;
+	// Backends of drivers that were removed by a reload; they are
+	// kept until the transaction that retracts their output commits.
+	std::forward_list< SteamWorks::PulleyScript::BackendParameters > m_retired_backends;
+	// Set when take_over() has replayed the output of failed
+	// transactions already, so that the next begin() does not.
+	bool m_replayed;
+
+	// After a reload, the generators that need to be refilled and
+	// the drivers whose output needs to be re-driven.
+	std::vector<bool> m_refill_generators;
+	std::vector<bool> m_redrive_drivers;
 
 	// Helper in find_subscriptions()
 	std::vector<varnum_t> variables_for_generator(gennum_t g);
+	// Helper after the variable names are known, fills m_slots_per_generator
+	void index_attributes();
+	// Helpers in take_over(), for comparing with the old script
+	std::vector<std::string> column_names(gennum_t g);
+	std::vector<hash_t> generator_hashes(drvnum_t d);
+	std::vector<hash_t> condition_hashes(drvnum_t d);
+	// Helpers in find_backends(), create the backend for one driver,
+	// sharing the instance of one of the @p fresh backends if possible
+	void add_backend(drvnum_t drvidx, std::vector<BackendParameters*>& fresh);
+	bool share_backend(BackendParameters& backend, const std::vector<BackendParameters*>& fresh);
 
 public:
-	Private() : m_valid(false), m_state(Parser::State::Initial)
+	Private() : m_valid(false), m_state(Parser::State::Initial), m_from_image(false), m_image(nullptr), m_replayed(false)
 	{
 		if (pulley_parser_init(&m_prs))
 		{
@@ -90,6 +138,11 @@ public:
 	~Private()
 	{
 		m_sql.close();
+		if (m_image)
+		{
+			image_reader_close(m_image);
+			m_image = nullptr;
+		}
 
 		if (is_valid())
 		{
@@ -104,6 +157,8 @@ public:
 
 	bool is_valid() const { return m_valid; }
 
+	bool from_image() const { return m_from_image; }
+
 	Parser::State state() const { return m_state; }
 
 	std::string state_string() const
@@ -198,6 +253,52 @@ public:
 		return 0;
 	}
 
+	int read_image(struct image_reader* img)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		if (m_state != Parser::State::Initial)
+		{
+			log.errorStream() << "Parser can only load an image from state Initial, not " << state_string();
+			image_reader_close(img);
+			return 1;
+		}
+
+		if (pulley_image_read_script(&m_prs, img))
+		{
+			log.errorStream() << "Could not load script from image.";
+			image_reader_close(img);
+			m_state = Parser::State::Broken;
+			return 1;
+		}
+
+		m_variables_per_generator.clear();
+		gennum_t count = gentab_count(m_prs.gentab);
+		for (gennum_t g=0; g<count; g++)
+		{
+			uint32_t varcount = variables_for_generator(g).size();
+			std::vector<const char*> names(varcount + 1);
+			if ((pulley_image_read_names(img, names.data(), varcount) != varcount) || !image_reader_ok(img))
+			{
+				log.errorStream() << "Could not load variable names for generator " << g << " from image.";
+				image_reader_close(img);
+				m_state = Parser::State::Broken;
+				return 1;
+			}
+			m_variables_per_generator.emplace_back(names.begin(), names.begin() + varcount);
+		}
+		index_attributes();
+
+		auto stream = log.debugStream();
+		hash_t h = m_prs.scanhash;
+		stream << "Loaded image for ";
+		SteamWorks::Logging::log_hex(stream, (uint8_t *)&h, sizeof(h));
+
+		m_image = img;
+		m_from_image = true;
+		m_state = Parser::State::Analyzed;
+		return 0;
+	}
+
 	int structural_analysis()
 	{
 		if (!can_analyze())
@@ -271,7 +372,20 @@ public:
 
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
 
-		if (squeal_have_tables(m_sql.m_sql, m_prs.gentab, 0) != 0)
+		if (m_image)
+		{
+			// The image replaces table creation and generator configuration
+			int r = squeal_read_image(m_sql.m_sql, m_image);
+			image_reader_close(m_image);
+			m_image = nullptr;
+			if (r != 0)
+			{
+				log.errorStream() << "Could not setup SQL from image.";
+				m_state = State::Broken;
+				return 1;
+			}
+		}
+		else if (squeal_have_tables(m_sql.m_sql, m_prs.gentab, 0) != 0)
 		{
 			log.errorStream() << "Could not create SQL tables for script.";
 			m_state = State::Broken;
@@ -285,7 +399,7 @@ public:
 			return 1;
 		}
 
-		if (squeal_configure_generators(m_sql.m_sql, m_prs.gentab, m_prs.drvtab) != 0)
+		if (!m_from_image && (squeal_configure_generators(m_sql.m_sql, m_prs.gentab, m_prs.drvtab) != 0))
 		{
 			log.errorStream() << "Could not configure generator SQL statements.";
 			m_state = State::Broken;
@@ -320,16 +434,54 @@ public:
 	std::forward_list< std::string > find_subscriptions();
 	void find_backends();
 
+	// Hot reload, taking over from the parser of the running script
+	int take_over(Private& old);
+	void refill_entry(const std::string& uuid, const picojson::object& data);
+	void redrive();
+
 	// Remove an entry from the middle-end (post-SQL)
 	void remove_entry(const std::string& uuid);
 	void add_entry(const std::string& uuid, const picojson::object& data);
 
+	// Regenerate a driver's output (pull mode)
+	long pull(drvnum_t driver, unsigned long cursor, unsigned long limit);
+
+	bool congested() const
+	{
+		return std::any_of(m_backends.cbegin(), m_backends.cend(), [](const BackendParameters& b) { return b.instance && b.instance->congested(); });
+	}
+
+	// Backends that collaborate in the transaction of another
+	// backend (the leader) for the current transaction, as member
+	// -> leader. These are found by begin().
+	std::unordered_map<const PulleyBack::Instance*, PulleyBack::Instance*> m_collaborators;
+	void collaborate();
+
+	// Prepares and commits the backends in parallel
+	std::unique_ptr<ThreadPool> m_pool;
+	void replay_pending();
+	void open_journal(BackendParameters& backend);
+
+	// LDAP syntax OID per (lower case) attribute name, for typed output
+	std::unordered_map<std::string, std::string> m_syntaxes;
+	std::string attribute_of(varnum_t v);
+	std::vector<uint8_t> tags_for(drvnum_t driver);
+	void type_backend(BackendParameters& backend);
+	void set_attribute_syntaxes(const std::unordered_map<std::string, std::string>& syntaxes);
+	void run_parallel(const std::vector<ThreadPool::task_t>& tasks);
+
 	std::weak_ptr<SteamWorks::PulleyScript::BackendTransaction> m_transaction;
 	std::shared_ptr<SteamWorks::PulleyScript::BackendTransaction> begin()
 	{
 		auto p = m_transaction.lock();
 		if (!p)
 		{
+			collaborate();
+			if (!m_replayed)
+			{
+				replay_pending();
+			}
+			m_replayed = false;
 			p = std::make_shared<SteamWorks::PulleyScript::BackendTransaction>(this);
 			m_transaction = p;
 		}
@@ -389,6 +541,13 @@ int SteamWorks::PulleyScript::Parser::read_file(const char* filename)
 	}
 
 	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	struct image_reader* img = image_reader_open(filename);
+	if (img)
+	{
+		log.debugStream() << "Loading image " << filename;
+		return d->read_image(img);
+	}
+
 	FILE *fh = fopen(filename, "r");
 	if (!fh) {
 		log.errorStream() << "Failed to open " << filename;
@@ -408,6 +567,11 @@ int SteamWorks::PulleyScript::Parser::read_file(FILE* input)
 
 int SteamWorks::PulleyScript::Parser::structural_analysis()
 {
+	if (d->from_image() && (state() == State::Analyzed))
+	{
+		// Analysis was done when the image was compiled
+		return 0;
+	}
 	if (state() != State::Parsing)
 	{
 		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
@@ -470,7 +634,12 @@ std::forward_list< std::string > SteamWorks::PulleyScript::Parser::Private::find
 		return std::forward_list<std::string>();
 	}
 
-	m_variables_per_generator.clear();
+	// An image holds the variable names already, so then only the
+	// filter expressions of generators pulling from world are needed.
+	if (!m_from_image)
+	{
+		m_variables_per_generator.clear();
+	}
 
 	std::forward_list<std::string> filterexps;
 	gennum_t count = gentab_count(m_prs.gentab);
@@ -490,10 +659,21 @@ std::forward_list< std::string > SteamWorks::PulleyScript::Parser::Private::find
 			filterexp = &filterexps.front();
 		}
 
+		if (m_from_image && !filterexp)
+		{
+			continue;
+		}
+
 		varnum_t b = gen_get_binding(m_prs.gentab, i);
 		struct var_value* value = var_share_value(m_prs.vartab, b);
 
 		auto bound_varnums = variables_for_generator(i);  // Variables on the right-hand side of binding
+		if (m_from_image)
+		{
+			generator_variablenames_t names(bound_varnums.size());
+			explain_binding(m_prs.vartab, value->typed_blob.ptr, value->typed_blob.len, filterexp, bound_varnums, names);
+			continue;
+		}
 		m_variables_per_generator.emplace_back(bound_varnums.size());  // New vector of names
 
 		explain_binding(m_prs.vartab, value->typed_blob.ptr, value->typed_blob.len, filterexp, bound_varnums, m_variables_per_generator.back());
@@ -507,284 +687,1557 @@ std::forward_list< std::string > SteamWorks::PulleyScript::Parser::Private::find
 		}
 	}
 
+	index_attributes();
 	return filterexps;
 }
 
-struct DERItem
+void SteamWorks::PulleyScript::Parser::Private::index_attributes()
 {
-	der_t ptr;
-
-	DERItem(struct squeal_blob* parm) :
-		ptr(nullptr)
+	m_slots_per_generator.clear();
+	for (const auto& names : m_variables_per_generator)
 	{
-		uint8_t tag = 0x04; // Universal tag octet string
-		uint8_t len_len = 1;
-		size_t len = parm->size;
-		while (len>=128)
+		m_slots_per_generator.emplace_back();
+		for (const auto& f : names)
 		{
-			len = len >> 8;
-			len_len++;
+			m_slots_per_generator.back().push_back(m_attributes.intern(f));
 		}
+	}
+}
+
+/**
+ * Bump allocator for the DER encoding of output tuples, one per
+ * backend. Memory is handed out from chunks and only released all
+ * at once, by reset(). Forkdata is only valid during the call into
+ * the backend (the journal, router, batch buffer and queue all copy
+ * it), so the arena is reset after each fork and stays as large as
+ * the largest fork, whatever the size of the transaction.
+ */
+class SteamWorks::PulleyScript::DERArena
+{
+private:
+	struct Chunk
+	{
+		std::unique_ptr<uint8_t[]> data;
+		size_t size;
+	} ;
+	std::vector<Chunk> m_chunks;
+	size_t m_used;  // Bytes used in the last chunk
+
+	// Longest converted value: a GeneralizedTime with 16 digits of fraction
+	enum : size_t { max_converted = 32 };
 
-		ptr = (der_t)malloc(1 + len_len + parm->size);
-		if (ptr)
+	// Scratch space for encode(), one per value; grows to the widest fork
+	struct Item
+	{
+		const uint8_t* content;
+		size_t size;
+		uint8_t tag;
+		uint8_t len_len;
+		uint8_t converted[max_converted];  // For INTEGER, BOOLEAN and GeneralizedTime
+	} ;
+	std::vector<Item> m_items;
+
+	uint8_t* allocate(size_t size)
+	{
+		size = (size + alignof(der_t) - 1) & ~(alignof(der_t) - 1);
+		if (m_chunks.empty() || (m_used + size > m_chunks.back().size))
 		{
-			ptr[0] = tag;
-			if (len_len > 1)
+			size_t chunksize = m_chunks.empty() ? 4096 : 2 * m_chunks.back().size;
+			if (chunksize < size)
 			{
-				ptr[1] = len_len | 0x80;
-				len = parm->size;
-				for (off_t i = len_len + 2; i >= 2; --i)
-				{
-					ptr[i] = len & 0xff;
-					len = len >> 8;
-				}
-			}
-			else
-			{
-				assert(parm->size < 128);
-				ptr[1] = parm->size & 0x7f;
+				chunksize = size;
 			}
-			memcpy(ptr + 1 + len_len, parm->data, parm->size);
+			m_chunks.push_back(Chunk{ std::unique_ptr<uint8_t[]>(new uint8_t[chunksize]), chunksize });
+			m_used = 0;
 		}
+		uint8_t* p = m_chunks.back().data.get() + m_used;
+		m_used += size;
+		return p;
+	}
+
+	// Number of octets in the DER length field for @p size
+	static uint8_t length_size(size_t size)
+	{
+		// Long form: one octet more than the significant octets of size
+		return size < 128 ? 1 : 1 + (8 * sizeof(unsigned long long) - __builtin_clzll(size) + 7) / 8;
+	}
 
-		auto& log = SteamWorks::Logging::getLogger("steamworks.der");
-		log.debugStream() << "Allocated DER @" << (void *)ptr << " tag=" << int(ptr[0]) << " len=" << int(ptr[1]);
+	// Days since 1970-01-01 of a date in the proleptic Gregorian calendar, and back
+	static long days_from_civil(long y, unsigned int m, unsigned int d)
+	{
+		y -= m <= 2;
+		long era = (y >= 0 ? y : y - 399) / 400;
+		unsigned int yoe = y - era * 400;
+		unsigned int doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+		unsigned int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + long(doe) - 719468;
 	}
 
-	DERItem() :
-		ptr(nullptr)
+	static void civil_from_days(long z, long& y, unsigned int& m, unsigned int& d)
 	{
+		z += 719468;
+		long era = (z >= 0 ? z : z - 146096) / 146097;
+		unsigned int doe = z - era * 146097;
+		unsigned int yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		unsigned int doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		unsigned int mp = (5 * doy + 2) / 153;
+		d = doy - (153 * mp + 2) / 5 + 1;
+		m = mp < 10 ? mp + 3 : mp - 9;
+		y = long(yoe) + era * 400 + (m <= 2);
 	}
 
-	~DERItem()
+	// The @p n digits at @p s as a number, or -1 if they are not all digits
+	static int number(const char* s, size_t n)
 	{
-		if(ptr)
+		int value = 0;
+		for (size_t i = 0; i < n; i++)
 		{
-			free(ptr);
-			ptr = nullptr;
+			if (!isdigit((unsigned char)s[i]))
+			{
+				return -1;
+			}
+			value = value * 10 + (s[i] - '0');
 		}
+		return value;
 	}
-} ;
-
-struct DERArray
-{
-	int count;
-	der_t* ptr;
-	std::vector<DERItem> items;
 
-	DERArray(int numactpart, struct squeal_blob* actparm) :
-		count(numactpart),
-		ptr(numactpart > 0 ? (der_t*)calloc(numactpart, sizeof(der_t)) : nullptr)
+	/**
+	 * Write LDAP GeneralizedTime @p s (RFC 4517) into @p buffer in the
+	 * form DER requires: YYYYMMDDHHMMSS[.f]Z, in UTC, with seconds and
+	 * without trailing zeros in the fraction. Returns the size, or 0
+	 * if @p s is not a valid time or cannot be written exactly (a
+	 * fraction of an hour or minute, or too many digits of fraction).
+	 */
+	static size_t generalized_time(const char* s, size_t n, uint8_t* buffer)
 	{
-		if ((numactpart > 0) && (numactpart > items.capacity()))
+		if (n < 11)
 		{
-			items.reserve(numactpart);
+			return 0;
 		}
-
-		if (ptr)
+		long year = number(s, 4);
+		int month = number(s + 4, 2);
+		int day = number(s + 6, 2);
+		int hour = number(s + 8, 2);
+		int minute = 0;
+		int second = 0;
+		size_t p = 10;
+		bool seconds = false;
+		if ((n - p >= 2) && isdigit((unsigned char)s[p]))
 		{
-			for(unsigned int i=0; i<numactpart; i++)
+			minute = number(s + p, 2);
+			p += 2;
+			if ((n - p >= 2) && isdigit((unsigned char)s[p]))
 			{
-				items.emplace_back(&actparm[i]);
-				ptr[i] = items[i].ptr;
+				second = number(s + p, 2);
+				p += 2;
+				seconds = true;
 			}
 		}
-		else
+		if ((year < 0) || (month < 1) || (month > 12) || (day < 1) || (hour < 0) || (hour > 23) ||
+			(minute < 0) || (minute > 59) || (second < 0) || (second > 60))
 		{
-			free(ptr);
-			ptr = nullptr;
-			count = 0;
+			return 0;
+		}
+		static const int month_days[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+		bool leap = (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+		if ((day > month_days[month - 1]) || ((month == 2) && (day == 29) && !leap))
+		{
+			return 0;
 		}
-	}
-
-	~DERArray()
-	{
-		free(ptr);
-		ptr = nullptr;
-		count = -1;
-	}
-} ;
 
-static void ceebee(void *cbdata, int add_not_del, int numactpart, struct squeal_blob* actparm)
-{
-	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-	log.debugStream() << "Callback called " << cbdata << ' ' << add_not_del << ' ' << numactpart;
+		// Fraction of a second, with trailing zeros dropped
+		const char* fraction = nullptr;
+		size_t fraction_size = 0;
+		if ((p < n) && ((s[p] == '.') || (s[p] == ',')))
+		{
+			fraction = s + ++p;
+			while ((p < n) && isdigit((unsigned char)s[p]))
+			{
+				p++;
+			}
+			fraction_size = s + p - fraction;
+			if ((fraction_size == 0) || !seconds)
+			{
+				return 0;
+			}
+			while ((fraction_size > 0) && (fraction[fraction_size - 1] == '0'))
+			{
+				fraction_size--;
+			}
+			if (fraction_size > max_converted - 16)
+			{
+				return 0;
+			}
+		}
 
-	auto instance = reinterpret_cast<SteamWorks::PulleyBack::Instance*>(cbdata);
-	log.debugStream() << "  .. name=" << instance->name() << " valid=" << instance->is_valid();
+		// Time zone: Z, or a difference from UTC to take off
+		if (p >= n)
+		{
+			return 0;
+		}
+		if (s[p] == 'Z')
+		{
+			p++;
+		}
+		else if ((s[p] == '+') || (s[p] == '-'))
+		{
+			int sign = (s[p] == '+') ? 1 : -1;
+			size_t zone = n - p - 1;
+			int zone_hours = (zone >= 2) ? number(s + p + 1, 2) : -1;
+			int zone_minutes = (zone == 4) ? number(s + p + 3, 2) : 0;
+			if (((zone != 2) && (zone != 4)) || (zone_hours < 0) || (zone_hours > 23) || (zone_minutes < 0) || (zone_minutes > 59))
+			{
+				return 0;
+			}
+			p = n;
+
+			long minutes = (days_from_civil(year, month, day) * 24 + hour) * 60 + minute - sign * (zone_hours * 60 + zone_minutes);
+			long days = (minutes >= 0 ? minutes : minutes - 1439) / 1440;
+			minutes -= days * 1440;
+			unsigned int m, d;
+			civil_from_days(days, year, m, d);
+			month = m;
+			day = d;
+			hour = minutes / 60;
+			minute = minutes % 60;
+			if ((year < 0) || (year > 9999))
+			{
+				return 0;
+			}
+		}
+		if (p != n)
+		{
+			return 0;
+		}
 
-	DERArray a(numactpart, actparm);
-	if (add_not_del)
-	{
-		instance->add(a.ptr);
-	}
-	else
-	{
-		instance->del(a.ptr);
+		char* out = reinterpret_cast<char*>(buffer);
+		int size = snprintf(out, max_converted, "%04ld%02d%02d%02d%02d%02d", year, month, day, hour, minute, second);
+		if (fraction_size > 0)
+		{
+			out[size++] = '.';
+			memcpy(out + size, fraction, fraction_size);
+			size += fraction_size;
+		}
+		out[size++] = 'Z';
+		return size;
 	}
-}
-
-void SteamWorks::PulleyScript::Parser::Private::find_backends()
-{
-	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-	log.debugStream() << "Finding backend outputs:";
 
-	m_backends.clear();
-	drvnum_t count = drvtab_count(m_prs.drvtab);
-	for (drvnum_t drvidx=0; drvidx < count; drvidx++)
+	/**
+	 * Work out the content of @p blob as a value with DER @p tag.
+	 * INTEGER, BOOLEAN and GeneralizedTime are converted from their
+	 * LDAP string form into @p buffer (of max_converted bytes); the
+	 * string types are copied as they are. Values that do not convert
+	 * fall back to an octet string. Returns the tag to use, and stores
+	 * the content in @p content and @p size.
+	 */
+	static uint8_t convert(uint8_t tag, const struct squeal_blob& blob, uint8_t* buffer, const uint8_t** content, size_t* size)
 	{
-		const char *name = drv_get_module(m_prs.drvtab, drvidx);
-		log.debugStream() << "  .. parameters for driver " << drvidx << ' ' << name;
-		varnum_t binding = drv_get_module_parameters(m_prs.drvtab, drvidx);
-		if (binding != VARNUM_BAD)
-		{
-			struct var_value* value = var_share_value(m_prs.vartab, binding);
-			std::vector<std::string> expressions;
-			decode_parameter_binding(m_prs.vartab, value->typed_blob.ptr, value->typed_blob.len, expressions);
-			m_backends.emplace_front(name, expressions);
+		const char* s = static_cast<const char*>(blob.data);
+		*content = static_cast<const uint8_t*>(blob.data);
+		*size = blob.size;
 
-			varnum_t* var_list = nullptr;
-			varnum_t var_count = 0;
-			drv_share_output_variable_table(m_prs.drvtab, drvidx, &var_list, &var_count);
+		if (tag == der_boolean)
+		{
+			if ((blob.size == 4) && !memcmp(s, "TRUE", 4))
+			{
+				buffer[0] = 0xff;
+			}
+			else if ((blob.size == 5) && !memcmp(s, "FALSE", 5))
+			{
+				buffer[0] = 0x00;
+			}
+			else
+			{
+				return der_octet_string;
+			}
+			*content = buffer;
+			*size = 1;
+		}
+		else if (tag == der_integer)
+		{
+			// Up to 18 digits always fit in an int64_t
+			size_t i = (blob.size > 0) && (s[0] == '-') ? 1 : 0;
+			if ((blob.size <= i) || (blob.size - i > 18))
+			{
+				return der_octet_string;
+			}
+			int64_t value = 0;
+			for (size_t j = i; j < blob.size; j++)
+			{
+				if (!isdigit((unsigned char)s[j]))
+				{
+					return der_octet_string;
+				}
+				value = value * 10 + (s[j] - '0');
+			}
+			if (i)
+			{
+				value = -value;
+			}
 
-			const auto& b = m_backends.begin();
-			b->driver = drvidx;
-			b->varc = var_count;
-			b->instance.reset(new PulleyBack::Instance(PulleyBack::Loader(b->name).get_instance(*b)));
-			if (b->instance->is_valid())
+			// Minimal two's complement, big-endian
+			size_t octets = 1;
+			while ((octets < sizeof(value)) && ((value < -(int64_t(1) << (8 * octets - 1))) || (value >= (int64_t(1) << (8 * octets - 1)))))
 			{
-				squeal_configure_driver(m_sql.m_sql, drvidx, ceebee, b->instance.get());
+				octets++;
 			}
+			for (size_t j = 0; j < octets; j++)
+			{
+				buffer[j] = (uint64_t(value) >> (8 * (octets - 1 - j))) & 0xff;
+			}
+			*content = buffer;
+			*size = octets;
+		}
+		else if (tag == der_generalized_time)
+		{
+			size_t octets = generalized_time(s, blob.size, buffer);
+			if (!octets)
+			{
+				return der_octet_string;
+			}
+			*content = buffer;
+			*size = octets;
 		}
+		return tag;
 	}
-}
 
-void SteamWorks::PulleyScript::Parser::remove_entry(const std::string& uuid)
-{
-	if (state() != State::Ready)
+public:
+	// Universal DER tags used for output
+	enum : uint8_t
 	{
-		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot remove entry.";
-		return;
-	}
-
-	auto transaction = d->begin();
-	d->remove_entry(uuid);
-}
-
-void SteamWorks::PulleyScript::Parser::add_entry(const std::string& uuid, const picojson::object& data)
-{
-	if (state() != State::Ready)
+		der_boolean = 0x01,
+		der_integer = 0x02,
+		der_octet_string = 0x04,
+		der_utf8_string = 0x0c,
+		der_numeric_string = 0x12,
+		der_printable_string = 0x13,
+		der_ia5_string = 0x16,
+		der_generalized_time = 0x18
+	} ;
+
+	DERArena() : m_used(0) {}
+
+	/**
+	 * Encode the @p count blobs in @p blobs as DER values; with
+	 * @p tags (one per blob) as the types in there, otherwise as
+	 * octet strings. The sizes are worked out first, so that the
+	 * array of pointers and all the values take up one allocation
+	 * from the arena.
+	 */
+	der_t* encode(int count, const struct squeal_blob* blobs, const uint8_t* tags = nullptr)
 	{
-		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot add entry.";
-		return;
-	}
-
-	auto transaction = d->begin();
-	d->add_entry(uuid, data);
-}
+		if (m_items.size() < size_t(count))
+		{
+			m_items.resize(count);
+		}
 
-std::shared_ptr< SteamWorks::PulleyScript::BackendTransaction > SteamWorks::PulleyScript::Parser::begin()
-{
-	return d->begin();
-}
+		size_t total = count * sizeof(der_t);
+		for (int i = 0; i < count; i++)
+		{
+			Item& item = m_items[i];
+			item.tag = convert(tags ? tags[i] : der_octet_string, blobs[i], item.converted, &item.content, &item.size);
+			total += 1 + item.size;
+		}
+		// All the length-field sizes in one pass
+		for (int i = 0; i < count; i++)
+		{
+			m_items[i].len_len = length_size(m_items[i].size);
+			total += m_items[i].len_len;
+		}
 
-void SteamWorks::PulleyScript::Parser::Private::remove_entry(const std::string& uuid)
-{
-	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-	log.debugStream() << "Removing entry:" << uuid;
+		uint8_t* block = allocate(total);
+		der_t* forkdata = reinterpret_cast<der_t*>(block);
+		uint8_t* p = block + count * sizeof(der_t);
+		for (int i = 0; i < count; i++)
+		{
+			const Item& item = m_items[i];
+			forkdata[i] = p;
+			*p++ = item.tag;
+			if (item.len_len == 1)
+			{
+				*p++ = item.size;
+			}
+			else
+			{
+				// Long form: number of length octets, then big-endian length
+				*p++ = 0x80 | (item.len_len - 1);
+				for (int shift = 8 * (item.len_len - 2); shift >= 0; shift -= 8)
+				{
+					*p++ = (item.size >> shift) & 0xff;
+				}
+			}
+			memcpy(p, item.content, item.size);
+			p += item.size;
+		}
+		return forkdata;
+	}
 
-	gennum_t count = gentab_count(m_prs.gentab);
-	for (gennum_t i=0; i<count; i++)
+	/**
+	 * Release everything allocated so far. The largest chunk is
+	 * kept for the next fork.
+	 */
+	void reset()
 	{
-		hash_t h = gen_get_hash(m_prs.gentab, i);
-
-		auto stream = log.debugStream();
-		stream << "  .. generator " << i << " hash ";
-		SteamWorks::Logging::log_hex(stream, (uint8_t *)&h, sizeof(h));
-
-		squeal_delete_forks(m_sql.m_sql, i, uuid.c_str());
+		if (m_chunks.size() > 1)
+		{
+			std::swap(m_chunks.front(), m_chunks.back());
+			m_chunks.resize(1);
+		}
+		m_used = 0;
 	}
-}
+} ;
 
-void SteamWorks::PulleyScript::Parser::Private::add_entry(const std::string& uuid, const picojson::object& data)
+/**
+ * Routes the output of several drivers into one shared backend
+ * instance. Each driver has a routing tag (its route), and the router
+ * remembers which routes produce each fork. A fork goes to the instance
+ * when the first route adds it, and is removed when the last route
+ * deletes it, so the instance sees the output as if from one driver.
+ */
+class SteamWorks::PulleyScript::ForkRouter
 {
-	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-   	log.debugStream() << "Adding entry:" << uuid;
+private:
+	// Routes per fork, keyed by the fork's DER values back-to-back
+	std::unordered_map< std::string, std::vector<bool> > m_forks;
+	unsigned int m_routes;
+	std::string m_key;  // Scratch space for key()
 
-	gennum_t count = gentab_count(m_prs.gentab);
-	for (gennum_t i=0; i<count; i++)
+	const std::string& key(int varc, der_t* forkdata)
 	{
-		hash_t h = gen_get_hash(m_prs.gentab, i);
-
-		auto stream = log.debugStream();
-		stream << "  .. generator " << i << " hash ";
-		SteamWorks::Logging::log_hex(stream, (uint8_t *)&h, sizeof(h));
-
-		for (const auto& f : variable_names(i))
+		m_key.clear();
+		for (int i = 0; i < varc; i++)
 		{
-			log.debugStream() << "  .. generate with " << f;
+			m_key.append(reinterpret_cast<const char*>(forkdata[i]), PulleyBack::der_size(forkdata[i]));
 		}
+		return m_key;
+	}
 
-		struct squeal_blob blobs[variable_names(i).size()];
-		MultiIterator it(data, variable_names(i));
-
-		while (!it.is_done())
-		{
-			MultiIterator::value_t v = it.next();
-			unsigned int blobnum = 0;
-			for (const auto& f : v)
-			{
-				blobs[blobnum].data = (void *)f.c_str();
-				blobs[blobnum].size = f.length();
-				blobnum++;
-			}
+public:
+	ForkRouter() : m_routes(0) {}
 
-			squeal_insert_fork(m_sql.m_sql, i, uuid.c_str(), variable_names(i).size(), blobs);
-		}
+	/** Returns the routing tag for one more driver. */
+	unsigned int add_route()
+	{
+		return m_routes++;
 	}
-}
-
-void SteamWorks::PulleyScript::Parser::Private::commit()
-{
-	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
-	log.debugStream() << "Committing transaction.";
 
-	for (const auto& backend : m_backends)
+	/**
+	 * Route the addition of a fork; returns true if it is new to the
+	 * instance, and must be passed on.
+	 */
+	bool add(unsigned int route, int varc, der_t* forkdata)
 	{
-		int prep = backend.instance->prepare();
-		log.debugStream() << "  .. backend " << backend.name << " prepare " << prep;
-		if (prep == 0)
+		auto& routes = m_forks[key(varc, forkdata)];
+		bool is_new = std::none_of(routes.cbegin(), routes.cend(), [](bool r) { return r; });
+		if (routes.size() < m_routes)
 		{
-			// Failure, clear up everything.
-			goto fail;
+			routes.resize(m_routes, false);
 		}
+		routes[route] = true;
+		return is_new;
 	}
 
-	for (const auto& backend : m_backends)
+	/**
+	 * Route the removal of a fork; returns true if no route produces
+	 * it any more, and the removal must be passed on.
+	 */
+	bool del(unsigned int route, int varc, der_t* forkdata)
 	{
-		int comm = backend.instance->commit();
-		log.debugStream() << "  .. backend " << backend.name << " commit " << comm;
-		if (comm == 0)
+		auto it = m_forks.find(key(varc, forkdata));
+		if ((it == m_forks.end()) || (route >= it->second.size()) || !it->second[route])
+		{
+			return false;
+		}
+		it->second[route] = false;
+		if (std::any_of(it->second.cbegin(), it->second.cend(), [](bool r) { return r; }))
 		{
-			goto fail;
+			return false;
 		}
+		m_forks.erase(it);
+		return true;
 	}
 
-	return;
-
-fail:
-	for (const auto& backend : m_backends)
+	/**
+	 * Drop everything from @p route, instead of resetting the instance
+	 * (which would drop the output of the other routes as well). Calls
+	 * @p del for each fork that no route produces any more, and returns
+	 * how many there were.
+	 */
+	size_t reset(unsigned int route, int varc, std::function<void(der_t*)> del)
 	{
-		backend.instance->rollback();
+		std::vector<std::string> dropped;
+		for (auto it = m_forks.begin(); it != m_forks.end(); )
+		{
+			if (route < it->second.size())
+			{
+				it->second[route] = false;
+			}
+			if (std::none_of(it->second.cbegin(), it->second.cend(), [](bool r) { return r; }))
+			{
+				dropped.push_back(it->first);
+				it = m_forks.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		std::vector<der_t> forkdata(varc);
+		for (auto& fork : dropped)
+		{
+			uint8_t* p = reinterpret_cast<uint8_t*>(&fork[0]);
+			for (int i = 0; i < varc; i++)
+			{
+				forkdata[i] = p;
+				p += PulleyBack::der_size(p);
+			}
+			del(forkdata.data());
+		}
+		return dropped.size();
+	}
+} ;
+
+/**
+ * DER tags for the LDAP syntaxes (RFC 4517) that have a matching
+ * universal type; all others are passed as octet strings.
+ */
+static const struct
+{
+	const char* oid;
+	uint8_t tag;
+} syntax_tags[] =
+{
+	{ "1.3.6.1.4.1.1466.115.121.1.7", SteamWorks::PulleyScript::DERArena::der_boolean },  // Boolean
+	{ "1.3.6.1.4.1.1466.115.121.1.12", SteamWorks::PulleyScript::DERArena::der_utf8_string },  // DN
+	{ "1.3.6.1.4.1.1466.115.121.1.15", SteamWorks::PulleyScript::DERArena::der_utf8_string },  // Directory String
+	{ "1.3.6.1.4.1.1466.115.121.1.24", SteamWorks::PulleyScript::DERArena::der_generalized_time },  // Generalized Time
+	{ "1.3.6.1.4.1.1466.115.121.1.26", SteamWorks::PulleyScript::DERArena::der_ia5_string },  // IA5 String
+	{ "1.3.6.1.4.1.1466.115.121.1.27", SteamWorks::PulleyScript::DERArena::der_integer },  // INTEGER
+	{ "1.3.6.1.4.1.1466.115.121.1.36", SteamWorks::PulleyScript::DERArena::der_numeric_string },  // Numeric String
+	{ "1.3.6.1.4.1.1466.115.121.1.44", SteamWorks::PulleyScript::DERArena::der_printable_string },  // Printable String
+} ;
+
+std::string SteamWorks::PulleyScript::Parser::Private::attribute_of(varnum_t v)
+{
+	gennum_t count = gentab_count(m_prs.gentab);
+	for (gennum_t g = 0; (g < count) && (g < m_variables_per_generator.size()); g++)
+	{
+		auto vars = variables_for_generator(g);
+		auto it = std::find(vars.cbegin(), vars.cend(), v);
+		if (it == vars.cend())
+		{
+			continue;
+		}
+		const auto& names = m_variables_per_generator[g];
+		size_t k = it - vars.cbegin();
+		if ((k < names.size()) && !names[k].empty())
+		{
+			std::string name = names[k];
+			for (auto& c : name)
+			{
+				c = tolower((unsigned char)c);
+			}
+			return name;
+		}
+	}
+	return std::string();
+}
+
+std::vector<uint8_t> SteamWorks::PulleyScript::Parser::Private::tags_for(drvnum_t driver)
+{
+	varnum_t* var_list = nullptr;
+	varnum_t var_count = 0;
+	drv_share_output_variable_table(m_prs.drvtab, driver, &var_list, &var_count);
+
+	std::vector<uint8_t> tags(var_count, DERArena::der_octet_string);
+	for (varnum_t i = 0; i < var_count; i++)
+	{
+		auto syntax = m_syntaxes.find(attribute_of(var_list[i]));
+		if (syntax == m_syntaxes.end())
+		{
+			continue;
+		}
+		for (const auto& st : syntax_tags)
+		{
+			if (syntax->second == st.oid)
+			{
+				tags[i] = st.tag;
+				break;
+			}
+		}
+	}
+	return tags;
+}
+
+void SteamWorks::PulleyScript::Parser::Private::type_backend(BackendParameters& backend)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	// A shared instance gets one type per variable, so where the
+	// drivers sharing it disagree, that is an octet string.
+	std::vector<uint8_t> tags = tags_for(backend.driver);
+	bool fixed = backend.types_fixed;
+	for (const auto& other : m_backends)
+	{
+		if ((&other == &backend) || (other.instance != backend.instance))
+		{
+			continue;
+		}
+		fixed = fixed || other.types_fixed;
+		std::vector<uint8_t> other_tags = tags_for(other.driver);
+		for (size_t i = 0; (i < tags.size()) && (i < other_tags.size()); i++)
+		{
+			if (tags[i] != other_tags[i])
+			{
+				tags[i] = DERArena::der_octet_string;
+			}
+		}
+	}
+
+	// The backend has its types, and may have output in them
+	// already; it must not see the same variable typed otherwise.
+	if (fixed)
+	{
+		if (backend.tags.empty())
+		{
+			log.debugStream() << "  .. backend " << backend.name << " has had untyped output and stays untyped.";
+		}
+		else if (tags != backend.tags)
+		{
+			log.warnStream() << "  .. backend " << backend.name << " keeps the types of its output; the attribute syntaxes changed.";
+		}
+		return;
+	}
+
+	bool typed = backend.instance && backend.instance->set_types(tags);
+	if (typed)
+	{
+		log.debugStream() << "  .. backend " << backend.name << " takes typed values.";
+	}
+	for (auto& b : m_backends)
+	{
+		if ((&b == &backend) || (backend.instance && (b.instance == backend.instance)))
+		{
+			b.tags = typed ? tags : std::vector<uint8_t>();
+			b.types_fixed = !m_syntaxes.empty();
+		}
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::Private::set_attribute_syntaxes(const std::unordered_map<std::string, std::string>& syntaxes)
+{
+	m_syntaxes = syntaxes;
+	for (auto& backend : m_backends)
+	{
+		type_backend(backend);
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::set_attribute_syntaxes(const std::unordered_map<std::string, std::string>& syntaxes)
+{
+	d->set_attribute_syntaxes(syntaxes);
+}
+
+static void ceebee(void *cbdata, int add_not_del, int numactpart, struct squeal_blob* actparm)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Callback called " << cbdata << ' ' << add_not_del << ' ' << numactpart;
+
+	auto backend = reinterpret_cast<SteamWorks::PulleyScript::BackendParameters*>(cbdata);
+	auto& instance = backend->instance;
+	backend->types_fixed = true;  // Whether typed or not
+	log.debugStream() << "  .. name=" << instance->name() << " valid=" << instance->is_valid();
+
+	// Built-in backends take the blobs as they are, unless the
+	// router needs them as DER.
+	if (instance->takes_blobs() && !backend->router)
+	{
+		backend->journal->record(add_not_del, numactpart, actparm);
+		if (add_not_del)
+		{
+			instance->add(actparm);
+		}
+		else
+		{
+			instance->del(actparm);
+		}
+		return;
+	}
+
+	der_t* forkdata = backend->arena->encode(numactpart, actparm, (backend->tags.size() == (size_t)numactpart) ? backend->tags.data() : nullptr);
+	if (backend->router && !(add_not_del ? backend->router->add(backend->route, numactpart, forkdata) : backend->router->del(backend->route, numactpart, forkdata)))
+	{
+		// The shared instance already has (or still needs) this fork
+		backend->arena->reset();
+		return;
+	}
+	backend->journal->record(add_not_del, numactpart, forkdata);
+	if (add_not_del)
+	{
+		instance->add(forkdata);
+	}
+	else
+	{
+		instance->del(forkdata);
+	}
+	backend->arena->reset();  // Consumed (or copied) by now
+}
+
+static std::string journal_dir;
+
+void SteamWorks::PulleyScript::Parser::set_journal_dir(const std::string& dir)
+{
+	journal_dir = dir;
+}
+
+void SteamWorks::PulleyScript::Parser::Private::open_journal(BackendParameters& backend)
+{
+	// Named after the driver, so that it is found again after a
+	// restart or reload; identical drivers are numbered.
+	hash_t h = drv_get_hash(m_prs.drvtab, backend.driver);
+	unsigned int same = std::count_if(m_backends.cbegin(), m_backends.cend(), [&](const BackendParameters& b) { return (&b != &backend) && (drv_get_hash(m_prs.drvtab, b.driver) == h); });
+
+	char name[32];
+	snprintf(name, sizeof(name), "/%08x-%u.journal", h, same);
+	backend.journal->open(journal_dir + name);
+}
+
+void SteamWorks::PulleyScript::Parser::Private::find_backends()
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Finding backend outputs:";
+
+	m_backends.clear();
+	std::vector<BackendParameters*> fresh;
+	drvnum_t count = drvtab_count(m_prs.drvtab);
+	for (drvnum_t drvidx=0; drvidx < count; drvidx++)
+	{
+		add_backend(drvidx, fresh);
+	}
+}
+
+bool SteamWorks::PulleyScript::Parser::Private::share_backend(BackendParameters& backend, const std::vector<BackendParameters*>& fresh)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	auto same = [&](const BackendParameters* b)
+	{
+		if ((b->name != backend.name) || (b->varc != backend.varc) || (b->argc != backend.argc) || !b->instance || !b->instance->is_valid())
+		{
+			return false;
+		}
+		for (unsigned int i = 0; i < backend.argc; i++)
+		{
+			if (strcmp(b->argv[i], backend.argv[i]) != 0)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+	auto it = std::find_if(fresh.cbegin(), fresh.cend(), same);
+	if (it == fresh.cend())
+	{
+		return false;
+	}
+
+	BackendParameters& other = **it;
+	if (!other.router)
+	{
+		other.router = std::make_shared<ForkRouter>();
+		other.route = other.router->add_route();
+	}
+	backend.instance = other.instance;
+	backend.journal = other.journal;
+	backend.router = other.router;
+	backend.route = backend.router->add_route();
+	log.debugStream() << "  .. driver " << backend.driver << " shares the backend of driver " << other.driver << " route " << backend.route;
+	return true;
+}
+
+void SteamWorks::PulleyScript::Parser::Private::add_backend(drvnum_t drvidx, std::vector<BackendParameters*>& fresh)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	const char *name = drv_get_module(m_prs.drvtab, drvidx);
+	log.debugStream() << "  .. parameters for driver " << drvidx << ' ' << name;
+	varnum_t binding = drv_get_module_parameters(m_prs.drvtab, drvidx);
+	if (binding != VARNUM_BAD)
+	{
+		struct var_value* value = var_share_value(m_prs.vartab, binding);
+		std::vector<std::string> expressions;
+		decode_parameter_binding(m_prs.vartab, value->typed_blob.ptr, value->typed_blob.len, expressions);
+		m_backends.emplace_front(name, expressions);
+
+		varnum_t* var_list = nullptr;
+		varnum_t var_count = 0;
+		drv_share_output_variable_table(m_prs.drvtab, drvidx, &var_list, &var_count);
+
+		const auto& b = m_backends.begin();
+		b->driver = drvidx;
+		b->varc = var_count;
+		bool shared = share_backend(*b, fresh);
+		if (!shared)
+		{
+			b->instance.reset(new PulleyBack::Instance(PulleyBack::Loader(b->name).get_instance(*b)));
+		}
+		if (b->instance->is_valid())
+		{
+			fresh.push_back(&(*b));
+			if (!shared && !journal_dir.empty())
+			{
+				open_journal(*b);
+			}
+			if (!m_syntaxes.empty())
+			{
+				type_backend(*b);
+			}
+			squeal_configure_driver(m_sql.m_sql, drvidx, ceebee, &(*b));
+		}
+	}
+}
+
+std::vector<std::string> SteamWorks::PulleyScript::Parser::Private::column_names(gennum_t g)
+{
+	std::vector<std::string> names;
+	for (auto v : variables_for_generator(g))
+	{
+		names.emplace_back(var_get_name(m_prs.vartab, v));
+	}
+	return names;
+}
+
+std::vector<hash_t> SteamWorks::PulleyScript::Parser::Private::generator_hashes(drvnum_t d)
+{
+	std::vector<hash_t> hashes;
+	bitset_iter_t it;
+	bitset_iterator_init(&it, drv_share_generators(m_prs.drvtab, d));
+	while (bitset_iterator_next_one(&it, NULL))
+	{
+		hashes.push_back(gen_get_hash(m_prs.gentab, bitset_iterator_bitnum(&it)));
+	}
+	std::sort(hashes.begin(), hashes.end());
+	return hashes;
+}
+
+std::vector<hash_t> SteamWorks::PulleyScript::Parser::Private::condition_hashes(drvnum_t d)
+{
+	std::vector<hash_t> hashes;
+	bitset_iter_t it;
+	bitset_iterator_init(&it, drv_share_conditions(m_prs.drvtab, d));
+	while (bitset_iterator_next_one(&it, NULL))
+	{
+		hashes.push_back(cnd_get_hash(m_prs.cndtab, bitset_iterator_bitnum(&it)));
+	}
+	std::sort(hashes.begin(), hashes.end());
+	return hashes;
+}
+
+/* Create (or reuse) the tables and prepare the statements for the script
+ * in @p prs; returns nullptr on success, or a message that says what failed.
+ */
+static const char* setup_squeal(struct squeal* sql, struct parser& prs, bool may_reuse)
+{
+	if (squeal_have_tables(sql, prs.gentab, may_reuse) != 0)
+	{
+		return "Could not create SQL tables for script.";
+	}
+	if (squeal_configure(sql) != 0)
+	{
+		return "Could not prepare SQL statements for drv_all.";
+	}
+	if (squeal_configure_generators(sql, prs.gentab, prs.drvtab) != 0)
+	{
+		return "Could not configure generator SQL statements.";
+	}
+	return nullptr;
+}
+
+int SteamWorks::PulleyScript::Parser::Private::take_over(Private& old)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Taking over from running script:";
+
+	if (old.m_state != State::Ready)
+	{
+		log.errorStream() << "Can only reload over a running script, not from state " << old.state_string();
+		return 1;
+	}
+	if (!can_generate_sql())
+	{
+		return 1;
+	}
+
+	gennum_t gencount = gentab_count(m_prs.gentab);
+	gennum_t oldgencount = gentab_count(old.m_prs.gentab);
+	drvnum_t drvcount = drvtab_count(m_prs.drvtab);
+	drvnum_t olddrvcount = drvtab_count(old.m_prs.drvtab);
+
+	if (m_variables_per_generator.size() != gencount)
+	{
+		log.errorStream() << "Find subscriptions before taking over.";
+		return 1;
+	}
+
+	// A generator is kept when the old script has the same line, and
+	// with it the same gen_<hash> table; its columns must come in the
+	// same order, since tuples are inserted by position.
+	std::vector<gennum_t> genmap(gencount, GENNUM_BAD);
+	std::vector<bool> oldgen_kept(oldgencount, false);
+	for (gennum_t g=0; g<gencount; g++)
+	{
+		for (gennum_t og=0; og<oldgencount; og++)
+		{
+			if (!oldgen_kept[og] &&
+				(gen_get_hash(m_prs.gentab, g) == gen_get_hash(old.m_prs.gentab, og)) &&
+				(column_names(g) == old.column_names(og)))
+			{
+				genmap[g] = og;
+				oldgen_kept[og] = true;
+				break;
+			}
+		}
+	}
+
+	// A driver is kept when the old script has the same line, fed by
+	// the same generators (all of them kept) under the same conditions.
+	std::vector<drvnum_t> olddrvmap(olddrvcount, DRVNUM_BAD);  // Old to new
+	m_redrive_drivers.assign(drvcount, true);
+	for (drvnum_t d=0; d<drvcount; d++)
+	{
+		bool generators_kept = true;
+		bitset_iter_t it;
+		bitset_iterator_init(&it, drv_share_generators(m_prs.drvtab, d));
+		while (bitset_iterator_next_one(&it, NULL))
+		{
+			if (genmap[bitset_iterator_bitnum(&it)] == GENNUM_BAD)
+			{
+				generators_kept = false;
+			}
+		}
+		if (!generators_kept)
+		{
+			continue;
+		}
+
+		for (drvnum_t od=0; od<olddrvcount; od++)
+		{
+			if ((olddrvmap[od] == DRVNUM_BAD) &&
+				(drv_get_hash(m_prs.drvtab, d) == drv_get_hash(old.m_prs.drvtab, od)) &&
+				(generator_hashes(d) == old.generator_hashes(od)) &&
+				(condition_hashes(d) == old.condition_hashes(od)))
+			{
+				olddrvmap[od] = d;
+				m_redrive_drivers[d] = false;
+				break;
+			}
+		}
+	}
+
+	// Check the SQL for this script on a scratch (in-memory) database
+	// first, so that a script that the squeal engine cannot handle is
+	// refused before anything changes for the running script.
+	struct squeal* scratch = squeal_open_in_dbdir(m_prs.scanhash, gencount, drvcount, nullptr);
+	const char* failure = scratch ? setup_squeal(scratch, m_prs, false) : "Could not open a scratch SQL database.";
+	if (scratch)
+	{
+		squeal_close(scratch);
+	}
+	if (failure)
+	{
+		log.errorStream() << failure << " Keeping the running script.";
+		m_state = State::Broken;
+		return 1;
+	}
+
+	// The database is shared with the old script, keeping drv_all and
+	// the gen_<hash> tables of the generators that are kept. Set it up
+	// for this script completely before anything changes for the old
+	// one, so that a failure leaves the old script running as it was.
+	// A table that a new generator would reuse with other columns is
+	// the exception; it must go first.
+	for (gennum_t g=0; g<gencount; g++)
+	{
+		for (gennum_t og=0; (genmap[g] == GENNUM_BAD) && (og<oldgencount); og++)
+		{
+			if (!oldgen_kept[og] && (gen_get_hash(m_prs.gentab, g) == gen_get_hash(old.m_prs.gentab, og)))
+			{
+				log.warnStream() << "  .. generator " << g << " changed its columns, dropping its table";
+				squeal_drop_generator(old.m_sql.m_sql, gen_get_hash(old.m_prs.gentab, og));
+			}
+		}
+	}
+	struct squeal* sql = squeal_reopen(old.m_sql.m_sql, gencount, drvcount);
+	if (!sql)
+	{
+		log.errorStream() << "Could not take over SQL from running script.";
+		m_state = State::Broken;
+		return 1;
+	}
+	if ((failure = setup_squeal(sql, m_prs, true)))
+	{
+		log.errorStream() << failure << " Keeping the running script.";
+		squeal_detach(sql);
+		m_state = State::Broken;
+		return 1;
+	}
+
+	// Nothing fails from here on. Retract the output of removed and
+	// changed drivers, while the old script and its backends are
+	// still in place; output of failed transactions goes first.
+	old.replay_pending();
+	m_replayed = true;
+	for (drvnum_t od=0; od<olddrvcount; od++)
+	{
+		if (olddrvmap[od] == DRVNUM_BAD)
+		{
+			long n = squeal_driver_retract(old.m_sql.m_sql, old.m_prs.drvtab, od);
+			log.debugStream() << "  .. retracted old driver " << od << " tuples " << n;
+		}
+	}
+
+	// Backends move along with their drivers; backends of removed and
+	// changed drivers are retired, and committed with this transaction.
+	while (!old.m_backends.empty())
+	{
+		drvnum_t d = olddrvmap[old.m_backends.front().driver];
+		if (d == DRVNUM_BAD)
+		{
+			m_retired_backends.splice_after(m_retired_backends.before_begin(), old.m_backends, old.m_backends.before_begin());
+		}
+		else
+		{
+			m_backends.splice_after(m_backends.before_begin(), old.m_backends, old.m_backends.before_begin());
+			log.debugStream() << "  .. keeping backend " << m_backends.front().name << " driver " << m_backends.front().driver << " as " << d;
+			m_backends.front().driver = d;
+		}
+	}
+
+	squeal_detach(old.m_sql.m_sql);
+	old.m_sql.m_sql = nullptr;
+	old.m_state = State::Broken;
+	m_sql.m_sql = sql;
+	if (m_image)
+	{
+		image_reader_close(m_image);
+		m_image = nullptr;
+	}
+
+	// Tables of removed generators are no longer used by either script
+	for (gennum_t og=0; og<oldgencount; og++)
+	{
+		if (!oldgen_kept[og] && (squeal_drop_generator(m_sql.m_sql, gen_get_hash(old.m_prs.gentab, og)) != 0))
+		{
+			log.warnStream() << "Could not drop the table of removed generator " << og;
+		}
+	}
+
+	for (auto& b : m_backends)
+	{
+		if (b.instance->is_valid())
+		{
+			squeal_configure_driver(m_sql.m_sql, b.driver, ceebee, &b);
+		}
+	}
+	// New backends share instances among themselves, but not with
+	// the kept ones, whose output the router has not seen.
+	std::vector<BackendParameters*> fresh;
+	for (drvnum_t d=0; d<drvcount; d++)
+	{
+		if (m_redrive_drivers[d])
+		{
+			add_backend(d, fresh);
+		}
+	}
+
+	m_refill_generators.assign(gencount, false);
+	for (gennum_t g=0; g<gencount; g++)
+	{
+		m_refill_generators[g] = (genmap[g] == GENNUM_BAD);
+	}
+
+	log.debugStream() << "  .. generators kept " << std::count(oldgen_kept.begin(), oldgen_kept.end(), true) << " of " << gencount;
+	log.debugStream() << "  .. drivers kept " << std::count(m_redrive_drivers.begin(), m_redrive_drivers.end(), false) << " of " << drvcount;
+
+	m_state = State::Ready;
+	return 0;
+}
+
+void SteamWorks::PulleyScript::Parser::Private::refill_entry(const std::string& uuid, const picojson::object& data)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Refilling entry:" << uuid;
+
+	m_attributes.resolve(data, m_entry_values);
+
+	for (gennum_t i=0; i<m_refill_generators.size(); i++)
+	{
+		if (!m_refill_generators[i])
+		{
+			continue;
+		}
+
+		const auto& slots = m_slots_per_generator.at(i);
+		m_fork_blobs.resize(slots.size() + 1);
+		MultiIterator<struct squeal_blob> it(m_entry_values, slots);
+
+		while (it.next(m_fork_blobs.data()))
+		{
+			squeal_store_fork(m_sql.m_sql, i, uuid.c_str(), slots.size(), m_fork_blobs.data());
+		}
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::Private::redrive()
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	for (drvnum_t d=0; d<m_redrive_drivers.size(); d++)
+	{
+		if (m_redrive_drivers[d])
+		{
+			long n = squeal_driver_redrive(m_sql.m_sql, m_prs.drvtab, d);
+			log.debugStream() << "Re-driven driver " << d << " tuples " << n;
+		}
+	}
+
+	m_refill_generators.clear();
+	m_redrive_drivers.clear();
+}
+
+int SteamWorks::PulleyScript::Parser::take_over(Parser& old)
+{
+	return d->take_over(*old.d);
+}
+
+void SteamWorks::PulleyScript::Parser::refill_entry(const std::string& uuid, const picojson::object& data)
+{
+	if (state() != State::Ready)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot refill entry.";
+		return;
+	}
+
+	d->refill_entry(uuid, data);
+}
+
+void SteamWorks::PulleyScript::Parser::redrive()
+{
+	if (state() != State::Ready)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot re-drive output.";
+		return;
+	}
+
+	auto transaction = d->begin();
+	d->redrive();
+}
+
+void SteamWorks::PulleyScript::Parser::remove_entry(const std::string& uuid)
+{
+	if (state() != State::Ready)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot remove entry.";
+		return;
+	}
+
+	auto transaction = d->begin();
+	d->remove_entry(uuid);
+}
+
+void SteamWorks::PulleyScript::Parser::add_entry(const std::string& uuid, const picojson::object& data)
+{
+	if (state() != State::Ready)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot add entry.";
+		return;
+	}
+
+	auto transaction = d->begin();
+	d->add_entry(uuid, data);
+}
+
+long SteamWorks::PulleyScript::Parser::pull(drvnum_t driver, unsigned long cursor, unsigned long limit)
+{
+	if (state() != State::Ready)
+	{
+		auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+		log.errorStream() << "Pulley setup was incomplete or failed (" << d->state_string() << "). " << "Cannot pull driver.";
+		return -1;
+	}
+
+	auto transaction = d->begin();
+	return d->pull(driver, cursor, limit);
+}
+
+bool SteamWorks::PulleyScript::Parser::congested() const
+{
+	return d->congested();
+}
+
+std::shared_ptr< SteamWorks::PulleyScript::BackendTransaction > SteamWorks::PulleyScript::Parser::begin()
+{
+	return d->begin();
+}
+
+void SteamWorks::PulleyScript::Parser::Private::remove_entry(const std::string& uuid)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Removing entry:" << uuid;
+
+	gennum_t count = gentab_count(m_prs.gentab);
+	for (gennum_t i=0; i<count; i++)
+	{
+		hash_t h = gen_get_hash(m_prs.gentab, i);
+
+		auto stream = log.debugStream();
+		stream << "  .. generator " << i << " hash ";
+		SteamWorks::Logging::log_hex(stream, (uint8_t *)&h, sizeof(h));
+
+		squeal_delete_forks(m_sql.m_sql, i, uuid.c_str());
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::Private::add_entry(const std::string& uuid, const picojson::object& data)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+   	log.debugStream() << "Adding entry:" << uuid;
+
+	m_attributes.resolve(data, m_entry_values);
+
+	gennum_t count = gentab_count(m_prs.gentab);
+	for (gennum_t i=0; i<count; i++)
+	{
+		hash_t h = gen_get_hash(m_prs.gentab, i);
+
+		auto stream = log.debugStream();
+		stream << "  .. generator " << i << " hash ";
+		SteamWorks::Logging::log_hex(stream, (uint8_t *)&h, sizeof(h));
+
+		for (const auto& f : variable_names(i))
+		{
+			log.debugStream() << "  .. generate with " << f;
+		}
+
+		const auto& slots = m_slots_per_generator.at(i);
+		m_fork_blobs.resize(slots.size() + 1);
+		MultiIterator<struct squeal_blob> it(m_entry_values, slots);
+
+		while (it.next(m_fork_blobs.data()))
+		{
+			squeal_insert_fork(m_sql.m_sql, i, uuid.c_str(), slots.size(), m_fork_blobs.data());
+		}
+	}
+}
+
+long SteamWorks::PulleyScript::Parser::Private::pull(drvnum_t driver, unsigned long cursor, unsigned long limit)
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Pulling driver " << driver << " from " << cursor << " limit " << limit;
+
+	if (driver >= drvtab_count(m_prs.drvtab))
+	{
+		log.errorStream() << "No driver " << driver << " in script.";
+		return -1;
+	}
+
+	bool have_backend = false;
+	for (const auto& backend : m_backends)
+	{
+		if (backend.driver != driver)
+		{
+			continue;
+		}
+		have_backend = true;
+		// Starting from scratch; the backend drops everything in this transaction.
+		if (cursor == 0)
+		{
+			if (backend.router)
+			{
+				// Other drivers share the instance; drop only what is ours.
+				size_t n = backend.router->reset(backend.route, backend.varc, [&backend](der_t* forkdata)
+				{
+					backend.instance->del(forkdata);
+					backend.journal->record(false, backend.varc, forkdata);
+				});
+				log.debugStream() << "  .. backend " << backend.name << " route " << backend.route << " dropped " << n;
+				continue;
+			}
+			int r = backend.instance->reset();
+			backend.journal->record_reset();
+			log.debugStream() << "  .. backend " << backend.name << " reset " << r;
+		}
+	}
+	if (!have_backend)
+	{
+		log.warnStream() << "Driver " << driver << " has no backend; output is discarded.";
+	}
+
+	return squeal_driver_pull(m_sql.m_sql, m_prs.drvtab, driver, cursor, limit);
+}
+
+void SteamWorks::PulleyScript::Parser::Private::collaborate()
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	// Each backend is asked to join the transaction of one of the
+	// leaders so far, until one accepts; otherwise it leads its own.
+	m_collaborators.clear();
+	std::vector<PulleyBack::Instance*> leaders;
+	for (auto& backend : m_backends)
+	{
+		PulleyBack::Instance* instance = backend.instance.get();
+		if (!instance || m_collaborators.count(instance) || (std::find(leaders.cbegin(), leaders.cend(), instance) != leaders.cend()))
+		{
+			continue;  // Shared instances are asked once
+		}
+
+		auto leader = std::find_if(leaders.cbegin(), leaders.cend(), [&](PulleyBack::Instance* l) { return l->collaborate(*instance); });
+		if (leader == leaders.cend())
+		{
+			leaders.push_back(instance);
+		}
+		else
+		{
+			log.debugStream() << "  .. backend " << backend.name << " collaborates with " << (*leader)->name();
+			m_collaborators[instance] = *leader;
+		}
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::Private::run_parallel(const std::vector<ThreadPool::task_t>& tasks)
+{
+	static const size_t max_threads = 16;
+
+	if (tasks.size() < 2)
+	{
+		for (const auto& task : tasks)
+		{
+			task();
+		}
+		return;
+	}
+
+	// The calling thread does one of the tasks
+	size_t threads = std::min(tasks.size() - 1, max_threads);
+	if (!m_pool || (m_pool->size() < threads))
+	{
+		m_pool.reset(new ThreadPool(threads));
+	}
+	m_pool->run(tasks);
+}
+
+void SteamWorks::PulleyScript::Parser::Private::replay_pending()
+{
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+
+	// Output of failed transactions goes first in this one; the
+	// journal of a shared instance is replayed once.
+	std::unordered_set<const PulleyBack::Journal*> seen;
+	for (auto& backend : m_backends)
+	{
+		if (backend.instance && backend.journal->has_pending() && seen.insert(backend.journal.get()).second)
+		{
+			log.debugStream() << "  .. backend " << backend.name << " replaying output of failed transactions.";
+			backend.journal->replay(*backend.instance, true);
+		}
+	}
+}
+
+void SteamWorks::PulleyScript::Parser::Private::commit()
+{
+	static const int max_attempts = 6;
+	static const unsigned int first_backoff = 10;  // Milliseconds, doubles for each retry
+
+	auto& log = SteamWorks::Logging::getLogger("steamworks.pulleyscript");
+	log.debugStream() << "Committing transaction.";
+
+	// Retired backends take part in the transaction that retracted
+	// their output, and are closed after it.
+	std::forward_list< SteamWorks::PulleyScript::BackendParameters >* lists[] = { &m_backends, &m_retired_backends };
+
+	// One group per transaction; collaborating backends share the
+	// transaction of their leader. Backends that arrived after
+	// begin(), in a reload, lead their own. A shared instance is
+	// in its group once, with the backend of its first driver.
+	struct Group
+	{
+		PulleyBack::Instance* leader;
+		std::vector<BackendParameters*> backends;  // Leader and members, one per instance
+		int result;
+		bool again;  // Failed with EAGAIN
+		bool committed;
+	} ;
+	std::vector<Group> groups;
+	std::unordered_map<const PulleyBack::Instance*, size_t> group_of;
+	std::unordered_set<const PulleyBack::Instance*> seen;
+	for (auto list : lists)
+	{
+		for (auto& backend : *list)
+		{
+			PulleyBack::Instance* instance = backend.instance.get();
+			if (!instance || !seen.insert(instance).second)
+			{
+				continue;
+			}
+			auto c = m_collaborators.find(instance);
+			PulleyBack::Instance* leader = (c == m_collaborators.end()) ? instance : c->second;
+			auto g = group_of.emplace(leader, groups.size());
+			if (g.second)
+			{
+				groups.push_back(Group{leader, {}, 0, false, false});
+			}
+			groups[g.first->second].backends.push_back(&backend);
+		}
+	}
+	m_collaborators.clear();
+
+	std::vector<ThreadPool::task_t> tasks;
+	tasks.reserve(groups.size());
+	auto run_phase = [&](std::function<void(Group&)> phase)
+	{
+		tasks.clear();
+		for (auto& g : groups)
+		{
+			if (!g.committed)
+			{
+				tasks.push_back([&g, phase]() { phase(g); });
+			}
+		}
+		run_parallel(tasks);
+	};
+	auto all_succeeded = [&]()
+	{
+		for (const auto& g : groups)
+		{
+			log.debugStream() << "  .. backend " << g.leader->name() << " +" << (g.backends.size() - 1) << " result " << g.result;
+		}
+		return std::none_of(groups.cbegin(), groups.cend(), [](const Group& g) { return !g.committed && (g.result == 0); });
+	};
+
+	// The journals are synced before preparing, so that the output
+	// can be delivered again if the backend fails; a journal that
+	// cannot be synced fails its group. A deadlock (EAGAIN) is retried
+	// right away, rolling back and delivering the output of this
+	// transaction again; other failures are left pending in the
+	// journal for the next transaction. Without journal files there
+	// is nothing to deliver again, and failures lose the output.
+	unsigned int backoff = first_backoff;
+	for (int attempt = 1; ; attempt++)
+	{
+		run_phase([](Group& g)
+		{
+			g.result = 1;
+			for (auto b : g.backends)
+			{
+				if (!b->journal->sync())
+				{
+					g.result = 0;
+				}
+				else if ((b->instance.get() != g.leader) && !b->instance->deliver())
+				{
+					g.result = 0;
+				}
+			}
+			g.again = false;
+			if (g.result)
+			{
+				errno = 0;
+				g.result = g.leader->prepare();
+				g.again = (g.result == 0) && (errno == EAGAIN);
+			}
+		});
+
+		if (all_succeeded())
+		{
+			run_phase([](Group& g)
+			{
+				errno = 0;
+				g.result = g.leader->commit();
+				g.again = (g.result == 0) && (errno == EAGAIN);
+				g.committed = (g.result != 0);
+			});
+			if (all_succeeded())
+			{
+				break;
+			}
+		}
+
+		// Failure, clear up everything that has not committed.
+		run_phase([](Group& g)
+		{
+			for (auto b : g.backends)
+			{
+				if (b->instance.get() != g.leader)
+				{
+					b->instance->rollback();
+				}
+			}
+			g.leader->rollback();
+		});
+
+		bool again = std::all_of(groups.cbegin(), groups.cend(), [](const Group& g) { return g.committed || (g.result != 0) || g.again; });
+		bool journaled = std::all_of(groups.cbegin(), groups.cend(), [](const Group& g)
+		{
+			return g.committed || std::all_of(g.backends.cbegin(), g.backends.cend(), [](const BackendParameters* b) { return b->journal->is_open(); });
+		});
+		if (!journaled)
+		{
+			log.errorStream() << "Transaction failed; backends without a journal have lost its output.";
+			break;
+		}
+		if (!again || (attempt == max_attempts))
+		{
+			log.errorStream() << "Transaction failed; the output is kept for the next transaction.";
+			break;
+		}
+
+		log.warnStream() << "Backends deadlocked, retrying in " << backoff << "ms.";
+		std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+		backoff *= 2;
+		for (auto& g : groups)
+		{
+			if (g.committed)
+			{
+				continue;
+			}
+			for (auto b : g.backends)
+			{
+				b->journal->replay(*b->instance, false);
+			}
+		}
+	}
+
+	for (const auto& g : groups)
+	{
+		for (auto b : g.backends)
+		{
+			if (g.committed)
+			{
+				b->journal->committed();
+			}
+			else
+			{
+				b->journal->failed();
+			}
+		}
 	}
+
+	m_retired_backends.clear();
 }
 
 
 SteamWorks::PulleyScript::BackendParameters::BackendParameters(std::string n, const std::vector<std::string>& expressions) :
 	name(n),
+	arena(new DERArena),
+	journal(new PulleyBack::Journal),
+	route(0),
+	types_fixed(false),
 	varc(0),
 	argc(expressions.size()),
 	argv(nullptr)
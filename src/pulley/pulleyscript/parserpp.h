@@ -19,15 +19,22 @@ Adriaan de Groot <groot@kde.org>
 
 #include <forward_list>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <picojson.h>
 
 namespace SteamWorks
 {
 
+namespace PulleyBack { class Journal; }
+
 namespace PulleyScript
 {
 class BackendTransaction;
+class DERArena;
+class ForkRouter;
 
 /**
  * Parameters to pass to a backend instance. This is basically a
@@ -38,7 +45,13 @@ struct BackendParameters
 {
 	std::string name; // Only used for logging
 	drvnum_t driver;  // Parameters for which driver
-	std::unique_ptr<PulleyBack::Instance> instance;
+	std::shared_ptr<PulleyBack::Instance> instance;  // Shared by identical drivers
+	std::unique_ptr<DERArena> arena;  // DER encoding of output for instance
+	std::shared_ptr<PulleyBack::Journal> journal;  // Output since the last commit, per instance
+	std::shared_ptr<ForkRouter> router;  // Set when the instance is shared
+	unsigned int route;  // Routing tag of this driver in router
+	std::vector<uint8_t> tags;  // DER tag per output variable; empty for octet strings
+	bool types_fixed;  // Tags were set from syntaxes, or output has gone out
 	int varc;
 	int argc;
 	char** argv;
@@ -95,6 +108,11 @@ public:
 	 * Reads (parses & analyzes) a given @p filename.
 	 * Adds the result to the parser state. Returns
 	 * 0 on success, non-zero on error.
+	 *
+	 * The file may also be a precompiled image, as written by
+	 * the compiler's -o option. An image must be the only thing
+	 * read; it brings the parser to state Analyzed and makes
+	 * structural_analysis() and SQL generation cheap no-ops.
 	 */
 	int read_file(const char *filename);
 	/**
@@ -133,12 +151,75 @@ public:
 	 */
 	void find_backends();
 
+	/**
+	 * Hot reload: take over the running middle-end and backends
+	 * from @p old, which is Ready, for the script that this parser
+	 * has analyzed. Call find_subscriptions() first; this replaces
+	 * setup_sql() and find_backends().
+	 *
+	 * Generators and drivers are compared by their lexhash. The
+	 * gen_<hash> tables of unchanged generators and the backend
+	 * instances of unchanged drivers are kept. The output of removed
+	 * and changed drivers is retracted, and the tables of removed
+	 * generators are dropped. This parser becomes Ready and @p old
+	 * is left Broken. Returns 0 on success. The SQL for this script
+	 * is set up before anything changes for @p old, so on failure
+	 * @p old is still Ready and keeps running as it was.
+	 *
+	 * Tables of new generators start empty: pass every entry that
+	 * is already known to refill_entry() and then call redrive() to
+	 * deliver the output of new and changed drivers. Call begin()
+	 * right after this and do all of that inside its transaction,
+	 * which then includes the retracted output and the backends
+	 * that were taken over, so that they see the reload as a single
+	 * change.
+	 */
+	int take_over(Parser& old);
+	void refill_entry(const std::string& uuid, const picojson::object& data);
+	void redrive();
+
 	/**
 	 * Remove a UUID from the middle-end.
 	 */
 	void remove_entry(const std::string& uuid);
 	void add_entry(const std::string& uuid, const picojson::object& data);
 
+	/**
+	 * Pull mode: regenerate the complete output of one @p driver
+	 * from the middle-end, e.g. to rebuild a backend that has lost
+	 * its data, without replaying the DIT through every driver.
+	 * The output is delivered as additions, in batches of at most
+	 * @p limit tuples (0 delivers everything at once); each call is
+	 * one transaction. Start with @p cursor 0, which also resets the
+	 * backend, and pass the previous cursor plus the number of tuples
+	 * delivered to get the next batch.
+	 *
+	 * Returns the number of tuples delivered, which is less than
+	 * @p limit once the output is complete, or -1 on error.
+	 */
+	long pull(drvnum_t driver, unsigned long cursor, unsigned long limit);
+
+	/**
+	 * Returns true if any backend delivers asynchronously and its
+	 * queue is filling up (see PulleyBack::Loader::set_queue_depth()).
+	 * Feeding more entries then blocks until the backend catches up,
+	 * so callers should hold back on fetching new changes.
+	 */
+	bool congested() const;
+
+	/**
+	 * Tell the parser the LDAP syntax of attributes, as a map of
+	 * (lower case) attribute names to syntax OIDs such as the one
+	 * from LDAP::TypeInfo::syntaxes(). Backends that take typed
+	 * values (see pulleyback_types()) then get BOOLEAN, INTEGER,
+	 * UTF8String, GeneralizedTime etc. rather than octet strings
+	 * for variables bound to attributes of a matching syntax.
+	 * The types of a backend are set once, before its first
+	 * output; later syntaxes (e.g. from a reconnect) that would
+	 * change them are ignored. Call this outside of transactions.
+	 */
+	void set_attribute_syntaxes(const std::unordered_map<std::string, std::string>& syntaxes);
+
 	/**
 	 * Transaction support. This is not mandatory -- if you do
 	 * not call these functions, remove_entry() and add_entry()
@@ -164,6 +245,15 @@ public:
 	 * (TODO: return error state somehow -- e.g. exception).
 	 */
 	std::shared_ptr<BackendTransaction> begin();
+
+	/**
+	 * Keep the journals of the backends (see PulleyBack::Journal)
+	 * in files in @p dir, so that output that a backend failed to
+	 * take survives a restart. Without a directory, nothing is
+	 * journaled, and output that a backend fails to take is lost.
+	 * Set this before find_backends().
+	 */
+	static void set_journal_dir(const std::string& dir);
 } ;
 
 class BackendTransaction
@@ -33,6 +33,7 @@
 #include "condition.h"
 #include "driver.h"
 #include "squeal.h"
+#include "image.h"
 
 #include <unistd.h>
 #include <sys/stat.h>
@@ -101,6 +102,14 @@ typedef fnv1a_t s3key_t;
  * The callback function requires one additional flag, namely add_not_del which
  * is set to PULLEY_TUPLE_ADD or PULLEY_TUPLE_DEL to indicate how the
  * output variables are to be processed.
+ *
+ * For pull mode, drv_pull is a statement (prepared on first use) that produces
+ * the driver's complete output from the stored gen_xxx tables, ordered by the
+ * output variables.  It is stepped in batches; between batches it stays open
+ * as long as pull_running is set, and pull_cursor tells how many output tuples
+ * have been delivered so far.  When a running pull is interrupted, the last
+ * tuple it delivered is kept in pull_after, and the pull resumes after that
+ * tuple rather than at an OFFSET into output that may have changed since.
  */
 struct s3ins_driver {
 	s3key_t drvall_prehash;		// Already hashed driver's lexhash
@@ -108,6 +117,12 @@ struct s3ins_driver {
 	void *cbdata;			// First arg to cbfun
 	int cbnumparm;			// Number of callback blob variables
 	struct squeal_blob *cbparm;	// Array for callback blob variables
+	sqlite3_stmt *drv_pull;		// Supply ?001 to ?003+, or continue stepping
+	bool pull_running;		// drv_pull is halfway its output
+	bool pull_row;			// drv_pull is at a delivered tuple
+	unsigned long pull_cursor;	// Output tuples delivered by drv_pull
+	sqlite3_value **pull_after;	// Last tuple delivered before interrupt
+	unsigned long pull_after_cursor;	// Cursor just after pull_after
 };
 
 /* When a generator forks a tuple, this should be forward to the apropriate
@@ -157,6 +172,15 @@ struct s3ins_generator {
 	struct s3ins_gen2drv* driveout;   // Driver instructions for this generator
 };
 
+/* Write buffer state; consisting of a pointer, a current writing offset annex length,
+ * and a buffer allocated size.
+ */
+struct sqlbuf {
+	char *buf;
+	size_t ofs;
+	size_t siz;
+};
+
 /* The "squeal" structure holds the overall information for a SQLite3 engine instance.
  * It is defined as an opaque type for use by other modules in squeal.h.
  *
@@ -164,6 +188,9 @@ struct s3ins_generator {
  * to be taken from the s3ins_driver structure.  This hash has already walked
  * through the lexhash and is ready for further application of the blobs that
  * define the rule.
+ *
+ * The ddl buffer records the statements run by squeal_have_tables(), as a
+ * script that can be stored in an image and run again with sqlite3_exec().
  */
 struct squeal {
 	sqlite3 *s3db;			// link to SQLite3 engine
@@ -173,20 +200,13 @@ struct squeal {
 	sqlite3_stmt *get_drv_all;	// ?hash
 	sqlite3_stmt *inc_drv_all;	// ?hash
 	sqlite3_stmt *dec_drv_all;	// ?hash
+	sqlite3_stmt *del_drv_all;	// ?hash
+	struct sqlbuf ddl;		// Table definitions, ";\n" separated
 	int numgens;			// Number of gens[] tuples
 	struct s3ins_generator gens [1];// Array of generator descriptions
 };
 
 
-/* Write buffer state; consisting of a pointer, a current writing offset annex length,
- * and a buffer allocated size.
- */
-struct sqlbuf {
-	char *buf;
-	size_t ofs;
-	size_t siz;
-};
-
 #define BUF_GET 1
 #define BUF_PUT 0
 
@@ -278,6 +298,17 @@ static int sqlbuf_run (struct sqlbuf *sql, sqlite3 *s3db) {
 }
 
 
+/* Run a table definition from the given sqlbuf string, and record it in the
+ * ddl script of the squeal engine.  Reset the buffer when done.
+ * Return 0 on success, 1 on failure.
+ */
+static int sqlbuf_run_ddl (struct sqlbuf *sql, struct squeal *squeal) {
+	sqlbuf_writeblob (&squeal->ddl, sql->buf, sql->ofs);
+	sqlbuf_write (&squeal->ddl, ";\n");
+	return sqlbuf_run (sql, squeal->s3db);
+}
+
+
 /* Derive a table name based on a prefix and a "lexhash" over a construct and
  * send it out through sqlbuf_write().
  * (The hash is not processed portably, as it uses local byte order.)
@@ -427,9 +458,10 @@ static int s3ins_run_uuid(sqlite3 *s3db, sqlite3_stmt *s3in, const char *uuid,
 /* Consider passing a series of blobs to a driver as output, either add or delete.
  * Avoid this when multiplicity forbids; that is, already added or not ready for
  * deletion yet, due to other existing instances.  Only when there are no other
- * instances, do we actually perform the callback.
+ * instances, do we actually perform the callback.  Return whether the output
+ * was passed to the driver.
  */
-static void squeal_driver_callback_demult (struct squeal *squeal,
+static bool squeal_driver_callback_demult (struct squeal *squeal,
 			struct s3ins_driver *drvback, int add_not_del) {
 	int s3rv = SQLITE_OK;
 	bool drive = false;
@@ -475,6 +507,7 @@ static void squeal_driver_callback_demult (struct squeal *squeal,
 		drvback->cbfun (drvback->cbdata, add_not_del,
 				drvback->cbnumparm, drvback->cbparm);
 	}
+	return drive;
 }
 
 
@@ -508,6 +541,54 @@ static void squeal_produce_output (struct squeal *squeal, int add_not_del,
 }
 
 
+/* Forget the tuple that an interrupted pull would resume after.
+ */
+static void squeal_pull_forget (struct s3ins_driver *drv) {
+	int i;
+	if (drv->pull_after != NULL) {
+		for (i=0; i < drv->cbnumparm; i++) {
+			sqlite3_value_free (drv->pull_after [i]);
+		}
+		free (drv->pull_after);
+		drv->pull_after = NULL;
+	}
+}
+
+/* Stop any pull-mode statements that are halfway their output.  A running
+ * SELECT keeps SQLite3 from committing the changes made by other statements
+ * on the same connection, and it would not see those changes consistently
+ * anyway.  So before a generator forks, every running pull is reset; the
+ * next batch of that pull restarts after the last tuple it delivered, which
+ * is copied before the reset.  Tuples that the fork adds before that point
+ * are not pulled; they are delivered by the fork itself.
+ */
+static void squeal_pull_interrupt (struct squeal *squeal) {
+	struct s3ins_driver *drv;
+	int d;
+	int i;
+	for (d=0; d < squeal->numdrivers; d++) {
+		drv = &squeal->drivers [d];
+		if (!drv->pull_running) {
+			continue;
+		}
+		squeal_pull_forget (drv);
+		if (drv->pull_row) {
+			drv->pull_after = calloc (drv->cbnumparm, sizeof (sqlite3_value *));
+			for (i=0; (drv->pull_after != NULL) && (i < drv->cbnumparm); i++) {
+				drv->pull_after [i] = sqlite3_value_dup (sqlite3_column_value (drv->drv_pull, i));
+				if (drv->pull_after [i] == NULL) {
+					squeal_pull_forget (drv);
+				}
+			}
+			drv->pull_after_cursor = drv->pull_cursor;
+		}
+		sqlite3_reset (drv->drv_pull);
+		drv->pull_running = false;
+		drv->pull_row = false;
+	}
+}
+
+
 /* Process a new tuple fork in a generator.  This either reflects add or delete of
  * a tuple.  The generator will iterate over all the drivers that are interested,
  * and run the respective output generator on each.  In addition, if the generator
@@ -521,6 +602,7 @@ static void _squeal_generator_fork (struct squeal *squeal,
 	int d;
 	int i;
 	assert (genfront->numrecvars == numrecvars);
+	squeal_pull_interrupt (squeal);
 
 	DEBUG("Generator fork @%p add?%d\n", (void *)genfront, add_not_del);
 	DEBUG("  .. adding %d variables.", numrecvars);
@@ -565,6 +647,8 @@ static void _squeal_fork(struct squeal *squeal, gennum_t gennum, const char *ent
 	unsigned int driveridx, columnidx;
 	struct s3ins_generator* genfront = &(squeal->gens[gennum]);
 
+	squeal_pull_interrupt (squeal);
+
 	if (add_not_del)
 	{
 		assert (genfront->numrecvars == numrecvars);
@@ -625,6 +709,183 @@ void squeal_delete_forks(struct squeal *squeal, gennum_t gennum, const char *ent
 	_squeal_fork(squeal, gennum, entryUUID, PULLEY_TUPLE_DEL, 0, NULL);
 }
 
+void squeal_store_fork(struct squeal *squeal, gennum_t gennum, const char *entryUUID, int numrecvars, struct squeal_blob *recvars)
+{
+	int sqlret;
+	struct s3ins_generator* genfront = &(squeal->gens[gennum]);
+
+	assert (genfront->numrecvars == numrecvars);
+	squeal_pull_interrupt (squeal);
+
+	sqlret = s3ins_run_uuid(squeal->s3db, genfront->opt_gen_add_tuple, entryUUID, numrecvars, recvars);
+	if ((sqlret != SQLITE_OK) && (sqlret != SQLITE_DONE))
+	{
+		ERROR("Can't store fork SQL err %d %s\n", sqlret, sqlite3_errmsg(squeal->s3db));
+	}
+}
+
+long squeal_driver_pull (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum,
+			unsigned long cursor, unsigned long limit) {
+	struct s3ins_driver *drv;
+	sqlite3_stmt *s3in;
+	unsigned long produced = 0;
+	int s3rv = SQLITE_OK;
+	sqlite3_int64 offset;
+	int i;
+
+	if (drvnum >= squeal->numdrivers) {
+		ERROR("No driver %u to pull from\n", drvnum);
+		return -1;
+	}
+	drv = &squeal->drivers [drvnum];
+	//
+	// Prepare the pull statement on first use
+	if (drv->drv_pull == NULL) {
+		drv->drv_pull = squeal_produce_pull (squeal, drvtab, drvnum);
+		if (drv->drv_pull == NULL) {
+			return -1;
+		}
+		drv->pull_running = false;
+	}
+	s3in = drv->drv_pull;
+	//
+	// Continue where the previous batch stopped, resume after the tuple
+	// where it was interrupted, or (re)start at an offset of the cursor
+	if (!drv->pull_running || (drv->pull_cursor != cursor)) {
+		sqlite3_reset (s3in);
+		sqlite3_clear_bindings (s3in);
+		if ((drv->pull_after != NULL) && (drv->pull_after_cursor == cursor)) {
+			DEBUG("Pull driver %u resumes after tuple %lu\n", drvnum, cursor);
+			sqlite3_bind_int (s3in, 1, 1);
+			for (i=0; i < drv->cbnumparm; i++) {
+				sqlite3_bind_value (s3in, 3 + i, drv->pull_after [i]);
+			}
+			offset = 0;
+		} else {
+			DEBUG("Pull driver %u restarts at offset %lu\n", drvnum, cursor);
+			sqlite3_bind_int (s3in, 1, 0);
+			offset = (sqlite3_int64) cursor;
+		}
+		sqlite3_bind_int64 (s3in, 2, offset);
+		squeal_pull_forget (drv);
+		drv->pull_cursor = cursor;
+		drv->pull_running = true;
+		drv->pull_row = false;
+	}
+	//
+	// Deliver output tuples straight to the driver, without passing drv_all;
+	// pulling does not change the number of repeats of any output tuple
+	while ((limit == 0) || (produced < limit)) {
+		s3rv = sqlite3_step (s3in);
+		if (s3rv != SQLITE_ROW) {
+			break;
+		}
+		assert (sqlite3_column_count (s3in) == drv->cbnumparm);
+		for (i=0; i < drv->cbnumparm; i++) {
+			drv->cbparm [i].data = (void *) sqlite3_column_blob  (s3in, i);
+			drv->cbparm [i].size = (size_t) sqlite3_column_bytes (s3in, i);
+		}
+		if (drv->cbfun) {
+			drv->cbfun (drv->cbdata, PULLEY_TUPLE_ADD,
+					drv->cbnumparm, drv->cbparm);
+		}
+		drv->pull_row = true;
+		produced++;
+	}
+	drv->pull_cursor += produced;
+	//
+	// Release the statement when all output was delivered, or upon error
+	if ((s3rv != SQLITE_ROW) && (s3rv != SQLITE_OK)) {
+		sqlite3_reset (s3in);
+		drv->pull_running = false;
+		drv->pull_row = false;
+		if (s3rv != SQLITE_DONE) {
+			ERROR("SQLite3 ERROR %d while pulling driver %u: %s\n", s3rv, drvnum, sqlite3_errmsg (squeal->s3db));
+			return -1;
+		}
+	}
+	DEBUG("Pull driver %u delivered %lu tuples, cursor now %lu\n", drvnum, produced, drv->pull_cursor);
+	return (long) produced;
+}
+
+static sqlite3_stmt *squeal_produce_join (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum, bool distinct);
+
+/* Sweep over the complete output of a driver, with one row for each way in
+ * which its generators produce an output tuple; this is what drv_all counts
+ * during normal operation.  When adding, each row passes through drv_all as
+ * if a generator forked it.  When removing, the first row of an output tuple
+ * drops it from drv_all altogether and makes the callback; its repeats find
+ * nothing left to remove.  Return the number of callbacks, or -1 on error.
+ */
+static long squeal_driver_sweep (struct squeal *squeal, struct drvtab *drvtab,
+			drvnum_t drvnum, int add_not_del) {
+	struct s3ins_driver *drv;
+	sqlite3_stmt *s3in;
+	s3key_t hash;
+	long delivered = 0;
+	int repeats;
+	int s3rv;
+	int i;
+
+	if (drvnum >= squeal->numdrivers) {
+		ERROR("No driver %u to sweep\n", drvnum);
+		return -1;
+	}
+	drv = &squeal->drivers [drvnum];
+	squeal_pull_interrupt (squeal);
+	s3in = squeal_produce_join (squeal, drvtab, drvnum, false);
+	if (s3in == NULL) {
+		return -1;
+	}
+	sqlite3_bind_int64 (s3in, 2, 0);
+	while ((s3rv = sqlite3_step (s3in)) == SQLITE_ROW) {
+		assert (sqlite3_column_count (s3in) == drv->cbnumparm);
+		for (i=0; i < drv->cbnumparm; i++) {
+			drv->cbparm [i].data = (void *) sqlite3_column_blob  (s3in, i);
+			drv->cbparm [i].size = (size_t) sqlite3_column_bytes (s3in, i);
+		}
+		if (add_not_del == PULLEY_TUPLE_ADD) {
+			if (squeal_driver_callback_demult (squeal, drv, PULLEY_TUPLE_ADD)) {
+				delivered++;
+			}
+			continue;
+		}
+		hash = drv->drvall_prehash;
+		for (i=0; i < drv->cbnumparm; i++) {
+			s3key_add_blob (&hash, &drv->cbparm [i]);
+		}
+		repeats = 0;
+		if (s3ins_run (squeal->s3db, squeal->get_drv_all,
+				hash, drv->cbnumparm, drv->cbparm) == SQLITE_ROW) {
+			repeats = sqlite3_column_int (squeal->get_drv_all, 0);
+		}
+		if (repeats <= 0) {
+			continue;
+		}
+		s3ins_run (squeal->s3db, squeal->del_drv_all, hash, 0, NULL);
+		if (drv->cbfun) {
+			drv->cbfun (drv->cbdata, PULLEY_TUPLE_DEL,
+					drv->cbnumparm, drv->cbparm);
+		}
+		delivered++;
+	}
+	if (s3rv != SQLITE_DONE) {
+		ERROR("SQLite3 ERROR %d while sweeping driver %u: %s\n", s3rv, drvnum, sqlite3_errmsg (squeal->s3db));
+		delivered = -1;
+	}
+	sqlite3_finalize (s3in);
+	DEBUG("Sweep driver %u add?%d made %ld callbacks\n", drvnum, add_not_del, delivered);
+	return delivered;
+}
+
+long squeal_driver_retract (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum) {
+	return squeal_driver_sweep (squeal, drvtab, drvnum, PULLEY_TUPLE_DEL);
+}
+
+long squeal_driver_redrive (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum) {
+	return squeal_driver_sweep (squeal, drvtab, drvnum, PULLEY_TUPLE_ADD);
+}
+
 
 /********** BACKEND STRUCTURE CREATION **********/
 
@@ -903,6 +1164,151 @@ cleanup:
 	return retval;
 }
 
+/* Construct an SQL query that produces the complete output for driver d, not
+ * triggered by any generator.  All the generators of the driver are joined
+ * from their stored gen_xxx tables, so every variable is a column and there
+ * are no ?003 parameters.  When distinct is set, output that drv_all counts
+ * as repeats is folded with DISTINCT, and the output is ordered by its
+ * variables, so that a pull can be resumed after a given tuple: with ?001
+ * set, only output after the tuple in parameters ?003 and up is produced.
+ * The query is paged with an offset in ?002.  Return the prepared statement.
+ */
+static sqlite3_stmt *squeal_produce_join (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum, bool distinct) {
+	sqlite3_stmt *retval = NULL;
+	struct sqlbuf sql;
+	char *comma;
+	varnum_t *outarray;
+	varnum_t  outcount;
+	bitset_t *gens;
+	bitset_t *itbits;
+	bitset_iter_t it;
+	struct vartab *vartab;
+	struct cndtab *cndtab;
+	struct gentab *gentab;
+	int *exp;
+	size_t explen;
+	bitset_t *params;
+	int i;
+	//
+	// Grab a write buffer
+	sqlbuf_exchg (&sql, BUF_GET);
+	//
+	// Construct additional types
+	vartab = vartab_from_type (drvtab_share_vartype (drvtab));
+	cndtab = cndtab_from_type (drvtab_share_cndtype (drvtab));
+	gentab = gentab_from_type (drvtab_share_gentype (drvtab));
+	gens = drv_share_generators (drvtab, drvnum);
+	if (bitset_isempty (gens)) {
+		ERROR("Driver %u has no generators to pull from\n", drvnum);
+		goto cleanup;
+	}
+	//
+	// All variables of all the driver's generators are columns in the join
+	params = bitset_new (drvtab_share_vartype (drvtab));
+	bitset_iterator_init (&it, gens);
+	while (bitset_iterator_next_one (&it, NULL)) {
+		bitset_union (params, gen_share_variables (gentab, bitset_iterator_bitnum (&it)));
+	}
+
+	//
+	// First, construct "SELECT [DISTINCT] v0,v1,v2" -- the driver's output
+	drv_share_output_variable_table (drvtab, drvnum, &outarray, &outcount);
+	assert (outcount > 0);
+	//
+	// The output parameters are usually allocated by squeal_produce_outputs()
+	if (squeal->drivers[drvnum].cbparm == NULL) {
+		squeal->drivers[drvnum].cbparm = calloc(outcount, sizeof(struct squeal_blob));
+		squeal->drivers[drvnum].cbnumparm = outcount;
+		squeal->drivers[drvnum].drvall_prehash = drv_get_hash(drvtab, drvnum);
+	}
+	comma = distinct? "SELECT DISTINCT ": "SELECT ";
+	for (i=0; i<outcount; i++) {
+		sqlbuf_write (&sql, comma);
+		sqlbuf_write (&sql, "var_");
+		sqlbuf_write (&sql, var_get_name (vartab, outarray [i]));
+		comma = ",";
+	}
+
+	//
+	// Second, construct "FROM g0 NATURAL JOIN g1" -- as in squeal_produce_outputs()
+	comma = "\nFROM   ";
+	bitset_iterator_init (&it, gens);
+	while (bitset_iterator_next_one (&it, NULL)) {
+		sqlbuf_write (&sql, comma);
+		sqlbuf_lexhash2name (&sql, "gen_", gen_get_hash (gentab, bitset_iterator_bitnum (&it)));
+		comma = " NATURAL JOIN\n       ";
+	}
+
+	//
+	// Third, apply all the conditions of the driver
+	itbits = drv_share_conditions (drvtab, drvnum); /* 0 conditions is acceptable */
+	comma = "\nWHERE  ";
+	bitset_iterator_init (&it, itbits);
+	while (bitset_iterator_next_one (&it, NULL)) {
+		sqlbuf_write (&sql, comma);
+		cnd_share_expression (cndtab, bitset_iterator_bitnum (&it), &exp, &explen);
+		squeal_produce_expression (&sql, vartab, params, exp, explen);
+		comma = "\nAND    ";
+	}
+	bitset_destroy (params);
+
+	//
+	// For pulls, "AND (?001=0 OR v0>?003 OR (v0=?003 AND v1>?004))"
+	// to continue after a given tuple, in the order of "ORDER BY v0,v1"
+	if (distinct) {
+		int j;
+		char param [10];
+		sqlbuf_write (&sql, comma);
+		sqlbuf_write (&sql, "(?001 = 0");
+		for (i=0; i<outcount; i++) {
+			sqlbuf_write (&sql, "\n        OR (");
+			for (j=0; j<=i; j++) {
+				snprintf (param, sizeof (param), "?%03d", 3 + j);
+				sqlbuf_write (&sql, (j > 0)? " AND var_": "var_");
+				sqlbuf_write (&sql, var_get_name (vartab, outarray [j]));
+				sqlbuf_write (&sql, (j < i)? "=": ">");
+				sqlbuf_write (&sql, param);
+			}
+			sqlbuf_write (&sql, ")");
+		}
+		sqlbuf_write (&sql, ")");
+		comma = "\nORDER BY ";
+		for (i=0; i<outcount; i++) {
+			sqlbuf_write (&sql, comma);
+			sqlbuf_write (&sql, "var_");
+			sqlbuf_write (&sql, var_get_name (vartab, outarray [i]));
+			comma = ",";
+		}
+	}
+
+	//
+	// Finally, page through the output; SQLite3 requires LIMIT with OFFSET
+	sqlbuf_write (&sql, "\nLIMIT  -1 OFFSET ?002");
+
+	//
+	// Based on the generated SQL string, prepare a statement
+	if (sqlite3_prepare (squeal->s3db, sql.buf, sql.ofs, &retval, NULL) != SQLITE_OK) {
+		ERROR("Failed to construct pull rule for SQLite3 engine: %s\n%.*s",
+						sqlite3_errmsg (squeal->s3db),
+						(int) sql.ofs, sql.buf);
+		retval = NULL;
+		goto cleanup;
+	}
+	DEBUG("prep sql>\n%.*s\n\n", (int) sql.ofs, sql.buf);
+
+cleanup:
+	//
+	// Release the SQL buffer
+	sqlbuf_exchg (&sql, BUF_PUT);
+	//
+	// Return the prepared statement
+	return retval;
+}
+
+sqlite3_stmt *squeal_produce_pull (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum) {
+	return squeal_produce_join (squeal, drvtab, drvnum, true);
+}
+
 
 /* Create type descriptions in the present database.  Indicate whether pre-existing
  * tables may be reused.  If not, they will be dropped if they already exist.
@@ -926,20 +1332,23 @@ int squeal_have_tables (struct squeal *squeal, struct gentab *gentab, bool may_r
 	// Retrieve additional types
 	vartab = vartab_from_type (gentab_share_variable_type (gentab));
 	//
+	// Start a fresh ddl script
+	squeal->ddl.ofs = 0;
+	//
 	// Create the drv_all table -- do not create entries due to no (new) output
 	if (!may_reuse) {
 		sqlbuf_write (&sql, "DROP TABLE IF EXISTS drv_all");
-		retval = retval || sqlbuf_run (&sql, squeal->s3db);
+		retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	}
 	sqlbuf_write (&sql, "CREATE TABLE IF NOT EXISTS drv_all (\n"
 				"\tout_hash   INTEGER PRIMARY KEY NOT NULL,\n"
 				"\tout_repeat INTEGER NOT NULL)");
-	retval = retval || sqlbuf_run (&sql, squeal->s3db);
+	retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	//
 	// Create the trigger that removes zero values for out_repeat from drv_all
 	if (!may_reuse) {
 		sqlbuf_write (&sql, "DROP TRIGGER IF EXISTS drv_all_dropzero");
-		retval = retval || sqlbuf_run (&sql, squeal->s3db);
+		retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	}
 	sqlbuf_write (&sql, "CREATE TRIGGER IF NOT EXISTS drv_all_dropzero\n"
 				"AFTER UPDATE ON drv_all\n"
@@ -947,17 +1356,17 @@ int squeal_have_tables (struct squeal *squeal, struct gentab *gentab, bool may_r
 				"BEGIN DELETE FROM drv_all\n"
 				"      WHERE out_repeat = 0;\n"
 				"END");
-	retval = retval || sqlbuf_run (&sql, squeal->s3db);
+	retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	//
 	// Create a table holding the cookie for LDAP SyncRepl
 	if (!may_reuse) {
 		sqlbuf_write (&sql, "DROP TABLE IF EXISTS syncrepl_cookie");
-		retval = retval || sqlbuf_run (&sql, squeal->s3db);
+		retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	}
 	sqlbuf_write (&sql, "CREATE TABLE IF NOT EXISTS syncrepl_cookie (\n"
 				"\ttimestamp INTEGER PRIMARY KEY NOT NULL,\n"
 				"\tcookie BLOB)");
-	retval = retval || sqlbuf_run (&sql, squeal->s3db);
+	retval = retval || sqlbuf_run_ddl (&sql, squeal);
 	//
 	// Create a table for each generator that is/has a co-generator
 	numgens = gentab_count (gentab);
@@ -980,7 +1389,7 @@ int squeal_have_tables (struct squeal *squeal, struct gentab *gentab, bool may_r
 		if (!may_reuse) {
 			sqlbuf_write (&sql, "DROP TABLE IF EXISTS ");
 			sqlbuf_lexhash2name (&sql, "gen_", gen_get_hash (gentab, g));
-			retval = retval || sqlbuf_run (&sql, squeal->s3db);
+			retval = retval || sqlbuf_run_ddl (&sql, squeal);
 		}
 		sqlbuf_write (&sql, "CREATE TABLE IF NOT EXISTS ");
 		sqlbuf_lexhash2name (&sql, "gen_", gen_get_hash (gentab, g));
@@ -998,12 +1407,12 @@ int squeal_have_tables (struct squeal *squeal, struct gentab *gentab, bool may_r
 			varcount++;
 		}
 		sqlbuf_write (&sql, ")");
-		retval = retval || sqlbuf_run (&sql, squeal->s3db);
+		retval = retval || sqlbuf_run_ddl (&sql, squeal);
 		sqlbuf_write (&sql, "CREATE INDEX IF NOT EXISTS ");
 		sqlbuf_lexhash2name (&sql, "idx_", gen_get_hash (gentab, g));
 		sqlbuf_lexhash2name (&sql, "\n\tON gen_", gen_get_hash (gentab, g));
 		sqlbuf_write (&sql, " (entryUUID)");
-		retval = retval || sqlbuf_run (&sql, squeal->s3db);
+		retval = retval || sqlbuf_run_ddl (&sql, squeal);
 
 		squeal->gens[g].numrecvars = varcount;
 	}
@@ -1015,6 +1424,20 @@ int squeal_have_tables (struct squeal *squeal, struct gentab *gentab, bool may_r
 	return retval;
 }
 
+/* Drop the gen_xxx table of a generator that is no longer part of the script.
+ * Return 0 on success, 1 on failure.
+ */
+int squeal_drop_generator (struct squeal *squeal, hash_t genhash) {
+	struct sqlbuf sql;
+	int retval;
+	sqlbuf_exchg (&sql, BUF_GET);
+	sqlbuf_write (&sql, "DROP TABLE IF EXISTS ");
+	sqlbuf_lexhash2name (&sql, "gen_", genhash);
+	retval = sqlbuf_run (&sql, squeal->s3db);
+	sqlbuf_exchg (&sql, BUF_PUT);
+	return retval;
+}
+
 
 int squeal_configure_generators(struct squeal* squeal, struct gentab* gentab, struct drvtab* drvtab)
 {
@@ -1091,6 +1514,123 @@ int squeal_configure_driver(struct squeal* squeal, drvnum_t drv, squeal_driverfu
 	return 0;
 }
 
+/* Prepare a statement whose SQL text is the next string in an image.  A NULL
+ * string leaves the statement NULL.  Return 0 on success, 1 on failure.
+ */
+static int squeal_prepare_image (struct squeal *squeal, struct image_reader *img, sqlite3_stmt **stmt) {
+	const char *sql;
+	int sqlretval;
+	*stmt = NULL;
+	sql = image_get_string (img);
+	if (sql == NULL) {
+		return image_reader_ok (img)? 0: 1;
+	}
+	if ((sqlretval = sqlite3_prepare (squeal->s3db, sql, -1, stmt, NULL)) != SQLITE_OK) {
+		ERROR("PREP ERROR in image SQL %d: %s\n%s\n", sqlretval, sqlite3_errmsg (squeal->s3db), sql);
+		*stmt = NULL;
+		return 1;
+	}
+	DEBUG("prep sql>\n%s\n\n", sql);
+	return 0;
+}
+
+void squeal_write_image (struct squeal *squeal, struct image_writer *img) {
+	struct s3ins_generator *gen;
+	sqlite3_stmt *produce;
+	int gennum, drvnum, i;
+	image_put_text (img, squeal->ddl.buf? squeal->ddl.buf: "", squeal->ddl.ofs);
+	image_put_uint32 (img, squeal->numgens);
+	for (gennum=0; gennum < squeal->numgens; gennum++) {
+		gen = &squeal->gens [gennum];
+		image_put_uint32 (img, gen->numrecvars);
+		image_put_string (img, gen->opt_gen_add_tuple? sqlite3_sql (gen->opt_gen_add_tuple): NULL);
+		image_put_string (img, gen->opt_gen_del_tuple? sqlite3_sql (gen->opt_gen_del_tuple): NULL);
+		image_put_uint32 (img, gen->numdriveout);
+		for (i=0; i < gen->numdriveout; i++) {
+			produce = gen->driveout [i].gen2drv_produce;
+			image_put_uint32 (img, gen->driveout [i].driver - squeal->drivers);
+			image_put_string (img, produce? sqlite3_sql (produce): NULL);
+		}
+	}
+	image_put_uint32 (img, squeal->numdrivers);
+	for (drvnum=0; drvnum < squeal->numdrivers; drvnum++) {
+		image_put_uint32 (img, squeal->drivers [drvnum].cbnumparm);
+		image_put_uint64 (img, squeal->drivers [drvnum].drvall_prehash);
+	}
+}
+
+int squeal_read_image (struct squeal *squeal, struct image_reader *img) {
+	struct s3ins_generator *gen;
+	struct s3ins_driver *drv;
+	const char *ddl;
+	char *errmsg = NULL;
+	int gennum, drvnum, i;
+	//
+	// Run the table definitions, and keep them for squeal_write_image()
+	ddl = image_get_string (img);
+	if (ddl == NULL) {
+		ERROR("Image holds no table definitions\n");
+		return 1;
+	}
+	DEBUG("exec sql>\n%s\n", ddl);
+	if (sqlite3_exec (squeal->s3db, ddl, NULL, NULL, &errmsg) != SQLITE_OK) {
+		ERROR("RUNTIME ERROR in image SQL: %s\n", errmsg? errmsg: "");
+		sqlite3_free (errmsg);
+		return 1;
+	}
+	squeal->ddl.ofs = 0;
+	sqlbuf_write (&squeal->ddl, ddl);
+	//
+	// Prepare the statements for the generators and their drivers
+	if (image_get_uint32 (img) != squeal->numgens) {
+		ERROR("Image does not match the number of generators\n");
+		return 1;
+	}
+	for (gennum=0; gennum < squeal->numgens; gennum++) {
+		gen = &squeal->gens [gennum];
+		gen->numrecvars = image_get_uint32 (img);
+		if (squeal_prepare_image (squeal, img, &gen->opt_gen_add_tuple)
+				|| squeal_prepare_image (squeal, img, &gen->opt_gen_del_tuple)) {
+			return 1;
+		}
+		gen->numdriveout = image_get_uint32 (img);
+		if (!image_reader_ok (img) || (gen->numdriveout > squeal->numdrivers)) {
+			return 1;
+		}
+		gen->driveout = calloc (gen->numdriveout + 1, sizeof (struct s3ins_gen2drv));
+		if (gen->driveout == NULL) {
+			return 1;
+		}
+		for (i=0; i < gen->numdriveout; i++) {
+			drvnum = image_get_uint32 (img);
+			if ((drvnum < 0) || (drvnum >= squeal->numdrivers)) {
+				return 1;
+			}
+			gen->driveout [i].driver = &squeal->drivers [drvnum];
+			if (squeal_prepare_image (squeal, img, &gen->driveout [i].gen2drv_produce)) {
+				return 1;
+			}
+		}
+	}
+	//
+	// Setup the drivers' output parameters
+	if (image_get_uint32 (img) != squeal->numdrivers) {
+		ERROR("Image does not match the number of drivers\n");
+		return 1;
+	}
+	for (drvnum=0; drvnum < squeal->numdrivers; drvnum++) {
+		drv = &squeal->drivers [drvnum];
+		drv->cbnumparm = image_get_uint32 (img);
+		drv->drvall_prehash = image_get_uint64 (img);
+		free (drv->cbparm);
+		drv->cbparm = calloc (drv->cbnumparm + 1, sizeof (struct squeal_blob));
+		if (drv->cbparm == NULL) {
+			return 1;
+		}
+	}
+	return image_reader_ok (img)? 0: 1;
+}
+
 int squeal_configure (struct squeal *squeal) {
 	struct sqlbuf sql;
 	int retval = 0;
@@ -1137,6 +1677,16 @@ int squeal_configure (struct squeal *squeal) {
 		goto cleanup;
 	}
 	sql.ofs = 0;
+	//
+	// Remove a drv_all's out_hash regardless of its out_repeat:
+	sqlbuf_write (&sql, "DELETE FROM drv_all\n"
+				"WHERE out_hash = :hash");
+	if ((sqlretval = sqlite3_prepare (squeal->s3db, sql.buf, sql.ofs, &squeal->del_drv_all, NULL)) != SQLITE_OK) {
+		ERROR("PREP ERROR delete in SQL %d\n", sqlretval);
+		retval = 1;
+		goto cleanup;
+	}
+	sql.ofs = 0;
 cleanup:
 	//
 	// Release the SQL buffer
@@ -1188,14 +1738,10 @@ void _copy_dbdir(struct sqlbuf* buf, const char *dbdir)
  * TODO: Consider use of sticky bits, as are used for /tmp
  * TODO: Privileges of the database itself?
  */
-struct squeal *squeal_open_in_dbdir (hash_t lexhash, gennum_t numgens, drvnum_t numdrvs, const char *dbdir) {
-	struct squeal *retval = NULL, *work = NULL;
-	sqlite3 *s3db = NULL;
-	struct sqlbuf dbname;
-
-	DEBUG("squeal_open with %d gen %d drv in '%s'", numgens, numdrvs, dbdir);
-	//
-	// Allocate the memory structures for the squeal backend
+/* Allocate the memory structures for a squeal backend, without a database.
+ */
+static struct squeal *squeal_alloc (gennum_t numgens, drvnum_t numdrvs) {
+	struct squeal *work;
 	work = calloc (1, sizeof (struct squeal)
 				+ (numgens-1) * sizeof (struct s3ins_generator));
 	if (work == NULL) {
@@ -1208,6 +1754,55 @@ struct squeal *squeal_open_in_dbdir (hash_t lexhash, gennum_t numgens, drvnum_t
 		free (work);
 		return NULL;
 	}
+	return work;
+}
+
+/* Release the memory structures and prepared statements of a squeal backend,
+ * but not its database.
+ */
+static void squeal_release (struct squeal *squeal) {
+	unsigned int i;
+	int d;
+	for (unsigned int drvnum = 0; drvnum < squeal->numdrivers; drvnum++)
+	{
+		sqlite3_finalize(squeal->drivers[drvnum].drv_pull);
+		squeal->drivers[drvnum].drv_pull = NULL;
+		squeal_pull_forget(&squeal->drivers[drvnum]);
+		free(squeal->drivers[drvnum].cbparm);
+		squeal->drivers[drvnum].cbparm = NULL;
+	}
+	for (i=0; i<squeal->numgens; i++)
+	{
+		sqlite3_finalize(squeal->gens[i].opt_gen_add_tuple);
+		sqlite3_finalize(squeal->gens[i].opt_gen_del_tuple);
+		for (d=0; d < squeal->gens[i].numdriveout; d++)
+		{
+			sqlite3_finalize(squeal->gens[i].driveout[d].gen2drv_produce);
+		}
+		free(squeal->gens[i].driveout);
+		squeal->gens[i].driveout = NULL;
+	}
+	sqlite3_finalize (squeal->get_drv_all);
+	sqlite3_finalize (squeal->inc_drv_all);
+	sqlite3_finalize (squeal->dec_drv_all);
+	sqlite3_finalize (squeal->del_drv_all);
+	free (squeal->drivers);
+	free (squeal->ddl.buf);
+	free (squeal);
+}
+
+struct squeal *squeal_open_in_dbdir (hash_t lexhash, gennum_t numgens, drvnum_t numdrvs, const char *dbdir) {
+	struct squeal *retval = NULL, *work = NULL;
+	sqlite3 *s3db = NULL;
+	struct sqlbuf dbname;
+
+	DEBUG("squeal_open with %d gen %d drv in '%s'", numgens, numdrvs, dbdir);
+	//
+	// Allocate the memory structures for the squeal backend
+	work = squeal_alloc (numgens, numdrvs);
+	if (work == NULL) {
+		return NULL;
+	}
 	//
 	// Fetch a buffer for fun and play
 	sqlbuf_exchg (&dbname, BUF_GET);
@@ -1253,22 +1848,35 @@ struct squeal *squeal_open (hash_t lexhash, gennum_t numgens, drvnum_t numdrvs)
 	return squeal_open_in_dbdir(lexhash, numgens, numdrvs, squeal_use_dbdir);
 }
 
+/* Reopen the database of a squeal engine for a reloaded Pulley script with
+ * numgens generators and numdrvs drivers.  The old handle stays usable, but
+ * its running pulls are interrupted, so that the new handle can create its
+ * tables; one of the two is to be released with squeal_detach() later.
+ */
+struct squeal *squeal_reopen (struct squeal *squeal, gennum_t numgens, drvnum_t numdrvs) {
+	struct squeal *work;
+	DEBUG("squeal_reopen with %d gen %d drv", numgens, numdrvs);
+	work = squeal_alloc (numgens, numdrvs);
+	if (work == NULL) {
+		return NULL;
+	}
+	squeal_pull_interrupt (squeal);
+	work->s3db = squeal->s3db;
+	return work;
+}
+
+/* Release a handle without closing its database, which another handle shares.
+ */
+void squeal_detach (struct squeal *squeal) {
+	squeal_release (squeal);
+}
+
 /* Close a SQLite3 engine using the handle that was returned by squeal_open().
  */
 void squeal_close (struct squeal *squeal) {
-	sqlite3_close (squeal->s3db);
-	for (unsigned int drvnum = 0; drvnum < squeal->numdrivers; drvnum++)
-	{
-		free(squeal->drivers[drvnum].cbparm);
-		squeal->drivers[drvnum].cbparm = NULL;
-	}
-	free (squeal->drivers);
-	for (unsigned int i=0; i<squeal->numgens; i++)
-	{
-		free(squeal->gens[i].driveout);
-		squeal->gens[i].driveout = NULL;
-	}
-	free (squeal);
+	sqlite3 *s3db = squeal->s3db;
+	squeal_release (squeal);
+	sqlite3_close (s3db);
 }
 
 /* Unlink a SQLite3 engine for a given Pulley script lexhash.  As with any other
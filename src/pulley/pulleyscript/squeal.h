@@ -55,6 +55,24 @@ struct squeal *squeal_open_in_dbdir (hash_t lexhash, gennum_t numgens, drvnum_t
  */
 void squeal_close (struct squeal *s3db);
 
+/* Reopen the database of a SQLite3 engine for a reloaded Pulley script, with
+ * numgens generators and numdrvs drivers.  The database, including drv_all and
+ * the gen_xxx tables, is shared by the returned handle and the old handle,
+ * which remains usable.  Continue with squeal_have_tables() with may_reuse
+ * set, squeal_configure() and squeal_configure_generators(); if those fail,
+ * squeal_detach() the new handle and keep using the old one.  Otherwise, use
+ * the old handle for the last time (e.g. to retract output) and detach it.
+ * The database keeps the name derived from the original script's lexhash.
+ * The return value NULL indicates an error.
+ */
+struct squeal *squeal_reopen (struct squeal *s3db, gennum_t numgens, drvnum_t numdrvs);
+
+/* Release a handle that shares its database with another, as obtained from
+ * squeal_reopen(), without closing the database.  The handle must not be
+ * used anymore.
+ */
+void squeal_detach (struct squeal *s3db);
+
 /* Unlink a SQLite3 engine for a given Pulley script lexhash.  As with any other
  * file, there is a chance that the file has a hard link and is kept around for that.
  */
@@ -67,6 +85,11 @@ void squeal_unlink_in_dbdir (hash_t lexhash, const char *dbdir);
  */
 int squeal_have_tables (struct squeal *s3db, struct gentab *gentab, bool may_reuse);
 
+/* Drop the gen_xxx table for the generator with the given lexhash, when it is
+ * no longer used after a reload.  Return 0 on success, 1 on failure.
+ */
+int squeal_drop_generator (struct squeal *s3db, hash_t genhash);
+
 /**
  * Prepare statements that manipulate the drv_all table;
  * these count the number of uses of each out_hash.
@@ -81,6 +104,21 @@ int squeal_configure (struct squeal *squeal);
  */
 int squeal_configure_generators(struct squeal* squeal, struct gentab* gentab, struct drvtab* drvtab);
 
+/**
+ * Write the tables and prepared SQL statements of the squeal engine to an
+ * image, after squeal_have_tables() and squeal_configure_generators().
+ */
+void squeal_write_image (struct squeal *squeal, struct image_writer *img);
+
+/**
+ * Setup the tables and prepared SQL statements of the squeal engine from
+ * an image, as written by squeal_write_image().  This replaces the calls
+ * to squeal_have_tables() and squeal_configure_generators(); tables are
+ * dropped and recreated just like squeal_have_tables() without reuse.
+ * Call squeal_configure() as usual.  Return 0 on success, 1 on failure.
+ */
+int squeal_read_image (struct squeal *squeal, struct image_reader *img);
+
 /**
  * Setup the driver to call(back) the given @p cbfun with @p cbdata as
  * the first argument.
@@ -107,6 +145,14 @@ void squeal_insert_fork(struct squeal *squeal, gennum_t gennum, const char *entr
  */
 void squeal_delete_forks(struct squeal *squeal, gennum_t gennum, const char *entryUUID);
 
+/**
+ * Store one tuple of variables (a fork) in the gen_<hash> table of
+ * generator @p gennum, without producing any output. This fills a
+ * generator that was added by a reload; its drivers catch up with
+ * squeal_driver_redrive() once all the tuples are stored.
+ */
+void squeal_store_fork(struct squeal *squeal, gennum_t gennum, const char *entryUUID, int numrecvars, struct squeal_blob *recvars);
+
 /* Construct an SQL query that produces output for driver d when generator g
  * forks a tuple.  Note that addition or removal is not an issue yet; the
  * desired output from the query is a list of additional variables.  Return
@@ -116,6 +162,45 @@ void squeal_delete_forks(struct squeal *squeal, gennum_t gennum, const char *ent
  */
 sqlite3_stmt *squeal_produce_outputs (struct squeal *squeal, struct drvtab *drvtab, gennum_t gennum, drvnum_t drvnum);
 
+/* Construct an SQL query that produces the complete output for driver d from
+ * the stored generator tables, for use in pull mode.  Return the prepared
+ * statement for this SQL query, or NULL on failure.
+ */
+sqlite3_stmt *squeal_produce_pull (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum);
+
+/**
+ * Run driver @p drvnum in pull mode: regenerate its output from the
+ * gen_<hash> tables and deliver it as PULLEY_TUPLE_ADD callbacks,
+ * without consulting or changing drv_all. Output is delivered in
+ * batches of at most @p limit tuples (0 means no limit), starting
+ * after the first @p cursor tuples of the output. When the previous
+ * batch for this driver ended at @p cursor, the pull continues from
+ * there in constant time; otherwise it skips ahead with an OFFSET.
+ *
+ * Returns the number of tuples delivered, which is less than @p limit
+ * when the output is complete, or -1 on error.
+ */
+long squeal_driver_pull (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum, unsigned long cursor, unsigned long limit);
+
+/**
+ * Retract the complete output of driver @p drvnum, as part of a reload
+ * that removes or changes it: every output tuple that drv_all counts is
+ * removed from drv_all and delivered as a PULLEY_TUPLE_DEL callback.
+ *
+ * Returns the number of tuples retracted, or -1 on error.
+ */
+long squeal_driver_retract (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum);
+
+/**
+ * Re-drive the complete output of driver @p drvnum, as part of a reload
+ * that adds or changes it: the output passes through drv_all as if each
+ * of its tuples were forked by the generators, and the first occurrence
+ * of each is delivered as a PULLEY_TUPLE_ADD callback.
+ *
+ * Returns the number of tuples delivered, or -1 on error.
+ */
+long squeal_driver_redrive (struct squeal *squeal, struct drvtab *drvtab, drvnum_t drvnum);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+#include "stats.h"
+
+#include <algorithm>
+#include <fstream>
+#include <mutex>
+
+std::atomic<bool> SteamWorks::PulleyBack::Stats::s_enabled(false);
+
+// Registry of the Stats of open instances
+static std::mutex registry_mutex;
+static std::vector< std::weak_ptr<SteamWorks::PulleyBack::Stats> > registry;
+static unsigned long last_instance = 0;
+
+SteamWorks::PulleyBack::Stats::Stats(const std::string& backend, unsigned long instance) :
+	m_backend(backend),
+	m_instance(instance),
+	m_shards()
+{
+}
+
+std::shared_ptr<SteamWorks::PulleyBack::Stats> SteamWorks::PulleyBack::Stats::create(const std::string& backend)
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	std::shared_ptr<Stats> stats(new Stats(backend, ++last_instance));
+
+	registry.erase(std::remove_if(registry.begin(), registry.end(), [](const std::weak_ptr<Stats>& s) { return s.expired(); }), registry.end());
+	registry.push_back(stats);
+	return stats;
+}
+
+void SteamWorks::PulleyBack::Stats::set_enabled(bool enabled)
+{
+	s_enabled.store(enabled);
+}
+
+const char* SteamWorks::PulleyBack::Stats::op_name(unsigned int op)
+{
+	static const char* const names[num_ops] = { "add", "del", "reset", "prepare", "commit", "rollback" };
+	return op < num_ops ? names[op] : "unknown";
+}
+
+void SteamWorks::PulleyBack::Stats::record(Op op, unsigned int forks, bool error, uint64_t nanoseconds)
+{
+	Shard& s = m_shards.local();
+	s.calls[op].add(1);
+	s.forks[op].add(forks);
+	if (error)
+	{
+		s.errors[op].add(1);
+	}
+	s.latency[op].record(nanoseconds);
+}
+
+SteamWorks::PulleyBack::Stats::Snapshot SteamWorks::PulleyBack::Stats::snapshot() const
+{
+	Snapshot snap = Snapshot();
+	snap.backend = m_backend;
+	snap.instance = m_instance;
+	for (unsigned int i = 0; i < Sharded::num_shards; i++)
+	{
+		const Shard& s = m_shards[i];
+		for (unsigned int op = 0; op < num_ops; op++)
+		{
+			snap.calls[op] += s.calls[op].load();
+			snap.forks[op] += s.forks[op].load();
+			snap.errors[op] += s.errors[op].load();
+			snap.latency[op].add(s.latency[op]);
+		}
+	}
+	return snap;
+}
+
+std::vector<SteamWorks::PulleyBack::Stats::Snapshot> SteamWorks::PulleyBack::Stats::collect()
+{
+	std::vector<Snapshot> snapshots;
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (const auto& s : registry)
+	{
+		auto stats = s.lock();
+		if (stats)
+		{
+			snapshots.push_back(stats->snapshot());
+		}
+	}
+	return snapshots;
+}
+
+static std::string labels(const SteamWorks::PulleyBack::Stats::Snapshot& snap, unsigned int op)
+{
+	std::string l("backend=\"");
+	for (char c : snap.backend)
+	{
+		if ((c == '"') || (c == '\\'))
+		{
+			l.push_back('\\');
+			l.push_back(c);
+		}
+		else if (c == '\n')
+		{
+			l.append("\\n");
+		}
+		else
+		{
+			l.push_back(c);
+		}
+	}
+	l.append("\",instance=\"").append(std::to_string(snap.instance));
+	l.append("\",op=\"").append(SteamWorks::PulleyBack::Stats::op_name(op)).push_back('"');
+	return l;
+}
+
+void SteamWorks::PulleyBack::Stats::write_prometheus(std::ostream& out, const std::vector<Snapshot>& snapshots)
+{
+	static const char* const counters[][2] =
+	{
+		{ "pulleyback_calls_total", "Calls into the backend." },
+		{ "pulleyback_forks_total", "Forks passed to the backend." },
+		{ "pulleyback_errors_total", "Calls into the backend that failed." },
+	} ;
+
+	for (unsigned int c = 0; c < 3; c++)
+	{
+		out << "# HELP " << counters[c][0] << ' ' << counters[c][1] << '\n';
+		out << "# TYPE " << counters[c][0] << " counter\n";
+		for (const auto& snap : snapshots)
+		{
+			const uint64_t* values = (c == 0) ? snap.calls : (c == 1) ? snap.forks : snap.errors;
+			for (unsigned int op = 0; op < num_ops; op++)
+			{
+				out << counters[c][0] << '{' << labels(snap, op) << "} " << values[op] << '\n';
+			}
+		}
+	}
+
+	out << "# HELP pulleyback_latency_seconds Time spent in calls into the backend.\n";
+	out << "# TYPE pulleyback_latency_seconds histogram\n";
+	for (const auto& snap : snapshots)
+	{
+		for (unsigned int op = 0; op < num_ops; op++)
+		{
+			Sharded::write_prometheus(out, "pulleyback_latency_seconds", labels(snap, op), snap.latency[op]);
+		}
+	}
+}
+
+bool SteamWorks::PulleyBack::Stats::dump(const std::string& path)
+{
+	std::string tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp.c_str(), std::ios::out | std::ios::trunc);
+		write_prometheus(out, collect());
+		if (!out)
+		{
+			return false;
+		}
+	}
+	return rename(tmp.c_str(), path.c_str()) == 0;
+}
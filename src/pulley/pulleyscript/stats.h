@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Counters and latency histograms per backend instance, for each of
+ * the calls into the plugin: how often it was called, how many forks
+ * it was given, how often it failed and how long it took.
+ *
+ * Calls come from the Pulley thread, queue workers and the threads
+ * that prepare and commit in parallel, so the counters are sharded
+ * (see sharded.h). Collecting is off by default, and then costs a
+ * single flag check per call.
+ */
+#ifndef STEAMWORKS_PULLEY_STATS_H
+#define STEAMWORKS_PULLEY_STATS_H
+
+#include "sharded.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace SteamWorks
+{
+
+namespace PulleyBack
+{
+
+class Stats
+{
+public:
+	enum Op { Add = 0, Del, Reset, Prepare, Commit, Rollback };
+	enum : unsigned int
+	{
+		num_ops = 6
+	} ;
+
+	struct Snapshot
+	{
+		std::string backend;
+		unsigned long instance;
+		uint64_t calls[num_ops];
+		uint64_t forks[num_ops];
+		uint64_t errors[num_ops];
+		Sharded::Histogram::Snapshot latency[num_ops];
+	} ;
+
+private:
+	struct Shard
+	{
+		Sharded::Counter calls[num_ops];
+		Sharded::Counter forks[num_ops];
+		Sharded::Counter errors[num_ops];
+		Sharded::Histogram latency[num_ops];
+	} ;
+
+	std::string m_backend;
+	unsigned long m_instance;
+	Sharded::Counters<Shard> m_shards;
+
+	static std::atomic<bool> s_enabled;
+
+	Stats(const std::string& backend, unsigned long instance);
+
+public:
+	/**
+	 * Creates the Stats for a new instance of @p backend, and
+	 * registers it for collect(). It is dropped from there when the
+	 * last reference goes.
+	 */
+	static std::shared_ptr<Stats> create(const std::string& backend);
+
+	static void set_enabled(bool enabled);
+	static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+	static const char* op_name(unsigned int op);
+
+	void record(Op op, unsigned int forks, bool error, uint64_t nanoseconds);
+
+	Snapshot snapshot() const;
+
+	/** Snapshots of all the instances that are open. */
+	static std::vector<Snapshot> collect();
+
+	/**
+	 * Writes @p snapshots in the Prometheus text format; dump() does
+	 * that for all instances into the file at @p path, replacing it
+	 * atomically. Returns false if the file could not be written.
+	 */
+	static void write_prometheus(std::ostream& out, const std::vector<Snapshot>& snapshots);
+	static bool dump(const std::string& path);
+
+	/**
+	 * Times one call, if collecting is enabled:
+	 *
+	 *     Stats::Timer timer(stats);
+	 *     return timer.done(Stats::Add, plugin_add(...));
+	 */
+	class Timer
+	{
+	private:
+		Stats* m_stats;
+		std::chrono::steady_clock::time_point m_start;
+
+	public:
+		Timer(Stats* stats) :
+			m_stats(enabled() ? stats : nullptr)
+		{
+			if (m_stats)
+			{
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+
+		/** Records the call, failed if @p result is 0, and returns @p result. */
+		int done(Op op, int result, unsigned int forks = 1)
+		{
+			if (m_stats)
+			{
+				auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+				m_stats->record(op, forks, result == 0, elapsed.count());
+			}
+			return result;
+		}
+	} ;
+} ;
+
+}  // namespace PulleyBack
+}  // namespace
+
+#endif
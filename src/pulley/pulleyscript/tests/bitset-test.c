@@ -0,0 +1,185 @@
+/* bitset-test.c -- Check the bitset operations against plain arrays of bits.
+ *
+ * Bitsets of widths around the word size and around the inline storage
+ * (BITSET_INLINE_BITS) are combined with each other, in both orders, so
+ * that operands of different sizes and the growing of the accumulator
+ * are exercised.  Exits with a non-zero status on the first mismatch.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitset.h"
+
+
+#define MAXBITS 1024
+
+/* Normally provided by the lexer */
+void fatal_error (const char *msg) {
+	fprintf (stderr, "Fatal error: %s\n", msg);
+	exit (1);
+}
+
+static type_t test_type = { NULL, NULL, "test" };
+
+static const anynum_t widths [] = {
+	1, 63, 64, 65, 127, 128, 129, 191, 192, 193, 255, 256, 257, 1000
+};
+#define NUMWIDTHS (sizeof (widths) / sizeof (widths [0]))
+
+static int failures = 0;
+
+#define CHECK(cond,what,w1,w2) do { \
+	if (!(cond)) { \
+		fprintf (stderr, "FAIL %s (widths %u, %u)\n", what, w1, w2); \
+		failures++; \
+	} \
+} while (0)
+
+
+/* Fill a bitset and its reference with a pattern of bits below width:
+ * the first and last bits, bits around each word boundary, and some
+ * pseudo-random ones.
+ */
+static void fill (bitset_t *bts, bool *ref, anynum_t width, unsigned int seed) {
+	anynum_t i;
+	memset (ref, 0, MAXBITS * sizeof (bool));
+	for (i=0; i<width; i++) {
+		seed = seed * 1103515245 + 12345;
+		if ((i == 0) || (i == width - 1) ||
+				((i & 63) == 0) || ((i & 63) == 63) ||
+				(((seed >> 16) & 3) == 0)) {
+			bitset_set (bts, i);
+			ref [i] = true;
+		}
+	}
+}
+
+/* Compare a bitset to its reference, including the derived values */
+static bool same (bitset_t *bts, bool *ref) {
+	bitset_iter_t it;
+	anynum_t i, count = 0, min = BITNUM_BAD, max = BITNUM_BAD;
+	for (i=0; i<MAXBITS; i++) {
+		if (bitset_test (bts, i) != ref [i]) {
+			return false;
+		}
+		if (ref [i]) {
+			count++;
+			if (min == BITNUM_BAD) {
+				min = i;
+			}
+			max = i;
+		}
+	}
+	if ((bitset_count (bts) != count) ||
+			(bitset_min (bts) != min) ||
+			(bitset_max (bts) != max) ||
+			(bitset_isempty (bts) != (count == 0))) {
+		return false;
+	}
+	// The iterator visits exactly the set bits, in rising order
+	bitset_iterator_init (&it, bts);
+	i = 0;
+	while (bitset_iterator_next_one (&it, NULL)) {
+		while ((i < MAXBITS) && !ref [i]) {
+			i++;
+		}
+		if ((i >= MAXBITS) || (bitset_iterator_bitnum (&it) != i) ||
+				!bitset_iterator_test (&it, NULL)) {
+			return false;
+		}
+		i++;
+	}
+	while ((i < MAXBITS) && !ref [i]) {
+		i++;
+	}
+	return (i == MAXBITS);
+}
+
+int main (int argc, char *argv []) {
+	bool ra [MAXBITS], rb [MAXBITS], rr [MAXBITS];
+	bitset_t *a, *b, *r;
+	anynum_t w1, w2, i, j, k;
+	bool disjoint;
+
+	for (j=0; j<NUMWIDTHS; j++) {
+		for (k=0; k<NUMWIDTHS; k++) {
+			w1 = widths [j];
+			w2 = widths [k];
+			a = bitset_new (&test_type);
+			b = bitset_new (&test_type);
+			fill (a, ra, w1, 17 + j);
+			fill (b, rb, w2, 4711 + k);
+			CHECK (same (a, ra), "set", w1, w2);
+			CHECK (same (b, rb), "set", w2, w1);
+
+			r = bitset_clone (a);
+			CHECK (same (r, ra), "clone", w1, w2);
+			bitset_copy (r, b);
+			CHECK (same (r, rb), "copy", w1, w2);
+			bitset_destroy (r);
+
+			disjoint = true;
+			for (i=0; i<MAXBITS; i++) {
+				disjoint = disjoint && !(ra [i] && rb [i]);
+			}
+			CHECK (bitset_disjoint (a, b) == disjoint, "disjoint", w1, w2);
+
+			r = bitset_clone (a);
+			bitset_union (r, b);
+			for (i=0; i<MAXBITS; i++) {
+				rr [i] = ra [i] || rb [i];
+			}
+			CHECK (same (r, rr), "union", w1, w2);
+			bitset_destroy (r);
+
+			r = bitset_clone (a);
+			bitset_disjunction (r, b);
+			for (i=0; i<MAXBITS; i++) {
+				rr [i] = ra [i] && rb [i];
+			}
+			CHECK (same (r, rr), "disjunction", w1, w2);
+			bitset_destroy (r);
+
+			r = bitset_clone (a);
+			bitset_subtract (r, b);
+			for (i=0; i<MAXBITS; i++) {
+				rr [i] = ra [i] && !rb [i];
+			}
+			CHECK (same (r, rr), "subtract", w1, w2);
+			bitset_destroy (r);
+
+			r = bitset_clone (a);
+			bitset_bustract (r, b);
+			for (i=0; i<MAXBITS; i++) {
+				rr [i] = rb [i] && !ra [i];
+			}
+			CHECK (same (r, rr), "bustract", w1, w2);
+			bitset_destroy (r);
+
+			r = bitset_clone (a);
+			bitset_exor (r, b);
+			for (i=0; i<MAXBITS; i++) {
+				rr [i] = ra [i] != rb [i];
+			}
+			CHECK (same (r, rr), "exor", w1, w2);
+			bitset_destroy (r);
+
+			bitset_clear (a, w1 - 1);
+			bitset_toggle (a, w1);
+			ra [w1 - 1] = false;
+			ra [w1] = true;
+			CHECK (same (a, ra), "clear/toggle", w1, w2);
+
+			bitset_empty (a);
+			memset (ra, 0, sizeof (ra));
+			CHECK (same (a, ra), "empty", w1, w2);
+
+			bitset_destroy (a);
+			bitset_destroy (b);
+		}
+	}
+	return (failures == 0)? 0: 1;
+}
@@ -0,0 +1,276 @@
+/*
+Copyright (c) 2016 InternetWide.org and the ARPA2.net project
+All rights reserved. See file LICENSE for exact terms (2-clause BSD license).
+
+Adriaan de Groot <groot@kde.org>
+*/
+
+/**
+ * Checks built-in backends (PulleyBack::Sink) through the Loader: forks
+ * passed as blobs reach the Sink without copies, forks passed as DER
+ * (short and long form lengths) arrive as views of their values, also
+ * through a queue, and output that a Sink failed to commit is replayed
+ * from the journal, including after the journal file is opened again.
+ * Exits with a non-zero status if any check fails.
+ */
+
+#include "backend.h"
+#include "journal.h"
+#include "lexhash.h"
+#include "squeal.h"
+#include "stats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace SteamWorks::PulleyBack;
+
+static int failures = 0;
+
+#define CHECK(cond, what) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "FAIL %s\n", what); \
+		failures++; \
+	} \
+} while (0)
+
+/// What the test sinks were asked to do, e.g. "open x=1 2", "add a|b", "commit"
+static std::vector<std::string> calls;
+/// Data pointer of the first value of the last add()
+static const void* last_add_data = nullptr;
+/// Result of the next commit()
+static int commit_result = 1;
+
+class TestSink : public Sink
+{
+private:
+	int m_varc;
+
+	void record(const char* op, const struct squeal_blob* forkdata)
+	{
+		std::string call(op);
+		for (int i = 0; i < m_varc; i++)
+		{
+			call.push_back(i ? '|' : ' ');
+			call.append(static_cast<const char*>(forkdata[i].data), forkdata[i].size);
+		}
+		calls.push_back(call);
+	}
+
+public:
+	TestSink(int varc) : m_varc(varc) {}
+
+	int add(const struct squeal_blob* forkdata) override
+	{
+		last_add_data = forkdata[0].data;
+		record("add", forkdata);
+		return 1;
+	}
+	int del(const struct squeal_blob* forkdata) override
+	{
+		record("del", forkdata);
+		return 1;
+	}
+	int reset() override
+	{
+		calls.push_back("reset");
+		return 1;
+	}
+	int commit() override
+	{
+		calls.push_back("commit");
+		return commit_result;
+	}
+	void rollback() override
+	{
+		calls.push_back("rollback");
+	}
+} ;
+
+static Sink::Registration registration("test-sink", [](int argc, char** argv, int varc) -> Sink*
+{
+	if ((argc != 1) || strcmp(argv[0], "x=1"))
+	{
+		return nullptr;
+	}
+	calls.push_back("open " + std::string(argv[0]) + ' ' + std::to_string(varc));
+	return new TestSink(varc);
+});
+
+static char parameter[] = "x=1";
+static char* parameters[] = { parameter };
+
+static std::string joined()
+{
+	std::string s;
+	for (const auto& call : calls)
+	{
+		s.append(s.empty() ? "" : ", ").append(call);
+	}
+	return s;
+}
+
+/// Checks that the calls since the last check were @p expected.
+static void expect(const char* expected, const char* what)
+{
+	if (joined() != expected)
+	{
+		fprintf(stderr, "FAIL %s: got '%s', expected '%s'\n", what, joined().c_str(), expected);
+		failures++;
+	}
+	calls.clear();
+}
+
+/// DER OCTET STRING holding @p s
+static std::vector<uint8_t> der(const std::string& s)
+{
+	std::vector<uint8_t> v{ 0x04 };
+	if (s.size() < 0x80)
+	{
+		v.push_back(s.size());
+	}
+	else
+	{
+		v.push_back(0x82);
+		v.push_back(s.size() >> 8);
+		v.push_back(s.size() & 0xff);
+	}
+	v.insert(v.end(), s.begin(), s.end());
+	return v;
+}
+
+static void check_direct()
+{
+	Loader loader("test-sink");
+	CHECK(loader.is_valid(), "registered sink found");
+	CHECK(!loader.get_instance(0, nullptr, 2).is_valid(), "factory refuses bad parameters");
+	calls.clear();
+
+	Instance instance = loader.get_instance(1, parameters, 2);
+	CHECK(instance.is_valid() && instance.takes_blobs(), "instance takes blobs");
+	CHECK(instance.prepare() == -1, "prepare not supported");
+	expect("open x=1 2", "open");
+
+	// Blobs are passed on as they are
+	std::string value("a");
+	struct squeal_blob blobs[2] = { { &value[0], value.size() }, { (void*)"b", 1 } };
+	CHECK(instance.add(blobs) && (last_add_data == value.data()), "blobs without copies");
+	CHECK(instance.del(blobs), "del blobs");
+
+	// DER values arrive as views of their contents
+	std::string big(300, 'z');
+	auto short_der = der("c");
+	auto long_der = der(big);
+	der_t forkdata[2] = { short_der.data(), long_der.data() };
+	CHECK(instance.add(forkdata) && (last_add_data == short_der.data() + 2), "DER as a view");
+	CHECK(instance.del(forkdata), "del DER");
+	CHECK(instance.reset() && instance.commit(), "reset and commit");
+	instance.rollback();
+	expect(("add a|b, del a|b, add c|" + big + ", del c|" + big + ", reset, commit, rollback").c_str(), "direct calls");
+
+	// The calls are counted as for a plugin
+	Stats::set_enabled(true);
+	CHECK(instance.add(blobs) && instance.add(forkdata), "add with statistics");
+	Stats::set_enabled(false);
+	bool counted = false;
+	for (const auto& snap : Stats::collect())
+	{
+		counted = counted || ((snap.backend == "test-sink") && (snap.calls[Stats::Add] == 2) && (snap.forks[Stats::Add] == 2));
+	}
+	CHECK(counted, "statistics");
+	calls.clear();
+}
+
+static void check_queued()
+{
+	Loader::set_queue_depth(4);
+	{
+		Instance instance = Loader("test-sink").get_instance(1, parameters, 1);
+		CHECK(instance.is_valid() && !instance.takes_blobs(), "queued instance takes DER");
+		struct squeal_blob blob = { (void*)"q", 1 };
+		CHECK(!instance.add(&blob), "queued instance refuses blobs");
+
+		std::vector<std::vector<uint8_t>> values;
+		for (int i = 0; i < 10; i++)
+		{
+			values.push_back(der(std::to_string(i)));
+		}
+		for (auto& value : values)
+		{
+			der_t forkdata[1] = { value.data() };
+			CHECK(instance.add(forkdata), "queued add");
+		}
+		commit_result = 0;
+		CHECK(instance.commit() == 0, "queued commit failure is returned");
+		commit_result = 1;
+		CHECK(instance.commit() == 1, "queued commit");
+	}
+	Loader::set_queue_depth(0);
+	expect("open x=1 1, add 0, add 1, add 2, add 3, add 4, add 5, add 6, add 7, add 8, add 9, commit, commit", "queued calls");
+}
+
+static void check_journal()
+{
+	char dir[] = "/tmp/sink-test-XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		CHECK(false, "temporary directory");
+		return;
+	}
+	std::string path = std::string(dir) + "/journal";
+
+	Instance instance = Loader("test-sink").get_instance(1, parameters, 2);
+	std::string big(200, 'y');
+	struct squeal_blob first[2] = { { (void*)"k", 1 }, { &big[0], big.size() } };
+	struct squeal_blob second[2] = { { (void*)"l", 1 }, { (void*)"m", 1 } };
+	{
+		Journal journal;
+		CHECK(journal.open(path) && journal.is_open() && !journal.has_pending(), "new journal");
+
+		// A transaction that the sink fails to commit stays pending
+		journal.record(true, 2, first);
+		instance.add(first);
+		journal.record(false, 2, second);
+		instance.del(second);
+		CHECK(journal.sync(), "sync");
+		commit_result = 0;
+		CHECK(!instance.commit(), "failed commit");
+		commit_result = 1;
+		journal.failed();
+		CHECK(journal.has_pending(), "pending after failure");
+		calls.clear();
+
+		CHECK(journal.replay(instance, true) && instance.commit(), "replay");
+		expect(("add k|" + big + ", del l|m, commit").c_str(), "replayed calls");
+	}
+
+	// The pending output is still in the file; the replay was not
+	// marked as committed
+	{
+		Journal journal;
+		CHECK(journal.open(path) && journal.has_pending(), "pending after reopening");
+		CHECK(journal.replay(instance, true) && instance.commit(), "replay after reopening");
+		expect(("add k|" + big + ", del l|m, commit").c_str(), "calls replayed after reopening");
+		journal.committed();
+	}
+	{
+		Journal journal;
+		CHECK(journal.open(path) && !journal.has_pending(), "nothing pending after commit");
+	}
+
+	unlink(path.c_str());
+	rmdir(dir);
+}
+
+int main(int argc, char** argv)
+{
+	check_direct();
+	check_queued();
+	check_journal();
+	return (failures == 0) ? 0 : 1;
+}
@@ -15,6 +15,9 @@ typedef struct {
 struct vartab;
 typedef struct path path_t;
 
+struct image_writer;
+struct image_reader;
+
 
 typedef unsigned int anynum_t;
 typedef anynum_t varnum_t;
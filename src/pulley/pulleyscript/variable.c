@@ -22,6 +22,7 @@
 #include "variable.h"
 #include "generator.h"
 #include "parser.h"
+#include "image.h"
 
 #include "variable_int.h"
 
@@ -586,3 +587,141 @@ bool var_get_cheapest_generator (struct vartab *tab, varnum_t varnum,
 	}
 }
 
+
+/* Write the variable table to an image.  The shared varpartitions are not
+ * written, as they follow from the partition numbers.
+ */
+void vartab_write_image (struct vartab *tab, struct image_writer *img) {
+	varnum_t i;
+	uint32_t optcount;
+	struct list_attropt *opt;
+	image_put_uint32 (img, tab->count_vars);
+	for (i=0; i<tab->count_vars; i++) {
+		struct variable *var = &tab->vars [i];
+		image_put_string (img, var->name);
+		image_put_uint32 (img, var->kind);
+		image_put_uint32 (img, var->partition);
+		image_put_uint32 (img, var->cheapest_generator);
+		image_put_bitset (img, var->generators);
+		image_put_bitset (img, var->conditions);
+		image_put_bitset (img, var->driversout);
+		image_put_uint32 (img, var->value.type);
+		switch (var->value.type) {
+		case VARTP_INTEGER:
+			image_put_uint32 (img, (uint32_t) var->value.typed_integer);
+			break;
+		case VARTP_FLOAT:
+			image_put_float (img, var->value.typed_float);
+			break;
+		case VARTP_STRING:
+			image_put_string (img, var->value.typed_string);
+			break;
+		case VARTP_BLOB:
+			image_put_blob (img, var->value.typed_blob.ptr, var->value.typed_blob.len);
+			break;
+		case VARTP_ATTROPTS:
+			optcount = 0;
+			for (opt = var->value.typed_attropts; opt != NULL; opt = opt->next) {
+				optcount++;
+			}
+			image_put_uint32 (img, optcount);
+			for (opt = var->value.typed_attropts; opt != NULL; opt = opt->next) {
+				image_put_string (img, opt->option);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Read the variable table from an image into an empty table, and rebuild
+ * the shared varpartitions as vartab_collect_varpartitions() would.
+ */
+int vartab_read_image (struct vartab *tab, struct image_reader *img) {
+	uint32_t count, optcount, i, j, len;
+	const char *name;
+	const void *blob;
+	varkind_t kind;
+	varnum_t varnum;
+	struct variable *var;
+	struct var_value val;
+	struct list_attropt **optnext;
+	if (tab->count_vars != 0) {
+		return 1;
+	}
+	count = image_get_uint32 (img);
+	for (i=0; i<count; i++) {
+		name = image_get_string (img);
+		kind = image_get_uint32 (img);
+		if (name == NULL) {
+			return 1;
+		}
+		varnum = var_add (tab, (char *) name, kind);
+		var = &tab->vars [varnum];
+		var->partition = image_get_uint32 (img);
+		var->cheapest_generator = image_get_uint32 (img);
+		image_get_bitset (img, var->generators);
+		image_get_bitset (img, var->conditions);
+		image_get_bitset (img, var->driversout);
+		val.type = image_get_uint32 (img);
+		switch (val.type) {
+		case VARTP_INTEGER:
+			val.typed_integer = (int) image_get_uint32 (img);
+			break;
+		case VARTP_FLOAT:
+			val.typed_float = image_get_float (img);
+			break;
+		case VARTP_STRING:
+			name = image_get_string (img);
+			val.typed_string = name? strdup (name): NULL;
+			break;
+		case VARTP_BLOB:
+			blob = image_get_blob (img, &len);
+			val.typed_blob.ptr = malloc (len? len: 1);
+			if (val.typed_blob.ptr == NULL) {
+				fatal_error ("Out of memory loading variable value");
+			}
+			if (blob != NULL) {
+				memcpy (val.typed_blob.ptr, blob, len);
+			}
+			val.typed_blob.len = len;
+			break;
+		case VARTP_ATTROPTS:
+			val.typed_attropts = NULL;
+			optnext = &val.typed_attropts;
+			optcount = image_get_uint32 (img);
+			for (j=0; (j<optcount) && image_reader_ok (img); j++) {
+				name = image_get_string (img);
+				if (name == NULL) {
+					break;
+				}
+				*optnext = malloc (sizeof (struct list_attropt) + strlen (name));
+				if (*optnext == NULL) {
+					fatal_error ("Out of memory loading attribute options");
+				}
+				strcpy ((*optnext)->option, name);
+				(*optnext)->next = NULL;
+				optnext = &(*optnext)->next;
+			}
+			break;
+		case VARTP_UNDEFINED:
+			break;
+		default:
+			return 1;
+		}
+		if (val.type != VARTP_UNDEFINED) {
+			var_set_value (tab, varnum, &val);
+		}
+		if (!image_reader_ok (img)) {
+			return 1;
+		}
+	}
+	for (i=0; i<count; i++) {
+		if (tab->vars [i].partition >= count) {
+			return 1;
+		}
+	}
+	vartab_collect_varpartitions (tab);
+	return 0;
+}
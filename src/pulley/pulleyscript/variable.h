@@ -264,6 +264,13 @@ bitset_t *vartab_unbound_variables (struct vartab *tab);
  */
 bitset_t *vartab_multibound_variables (struct vartab *tab);
 
+/* Write the variable table to an image, or read it back into an empty
+ * variable table.  This covers the state after structural analysis,
+ * including the varpartitions.  Reading returns 0 on success, 1 on failure.
+ */
+void vartab_write_image (struct vartab *tab, struct image_writer *img);
+int vartab_read_image (struct vartab *tab, struct image_reader *img);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,13 +48,28 @@ ShaftDispatcher::ShaftDispatcher() :
 {
 }
 
+const VerbTable<ShaftDispatcher::Handler> ShaftDispatcher::s_verbs =
+{
+	{ "connect", &ShaftDispatcher::do_connect },
+	{ "stop", &ShaftDispatcher::do_stop },
+	{ "serverinfo", &ShaftDispatcher::do_serverinfo },
+	{ "upstream", &ShaftDispatcher::do_upstream },
+} ;
+
 int ShaftDispatcher::exec(const std::string& verb, const Values& values, Object& response)
 {
-	if (verb == "connect") return do_connect(values, response);
-	else if (verb == "stop") return do_stop(values);
-	else if (verb == "serverinfo") return do_serverinfo(values, response);
-	else if (verb == "upstream") return do_upstream(values, response);
-	return -1;
+	auto handler = s_verbs.find(verb);
+	return handler ? (this->*(*handler))(values, response) : -1;
+}
+
+int ShaftDispatcher::verb_index(const std::string& verb) const
+{
+	return s_verbs.index(verb);
+}
+
+const char* ShaftDispatcher::verb_name(size_t i) const
+{
+	return i < s_verbs.size() ? s_verbs.name(i) : nullptr;
 }
 
 int ShaftDispatcher::do_connect(const Values& values, Object& response)
@@ -72,7 +87,7 @@ int ShaftDispatcher::do_connect(const Values& values, Object& response)
 	return 0;
 }
 
-int ShaftDispatcher::do_stop(const Values& values)
+int ShaftDispatcher::do_stop(const Values& values, Object& response)
 {
 	m_state = stopped;
 	d->connection.reset(nullptr);
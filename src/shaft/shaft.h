@@ -21,10 +21,15 @@ private:
 	typedef enum { disconnected=0, connected, stopped } State;
 	State m_state;
 
+	using Handler = int (ShaftDispatcher::*)(const Values&, Object&);
+	static const VerbTable<Handler> s_verbs;
+
 public:
 	ShaftDispatcher();
 
 	virtual int exec(const std::string& verb, const Values& values, Object& response) override;
+	virtual int verb_index(const std::string& verb) const override;
+	virtual const char* verb_name(size_t i) const override;
 
 	State state() const { return m_state; }
 
@@ -32,7 +37,7 @@ protected:
 	/** Connect to the downstream (e.g. destination) LDAP server.
 	 *  This is where the shaft is going to write to. */
 	int do_connect(const Values& values, Object& response);
-	int do_stop(const Values& values);
+	int do_stop(const Values& values, Object& response);
 	int do_serverinfo(const Values& values, Object& response);
 	int do_upstream(const Values& values, Object& response);
 } ;